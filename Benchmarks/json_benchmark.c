@@ -0,0 +1,884 @@
+/* Throughput benchmarks for the JSON library.
+ *
+ * Build from the repository root:
+ *   gcc -O2 -I. Benchmarks/json_benchmark.c json*.c -o json_benchmark -lm -pthread
+ *
+ * Allocation counts need the GNU linker's symbol wrapping:
+ *   gcc -O2 -I. -DJSON_BENCH_COUNT_ALLOCS Benchmarks/json_benchmark.c json*.c \
+ *       -o json_benchmark -lm -pthread -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc
+ *
+ * Usage:
+ *   json_benchmark [--json] [--quick] [--scale N] [--filter TEXT]
+ *                  [--compare BASELINE.ndjson] [--tolerance PERCENT]
+ *
+ * --json prints one JSON object per benchmark (NDJSON), which is also the
+ * baseline format read back by --compare. A comparison fails (exit code 1)
+ * when throughput drops by more than the tolerance or a benchmark allocates
+ * more than it did in the baseline.
+ */
+
+#include "json.h"
+#include <math.h>
+#include <stdarg.h>
+#include <time.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define BENCH_HAVE_FORK 1
+#else
+#define BENCH_HAVE_FORK 0
+#endif
+
+/* Allocation counting */
+
+#ifdef JSON_BENCH_COUNT_ALLOCS
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+static size_t alloc_count;
+
+void* __wrap_malloc(size_t size) {
+    __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+    return __real_realloc(ptr, size);
+}
+
+static size_t alloc_snapshot(void) {
+    return __atomic_load_n(&alloc_count, __ATOMIC_RELAXED);
+}
+#define BENCH_COUNTS_ALLOCS 1
+#else
+static size_t alloc_snapshot(void) {
+    return 0;
+}
+#define BENCH_COUNTS_ALLOCS 0
+#endif
+
+/* Growable text buffer for the corpus generators */
+
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+} TextBuffer;
+
+static void text_append(TextBuffer* text, const char* format, ...) {
+    for (;;) {
+        size_t available = text->capacity - text->length;
+        va_list args;
+        va_start(args, format);
+        int written = vsnprintf(text->data ? text->data + text->length : NULL,
+                                available, format, args);
+        va_end(args);
+        if (written < 0) {
+            fprintf(stderr, "Corpus formatting failed\n");
+            exit(2);
+        }
+        if ((size_t)written < available) {
+            text->length += (size_t)written;
+            return;
+        }
+        size_t capacity = text->capacity ? text->capacity * 2 : 4096;
+        while (capacity - text->length <= (size_t)written) {
+            capacity *= 2;
+        }
+        char* data = realloc(text->data, capacity);
+        if (!data) {
+            fprintf(stderr, "Out of memory while building corpus\n");
+            exit(2);
+        }
+        text->data = data;
+        text->capacity = capacity;
+    }
+}
+
+/* Corpora */
+
+typedef struct {
+    const char* name;
+    char* text;
+    size_t length;
+    size_t values;      /* Values in the document, or in all NDJSON records */
+    int ndjson;         /* One record per line instead of a single document */
+    JsonValue* tree;    /* Parsed document for the output benchmarks */
+    char path[64];      /* Corpus on disk for the file benchmarks */
+} Corpus;
+
+/* Readings shaped like the Example Programs: a timestamp and a temperature */
+static void append_sensor_reading(TextBuffer* text, size_t index) {
+    unsigned seconds = (unsigned)(index % 86400);
+    text_append(text, "{\"timestamp\":\"2024-05-%02u %02u:%02u:%02u\",\"temperature\":%.6f}",
+                (unsigned)(1 + index / 86400 % 28), seconds / 3600, seconds / 60 % 60, seconds % 60,
+                22.5 + sin((double)index * 0.01) * 2.5);
+}
+
+static void make_sensor(TextBuffer* text, size_t target) {
+    text_append(text, "[");
+    for (size_t i = 0; text->length < target; i++) {
+        if (i > 0) {
+            text_append(text, ",");
+        }
+        append_sensor_reading(text, i);
+    }
+    text_append(text, "]");
+}
+
+/* Records with 256 members of mixed types */
+static void make_wide(TextBuffer* text, size_t target) {
+    text_append(text, "[");
+    for (size_t i = 0; text->length < target; i++) {
+        text_append(text, i > 0 ? ",{" : "{");
+        for (int field = 0; field < 256; field++) {
+            const char* separator = field > 0 ? "," : "";
+            switch (field % 4) {
+                case 0:
+                    text_append(text, "%s\"field_%03d\":%zu", separator, field, i * 256 + field);
+                    break;
+                case 1:
+                    text_append(text, "%s\"field_%03d\":%.3f", separator, field, field * 0.125 + i);
+                    break;
+                case 2:
+                    text_append(text, "%s\"field_%03d\":\"value %zu\"", separator, field, i);
+                    break;
+                default:
+                    text_append(text, "%s\"field_%03d\":%s", separator, field, field % 8 == 3 ? "true" : "null");
+                    break;
+            }
+        }
+        text_append(text, "}");
+    }
+    text_append(text, "]");
+}
+
+/* Items nested to JSON_MAX_NESTING_DEPTH, counting the outer array */
+static void make_deep(TextBuffer* text, size_t target) {
+    text_append(text, "[");
+    for (size_t i = 0; text->length < target; i++) {
+        if (i > 0) {
+            text_append(text, ",");
+        }
+        for (int depth = 1; depth < JSON_MAX_NESTING_DEPTH; depth++) {
+            text_append(text, depth % 2 ? "{\"level\":%d,\"child\":" : "[%d,", depth);
+        }
+        text_append(text, "%zu", i);
+        for (int depth = JSON_MAX_NESTING_DEPTH - 1; depth >= 1; depth--) {
+            text_append(text, depth % 2 ? "}" : "]");
+        }
+    }
+    text_append(text, "]");
+}
+
+/* Long plain strings alternating with escape-heavy ones */
+static void make_strings(TextBuffer* text, size_t target) {
+    text_append(text, "[");
+    for (size_t i = 0; text->length < target; i++) {
+        if (i > 0) {
+            text_append(text, ",");
+        }
+        if (i % 2 == 0) {
+            text_append(text, "\"Reading %zu from the north field station was within the expected range "
+                              "and no calibration was required for this interval\"", i);
+        } else {
+            text_append(text, "\"line %zu\\n\\tquoted \\\"value\\\" in C:\\\\data\\\\log\\r\\n"
+                              "caf\\u00e9 \\u00fcber \\ud83d\\ude00 \\/slash\\b\\f\"", i);
+        }
+    }
+    text_append(text, "]");
+}
+
+static void make_ndjson(TextBuffer* text, size_t target) {
+    for (size_t i = 0; text->length < target; i++) {
+        append_sensor_reading(text, i);
+        text_append(text, "\n");
+    }
+}
+
+static size_t count_values(const JsonValue* value) {
+    size_t count = 1;
+    if (value->type == JSON_ARRAY) {
+        for (size_t i = 0; i < value->value.array->size; i++) {
+            count += count_values(value->value.array->items[i]);
+        }
+    } else if (value->type == JSON_OBJECT) {
+        for (const JsonKeyValue* pair = value->value.object->pairs; pair; pair = pair->next) {
+            count += count_values(pair->value);
+        }
+    }
+    return count;
+}
+
+static int write_corpus_file(Corpus* corpus) {
+    snprintf(corpus->path, sizeof(corpus->path), "bench_%s.json", corpus->name);
+    FILE* file = fopen(corpus->path, "wb");
+    if (!file) {
+        return 0;
+    }
+    int ok = fwrite(corpus->text, 1, corpus->length, file) == corpus->length;
+    return fclose(file) == 0 && ok;
+}
+
+static int prepare_corpus(Corpus* corpus, const char* name, void (*generate)(TextBuffer*, size_t),
+                          size_t target, int ndjson) {
+    TextBuffer text = {0};
+    generate(&text, target);
+
+    corpus->name = name;
+    corpus->text = text.data;
+    corpus->length = text.length;
+    corpus->ndjson = ndjson;
+    corpus->tree = NULL;
+    corpus->values = 0;
+
+    if (!write_corpus_file(corpus)) {
+        fprintf(stderr, "Could not write %s\n", corpus->path);
+        return 0;
+    }
+
+    if (ndjson) {
+        JsonFileReader* reader = json_file_reader_create(corpus->path, 0);
+        JsonValue* record;
+        while (reader && (record = json_file_reader_next(reader))) {
+            corpus->values += count_values(record);
+            json_free(record);
+        }
+        json_file_reader_free(reader);
+    } else {
+        corpus->tree = json_parse_string(corpus->text);
+        if (!corpus->tree) {
+            fprintf(stderr, "Corpus %s does not parse: %s\n", name, json_get_last_error()->message);
+            return 0;
+        }
+        corpus->values = count_values(corpus->tree);
+    }
+    return corpus->values > 0;
+}
+
+static void release_corpus(Corpus* corpus) {
+    remove(corpus->path);
+    json_free(corpus->tree);
+    free(corpus->text);
+}
+
+/* Benchmarks. Each run returns 0 on failure */
+
+typedef int (*BenchFunction)(const Corpus* corpus);
+
+typedef struct {
+    const char* name;
+    BenchFunction run;
+    int ndjson;         /* Runs on the NDJSON corpus instead of the documents */
+} Benchmark;
+
+static int bench_parse(const Corpus* corpus) {
+    JsonValue* value = json_parse_string(corpus->text);
+    json_free(value);
+    return value != NULL;
+}
+
+static int bench_document(const Corpus* corpus) {
+    JsonDocument* doc = json_document_parse_buffer(corpus->text, corpus->length, NULL);
+    json_document_free(doc);
+    return doc != NULL;
+}
+
+static int bench_compact(const Corpus* corpus) {
+    JsonDocument* doc = json_document_parse_buffer(corpus->text, corpus->length, &JSON_PARSE_COMPACT);
+    json_document_free(doc);
+    return doc != NULL;
+}
+
+static int bench_interned(const Corpus* corpus) {
+    JsonParseConfig config = JSON_PARSE_DEFAULT;
+    config.intern_keys = 1;
+    JsonDocument* doc = json_document_parse_buffer(corpus->text, corpus->length, &config);
+    json_document_free(doc);
+    return doc != NULL;
+}
+
+static int bench_tape(const Corpus* corpus) {
+    JsonTape* tape = json_tape_parse(corpus->text, corpus->length, NULL);
+    json_tape_free(tape);
+    return tape != NULL;
+}
+
+static int free_pushed(JsonValue* value, void* user_data) {
+    (*(size_t*)user_data)++;
+    json_free(value);
+    return 1;
+}
+
+/* Fed in pieces of one TCP segment, as from a socket */
+static int bench_push(const Corpus* corpus) {
+    size_t values = 0;
+    JsonPushParser* parser = json_push_parser_create(free_pushed, &values);
+    int ok = parser != NULL;
+    for (size_t offset = 0; ok && offset < corpus->length; offset += 1460) {
+        size_t n = corpus->length - offset < 1460 ? corpus->length - offset : 1460;
+        ok = json_push_parser_feed(parser, corpus->text + offset, n);
+    }
+    ok = ok && json_push_parser_finish(parser) && values == 1;
+    json_push_parser_free(parser);
+    return ok;
+}
+
+static int count_scalar(void* user_data) {
+    (*(size_t*)user_data)++;
+    return JSON_SAX_CONTINUE;
+}
+
+static int count_string(void* user_data, const char* value, size_t length) {
+    (void)value;
+    (void)length;
+    return count_scalar(user_data);
+}
+
+static int count_number(void* user_data, double value, int is_integer, int64_t integer) {
+    (void)value;
+    (void)is_integer;
+    (void)integer;
+    return count_scalar(user_data);
+}
+
+static int count_boolean(void* user_data, int value) {
+    (void)value;
+    return count_scalar(user_data);
+}
+
+/* Events for every scalar, no tree */
+static int bench_sax(const Corpus* corpus) {
+    JsonSaxHandler handler = {0};
+    handler.string = count_string;
+    handler.number = count_number;
+    handler.boolean = count_boolean;
+    handler.null = count_scalar;
+    size_t scalars = 0;
+    return json_sax_parse_buffer(corpus->text, corpus->length, &handler, &scalars, NULL) && scalars > 0;
+}
+
+static int bench_validate(const Corpus* corpus) {
+    return json_validate_string(corpus->text);
+}
+
+static int bench_format_compact(const Corpus* corpus) {
+    char* text = json_format_string(corpus->tree, &JSON_FORMAT_COMPACT);
+    free(text);
+    return text != NULL;
+}
+
+static int bench_format_pretty(const Corpus* corpus) {
+    char* text = json_format_string(corpus->tree, &JSON_FORMAT_PRETTY);
+    free(text);
+    return text != NULL;
+}
+
+/* Compact output into one buffer kept across runs, and into a fresh
+   buffer sized by the estimate pass */
+static int bench_format_into(const Corpus* corpus) {
+    static JsonFormatBuffer buffer;
+    return json_format_into(corpus->tree, &JSON_FORMAT_COMPACT, &buffer) && buffer.length > 0;
+}
+
+static int bench_format_estimated(const Corpus* corpus) {
+    JsonFormatBuffer buffer;
+    json_format_buffer_init(&buffer, NULL, 0);
+    int ok = json_format_buffer_reserve(&buffer, json_format_estimate(corpus->tree, &JSON_FORMAT_COMPACT)) &&
+             json_format_into(corpus->tree, &JSON_FORMAT_COMPACT, &buffer);
+    json_format_buffer_release(&buffer);
+    return ok;
+}
+
+static int bench_cbor_encode(const Corpus* corpus) {
+    static JsonFormatBuffer buffer;
+    return json_cbor_encode(corpus->tree, &buffer, NULL) && buffer.length > 0;
+}
+
+/* Decodes an encoding of the corpus made on the first call for it */
+static int bench_cbor_decode(const Corpus* corpus) {
+    static JsonFormatBuffer buffer;
+    static const Corpus* encoded;
+    if (encoded != corpus) {
+        if (!json_cbor_encode(corpus->tree, &buffer, NULL)) {
+            return 0;
+        }
+        encoded = corpus;
+    }
+    JsonValue* value = json_cbor_decode(buffer.data, buffer.length, NULL, NULL);
+    json_free(value);
+    return value != NULL;
+}
+
+/* Clean-and-aggregate pass over the temperatures, through a copied tree,
+   an index list and columns */
+static int bench_clean_tree(const Corpus* corpus) {
+    JsonValue* cleaned = json_clean_data(corpus->tree, "temperature", NULL);
+    double sum = 0.0;
+    for (size_t i = 0; i < json_array_size(cleaned); i++) {
+        JsonValue* temperature = json_object_get(json_array_get(cleaned, i), "temperature");
+        if (temperature && temperature->type == JSON_NUMBER) {
+            sum += temperature->value.number;
+        }
+    }
+    json_free(cleaned);
+    return cleaned != NULL && !isnan(sum);
+}
+
+static int bench_clean_indices(const Corpus* corpus) {
+    size_t* indices = (size_t*)malloc(json_array_size(corpus->tree) * sizeof(size_t) + 1);
+    if (!indices) {
+        return 0;
+    }
+    size_t kept = json_clean_indices(corpus->tree, json_clean_keep_valid, "temperature", indices, NULL);
+    double sum = 0.0;
+    for (size_t i = 0; i < kept; i++) {
+        JsonValue* temperature = json_object_get(json_array_get(corpus->tree, indices[i]), "temperature");
+        if (temperature && temperature->type == JSON_NUMBER) {
+            sum += temperature->value.number;
+        }
+    }
+    free(indices);
+    return !isnan(sum);
+}
+
+static int bench_clean_columns(const Corpus* corpus) {
+    const char* fields[] = {"temperature"};
+    JsonColumns* columns = json_columns_extract(corpus->tree, fields, 1);
+    uint64_t* selection = columns ? (uint64_t*)malloc(JSON_BITMAP_WORDS(columns->rows) * sizeof(uint64_t) + 1) : NULL;
+    if (!selection) {
+        json_columns_free(columns);
+        return 0;
+    }
+    json_columns_select_all(columns, selection);
+    json_columns_select_clean(columns, &columns->columns[0], selection, NULL);
+    JsonColumnStats stats;
+    json_column_stats(columns, &columns->columns[0], selection, &stats);
+    free(selection);
+    json_columns_free(columns);
+    return 1;
+}
+
+static int bench_write_file(const Corpus* corpus) {
+    const JsonFileWriteConfig config = {
+        .buffer_size = 65536,
+        .temp_suffix = ".tmp",
+        .sync_on_close = 0,
+    };
+    return json_write_file_ex(corpus->tree, "bench_output.json", &config);
+}
+
+/* Every element appended on its own, as a collector would, without syncs */
+static int bench_array_writer(const Corpus* corpus) {
+    JsonArrayWriterConfig config = JSON_ARRAY_WRITER_DEFAULT;
+    config.sync_interval_ms = 0;
+    config.sync_on_close = 0;
+    JsonArrayWriter* writer = json_array_writer_open("bench_output.json", &config, NULL);
+    int ok = writer != NULL;
+    if (corpus->tree->type == JSON_ARRAY) {
+        for (size_t i = 0; ok && i < json_array_size(corpus->tree); i++) {
+            ok = json_array_writer_append(writer, json_array_get(corpus->tree, i));
+        }
+    } else {
+        ok = ok && json_array_writer_append(writer, corpus->tree);
+    }
+    return json_array_writer_close(writer) && ok;
+}
+
+static int bench_index_build(const Corpus* corpus) {
+    JsonIndex* index = json_index_build(corpus->path, NULL);
+    int ok = index && json_index_count(index) > 0;
+    json_index_free(index);
+    return ok;
+}
+
+/* Every 64th element of an index built on the first call for the corpus */
+static int bench_index_sample(const Corpus* corpus) {
+    static JsonIndex* index;
+    static const Corpus* indexed;
+    if (indexed != corpus) {
+        json_index_free(index);
+        index = json_index_build(corpus->path, NULL);
+        indexed = corpus;
+    }
+    int ok = index != NULL;
+    for (size_t i = 0; ok && i < json_index_count(index); i += 64) {
+        JsonValue* element = json_index_get(index, i, NULL);
+        ok = element != NULL;
+        json_free(element);
+    }
+    return ok;
+}
+
+static int bench_reader(const Corpus* corpus) {
+    JsonFileReader* reader = json_file_reader_create(corpus->path, 0);
+    if (!reader) {
+        return 0;
+    }
+    JsonValue* record;
+    while ((record = json_file_reader_next(reader))) {
+        json_free(record);
+    }
+    int ok = json_get_last_error()->code == JSON_ERROR_NONE;
+    json_file_reader_free(reader);
+    return ok;
+}
+
+static int count_record(const JsonBatchRecord* record, void* user_data) {
+    (void)user_data;
+    return record->value != NULL;
+}
+
+static int bench_batch(const Corpus* corpus) {
+    return json_batch_process_file(corpus->path, &JSON_BATCH_DEFAULT, count_record, NULL, NULL);
+}
+
+static const Benchmark benchmarks[] = {
+    {"parse", bench_parse, 0},
+    {"document_parse", bench_document, 0},
+    {"compact_parse", bench_compact, 0},
+    {"interned_parse", bench_interned, 0},
+    {"tape_parse", bench_tape, 0},
+    {"push_parse", bench_push, 0},
+    {"sax_parse", bench_sax, 0},
+    {"validate", bench_validate, 0},
+    {"format_compact", bench_format_compact, 0},
+    {"format_pretty", bench_format_pretty, 0},
+    {"format_into", bench_format_into, 0},
+    {"format_estimated", bench_format_estimated, 0},
+    {"cbor_encode", bench_cbor_encode, 0},
+    {"cbor_decode", bench_cbor_decode, 0},
+    {"clean_tree", bench_clean_tree, 0},
+    {"clean_indices", bench_clean_indices, 0},
+    {"clean_columns", bench_clean_columns, 0},
+    {"write_file_ex", bench_write_file, 0},
+    {"array_writer", bench_array_writer, 0},
+    {"index_build", bench_index_build, 0},
+    {"index_sample", bench_index_sample, 0},
+    {"file_reader", bench_reader, 1},
+    {"batch_process", bench_batch, 1},
+};
+
+/* Measurement */
+
+typedef struct {
+    char benchmark[32];
+    char corpus[32];
+    size_t bytes;
+    size_t values;
+    size_t iterations;
+    double seconds_best;
+    double mb_per_s;
+    double ns_per_value;
+    double mallocs_per_iter;    /* -1 when allocations are not counted */
+    long peak_rss_kb;           /* -1 when unavailable */
+    int ok;
+} BenchResult;
+
+typedef struct {
+    double min_seconds;
+    size_t max_iterations;
+} BenchOptions;
+
+static double now_seconds(void) {
+#if BENCH_HAVE_FORK
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+static long peak_rss_kb(void) {
+#if BENCH_HAVE_FORK
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return -1;
+    }
+#ifdef __APPLE__
+    return (long)(usage.ru_maxrss / 1024);  /* Bytes on macOS */
+#else
+    return (long)usage.ru_maxrss;
+#endif
+#else
+    return -1;
+#endif
+}
+
+/* Best single iteration after one warm-up run, repeated until min_seconds
+   have been spent (at least three timed runs) */
+static void measure(const Benchmark* bench, const Corpus* corpus, const BenchOptions* options,
+                    BenchResult* result) {
+    memset(result, 0, sizeof(*result));
+    snprintf(result->benchmark, sizeof(result->benchmark), "%s", bench->name);
+    snprintf(result->corpus, sizeof(result->corpus), "%s", corpus->name);
+    result->bytes = corpus->length;
+    result->values = corpus->values;
+
+    result->ok = bench->run(corpus);
+    if (!result->ok) {
+        return;
+    }
+
+    double best = INFINITY;
+    double spent = 0.0;
+    size_t allocs_before = alloc_snapshot();
+    while (result->iterations < options->max_iterations &&
+           (result->iterations < 3 || spent < options->min_seconds)) {
+        double start = now_seconds();
+        int ok = bench->run(corpus);
+        double elapsed = now_seconds() - start;
+        if (!ok) {
+            result->ok = 0;
+            return;
+        }
+        if (elapsed < best) {
+            best = elapsed;
+        }
+        spent += elapsed;
+        result->iterations++;
+    }
+    size_t allocs = alloc_snapshot() - allocs_before;
+
+    result->seconds_best = best;
+    result->mb_per_s = best > 0 ? (double)corpus->length / best / 1e6 : 0.0;
+    result->ns_per_value = best * 1e9 / (double)corpus->values;
+    result->mallocs_per_iter = BENCH_COUNTS_ALLOCS ? (double)allocs / (double)result->iterations : -1.0;
+    result->peak_rss_kb = peak_rss_kb();
+}
+
+/* Runs each benchmark in its own process so peak RSS belongs to it alone */
+static void run_benchmark(const Benchmark* bench, const Corpus* corpus, const BenchOptions* options,
+                          BenchResult* result) {
+#if BENCH_HAVE_FORK
+    int channel[2];
+    if (pipe(channel) == 0) {
+        fflush(NULL);
+        pid_t child = fork();
+        if (child == 0) {
+            close(channel[0]);
+            measure(bench, corpus, options, result);
+            ssize_t written = write(channel[1], result, sizeof(*result));
+            _exit(written == (ssize_t)sizeof(*result) ? 0 : 1);
+        }
+        close(channel[1]);
+        if (child > 0) {
+            ssize_t received = read(channel[0], result, sizeof(*result));
+            int status;
+            waitpid(child, &status, 0);
+            close(channel[0]);
+            if (received == (ssize_t)sizeof(*result)) {
+                return;
+            }
+            memset(result, 0, sizeof(*result));
+            snprintf(result->benchmark, sizeof(result->benchmark), "%s", bench->name);
+            snprintf(result->corpus, sizeof(result->corpus), "%s", corpus->name);
+            return;
+        }
+        close(channel[0]);
+    }
+#endif
+    measure(bench, corpus, options, result);
+}
+
+/* Output */
+
+static JsonValue* result_to_json(const BenchResult* result) {
+    JsonValue* object = json_create_object();
+    if (!object) {
+        return NULL;
+    }
+    json_object_set(object, "benchmark", json_create_string(result->benchmark));
+    json_object_set(object, "corpus", json_create_string(result->corpus));
+    json_object_set(object, "ok", json_create_boolean(result->ok));
+    json_object_set(object, "bytes", json_create_number((double)result->bytes));
+    json_object_set(object, "values", json_create_number((double)result->values));
+    json_object_set(object, "iterations", json_create_number((double)result->iterations));
+    json_object_set(object, "seconds_best", json_create_number(result->seconds_best));
+    json_object_set(object, "mb_per_s", json_create_number(result->mb_per_s));
+    json_object_set(object, "ns_per_value", json_create_number(result->ns_per_value));
+    json_object_set(object, "mallocs_per_iter", json_create_number(result->mallocs_per_iter));
+    json_object_set(object, "peak_rss_kb", json_create_number((double)result->peak_rss_kb));
+    return object;
+}
+
+static void print_result(const BenchResult* result, int as_json) {
+    if (as_json) {
+        /* Compact, with counts printed as plain integers */
+        JsonFormatConfig config = JSON_FORMAT_COMPACT;
+        config.number_format = JSON_NUMBER_FORMAT_SHORTEST;
+        JsonValue* object = result_to_json(result);
+        char* line = object ? json_format_string(object, &config) : NULL;
+        if (line) {
+            printf("%s\n", line);
+        }
+        free(line);
+        json_free(object);
+    } else if (!result->ok) {
+        printf("%-16s %-8s FAILED\n", result->benchmark, result->corpus);
+    } else {
+        printf("%-16s %-8s %9.1f MB/s %9.1f ns/value %10.1f allocs/iter %9ld KB peak\n",
+               result->benchmark, result->corpus, result->mb_per_s, result->ns_per_value,
+               result->mallocs_per_iter, result->peak_rss_kb);
+    }
+    fflush(stdout);
+}
+
+/* Baseline comparison */
+
+static const char* baseline_string(const JsonValue* record, const char* key) {
+    const JsonValue* value = json_object_get(record, key);
+    return value && value->type == JSON_STRING ? value->value.string : NULL;
+}
+
+static double baseline_number(const JsonValue* record, const char* key) {
+    const JsonValue* value = json_object_get(record, key);
+    return value && value->type == JSON_NUMBER ? value->value.number : -1.0;
+}
+
+/* Returns the number of regressions, or -1 if the baseline cannot be read */
+static int compare_baseline(const char* filename, const BenchResult* results, size_t count,
+                            double tolerance) {
+    JsonFileReader* reader = json_file_reader_create(filename, 0);
+    if (!reader) {
+        fprintf(stderr, "Cannot open baseline %s\n", filename);
+        return -1;
+    }
+
+    int regressions = 0;
+    JsonValue* record;
+    while ((record = json_file_reader_next(reader))) {
+        const char* bench = baseline_string(record, "benchmark");
+        const char* corpus = baseline_string(record, "corpus");
+        for (size_t i = 0; bench && corpus && i < count; i++) {
+            const BenchResult* result = &results[i];
+            if (strcmp(result->benchmark, bench) != 0 || strcmp(result->corpus, corpus) != 0) {
+                continue;
+            }
+            double old_speed = baseline_number(record, "mb_per_s");
+            double old_allocs = baseline_number(record, "mallocs_per_iter");
+            if (!result->ok) {
+                printf("REGRESSION %s/%s: benchmark failed\n", bench, corpus);
+                regressions++;
+            } else if (old_speed > 0 && result->mb_per_s < old_speed * (1.0 - tolerance / 100.0)) {
+                printf("REGRESSION %s/%s: %.1f MB/s, baseline %.1f MB/s\n",
+                       bench, corpus, result->mb_per_s, old_speed);
+                regressions++;
+            } else if (old_allocs >= 0 && result->mallocs_per_iter > old_allocs + 0.5) {
+                printf("REGRESSION %s/%s: %.1f allocs/iter, baseline %.1f\n",
+                       bench, corpus, result->mallocs_per_iter, old_allocs);
+                regressions++;
+            }
+        }
+        json_free(record);
+    }
+
+    int failed = json_get_last_error()->code != JSON_ERROR_NONE;
+    json_file_reader_free(reader);
+    if (failed) {
+        fprintf(stderr, "Baseline %s is malformed\n", filename);
+        return -1;
+    }
+    return regressions;
+}
+
+static void usage(const char* program) {
+    fprintf(stderr, "Usage: %s [--json] [--quick] [--scale N] [--filter TEXT]\n"
+                    "          [--compare BASELINE.ndjson] [--tolerance PERCENT]\n", program);
+}
+
+int main(int argc, char** argv) {
+    int as_json = 0;
+    double scale = 1.0;
+    const char* filter = NULL;
+    const char* baseline = NULL;
+    double tolerance = 10.0;
+    BenchOptions options = {.min_seconds = 0.5, .max_iterations = 1000};
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0) {
+            as_json = 1;
+        } else if (strcmp(argv[i], "--quick") == 0) {
+            options.min_seconds = 0.05;
+            scale = 0.1;
+        } else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+            scale = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc) {
+            baseline = argv[++i];
+        } else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+            tolerance = atof(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (!(scale > 0)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    /* Default corpora are about 4 MB each */
+    size_t target = (size_t)(4e6 * scale);
+    Corpus corpora[5];
+    size_t corpus_count = 0;
+    int ready = prepare_corpus(&corpora[corpus_count++], "sensor", make_sensor, target, 0) &&
+                prepare_corpus(&corpora[corpus_count++], "wide", make_wide, target, 0) &&
+                prepare_corpus(&corpora[corpus_count++], "deep", make_deep, target, 0) &&
+                prepare_corpus(&corpora[corpus_count++], "strings", make_strings, target, 0) &&
+                prepare_corpus(&corpora[corpus_count++], "ndjson", make_ndjson, target, 1);
+
+    size_t capacity = corpus_count * (sizeof(benchmarks) / sizeof(benchmarks[0]));
+    BenchResult* results = calloc(capacity, sizeof(BenchResult));
+    size_t result_count = 0;
+    int failures = 0;
+
+    if (!as_json && ready) {
+        printf("%-16s %-8s %14s %17s %22s %17s\n", "benchmark", "corpus", "throughput",
+               "per value", "allocations", "peak RSS");
+    }
+
+    for (size_t b = 0; ready && results && b < sizeof(benchmarks) / sizeof(benchmarks[0]); b++) {
+        for (size_t c = 0; c < corpus_count; c++) {
+            if (benchmarks[b].ndjson != corpora[c].ndjson) {
+                continue;
+            }
+            char label[80];
+            snprintf(label, sizeof(label), "%s/%s", benchmarks[b].name, corpora[c].name);
+            if (filter && !strstr(label, filter)) {
+                continue;
+            }
+            BenchResult* result = &results[result_count++];
+            run_benchmark(&benchmarks[b], &corpora[c], &options, result);
+            print_result(result, as_json);
+            failures += !result->ok;
+        }
+    }
+    remove("bench_output.json");
+
+    int regressions = 0;
+    if (ready && results && baseline) {
+        regressions = compare_baseline(baseline, results, result_count, tolerance);
+    }
+
+    for (size_t c = 0; c < corpus_count; c++) {
+        release_corpus(&corpora[c]);
+    }
+    free(results);
+
+    if (!ready || !results || regressions < 0) {
+        return 2;
+    }
+    return failures || regressions ? 1 : 0;
+}
@@ -16,49 +16,47 @@ static double generate_temperature() {
     return 22.5 + ((double)rand() / RAND_MAX - 0.5) * 5.0;
 }
 
-/* Create a JSON array of sensor readings */
-static JsonValue* create_sensor_data(SensorReading* readings, size_t count) {
-    JsonValue* array = json_create_array();
-    
-    for (size_t i = 0; i < count; i++) {
-        JsonValue* reading = json_create_object();
-        
-        char timestamp[32];
-        strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", 
-                localtime(&readings[i].timestamp));
-        
-        json_object_set(reading, "timestamp", json_create_string(timestamp));
-        json_object_set(reading, "temperature", 
-                       json_create_number(readings[i].valid ? readings[i].temperature : NAN));
-        
-        json_array_append(array, reading);
-    }
-    
-    return array;
+/* Fill the reused reading object with one sample */
+static void update_reading(JsonValue* reading, const SensorReading* sample) {
+    char timestamp[32];
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S",
+             localtime(&sample->timestamp));
+
+    json_object_set(reading, "timestamp", json_create_string(timestamp));
+    json_object_get(reading, "temperature")->value.number =
+        sample->valid ? sample->temperature : NAN;
 }
 
 /* Simulate continuous data collection */
 static void simulate_continuous_collection(const char* output_file, int duration_sec) {
-    JsonFileWriteConfig write_config = {
-        .buffer_size = 4096,
-        .temp_suffix = ".tmp",
-        .sync_on_close = 1
-    };
-
-    FILE* stream = fopen(output_file, "w");
-    if (!stream) {
-        printf("Failed to open output file\n");
+    /* Batch writes, sync every 10 readings or 2 seconds, and continue the
+       file of an earlier run, recovering it if that run was cut off */
+    JsonArrayWriterConfig write_config = JSON_ARRAY_WRITER_DEFAULT;
+    write_config.sync_every = 10;
+    write_config.sync_interval_ms = 2000;
+    write_config.append = 1;
+
+    JsonError error;
+    JsonArrayWriter* writer = json_array_writer_open(output_file, &write_config, &error);
+    if (!writer) {
+        printf("Failed to open output file: %s\n", error.message);
         return;
     }
+    size_t previous_count = json_array_writer_count(writer);
 
-    /* Write array start */
-    fprintf(stream, "[\n");
+    /* One reading object for all samples */
+    JsonValue* reading_json = json_create_object();
+    json_object_set(reading_json, "timestamp", json_create_string(""));
+    json_object_set(reading_json, "temperature", json_create_number(0.0));
 
     time_t start_time = time(NULL);
     int reading_count = 0;
 
     printf("Starting continuous data collection for %d seconds...\n", duration_sec);
-    
+    if (previous_count > 0) {
+        printf("Continuing after %zu earlier readings\n", previous_count);
+    }
+
     while (time(NULL) - start_time < duration_sec) {
         SensorReading reading = {
             .timestamp = time(NULL),
@@ -66,31 +64,20 @@ static void simulate_continuous_collection(const char* output_file, int duration
             .valid = (rand() % 10 > 1)  /* 80% chance of valid reading */
         };
 
-        JsonValue* reading_json = create_sensor_data(&reading, 1);
-        JsonValue* single_reading = json_array_get(reading_json, 0);
-
-        /* Write comma for all but first reading */
-        if (reading_count > 0) {
-            fprintf(stream, ",\n");
+        update_reading(reading_json, &reading);
+        if (!json_array_writer_append(writer, reading_json)) {
+            printf("Failed to write reading: %s\n", json_array_writer_error(writer)->message);
+            break;
         }
-
-        /* Write the reading */
-        char* formatted = json_format_string(single_reading, &JSON_FORMAT_COMPACT);
-        if (formatted) {
-            fprintf(stream, "  %s", formatted);
-            free(formatted);
-        }
-
-        fflush(stream);  /* Ensure data is written */
         reading_count++;
 
-        json_free(reading_json);
         usleep(500000);  /* Sleep for 500ms */
     }
 
-    /* Write array end */
-    fprintf(stream, "\n]\n");
-    fclose(stream);
+    json_free(reading_json);
+    if (!json_array_writer_close(writer)) {
+        printf("Failed to finish output file\n");
+    }
 
     printf("Collected %d readings\n", reading_count);
 }
@@ -153,14 +140,16 @@ int main() {
     printf("\n=== Test 3: Partial File Reading ===\n");
     JsonFileReader* reader = json_file_reader_create(data_file, 256);
     if (reader) {
-        printf("Reading data in chunks:\n");
-        int chunk_count = 0;
-        while (json_file_reader_next(reader) != NULL) {
-            chunk_count++;
-            printf("\rProcessed chunk %d", chunk_count);
+        printf("Reading values incrementally:\n");
+        int value_count = 0;
+        JsonValue* value;
+        while ((value = json_file_reader_next(reader)) != NULL) {
+            value_count++;
+            printf("\rProcessed value %d", value_count);
             fflush(stdout);
+            json_free(value);
         }
-        printf("\nFinished reading %d chunks\n", chunk_count);
+        printf("\nFinished reading %d values (%zu bytes)\n", value_count, reader->bytes_read);
         json_file_reader_free(reader);
     } else {
         const JsonError* error = json_get_file_error();
@@ -1,18 +1,95 @@
 /* json.c */
-#include "json.h"
+#include "json_internal.h"
 #include <math.h>
 
-/* Helper function to create a new JsonValue */
-static JsonValue *json_value_init(void)
+/* Error helpers shared by all modules. NULL error is ignored */
+void json_error_clear(JsonError *error)
 {
-    JsonValue *value = (JsonValue *)malloc(sizeof(JsonValue));
-    if (value)
+    if (!error)
+        return;
+    error->code = JSON_ERROR_NONE;
+    error->line = 0;
+    error->column = 0;
+    error->message[0] = '\0';
+    error->context[0] = '\0';
+}
+
+/* Record an error without position information. NULL error is ignored */
+void json_error_set(JsonError *error, JsonErrorCode code, const char *message)
+{
+    if (!error)
+        return;
+    json_error_clear(error);
+    error->code = code;
+    strncpy(error->message, message, sizeof(error->message) - 1);
+    error->message[sizeof(error->message) - 1] = '\0';
+}
+
+/* Helper function to create a new JsonValue, from the heap or from an arena.
+   Arrays and objects also get their (empty) container structure */
+JsonValue *json_value_alloc(JsonArena *arena, JsonType type)
+{
+    JsonValue *value = arena ? (JsonValue *)json_arena_alloc(arena, sizeof(JsonValue))
+                             : (JsonValue *)json_heap_alloc(sizeof(JsonValue));
+    if (!value)
     {
-        memset(value, 0, sizeof(JsonValue));
+        return NULL;
+    }
+    memset(value, 0, sizeof(JsonValue));
+    value->type = type;
+    value->flags = arena ? JSON_VALUE_ARENA : 0;
+    JSON_STATS_ADD(nodes, 1);
+
+    if (type == JSON_ARRAY)
+    {
+        JsonArray *array = arena ? (JsonArray *)json_arena_alloc(arena, sizeof(JsonArray))
+                                 : (JsonArray *)json_heap_alloc(sizeof(JsonArray));
+        if (!array)
+        {
+            if (!arena)
+                json_heap_free(value);
+            return NULL;
+        }
+        array->items = NULL;
+        array->size = 0;
+        array->capacity = 0;
+        array->arena = arena;
+        array->elements = NULL;
+        value->value.array = array;
+    }
+    else if (type == JSON_OBJECT)
+    {
+        JsonObject *object = arena ? (JsonObject *)json_arena_alloc(arena, sizeof(JsonObject))
+                                   : (JsonObject *)json_heap_alloc(sizeof(JsonObject));
+        if (!object)
+        {
+            if (!arena)
+                json_heap_free(value);
+            return NULL;
+        }
+        object->pairs = NULL;
+        object->size = 0;
+        object->arena = arena;
+        object->tail = NULL;
+        object->index = NULL;
+        object->index_capacity = 0;
+        value->value.object = object;
     }
     return value;
 }
 
+/* Short keys of heap objects are stored right behind their pair */
+static int pair_key_is_inline(const JsonKeyValue *pair)
+{
+    return pair->key == (const char *)(pair + 1);
+}
+
+/* Helper function to allocate a string buffer of length + 1 bytes */
+char *json_string_alloc(JsonArena *arena, size_t length)
+{
+    return arena ? (char *)json_arena_alloc(arena, length + 1) : (char *)json_heap_alloc(length + 1);
+}
+
 /* Helpler functionn to check if a value is valid for output */
 int json_is_valid_for_output(const JsonValue *value)
 {
@@ -25,9 +102,12 @@ int json_is_valid_for_output(const JsonValue *value)
     return 1;
 }
 
-/* Helper function to deep copy JSON values */
-static JsonValue* json_deep_copy(const JsonValue* src) {
-    if (!src) {
+static int object_set_copy(JsonValue *object_value, const char *key, size_t key_length,
+                           JsonValue *value);
+
+/* Shallow copy of one value: scalars in full, arrays and objects empty */
+static JsonValue* copy_node(const JsonValue* src) {
+    if (!src || !JSON_VALUE_READY(src)) {
         return NULL;
     }
 
@@ -39,64 +119,112 @@ static JsonValue* json_deep_copy(const JsonValue* src) {
             return json_create_boolean(src->value.boolean);
 
         case JSON_NUMBER:
+            if (src->flags & JSON_VALUE_INTEGER)
+                return json_create_integer(src->integer);
             return json_create_number(src->value.number);
 
         case JSON_STRING:
-            return json_create_string(src->value.string);
-
-        case JSON_ARRAY: {
-            JsonValue* array = json_create_array();
-            if (!array) return NULL;
-
-            for (size_t i = 0; i < src->value.array->size; i++) {
-                JsonValue* item_copy = json_deep_copy(src->value.array->items[i]);
-                if (!item_copy || !json_array_append(array, item_copy)) {
-                    json_free(array);
-                    json_free(item_copy);
-                    return NULL;
-                }
+            return json_create_string_length(src->value.string, src->length);
+
+        case JSON_ARRAY:
+            return json_create_array();
+
+        case JSON_OBJECT:
+            return json_create_object();
+
+        default:
+            return NULL;
+    }
+}
+
+/* Container being copied, and the position of its next member */
+typedef struct {
+    const JsonValue* src;
+    JsonValue* copy;
+    size_t index;                 /* Arrays */
+    const JsonKeyValue* pair;     /* Objects */
+} CopyFrame;
+
+#define COPY_INITIAL_FRAMES JSON_MAX_NESTING_DEPTH
+
+/* Helper function to deep copy JSON values. Nested containers are walked
+   from an explicit stack; every copied member is attached right away, so
+   freeing the root copy cleans up after a failure */
+static JsonValue* json_deep_copy(const JsonValue* src) {
+    JsonValue* root = copy_node(src);
+    if (!root || (root->type != JSON_ARRAY && root->type != JSON_OBJECT)) {
+        return root;
+    }
+
+    CopyFrame initial[COPY_INITIAL_FRAMES];
+    JsonStack stack;
+    json_stack_init(&stack, initial, COPY_INITIAL_FRAMES, sizeof(CopyFrame));
+    CopyFrame* frame = (CopyFrame*)json_stack_push(&stack);
+    frame->src = src;
+    frame->copy = root;
+    frame->index = 0;
+    frame->pair = src->type == JSON_OBJECT ? src->value.object->pairs : NULL;
+
+    while (stack.count) {
+        frame = JSON_STACK_TOP(&stack, CopyFrame);
+        const JsonValue* member;
+        const JsonKeyValue* pair = NULL;
+        if (frame->src->type == JSON_ARRAY) {
+            if (frame->index == frame->src->value.array->size) {
+                stack.count--;
+                continue;
+            }
+            member = frame->src->value.array->items[frame->index++];
+        } else {
+            if (!frame->pair) {
+                stack.count--;
+                continue;
             }
-            return array;
+            pair = frame->pair;
+            frame->pair = pair->next;
+            member = pair->value;
         }
 
-        case JSON_OBJECT: {
-            JsonValue* obj = json_create_object();
-            if (!obj) return NULL;
-
-            JsonKeyValue* current = src->value.object->pairs;
-            while (current) {
-                JsonValue* value_copy = json_deep_copy(current->value);
-                if (!value_copy || !json_object_set(obj, current->key, value_copy)) {
-                    json_free(obj);
-                    json_free(value_copy);
-                    return NULL;
-                }
-                current = current->next;
+        JsonValue* member_copy = copy_node(member);
+        int added = member_copy &&
+                    (pair ? object_set_copy(frame->copy, pair->key, pair->key_length, member_copy)
+                          : json_array_append(frame->copy, member_copy));
+        if (!added) {
+            json_free(member_copy);
+            break;
+        }
+
+        if (member_copy->type == JSON_ARRAY || member_copy->type == JSON_OBJECT) {
+            frame = (CopyFrame*)json_stack_push(&stack);
+            if (!frame) {
+                break;
             }
-            return obj;
+            frame->src = member;
+            frame->copy = member_copy;
+            frame->index = 0;
+            frame->pair = member->type == JSON_OBJECT ? member->value.object->pairs : NULL;
         }
+    }
 
-        default:
-            return NULL;
+    int complete = stack.count == 0;
+    json_stack_release(&stack);
+    if (!complete) {
+        json_free(root);
+        return NULL;
     }
+    return root;
 }
 
 JsonValue *json_create_null(void)
 {
-    JsonValue *value = json_value_init();
-    if (value)
-    {
-        value->type = JSON_NULL;
-    }
-    return value;
+    return json_value_alloc(NULL, JSON_NULL);
 }
 
 JsonValue *json_create_boolean(int boolean_value)
 {
-    JsonValue *value = json_value_init();
+    JsonValue *value = json_value_alloc(NULL, JSON_BOOLEAN);
     if (value)
     {
-        value->type = JSON_BOOLEAN;
         value->value.boolean = boolean_value;
     }
     return value;
@@ -104,28 +232,66 @@ JsonValue *json_create_boolean(int boolean_value)
 
 JsonValue *json_create_number(double number_value)
 {
-
-    JsonValue *value = json_value_init();
+    JsonValue *value = json_value_alloc(NULL, JSON_NUMBER);
     if (value)
     {
-        value->type = JSON_NUMBER;
         value->value.number = number_value;
     }
     return value;
 }
 
+JsonValue *json_create_integer(int64_t integer_value)
+{
+    JsonValue *value = json_value_alloc(NULL, JSON_NUMBER);
+    if (value)
+    {
+        value->value.number = (double)integer_value;
+        value->integer = integer_value;
+        value->flags |= JSON_VALUE_INTEGER;
+    }
+    return value;
+}
+
 JsonValue *json_create_string(const char *string_value)
 {
-    JsonValue *value = json_value_init();
+    return json_create_string_length(string_value, string_value ? strlen(string_value) : 0);
+}
+
+/* Create a string from length bytes, which may include embedded NULs.
+   Short strings live in the node's own allocation */
+JsonValue *json_create_string_length(const char *string_value, size_t length)
+{
+    if (string_value && length <= JSON_INLINE_STRING_MAX)
+    {
+        JsonValue *value = (JsonValue *)json_heap_alloc(sizeof(JsonValue) + JSON_INLINE_STRING_MAX + 1);
+        if (!value)
+        {
+            return NULL;
+        }
+        memset(value, 0, sizeof(JsonValue));
+        JSON_STATS_ADD(nodes, 1);
+        value->type = JSON_STRING;
+        value->flags = JSON_VALUE_INLINE;
+        value->value.string = (char *)(value + 1);
+        memcpy(value->value.string, string_value, length);
+        value->value.string[length] = '\0';
+        value->length = length;
+        return value;
+    }
+
+    JsonValue *value = json_value_alloc(NULL, JSON_NULL);
     if (value && string_value)
     {
         value->type = JSON_STRING;
-        value->value.string = strdup(string_value);
+        value->value.string = json_string_alloc(NULL, length);
         if (!value->value.string)
         {
-            free(value);
+            json_heap_free(value);
             return NULL;
         }
+        memcpy(value->value.string, string_value, length);
+        value->value.string[length] = '\0';
+        value->length = length;
     }
     return value;
 }
@@ -148,39 +314,12 @@ static size_t count_valid_array_items(const JsonArray *array)
 
 JsonValue *json_create_array(void)
 {
-    JsonValue *value = json_value_init();
-    if (value)
-    {
-        value->type = JSON_ARRAY;
-        value->value.array = (JsonArray *)malloc(sizeof(JsonArray));
-        if (!value->value.array)
-        {
-            free(value);
-            return NULL;
-        }
-        value->value.array->items = NULL;
-        value->value.array->size = 0;
-        value->value.array->capacity = 0;
-    }
-    return value;
+    return json_value_alloc(NULL, JSON_ARRAY);
 }
 
 JsonValue *json_create_object(void)
 {
-    JsonValue *value = json_value_init();
-    if (value)
-    {
-        value->type = JSON_OBJECT;
-        value->value.object = (JsonObject *)malloc(sizeof(JsonObject));
-        if (!value->value.object)
-        {
-            free(value);
-            return NULL;
-        }
-        value->value.object->pairs = NULL;
-        value->value.object->size = 0;
-    }
-    return value;
+    return json_value_alloc(NULL, JSON_OBJECT);
 }
 
 /* Modified print function to handle NaN values */
@@ -198,6 +337,12 @@ void json_print_value(const JsonValue *value, int indent_level)
         return;
     }
 
+    if (!JSON_VALUE_READY(value))
+    {
+        printf("null");
+        return;
+    }
+
     /* Print indentation */
     for (int i = 0; i < indent_level; i++)
     {
@@ -215,7 +360,11 @@ void json_print_value(const JsonValue *value, int indent_level)
             break;
 
         case JSON_NUMBER:
-            if (fabs(value->value.number) < 0.0001 || fabs(value->value.number) > 100000.0)
+            if (value->flags & JSON_VALUE_INTEGER)
+            {
+                printf("%lld", (long long)value->integer);
+            }
+            else if (fabs(value->value.number) < 0.0001 || fabs(value->value.number) > 100000.0)
             {
                 printf("%e", value->value.number);
             }
@@ -226,7 +375,7 @@ void json_print_value(const JsonValue *value, int indent_level)
             break;
 
         case JSON_STRING:
-            printf("\"%s\"", value->value.string);
+            printf("\"%.*s\"", (int)value->length, value->value.string);
             break;
 
         case JSON_ARRAY:
@@ -285,7 +434,7 @@ void json_print_value(const JsonValue *value, int indent_level)
                     {
                         printf("  ");
                     }
-                    printf("\"%s\": ", pair->key);
+                    printf("\"%.*s\": ", (int)pair->key_length, pair->key);
                     json_print_value(pair->value, 0);
                     pair = pair->next;
                 }
@@ -301,53 +450,87 @@ void json_print_value(const JsonValue *value, int indent_level)
     }
 }
 
-/* Memory cleanup function */
+/* Free one node and its string; a container's members must be gone */
+static void free_node(JsonValue *value)
+{
+    if (value->type == JSON_STRING && !(value->flags & JSON_VALUE_INLINE))
+        json_heap_free(value->value.string);
+    json_heap_free(value);
+}
+
+/* Memory cleanup function. Trees of any depth are freed without recursion
+   and without allocating: the pairs of every object reached are spliced
+   into one chain of pairs still to free, and arrays wait on a list linked
+   through their unused elements pointer */
 void json_free(JsonValue *value)
 {
-    if (!value)
-        return;
+    JsonKeyValue *pairs = NULL;   /* Pairs whose key, value and node are still to free */
+    JsonValue *arrays = NULL;     /* Arrays whose items are still to free */
 
-    switch (value->type)
+    for (;;)
     {
-    case JSON_STRING:
-        free(value->value.string);
-        break;
-    case JSON_ARRAY:
-        if (value->value.array)
+        /* Document-owned values are released with their arena */
+        if (value && !(value->flags & JSON_VALUE_ARENA))
         {
-            for (size_t i = 0; i < value->value.array->size; i++)
+            if (value->type == JSON_ARRAY && value->value.array)
             {
-                json_free(value->value.array->items[i]);
+                value->value.array->elements = arrays;
+                arrays = value;
             }
-            free(value->value.array->items);
-            free(value->value.array);
-        }
-        break;
-    case JSON_OBJECT:
-        if (value->value.object)
-        {
-            JsonKeyValue *current = value->value.object->pairs;
-            while (current)
+            else if (value->type == JSON_OBJECT && value->value.object)
+            {
+                JsonObject *object = value->value.object;
+                if (object->pairs)
+                {
+                    JsonKeyValue *last = object->pairs;
+                    while (last->next)
+                        last = last->next;
+                    last->next = pairs;
+                    pairs = object->pairs;
+                }
+                json_heap_free(object->index);
+                json_heap_free(object);
+                json_heap_free(value);
+            }
+            else
             {
-                JsonKeyValue *next = current->next;
-                free(current->key);
-                json_free(current->value);
-                free(current);
-                current = next;
+                free_node(value);
             }
-            free(value->value.object);
         }
-        break;
-    default:
-        break;
+
+        /* Next value: a pair's, or else an item of a pending array */
+        if (pairs)
+        {
+            JsonKeyValue *pair = pairs;
+            pairs = pair->next;
+            value = pair->value;
+            if (!pair_key_is_inline(pair) && !(pair->flags & JSON_KEY_INTERNED))
+                json_heap_free(pair->key);
+            json_heap_free(pair);
+            continue;
+        }
+        if (!arrays)
+            break;
+
+        JsonArray *array = arrays->value.array;
+        if (array->size)
+        {
+            value = array->items[--array->size];
+            continue;
+        }
+        value = arrays;
+        arrays = array->elements;
+        json_heap_free(array->items);
+        json_heap_free(array);
+        json_heap_free(value);
+        value = NULL;
     }
-    free(value);
 }
 
 /* Array manipulation functions */
 int json_array_append(JsonValue *array_value, JsonValue *value)
 {
-    if (!array_value || array_value->type != JSON_ARRAY)
+    if (!array_value || array_value->type != JSON_ARRAY || !JSON_VALUE_READY(array_value))
     {
         return 0; // Error: invalid parameters
     }
@@ -359,8 +542,17 @@ int json_array_append(JsonValue *array_value, JsonValue *value)
     if (array->size >= array->capacity)
     {
         size_t new_capacity = array->capacity == 0 ? 8 : array->capacity * 2;
-        JsonValue **new_items = (JsonValue **)realloc(array->items,
-                                                      new_capacity * sizeof(JsonValue *));
+        JsonValue **new_items;
+        if (array->arena)
+        {
+            new_items = (JsonValue **)json_arena_realloc(array->arena, array->items,
+                                                         array->capacity * sizeof(JsonValue *),
+                                                         new_capacity * sizeof(JsonValue *));
+        }
+        else
+        {
+            new_items = (JsonValue **)json_heap_realloc(array->items, new_capacity * sizeof(JsonValue *));
+        }
         if (!new_items)
         {
             return 0; // Error: memory allocation failed
@@ -377,7 +569,7 @@ int json_array_append(JsonValue *array_value, JsonValue *value)
 
 JsonValue *json_array_get(const JsonValue *array_value, size_t index)
 {
-    if (!array_value || array_value->type != JSON_ARRAY)
+    if (!array_value || array_value->type != JSON_ARRAY || !JSON_VALUE_READY(array_value))
     {
         return NULL; // Error: invalid array
     }
@@ -391,95 +583,431 @@ JsonValue *json_array_get(const JsonValue *array_value, size_t index)
     return array->items[index];
 }
 
+size_t json_array_size(const JsonValue *array_value)
+{
+    if (!array_value || array_value->type != JSON_ARRAY || !JSON_VALUE_READY(array_value))
+    {
+        return 0;
+    }
+    return array_value->value.array->size;
+}
 
 
-/* Helper function to create a new key-value pair */
-static JsonKeyValue *create_key_value_pair(const char *key, JsonValue *value)
+
+/* FNV-1a hash of an object key */
+uint32_t json_hash_key(const char *key, size_t length)
 {
-    JsonKeyValue *pair = (JsonKeyValue *)malloc(sizeof(JsonKeyValue));
-    if (!pair)
+    uint32_t hash = 2166136261u;
+    const unsigned char *p = (const unsigned char *)key;
+    for (size_t i = 0; i < length; i++)
     {
-        return NULL;
+        hash ^= p[i];
+        hash *= 16777619u;
     }
+    return hash;
+}
+
+/* Compare a stored pair key with a lookup key */
+static int pair_key_equals(const JsonKeyValue *pair, const char *key, size_t length, uint32_t hash)
+{
+    return pair->hash == hash && pair->key_length == length &&
+           (pair->key == key || memcmp(pair->key, key, length) == 0);
+}
 
-    pair->key = strdup(key);
-    if (!pair->key)
+/* Helper function to create a new key-value pair that takes ownership of key */
+static JsonKeyValue *create_key_value_pair(JsonArena *arena, char *key, size_t key_length,
+                                           uint32_t hash, JsonValue *value)
+{
+    JsonKeyValue *pair = arena ? (JsonKeyValue *)json_arena_alloc(arena, sizeof(JsonKeyValue))
+                               : (JsonKeyValue *)json_heap_alloc(sizeof(JsonKeyValue));
+    if (!pair)
     {
-        free(pair);
         return NULL;
     }
 
+    pair->key = key;
+    pair->key_length = key_length;
     pair->value = value;
     pair->next = NULL;
+    pair->hash = hash;
+    pair->flags = 0;
     return pair;
 }
 
-/* Modified Object set to handle NaN values */
-int json_object_set(JsonValue *object_value, const char *key, JsonValue *value)
+/* Find the pair for a key, through the index when the object has one */
+static JsonKeyValue *object_find_pair(const JsonObject *object, const char *key, size_t length,
+                                      uint32_t hash)
+{
+    if (object->index)
+    {
+        size_t mask = object->index_capacity - 1;
+        for (size_t slot = hash & mask; object->index[slot]; slot = (slot + 1) & mask)
+        {
+            JsonKeyValue *pair = object->index[slot];
+            if (pair_key_equals(pair, key, length, hash))
+            {
+                return pair;
+            }
+        }
+        return NULL;
+    }
+
+    for (JsonKeyValue *current = object->pairs; current; current = current->next)
+    {
+        if (pair_key_equals(current, key, length, hash))
+        {
+            return current;
+        }
+    }
+    return NULL;
+}
+
+/* Place a pair in the first free slot of its probe sequence */
+static void index_insert(JsonKeyValue **index, size_t capacity, JsonKeyValue *pair)
+{
+    size_t mask = capacity - 1;
+    size_t slot = pair->hash & mask;
+    while (index[slot])
+    {
+        slot = (slot + 1) & mask;
+    }
+    index[slot] = pair;
+}
+
+/* Rebuild the index with a new slot count, keeping the load factor <= 1/2 */
+static int object_rebuild_index(JsonObject *object, size_t capacity)
+{
+    size_t bytes = capacity * sizeof(JsonKeyValue *);
+    JsonKeyValue **index = object->arena ? (JsonKeyValue **)json_arena_alloc(object->arena, bytes)
+                                         : (JsonKeyValue **)json_heap_alloc(bytes);
+    if (!index)
+    {
+        return 0;
+    }
+    memset(index, 0, bytes);
+
+    for (JsonKeyValue *current = object->pairs; current; current = current->next)
+    {
+        index_insert(index, capacity, current);
+    }
+
+    if (!object->arena)
+    {
+        json_heap_free(object->index);
+    }
+    object->index = index;
+    object->index_capacity = capacity;
+    return 1;
+}
+
+/* Link a new pair at the end, keeping the index up to date */
+static void object_link_pair(JsonObject *object, JsonKeyValue *new_pair)
 {
-    if (!object_value || object_value->type != JSON_OBJECT || !key )
+    if (object->tail)
+    {
+        object->tail->next = new_pair;
+    }
+    else
+    {
+        object->pairs = new_pair;
+    }
+    object->tail = new_pair;
+    object->size++;
+
+    if (object->index && object->size * 2 <= object->index_capacity)
+    {
+        index_insert(object->index, object->index_capacity, new_pair);
+    }
+    else if (object->size >= JSON_OBJECT_INDEX_THRESHOLD)
+    {
+        size_t capacity = object->index_capacity ? object->index_capacity * 2
+                                                 : JSON_OBJECT_INDEX_THRESHOLD * 4;
+        /* The list stays authoritative, a failed rebuild only costs speed */
+        if (!object_rebuild_index(object, capacity) && object->index)
+        {
+            if (!object->arena)
+                json_heap_free(object->index);
+            object->index = NULL;
+            object->index_capacity = 0;
+        }
+    }
+}
+
+/* Append a new pair, keeping insertion order and the index up to date */
+static int object_append_pair(JsonObject *object, char *key, size_t key_length, uint32_t hash,
+                              JsonValue *value)
+{
+    JsonKeyValue *new_pair = create_key_value_pair(object->arena, key, key_length, hash, value);
+    if (!new_pair)
+    {
+        return 0; // Error: memory allocation failed
+    }
+    object_link_pair(object, new_pair);
+    return 1;
+}
+
+/* Set a member using a key buffer allocated the same way as the object
+   (json_string_alloc), or a key view for documents. The object takes
+   ownership of the key */
+int json_object_set_owned_key(JsonValue *object_value, char *key, size_t key_length,
+                              JsonValue *value)
+{
+    if (!object_value || object_value->type != JSON_OBJECT || !key ||
+        !JSON_VALUE_READY(object_value))
     {
         return 0; // Error: invalid parameters
     }
 
     // Allow NULL or NaN values to be stored
     JsonObject *object = object_value->value.object;
+    uint32_t hash = json_hash_key(key, key_length);
 
     /* First check if the key already exists */
-    JsonKeyValue *current = object->pairs;
-    while (current)
+    JsonKeyValue *existing = object_find_pair(object, key, key_length, hash);
+    if (existing)
+    {
+        /* Key exists, update the value */
+        json_free(existing->value); // Free the old value
+        existing->value = value;
+        if (!object->arena)
+            json_heap_free(key);
+        return 1;
+    }
+
+    return object_append_pair(object, key, key_length, hash, value);
+}
+
+/* Set a member, copying the key only when it is new */
+static int object_set_copy(JsonValue *object_value, const char *key, size_t key_length,
+                           JsonValue *value)
+{
+    JsonObject *object = object_value->value.object;
+    uint32_t hash = json_hash_key(key, key_length);
+
+    /* Replace an existing value without copying the key */
+    JsonKeyValue *existing = object_find_pair(object, key, key_length, hash);
+    if (existing)
+    {
+        json_free(existing->value); // Free the old value
+        existing->value = value;
+        return 1;
+    }
+
+    if (!object->arena && key_length <= JSON_INLINE_STRING_MAX)
     {
-        if (strcmp(current->key, key) == 0)
+        /* One allocation for the pair and its key */
+        JsonKeyValue *pair = (JsonKeyValue *)json_heap_alloc(sizeof(JsonKeyValue) + JSON_INLINE_STRING_MAX + 1);
+        if (!pair)
         {
-            /* Key exists, update the value */
-            json_free(current->value); // Free the old value
-            current->value = value;
-            return 1;
+            return 0; // Error: memory allocation failed
         }
-        current = current->next;
+        char *inline_key = (char *)(pair + 1);
+        memcpy(inline_key, key, key_length);
+        inline_key[key_length] = '\0';
+        pair->key = inline_key;
+        pair->key_length = key_length;
+        pair->value = value;
+        pair->next = NULL;
+        pair->hash = hash;
+        pair->flags = 0;
+        object_link_pair(object, pair);
+        return 1;
     }
 
-    /* Key doesn't exist, create a new pair */
-    JsonKeyValue *new_pair = create_key_value_pair(key, value);
-    if (!new_pair)
+    char *key_copy = json_string_alloc(object->arena, key_length);
+    if (!key_copy)
     {
         return 0; // Error: memory allocation failed
     }
+    memcpy(key_copy, key, key_length);
+    key_copy[key_length] = '\0';
 
-    /* Add the new pair at the beginning of the list */
-    new_pair->next = object->pairs;
-    object->pairs = new_pair;
-    object->size++;
-
+    if (!object_append_pair(object, key_copy, key_length, hash, value))
+    {
+        if (!object->arena)
+            json_heap_free(key_copy);
+        return 0; // Error: memory allocation failed
+    }
     return 1;
 }
 
-JsonValue *json_object_get(const JsonValue *object_value, const char *key)
+/* Modified Object set to handle NaN values */
+int json_object_set(JsonValue *object_value, const char *key, JsonValue *value)
 {
-    if (!object_value || object_value->type != JSON_OBJECT || !key)
+    if (!object_value || object_value->type != JSON_OBJECT || !key ||
+        !JSON_VALUE_READY(object_value))
     {
-        return NULL; // Error: invalid parameters
+        return 0; // Error: invalid parameters
+    }
+
+    return object_set_copy(object_value, key, strlen(key), value);
+}
+
+/* json_object_set() for a key of known length that is not NUL terminated */
+int json_object_set_length(JsonValue *object_value, const char *key, size_t key_length, JsonValue *value)
+{
+    if (!object_value || object_value->type != JSON_OBJECT || !key ||
+        !JSON_VALUE_READY(object_value))
+    {
+        return 0;
+    }
+    return object_set_copy(object_value, key, key_length, value);
+}
+
+/* Set a member under a key from a JsonKeyTable, which the pair shares */
+int json_object_set_interned(JsonValue *object_value, const char *interned_key, JsonValue *value)
+{
+    if (!object_value || object_value->type != JSON_OBJECT || !interned_key ||
+        !JSON_VALUE_READY(object_value))
+    {
+        return 0;
     }
 
     JsonObject *object = object_value->value.object;
-    JsonKeyValue *current = object->pairs;
+    const JsonKeyEntry *entry = JSON_KEY_ENTRY(interned_key);
+    JsonKeyValue *existing = object_find_pair(object, interned_key, entry->length, entry->hash);
+    if (existing)
+    {
+        json_free(existing->value);
+        existing->value = value;
+        return 1;
+    }
+
+    JsonKeyValue *pair = create_key_value_pair(object->arena, (char *)interned_key, entry->length,
+                                               entry->hash, value);
+    if (!pair)
+    {
+        return 0;
+    }
+    pair->flags = JSON_KEY_INTERNED;
+    object_link_pair(object, pair);
+    return 1;
+}
 
-    /* Search for the key */
-    while (current)
+/* Install count pairs built side by side, each pointing at its value.
+   Later duplicates replace the value of the first occurrence in place,
+   as json_object_set() would. The object must be empty */
+int json_object_adopt_pairs(JsonObject *object, JsonKeyValue *pairs, size_t count)
+{
+    size_t size = 0;
+    for (size_t i = 0; i < count; i++)
     {
-        if (strcmp(current->key, key) == 0)
+        JsonKeyValue *pair = &pairs[i];
+        pair->hash = (pair->flags & JSON_KEY_INTERNED) ? JSON_KEY_ENTRY(pair->key)->hash
+                                                      : json_hash_key(pair->key, pair->key_length);
+
+        JsonKeyValue *existing = NULL;
+        if (object->index)
         {
-            return current->value;
+            existing = object_find_pair(object, pair->key, pair->key_length, pair->hash);
         }
-        current = current->next;
+        else
+        {
+            for (size_t j = 0; j < size && !existing; j++)
+            {
+                if (pair_key_equals(&pairs[j], pair->key, pair->key_length, pair->hash))
+                    existing = &pairs[j];
+            }
+        }
+        if (existing)
+        {
+            existing->value = pair->value;
+            continue;
+        }
+
+        pairs[size] = *pair;
+        pairs[size].next = NULL;
+        if (size > 0)
+            pairs[size - 1].next = &pairs[size];
+        size++;
+
+        if (!object->index && size >= JSON_OBJECT_INDEX_THRESHOLD)
+        {
+            /* Size the index for every pair still to come */
+            size_t capacity = JSON_OBJECT_INDEX_THRESHOLD * 4;
+            while (count * 2 > capacity)
+                capacity *= 2;
+            object->pairs = pairs;
+            if (!object_rebuild_index(object, capacity))
+                return 0;
+        }
+        else if (object->index)
+        {
+            index_insert(object->index, object->index_capacity, &pairs[size - 1]);
+        }
+    }
+
+    object->pairs = size ? pairs : NULL;
+    object->tail = size ? &pairs[size - 1] : NULL;
+    object->size = size;
+    return 1;
+}
+
+JsonValue *json_object_get(const JsonValue *object_value, const char *key)
+{
+    if (!object_value || object_value->type != JSON_OBJECT || !key ||
+        !JSON_VALUE_READY(object_value))
+    {
+        return NULL; // Error: invalid parameters
+    }
+
+    size_t length = strlen(key);
+    JsonKeyValue *pair = object_find_pair(object_value->value.object, key, length,
+                                          json_hash_key(key, length));
+    return pair ? pair->value : NULL; // NULL when key not found
+}
+
+JsonValue *json_object_get_interned(const JsonValue *object_value, const char *interned_key)
+{
+    if (!object_value || object_value->type != JSON_OBJECT || !interned_key ||
+        !JSON_VALUE_READY(object_value))
+    {
+        return NULL;
+    }
+
+    const JsonKeyEntry *entry = JSON_KEY_ENTRY(interned_key);
+    JsonKeyValue *pair = object_find_pair(object_value->value.object, interned_key, entry->length,
+                                          entry->hash);
+    return pair ? pair->value : NULL;
+}
+
+/* Lookup with a hash computed in advance, for compiled paths */
+JsonValue *json_object_get_hashed(const JsonValue *object_value, const char *key, size_t length,
+                                  uint32_t hash)
+{
+    if (!object_value || object_value->type != JSON_OBJECT || !JSON_VALUE_READY(object_value))
+    {
+        return NULL;
+    }
+
+    JsonKeyValue *pair = object_find_pair(object_value->value.object, key, length, hash);
+    return pair ? pair->value : NULL;
+}
+
+size_t json_object_size(const JsonValue *object_value)
+{
+    if (!object_value || object_value->type != JSON_OBJECT || !JSON_VALUE_READY(object_value))
+    {
+        return 0;
+    }
+    return object_value->value.object->size;
+}
+
+/* Include a record if:
+   1. Field doesn't exist (not a criteria for exclusion)
+   2. Field exists and is not NaN */
+int json_clean_keep_valid(const JsonValue* record, void* field_name) {
+    if (!record || record->type != JSON_OBJECT) {
+        return 0;
     }
-    return NULL; // Key not found
+    const JsonValue* field = json_object_get(record, (const char*)field_name);
+    return !field || (field->type == JSON_NUMBER && !isnan(field->value.number));
 }
 
 /* Implementation in json.c */
 JsonValue* json_clean_data(const JsonValue* array, const char* field_name,
                           JsonCleanStats* stats) {
-    if (!array || array->type != JSON_ARRAY || !field_name) {
+    if (!array || array->type != JSON_ARRAY || !field_name || !JSON_VALUE_READY(array)) {
         return NULL;
     }
 
@@ -504,14 +1032,7 @@ JsonValue* json_clean_data(const JsonValue* array, const char* field_name,
             continue;
         }
 
-        /* Look for the specified field */
-        JsonValue* field = json_object_get(item, field_name);
-        
-        /* Include entry if:
-           1. Field doesn't exist (not a criteria for exclusion)
-           2. Field exists and is not NaN */
-        if (!field || 
-            (field->type == JSON_NUMBER && !isnan(field->value.number))) {
+        if (json_clean_keep_valid(item, (void*)field_name)) {
             
             /* Create a deep copy of the item */
             JsonValue* copy = json_deep_copy(item);
@@ -535,4 +1056,86 @@ JsonValue* json_clean_data(const JsonValue* array, const char* field_name,
     }
 
     return cleaned;
-}
\ No newline at end of file
+}
+
+size_t json_clean_in_place(JsonValue* array_value, JsonRecordPredicate keep, void* user_data,
+                           JsonCleanStats* stats) {
+    if (!array_value || array_value->type != JSON_ARRAY || !keep || !JSON_VALUE_READY(array_value)) {
+        return 0;
+    }
+
+    JsonArray* array = array_value->value.array;
+    size_t size = array->size;
+
+    /* A compact array keeps its elements side by side */
+    int contiguous = array->elements != NULL;
+    for (size_t i = 0; contiguous && i < size; i++) {
+        contiguous = array->items[i] == &array->elements[i];
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < size; i++) {
+        JsonValue* item = array->items[i];
+        if (!keep(item, user_data)) {
+            json_free(item);
+            continue;
+        }
+        if (contiguous) {
+            if (kept != i) {
+                array->elements[kept] = *item;
+            }
+            array->items[kept] = &array->elements[kept];
+        } else {
+            array->items[kept] = item;
+        }
+        kept++;
+    }
+    array->size = kept;
+
+    if (stats) {
+        stats->original_count = size;
+        stats->cleaned_count = kept;
+        stats->removed_count = size - kept;
+    }
+    return kept;
+}
+
+size_t json_clean_indices(const JsonValue* array_value, JsonRecordPredicate keep, void* user_data,
+                          size_t* indices, JsonCleanStats* stats) {
+    if (!array_value || array_value->type != JSON_ARRAY || !keep || !indices ||
+        !JSON_VALUE_READY(array_value)) {
+        return 0;
+    }
+
+    const JsonArray* array = array_value->value.array;
+    size_t kept = 0;
+    for (size_t i = 0; i < array->size; i++) {
+        if (keep(array->items[i], user_data)) {
+            indices[kept++] = i;
+        }
+    }
+
+    if (stats) {
+        stats->original_count = array->size;
+        stats->cleaned_count = kept;
+        stats->removed_count = array->size - kept;
+    }
+    return kept;
+}
+
+size_t json_clean_refine(const JsonValue* array_value, size_t* indices, size_t count,
+                         JsonRecordPredicate keep, void* user_data) {
+    if (!array_value || array_value->type != JSON_ARRAY || !keep || !indices ||
+        !JSON_VALUE_READY(array_value)) {
+        return 0;
+    }
+
+    const JsonArray* array = array_value->value.array;
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (indices[i] < array->size && keep(array->items[indices[i]], user_data)) {
+            indices[kept++] = indices[i];
+        }
+    }
+    return kept;
+}
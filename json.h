@@ -7,8 +7,19 @@
 #include <string.h>
 #include <stdint.h> // Added this after uint32_t errors on compile on risc-V Fedora 64bit
 
+/* Default limit on array/object nesting for parsing and validation. Nested
+   values are tracked on heap stacks, not the C stack, so this is a policy
+   rather than a safety limit: see json_set_max_depth() and
+   JsonParseConfig.max_depth */
 #define JSON_MAX_NESTING_DEPTH 32
 
+/* Objects with at least this many members get an open-addressing hash index */
+#define JSON_OBJECT_INDEX_THRESHOLD 8
+
+/* Heap strings and keys up to this many bytes share the allocation of their
+   node or pair */
+#define JSON_INLINE_STRING_MAX 15
+
 /* JSON value types */
 typedef enum {
     JSON_NULL,
@@ -45,12 +56,18 @@ typedef enum{
     JSON_ERROR_INVALID_NUMBER_INFINITY,
     JSON_ERROR_FILE_READ,    /* Error reading from file */
     JSON_ERROR_FILE_WRITE,   /* Error writing to file */
+    JSON_ERROR_CBOR_MALFORMED,   /* Not well-formed CBOR */
+    JSON_ERROR_CBOR_TRUNCATED,   /* CBOR input ends inside an item */
+    JSON_ERROR_CBOR_UNSUPPORTED, /* Well-formed CBOR without a JSON counterpart */
+    JSON_ERROR_INDEX_INVALID,    /* Not an index file, or a damaged one */
+    JSON_ERROR_INDEX_STALE,      /* Index built for a different version of the file */
 } JsonErrorCode;
 
 typedef enum {
     JSON_NUMBER_FORMAT_DECIMAL,     /* Regular decimal format (e.g., 123.456) */
     JSON_NUMBER_FORMAT_SCIENTIFIC,  /* Scientific notation (e.g., 1.23e+2) */
-    JSON_NUMBER_FORMAT_AUTO        /* Automatically choose based on magnitude */
+    JSON_NUMBER_FORMAT_AUTO,       /* Automatically choose based on magnitude */
+    JSON_NUMBER_FORMAT_SHORTEST    /* Shortest digits that round-trip exactly (ignores precision) */
 } JsonNumberFormat;
 
 typedef struct JsonFormatConfig {
@@ -65,6 +82,85 @@ typedef struct JsonFormatConfig {
     int sort_object_keys;           /* Whether to sort object keys alphabetically */
 } JsonFormatConfig;
 
+/* Memory allocator. reallocate must accept a NULL pointer like realloc(),
+   release is never called with NULL */
+typedef struct JsonAllocator {
+    void* (*allocate)(void* user_data, size_t size);
+    void* (*reallocate)(void* user_data, void* ptr, size_t size);
+    void (*release)(void* user_data, void* ptr);
+    void* user_data;
+} JsonAllocator;
+
+/* Phases timed by JsonStats */
+typedef enum {
+    JSON_PHASE_READ,                /* Reading and mapping input files */
+    JSON_PHASE_PARSE,               /* Parsing and validation */
+    JSON_PHASE_FORMAT,              /* Serializing values to text */
+    JSON_PHASE_WRITE,               /* Handing output to files, streams and callbacks */
+    JSON_PHASE_COUNT
+} JsonPhase;
+
+/* Counters collected for the calling thread, see json_stats_collect() */
+typedef struct JsonStats {
+    size_t allocations;             /* Successful allocate and reallocate calls */
+    size_t frees;
+    size_t bytes_allocated;         /* Bytes requested by those calls */
+    size_t nodes;                   /* Values created by parsers and json_create_*() */
+    size_t peak_depth;              /* Deepest array/object nesting reached while parsing */
+    size_t builder_reallocs;        /* Growths of the formatter's output buffer */
+    double seconds[JSON_PHASE_COUNT]; /* Wall time per phase, time in nested phases excluded */
+} JsonStats;
+
+/* Parser implementations; both accept the same inputs and report the same errors */
+typedef enum {
+    JSON_PARSE_ENGINE_RECURSIVE,    /* Descent parser straight into the tree (explicit stack) */
+    JSON_PARSE_ENGINE_TAPE          /* SIMD structural index and tape, then the tree */
+} JsonParseEngine;
+
+/* Parse configuration for documents */
+typedef struct JsonParseConfig {
+    int zero_copy_strings;          /* Store strings and keys without escapes as views into the
+                                       input (JSON_VALUE_VIEW). The input must outlive the document.
+                                       The tape engine always copies */
+    JsonParseEngine engine;
+    int lazy;                       /* Validate once, then build each array and object the first
+                                       time it is accessed (JSON_VALUE_LAZY). The input must
+                                       outlive the document. Always uses the recursive engine */
+    int compact;                    /* Store the members of every array and object contiguously
+                                       (JsonArray.elements, adjacent pairs and values). Always uses
+                                       the recursive engine; ignored for lazy documents */
+    int intern_keys;                /* Store each distinct key once per document, shared by every
+                                       object that uses it (JSON_KEY_INTERNED). Always uses the
+                                       recursive engine */
+    size_t max_depth;               /* Deepest array/object nesting accepted, 0 for
+                                       json_get_max_depth() */
+    const JsonAllocator* allocator; /* Memory of the document, NULL for the global allocator.
+                                       Copied into the document, whose memory it serves until
+                                       json_document_free() */
+    JsonStats* stats;               /* Collect statistics for this parse, NULL to leave the
+                                       thread's json_stats_collect() target alone */
+} JsonParseConfig;
+
+/* Default parse configuration (every string is copied) */
+extern const JsonParseConfig JSON_PARSE_DEFAULT;
+/* Zero-copy parse configuration */
+extern const JsonParseConfig JSON_PARSE_ZERO_COPY;
+/* Documents built through the tape engine */
+extern const JsonParseConfig JSON_PARSE_TAPE;
+/* Lazy documents: containers are built on first access */
+extern const JsonParseConfig JSON_PARSE_LAZY;
+/* Compact documents: contiguous members for cache-friendly iteration */
+extern const JsonParseConfig JSON_PARSE_COMPACT;
+
+/* Vector instruction sets used for scanning whitespace and strings */
+typedef enum {
+    JSON_SIMD_AUTO,     /* Best level supported by the CPU */
+    JSON_SIMD_SCALAR,   /* Plain byte loops */
+    JSON_SIMD_SSE2,
+    JSON_SIMD_AVX2,
+    JSON_SIMD_NEON
+} JsonSimdLevel;
+
 /* Default format configuration */
 extern const JsonFormatConfig JSON_FORMAT_DEFAULT;
 /* Compact format (minimal whitespace) */
@@ -90,12 +186,26 @@ typedef struct {
 struct JsonObject;
 struct JsonArray;
 
+/* Arena allocator backing a JsonDocument (opaque) */
+typedef struct JsonArena JsonArena;
+
+/* Parsed document whose nodes all live in one arena (opaque) */
+typedef struct JsonDocument JsonDocument;
+
+/* JsonValue flags */
+#define JSON_VALUE_ARENA 0x01u /* Node is owned by a JsonDocument arena */
+#define JSON_VALUE_VIEW  0x02u /* String points into the parse input, not NUL terminated */
+#define JSON_VALUE_INTEGER 0x04u /* Number holds an exact 64-bit integer in integer */
+#define JSON_VALUE_LAZY  0x08u /* Container of a lazy document whose members are not built yet */
+#define JSON_VALUE_INLINE 0x10u /* String bytes follow the node in the same heap allocation */
+
 const JsonError* json_get_last_error(void);      /* For parser errors */
 const JsonError* json_get_validation_error(void); /* For validation errors */
 
 /* Main JSON value structure */
 typedef struct JsonValue {
     JsonType type;
+    uint32_t flags;     /* JSON_VALUE_* storage flags */
     union {
         int boolean;
         double number;
@@ -103,26 +213,44 @@ typedef struct JsonValue {
         struct JsonArray* array;
         struct JsonObject* object;
     } value;
+    union {
+        size_t length;  /* Byte length of string values */
+        int64_t integer; /* Exact value of numbers flagged JSON_VALUE_INTEGER */
+    };
 } JsonValue;
 
 /* Key-calye pair for objects */
 typedef struct JsonKeyValue {
     char* key;
+    size_t key_length;         /* Byte length of key (views are not NUL terminated) */
     JsonValue* value;
     struct JsonKeyValue* next; /* For linked list implementation */
+    uint32_t hash;             /* Hash of key, used by the object index */
+    uint32_t flags;            /* JSON_KEY_* */
 } JsonKeyValue;
 
-/* Object structure */
+#define JSON_KEY_INTERNED 0x01u /* key belongs to a JsonKeyTable and is not freed with the object */
+
+/* Object structure. Pairs are kept in insertion order; once the object
+   reaches JSON_OBJECT_INDEX_THRESHOLD members lookups go through index.
+   In compact documents the pairs, and their values, are adjacent in memory */
 typedef struct JsonObject {
     JsonKeyValue* pairs;
     size_t size;
+    JsonArena* arena;       /* Owning arena, NULL for heap allocated objects */
+    JsonKeyValue* tail;     /* Last pair, for O(1) appends */
+    JsonKeyValue** index;   /* Open-addressing slots, NULL below the threshold */
+    size_t index_capacity;  /* Number of slots (power of two) */
 } JsonObject;
 
-/* Array structure */
+/* Array structure. Compact documents store the elements by value in one
+   block, and items[i] points at elements[i] for every parsed element */
 typedef struct JsonArray {
     JsonValue** items;
     size_t size;
     size_t capacity;
+    JsonArena* arena; /* Owning arena, NULL for heap allocated arrays */
+    JsonValue* elements; /* Contiguous elements of a compact array, NULL otherwise */
 } JsonArray;
 
 /* Function Declarations */
@@ -131,7 +259,9 @@ typedef struct JsonArray {
 JsonValue* json_create_null(void);
 JsonValue* json_create_boolean(int value);
 JsonValue* json_create_number(double value);
+JsonValue* json_create_integer(int64_t value);  /* value.number holds the nearest double */
 JsonValue* json_create_string(const char* value);
+JsonValue* json_create_string_length(const char* value, size_t length);
 JsonValue* json_create_array(void);
 JsonValue* json_create_object(void);
 
@@ -141,43 +271,352 @@ void json_print_value(const JsonValue* value, int indent_level);
 /* Array operations */
 int json_array_append(JsonValue* array, JsonValue* value);
 JsonValue* json_array_get(const JsonValue* array, size_t index);
+size_t json_array_size(const JsonValue* array);
 
 /* Object operations */
 int json_object_set(JsonValue* object, const char* key, JsonValue* value);
 JsonValue* json_object_get(const JsonValue* object, const char* key);
+size_t json_object_size(const JsonValue* object);
+
+/* Key-intern table: one copy of each distinct object key, together with its
+   hash and its escaped form for the formatter. Objects parsed with a table
+   point at its keys instead of holding their own, so the table must
+   outlive every value parsed with it. Not thread-safe */
+typedef struct JsonKeyTable JsonKeyTable;
+
+JsonKeyTable* json_key_table_create(const JsonAllocator* allocator); /* NULL for the global one */
+void json_key_table_free(JsonKeyTable* table);
+/* The table's copy of a key, NUL terminated; NULL if out of memory */
+const char* json_key_table_intern(JsonKeyTable* table, const char* key, size_t length);
+size_t json_key_table_size(const JsonKeyTable* table); /* Distinct keys */
+
+/* json_object_get() for a key returned by json_key_table_intern(): the
+   stored hash is used, and a key from the same table matches by pointer */
+JsonValue* json_object_get_interned(const JsonValue* object, const char* interned_key);
 
 /* Parsing functions */
 JsonValue* json_parse_file(const char* filename);
 JsonValue* json_parse_string(const char* json_string);
+/* Length-delimited input, e.g. a socket frame or a slice of a larger file.
+   data is never read past data + length and needs no NUL terminator */
+JsonValue* json_parse_buffer(const char* data, size_t length);
+
+/* Document parsing: all nodes, pairs, keys and strings are bump allocated
+   from large chunks and released together by json_document_free().
+   json_free() ignores document-owned values */
+JsonDocument* json_document_parse_string(const char* json_string);
+JsonDocument* json_document_parse_string_ex(const char* json_string, const JsonParseConfig* config);
+JsonDocument* json_document_parse_buffer(const char* data, size_t length, const JsonParseConfig* config);
+JsonDocument* json_document_parse_file(const char* filename);
+/* Files are memory-mapped; with zero_copy_strings the string views point
+   into the mapping, which the document keeps until json_document_free() */
+JsonDocument* json_document_parse_file_ex(const char* filename, const JsonParseConfig* config);
+/* Lazy documents (JSON_PARSE_LAZY) are validated up front, so a document
+   that parses never fails later on bad input. Arrays and objects start out
+   flagged JSON_VALUE_LAZY and are built one level at a time by
+   json_array_get(), json_array_size(), json_object_get(),
+   json_object_size(), the setters, the formatter and the printer. Read
+   value.array / value.object directly only after one of those calls.
+   Building mutates the document, so even read-only access to a lazy
+   document must stay on one thread at a time */
+
+/* Reentrant variants: errors are written to the caller's JsonError (NULL
+   to ignore them) instead of the per-thread state behind
+   json_get_last_error(), so independent inputs can be parsed on any number
+   of threads at once */
+JsonValue* json_parse_buffer_r(const char* data, size_t length, JsonError* error);
+/* Heap parse whose object keys come from keys (which may be NULL) */
+JsonValue* json_parse_buffer_keys_r(const char* data, size_t length, JsonKeyTable* keys,
+                                    JsonError* error);
+JsonValue* json_parse_file_r(const char* filename, JsonError* error);
+JsonDocument* json_document_parse_buffer_r(const char* data, size_t length,
+                                           const JsonParseConfig* config, JsonError* error);
+JsonDocument* json_document_parse_file_r(const char* filename, const JsonParseConfig* config,
+                                         JsonError* error);
+
+JsonValue* json_document_root(const JsonDocument* doc);
+/* Key table of a document parsed with intern_keys, NULL otherwise */
+JsonKeyTable* json_document_key_table(const JsonDocument* doc);
+void json_document_free(JsonDocument* doc);
+
+/* Tape parsing (json_tape.c): the input is indexed with SIMD and turned
+   into one flat array of 64-bit entries plus a string buffer. A cursor
+   walks the tape without building a tree; json_cursor_materialize()
+   builds a heap JsonValue for any part of it. Errors are the same as
+   json_parse_buffer_r() reports. The tape does not reference the input */
+typedef struct JsonTape JsonTape;
+
+/* Position in a tape. Cursors are plain values and need no freeing;
+   a cursor past the end of a container is invalid */
+typedef struct JsonCursor {
+    const JsonTape* tape;           /* NULL for an invalid cursor */
+    size_t index;
+    int in_object;                  /* Points at the value of an object member */
+} JsonCursor;
+
+JsonTape* json_tape_parse(const char* data, size_t length, JsonError* error);
+void json_tape_free(JsonTape* tape);
+JsonCursor json_tape_root(const JsonTape* tape);
+
+int json_cursor_is_valid(JsonCursor cursor);
+JsonType json_cursor_type(JsonCursor cursor);
+int json_cursor_boolean(JsonCursor cursor);
+double json_cursor_number(JsonCursor cursor);
+int json_cursor_is_integer(JsonCursor cursor);
+int64_t json_cursor_integer(JsonCursor cursor);
+const char* json_cursor_string(JsonCursor cursor, size_t* length);  /* NUL terminated; NULL and length 0 if not a string */
+size_t json_cursor_size(JsonCursor cursor);                         /* Elements or members */
+JsonCursor json_cursor_first(JsonCursor container);                 /* First element or member value */
+JsonCursor json_cursor_next(JsonCursor cursor);                     /* Next sibling */
+const char* json_cursor_key(JsonCursor member, size_t* length);     /* NULL and length 0 outside an object */
+JsonCursor json_cursor_get(JsonCursor object, const char* key);
+JsonCursor json_cursor_at(JsonCursor array, size_t index);
+JsonValue* json_cursor_materialize(JsonCursor cursor);
+
+/* JSON Pointer (RFC 6901) lookups (json_path.c). A compiled path keeps
+   each reference token unescaped, with its key hash and array index, for
+   evaluating the same path against many values. Tokens select a member of
+   an object (always by key) or an element of an array ("0", "1", ...; "-"
+   or any other token never matches). "" is the root itself */
+typedef struct JsonPath JsonPath;
+
+JsonPath* json_path_compile(const char* pointer); /* NULL if malformed or out of memory */
+void json_path_free(JsonPath* path);
+size_t json_path_length(const JsonPath* path);    /* Reference tokens */
+const char* json_path_segment(const JsonPath* path, size_t i, size_t* length); /* Unescaped token */
+
+/* NULL when the path does not lead to a value. In lazy documents only the
+   containers on the path are built */
+JsonValue* json_path_get(const JsonValue* root, const JsonPath* path);
+/* Same on a tape, without materializing anything; invalid cursor if absent */
+JsonCursor json_path_cursor(JsonCursor root, const JsonPath* path);
+/* Compile, evaluate and free in one call */
+JsonValue* json_pointer_get(const JsonValue* root, const char* pointer);
+
+/* Event parsing (SAX): the parser's grammar runs without building a tree
+   and reports each value to a handler as it is recognised. Memory is
+   O(depth) plus the longest escaped string; there is no allocation per
+   value. Strings and keys are not NUL terminated and only valid during
+   the call. Handlers may be NULL; each returns JSON_SAX_CONTINUE,
+   JSON_SAX_STOP to end the parse, or - from start_object and start_array
+   only - JSON_SAX_SKIP to pass over the container without further events,
+   its end event included. Skipped containers are still checked */
+enum {
+    JSON_SAX_STOP = 0,
+    JSON_SAX_CONTINUE = 1,
+    JSON_SAX_SKIP = 2
+};
+
+typedef struct JsonSaxHandler {
+    int (*start_object)(void* user_data);
+    int (*end_object)(void* user_data);
+    int (*start_array)(void* user_data);
+    int (*end_array)(void* user_data);
+    int (*key)(void* user_data, const char* key, size_t length);
+    int (*string)(void* user_data, const char* value, size_t length);
+    /* integer holds the exact value when is_integer is set */
+    int (*number)(void* user_data, double value, int is_integer, int64_t integer);
+    int (*boolean)(void* user_data, int value);
+    int (*null)(void* user_data);
+} JsonSaxHandler;
+
+/* Return 1 once the whole input was accepted, 0 on an error or when a
+   handler stopped (error->code is then JSON_ERROR_NONE). error may be NULL.
+   Events already delivered before an error are not taken back */
+int json_sax_parse_buffer(const char* data, size_t length, const JsonSaxHandler* handler, void* user_data,
+                          JsonError* error);
+int json_sax_parse_string(const char* json_string, const JsonSaxHandler* handler, void* user_data,
+                          JsonError* error);
+int json_sax_parse_file(const char* filename, const JsonSaxHandler* handler, void* user_data,
+                        JsonError* error);
+int json_sax_parse_stream(FILE* stream, const JsonSaxHandler* handler, void* user_data, JsonError* error);
 
 /* Pretty Print functions */
 char* json_format_string(const JsonValue* value, const JsonFormatConfig* config);
 int json_format_file(const JsonValue* value, const char* filename, const JsonFormatConfig* config);
 
+/* Reusable output buffer for json_format_into(). Storage given to
+   json_format_buffer_init() is used until a document outgrows it; from
+   then on, or without storage, data lives on the heap and keeps its
+   capacity from one document to the next */
+typedef struct JsonFormatBuffer {
+    char* data;                     /* NUL terminated output */
+    size_t length;                  /* Output bytes, without the NUL */
+    size_t capacity;
+    int owned;                      /* data was allocated by the library */
+} JsonFormatBuffer;
+
+void json_format_buffer_init(JsonFormatBuffer* buffer, char* storage, size_t capacity);
+/* Make room for length bytes of output plus the NUL */
+int json_format_buffer_reserve(JsonFormatBuffer* buffer, size_t length);
+void json_format_buffer_release(JsonFormatBuffer* buffer);
+
+/* Replace the buffer's contents with the formatted value. Nothing is
+   allocated while the output fits the capacity already there */
+int json_format_into(const JsonValue* value, const JsonFormatConfig* config, JsonFormatBuffer* buffer);
+/* Upper bound of the formatted length from a pass that writes nothing,
+   for sizing a buffer once; 0 on error */
+size_t json_format_estimate(const JsonValue* value, const JsonFormatConfig* config);
+
+/* Streaming output: the formatter fills a fixed buffer and hands it to the
+   sink whenever it is full, so memory use is independent of output size.
+   A callback returns 0 to abort formatting */
+typedef int (*JsonWriteCallback)(const char* data, size_t length, void* user_data);
+int json_format_callback(const JsonValue* value, const JsonFormatConfig* config,
+                         JsonWriteCallback callback, void* user_data);
+int json_format_stream(const JsonValue* value, FILE* stream, const JsonFormatConfig* config);
+int json_format_fd(const JsonValue* value, int fd, const JsonFormatConfig* config);
+
 /* Writing functions */
 int json_write_file(const JsonValue* value, const char* filename);
 char* json_write_string(const JsonValue* value);
 
 /* Validation function */
 int json_validate_string(const char* json_string);
+int json_validate_buffer(const char* data, size_t length);
+int json_validate_buffer_r(const char* data, size_t length, JsonError* error);
+int json_validate_file_r(const char* filename, JsonError* error);
 int json_validate_file(const char* filename);
 
 /* Clean data by removing entries with NaN values in specified field
    Returns a new JsonValue with clean data and optionally provides stats */
 JsonValue* json_clean_data(const JsonValue* array, const char* field_name, JsonCleanStats* stats);
 
-/* Error handling */
+/* Cleaning without copies. A predicate returns nonzero to keep a record;
+   chaining predicates means calling the variants again */
+typedef int (*JsonRecordPredicate)(const JsonValue* record, void* user_data);
+
+/* json_clean_data()'s test: an object whose field (user_data, a const
+   char*) is missing or a number other than NaN */
+int json_clean_keep_valid(const JsonValue* record, void* field_name);
+
+/* Compact array in place, keeping element order. Rejected heap elements
+   are freed; document elements stay in the arena until
+   json_document_free(). Never allocates. Returns the elements kept. In
+   stats, removed_count counts every rejected element */
+size_t json_clean_in_place(JsonValue* array, JsonRecordPredicate keep, void* user_data,
+                           JsonCleanStats* stats);
+
+/* Indices of the kept elements, written to indices, which must have room
+   for json_array_size(array) entries. Returns how many were kept */
+size_t json_clean_indices(const JsonValue* array, JsonRecordPredicate keep, void* user_data,
+                          size_t* indices, JsonCleanStats* stats);
+/* Narrow an index list from json_clean_indices() in place */
+size_t json_clean_refine(const JsonValue* array, size_t* indices, size_t count,
+                         JsonRecordPredicate keep, void* user_data);
+
+/* Columnar extraction: numeric fields of an array of records copied into
+   one double array per field, with bitmaps (bit row % 64 of word row / 64)
+   saying which rows hold what. Filters and aggregates run over the columns
+   and combine into selection bitmaps of JSON_BITMAP_WORDS(rows) words */
+#define JSON_BITMAP_WORDS(rows) (((rows) + 63) / 64)
+#define JSON_BITMAP_TEST(bitmap, row) (((bitmap)[(row) / 64] >> ((row) % 64)) & 1u)
+
+typedef struct JsonColumn {
+    char* name;                 /* Field name, NUL terminated */
+    size_t name_length;
+    double* values;             /* One per row, 0 where the row has no valid number */
+    uint64_t* valid;            /* The field is a number other than NaN */
+    uint64_t* present;          /* The field exists, whatever its type */
+    uint64_t* integers;         /* The number was an exact integer, formatted as one */
+    size_t valid_count;
+} JsonColumn;
+
+typedef struct JsonColumns {
+    size_t rows;                /* Elements of the source array */
+    uint64_t* records;          /* The element is an object */
+    size_t column_count;
+    JsonColumn* columns;
+} JsonColumns;
+
+typedef struct JsonColumnStats {
+    size_t count;               /* Selected rows with a valid value */
+    double sum;
+    double min;                 /* NaN when count is 0, like mean */
+    double max;
+    double mean;
+} JsonColumnStats;
+
+/* NULL if array is not an array or memory runs out. The array is not
+   referenced afterwards */
+JsonColumns* json_columns_extract(const JsonValue* array, const char* const* fields, size_t field_count);
+void json_columns_free(JsonColumns* columns);
+const JsonColumn* json_columns_find(const JsonColumns* columns, const char* field);
+
+/* Selections. Each narrows selection in place and returns the rows left */
+size_t json_columns_select_all(const JsonColumns* columns, uint64_t* selection); /* Every record */
+/* json_clean_data() as a filter: drop records whose field exists but is
+   not a valid number. stats is optional */
+size_t json_columns_select_clean(const JsonColumns* columns, const JsonColumn* column,
+                                 uint64_t* selection, JsonCleanStats* stats);
+/* Keep rows whose value lies in [min, max] */
+size_t json_columns_select_range(const JsonColumns* columns, const JsonColumn* column,
+                                 double min, double max, uint64_t* selection);
+size_t json_columns_count(const JsonColumns* columns, const uint64_t* selection);
+
+/* Aggregate the valid values of the selected rows (NULL selects all) */
+void json_column_stats(const JsonColumns* columns, const JsonColumn* column,
+                       const uint64_t* selection, JsonColumnStats* stats);
+
+/* Format the selected rows (NULL for every record) as an array of objects
+   with the extracted fields, in column order: what json_format_string()
+   gives for records holding just those fields. Fields without a valid
+   number are left out. No tree is built */
+char* json_format_columns(const JsonColumns* columns, const uint64_t* selection,
+                          const JsonFormatConfig* config);
+int json_format_columns_callback(const JsonColumns* columns, const uint64_t* selection,
+                                 const JsonFormatConfig* config, JsonWriteCallback callback,
+                                 void* user_data);
+
+/* Error handling. The json_get_*_error() state is kept per thread */
 const JsonError* json_get_last_error(void);
 
+/* Scanner selection. The best level is picked automatically on first use;
+   json_set_simd_level() returns 0 if the level is not available here.
+   The level is process-wide: set it before starting worker threads */
+int json_set_simd_level(JsonSimdLevel level);
+JsonSimdLevel json_get_simd_level(void);
+
+/* Nesting limit of json_parse_*(), json_validate_*(), the file reader, the
+   tape engine and documents whose config leaves max_depth at 0. 0 restores
+   JSON_MAX_NESTING_DEPTH. Process-wide like the scanner level */
+void json_set_max_depth(size_t max_depth);
+size_t json_get_max_depth(void);
+
 /* Cleanup function */
 void json_free(JsonValue* value);
 
-/* Partial file reading structure */
+/* Global allocator behind json_create_*(), heap parsing, formatting and the
+   file functions. Set it before the first allocation and keep it until the
+   last value is freed; NULL restores malloc/realloc/free. Returns 0 if a
+   function is missing */
+int json_set_allocator(const JsonAllocator* allocator);
+const JsonAllocator* json_get_allocator(void);
+
+/* Release a string returned by json_format_string() through the global
+   allocator (plain free() works with the default one) */
+void json_free_string(char* string);
+
+/* Start adding this thread's allocations, node counts and phase times to
+   stats; NULL stops. Counters are not reset. Returns the previous target */
+JsonStats* json_stats_collect(JsonStats* stats);
+
+/* Incremental reader for newline-delimited or concatenated JSON values.
+   The buffer is reused between values and only grows when a single value
+   does not fit into it */
 typedef struct JsonFileReader {
     FILE* file;
     char* buffer;
     size_t buffer_size;
-    size_t bytes_read;
+    size_t bytes_read;      /* Total bytes read from the file */
+    size_t data_start;      /* Start of unconsumed data in buffer */
+    size_t data_end;        /* End of buffered data */
+    size_t scan_pos;        /* Boundary scan resumes here after a refill */
+    size_t scan_depth;      /* Open arrays/objects at scan_pos */
+    int scan_in_string;     /* scan_pos is inside a string */
+    int scan_escape;        /* Previous string byte was a backslash */
+    int eof;                /* No more data in the file */
+    JsonKeyTable* keys;     /* Intern table for the keys of returned values, NULL for none */
 } JsonFileReader;
 
 /* File writing configuration */
@@ -196,10 +635,188 @@ int json_write_file_ex(const JsonValue* value, const char* filename,
 
 /* Partial file reading */
 JsonFileReader* json_file_reader_create(const char* filename, size_t buffer_size);
-JsonValue* json_file_reader_next(JsonFileReader* reader);
+JsonValue* json_file_reader_next(JsonFileReader* reader); /* NULL at end of file or on error */
 void json_file_reader_free(JsonFileReader* reader);
+/* Intern the keys of every value returned from now on. The caller keeps
+   ownership of the table and frees it after the last of those values */
+void json_file_reader_set_key_table(JsonFileReader* reader, JsonKeyTable* keys);
 
 /* Error handling */
 const JsonError* json_get_file_error(void);
 
+/* Append-only writer for a file holding one array, for continuous data
+   collection (json_writer.c). Values are formatted into a reused buffer
+   and written in batches of up to buffer_size bytes, each together with
+   the closing bracket, so the file is a complete array after every batch.
+   Syncs to disk are grouped: one covers every value appended since the
+   last. sync_interval_ms is checked when a value is appended */
+typedef struct JsonArrayWriterConfig {
+    size_t buffer_size;             /* Bytes collected before a write, 0 for 64 KiB */
+    const JsonFormatConfig* format; /* Element format, NULL for compact */
+    size_t sync_every;              /* Sync after this many values, 0 for no count limit */
+    unsigned sync_interval_ms;      /* Sync once this long has passed since the last sync, 0 for no time limit */
+    int sync_on_close;              /* Sync when the writer is closed */
+    int append;                     /* Continue an existing array file instead of replacing it */
+} JsonArrayWriterConfig;
+
+/* Replace the file, sync at least once a second and on close */
+extern const JsonArrayWriterConfig JSON_ARRAY_WRITER_DEFAULT;
+
+typedef struct JsonArrayWriter JsonArrayWriter;
+
+/* With append set, an existing file keeps every element that was written
+   completely; a tail cut off by a crash or power loss is dropped and the
+   array closed again before the first new value. A missing file is
+   created. config may be NULL */
+JsonArrayWriter* json_array_writer_open(const char* filename, const JsonArrayWriterConfig* config,
+                                        JsonError* error);
+int json_array_writer_append(JsonArrayWriter* writer, const JsonValue* value);
+int json_array_writer_flush(JsonArrayWriter* writer);   /* Write the batch, without syncing */
+int json_array_writer_sync(JsonArrayWriter* writer);    /* Write the batch and sync the file */
+size_t json_array_writer_count(const JsonArrayWriter* writer); /* Elements in the array, recovered ones included */
+const JsonError* json_array_writer_error(const JsonArrayWriter* writer); /* Of the last failed call */
+/* Writes what is left and frees the writer; returns 0 if that failed */
+int json_array_writer_close(JsonArrayWriter* writer);
+
+/* CBOR (RFC 8949) encoding of values (json_cbor.c). Output uses the
+   shortest heads and definite lengths; numbers created as integers become
+   CBOR integers, others the shortest float that holds them exactly.
+   Decoding also accepts indefinite lengths and skips tags. Byte strings,
+   map keys other than text, and simple values other than false, true,
+   null and undefined (read as null) fail with JSON_ERROR_CBOR_UNSUPPORTED.
+   Decoding errors have line 0 and the byte offset plus one as column.
+   error may be NULL in every call */
+int json_cbor_encode(const JsonValue* value, JsonFormatBuffer* buffer, JsonError* error);
+int json_cbor_write_callback(const JsonValue* value, JsonWriteCallback callback, void* user_data,
+                             JsonError* error);
+int json_cbor_write_stream(const JsonValue* value, FILE* stream, JsonError* error);
+/* Temporary file and rename as json_write_file_ex(); config may be NULL */
+int json_cbor_write_file(const JsonValue* value, const char* filename,
+                         const JsonFileWriteConfig* config, JsonError* error);
+
+/* One item from data. With used, the item may be followed by more data
+   and *used receives its length; without, trailing bytes are an error */
+JsonValue* json_cbor_decode(const void* data, size_t length, size_t* used, JsonError* error);
+JsonValue* json_cbor_read_file(const char* filename, JsonError* error);
+JsonValue* json_cbor_read_stream(FILE* stream, JsonError* error);
+
+/* Reader for CBOR sequences (RFC 8742), items written back to back, e.g.
+   by repeated json_cbor_write_stream() calls. The buffer is reused and
+   only grows for an item larger than it */
+typedef struct JsonCborReader JsonCborReader;
+
+JsonCborReader* json_cbor_reader_create(const char* filename, size_t buffer_size, JsonError* error);
+/* Reads from stream, which the caller keeps open and closes */
+JsonCborReader* json_cbor_reader_create_stream(FILE* stream, size_t buffer_size, JsonError* error);
+/* NULL at the end of the sequence or on error; error->code tells which */
+JsonValue* json_cbor_reader_next(JsonCborReader* reader, JsonError* error);
+void json_cbor_reader_free(JsonCborReader* reader);
+
+/* Random access to the elements of a file holding one large array or
+   object, such as a sensor archive (json_index.c). Building maps the file
+   and records where each top-level element, or member key and value,
+   begins and ends, in one pass that parses nothing; only brackets and
+   separators are checked. Each element is parsed on its own when asked
+   for, so fetching one costs the same wherever it is in the file. An
+   index is read-only: any number of threads may fetch from it at once,
+   e.g. one element range each */
+typedef struct JsonIndex JsonIndex;
+
+#define JSON_INDEX_NOT_FOUND ((size_t)-1)
+
+JsonIndex* json_index_build(const char* filename, JsonError* error);
+/* Sidecar with the offsets, e.g. "archive.json.idx", replaced atomically */
+int json_index_save(const JsonIndex* index, const char* index_filename, JsonError* error);
+/* Index from a sidecar, without a scan. Fails with JSON_ERROR_INDEX_STALE
+   if the length of filename, or its first or last 4 KiB, changed since the
+   index was built; other edits that keep the length are not detected */
+JsonIndex* json_index_open(const char* filename, const char* index_filename, JsonError* error);
+void json_index_free(JsonIndex* index);
+
+JsonType json_index_type(const JsonIndex* index);   /* JSON_ARRAY or JSON_OBJECT */
+size_t json_index_count(const JsonIndex* index);
+/* Raw text of element i inside the mapped file, not NUL terminated;
+   NULL with length 0 if out of range */
+const char* json_index_text(const JsonIndex* index, size_t i, size_t* length);
+/* Raw key of member i without its quotes, escapes left as written;
+   NULL with length 0 if out of range or not an object */
+const char* json_index_key(const JsonIndex* index, size_t i, size_t* length);
+/* Last member with key, as the parser keeps the last duplicate; JSON_INDEX_NOT_FOUND if absent */
+size_t json_index_find(const JsonIndex* index, const char* key);
+/* Heap value of element i; parse errors are located within the element */
+JsonValue* json_index_get(const JsonIndex* index, size_t i, JsonError* error);
+/* Array of count elements from first */
+JsonValue* json_index_get_range(const JsonIndex* index, size_t first, size_t count, JsonError* error);
+
+/* Push parser for input that arrives in pieces, e.g. from a non-blocking
+   socket (json_push.c). Chunks may end anywhere, also inside a string, an
+   escape, a \u surrogate pair or a number. Each top-level value goes to the
+   callback as soon as its last byte is fed; a top-level number needs the
+   byte after it, or json_push_parser_finish(). Values may follow each other
+   directly or be separated by whitespace, as in NDJSON. Only a token cut
+   by a chunk boundary is copied between calls */
+typedef struct JsonPushParser JsonPushParser;
+
+/* Takes ownership of value, a heap value for json_free(). Return 0 to stop */
+typedef int (*JsonPushCallback)(JsonValue* value, void* user_data);
+
+/* Nesting is limited to json_get_max_depth() at creation */
+JsonPushParser* json_push_parser_create(JsonPushCallback callback, void* user_data);
+/* Returns 0 on malformed input, when memory ran out or the callback
+   stopped; later calls then return 0 until json_push_parser_reset() */
+int json_push_parser_feed(JsonPushParser* parser, const char* data, size_t length);
+/* End of input: completes a trailing number and fails if a value is cut off */
+int json_push_parser_finish(JsonPushParser* parser);
+/* Drop any partial value and start a new stream at line 1 */
+void json_push_parser_reset(JsonPushParser* parser);
+/* Error of the last failed call. Lines and columns count from the start
+   of the stream; the context only covers the chunk being fed */
+const JsonError* json_push_parser_error(const JsonPushParser* parser);
+size_t json_push_parser_depth(const JsonPushParser* parser); /* Open arrays and objects */
+void json_push_parser_free(JsonPushParser* parser);
+
+/* Batch ingest of newline-delimited files (json_batch.c). Files are mapped
+   and split into chunks at record boundaries; chunks are parsed on a pool
+   of worker threads, each with its own arena */
+typedef struct JsonBatchConfig {
+    size_t threads;             /* Worker threads, 0 for one per online CPU */
+    size_t chunk_size;          /* Target bytes per work unit, 0 for 1 MiB */
+    int ordered;                /* Deliver records in file order, one callback at a time */
+    JsonParseConfig parse;      /* Applied to every record */
+} JsonBatchConfig;
+
+/* Ordered delivery on all CPUs */
+extern const JsonBatchConfig JSON_BATCH_DEFAULT;
+
+/* One record handed to the batch callback. value (or error) is only valid
+   during the callback, copy out whatever has to outlive it */
+typedef struct JsonBatchRecord {
+    const char* filename;
+    size_t file_index;          /* Index into the file list */
+    size_t offset;              /* Byte offset of the record within its file */
+    const JsonValue* value;     /* NULL if the record failed to parse */
+    const JsonError* error;     /* Set when value is NULL; line 1 is the record's line */
+} JsonBatchRecord;
+
+/* Return 0 to stop the batch. Unordered callbacks run concurrently on the
+   worker threads */
+typedef int (*JsonBatchCallback)(const JsonBatchRecord* record, void* user_data);
+
+typedef struct JsonBatchStats {
+    size_t files;
+    size_t chunks;
+    size_t records;             /* Records delivered, including failed ones */
+    size_t errors;              /* Records that failed to parse */
+    size_t bytes;
+    size_t threads;             /* Workers that took part, the caller included */
+} JsonBatchStats;
+
+/* Returns 0 if a file could not be opened, memory ran out or the callback
+   stopped the batch. Malformed records are delivered, not fatal */
+int json_batch_process_files(const char* const* filenames, size_t count, const JsonBatchConfig* config,
+                             JsonBatchCallback callback, void* user_data, JsonBatchStats* stats);
+int json_batch_process_file(const char* filename, const JsonBatchConfig* config,
+                            JsonBatchCallback callback, void* user_data, JsonBatchStats* stats);
+const JsonError* json_get_batch_error(void);
+
 #endif /* JSON_H */
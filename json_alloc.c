@@ -0,0 +1,261 @@
+/* json_alloc.c */
+#define _POSIX_C_SOURCE 200809L /* clock_gettime, CLOCK_MONOTONIC */
+#include "json_internal.h"
+#include <time.h>
+
+/* Pluggable allocation and per-thread statistics. Every heap allocation of
+   the library goes through a JsonAllocator: the global one by default, or
+   the one a document was parsed with. Statistics cost one thread-local
+   load per event while nobody is collecting */
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+static void *libc_allocate(void *user_data, size_t size)
+{
+    (void)user_data;
+    return malloc(size);
+}
+
+static void *libc_reallocate(void *user_data, void *ptr, size_t size)
+{
+    (void)user_data;
+    return realloc(ptr, size);
+}
+
+static void libc_release(void *user_data, void *ptr)
+{
+    (void)user_data;
+    free(ptr);
+}
+
+static const JsonAllocator libc_allocator = {
+    .allocate = libc_allocate,
+    .reallocate = libc_reallocate,
+    .release = libc_release,
+    .user_data = NULL,
+};
+
+/* Process-wide, like the SIMD level: set it before starting threads */
+static JsonAllocator global_allocator = {
+    .allocate = libc_allocate,
+    .reallocate = libc_reallocate,
+    .release = libc_release,
+    .user_data = NULL,
+};
+
+static JSON_THREAD_LOCAL JsonStats *stats_target;
+static JSON_THREAD_LOCAL int current_phase = -1;
+static JSON_THREAD_LOCAL double phase_started;
+
+int json_set_allocator(const JsonAllocator *allocator)
+{
+    if (!allocator)
+    {
+        global_allocator = libc_allocator;
+        return 1;
+    }
+    if (!allocator->allocate || !allocator->reallocate || !allocator->release)
+        return 0;
+    global_allocator = *allocator;
+    return 1;
+}
+
+const JsonAllocator *json_get_allocator(void)
+{
+    return &global_allocator;
+}
+
+static const JsonAllocator *resolve_allocator(const JsonAllocator *allocator)
+{
+    return allocator && allocator->allocate ? allocator : &global_allocator;
+}
+
+void *json_allocator_alloc(const JsonAllocator *allocator, size_t size)
+{
+    allocator = resolve_allocator(allocator);
+    void *ptr = allocator->allocate(allocator->user_data, size);
+    if (ptr && stats_target)
+    {
+        stats_target->allocations++;
+        stats_target->bytes_allocated += size;
+    }
+    return ptr;
+}
+
+void *json_allocator_realloc(const JsonAllocator *allocator, void *ptr, size_t size)
+{
+    allocator = resolve_allocator(allocator);
+    void *resized = allocator->reallocate(allocator->user_data, ptr, size);
+    if (resized && stats_target)
+    {
+        stats_target->allocations++;
+        stats_target->bytes_allocated += size;
+    }
+    return resized;
+}
+
+void json_allocator_free(const JsonAllocator *allocator, void *ptr)
+{
+    if (!ptr)
+        return;
+    allocator = resolve_allocator(allocator);
+    allocator->release(allocator->user_data, ptr);
+    if (stats_target)
+        stats_target->frees++;
+}
+
+void *json_heap_alloc(size_t size)
+{
+    return json_allocator_alloc(NULL, size);
+}
+
+void *json_heap_calloc(size_t count, size_t size)
+{
+    if (size && count > (size_t)-1 / size)
+        return NULL;
+    void *ptr = json_allocator_alloc(NULL, count * size);
+    if (ptr)
+        memset(ptr, 0, count * size);
+    return ptr;
+}
+
+void *json_heap_realloc(void *ptr, size_t size)
+{
+    return json_allocator_realloc(NULL, ptr, size);
+}
+
+void json_heap_free(void *ptr)
+{
+    json_allocator_free(NULL, ptr);
+}
+
+void json_free_string(char *string)
+{
+    json_heap_free(string);
+}
+
+/* Explicit stacks */
+
+void json_stack_init(JsonStack *stack, void *initial, size_t capacity, size_t frame_size)
+{
+    stack->frames = initial;
+    stack->count = 0;
+    stack->capacity = capacity;
+    stack->frame_size = frame_size;
+    stack->initial = initial;
+    stack->initial_capacity = capacity;
+}
+
+void *json_stack_push(JsonStack *stack)
+{
+    if (stack->count == stack->capacity)
+    {
+        size_t capacity = stack->capacity ? stack->capacity * 2 : 16;
+        if (capacity > (size_t)-1 / stack->frame_size)
+            return NULL;
+        void *frames;
+        if (stack->frames == stack->initial)
+        {
+            frames = json_heap_alloc(capacity * stack->frame_size);
+            if (frames && stack->count)
+                memcpy(frames, stack->initial, stack->count * stack->frame_size);
+        }
+        else
+        {
+            frames = json_heap_realloc(stack->frames, capacity * stack->frame_size);
+        }
+        if (!frames)
+            return NULL;
+        stack->frames = frames;
+        stack->capacity = capacity;
+    }
+    return (char *)stack->frames + stack->count++ * stack->frame_size;
+}
+
+void json_stack_release(JsonStack *stack)
+{
+    if (stack->frames != stack->initial)
+        json_heap_free(stack->frames);
+    stack->frames = stack->initial;
+    stack->capacity = stack->initial_capacity;
+    stack->count = 0;
+}
+
+/* Statistics */
+
+JsonStats *json_stats_collect(JsonStats *stats)
+{
+    JsonStats *previous = stats_target;
+    stats_target = stats;
+    return previous;
+}
+
+JsonStats *json_stats_active(void)
+{
+    return stats_target;
+}
+
+void json_stats_depth(size_t depth)
+{
+    if (stats_target && depth > stats_target->peak_depth)
+        stats_target->peak_depth = depth;
+}
+
+/* Monotonic wall clock in seconds */
+static double stats_clock(void)
+{
+#if defined(_WIN32)
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#elif defined(_POSIX_TIMERS) && _POSIX_TIMERS > 0 && defined(CLOCK_MONOTONIC)
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+double json_clock_seconds(void)
+{
+    return stats_clock();
+}
+
+void json_phase_enter(JsonPhase phase, JsonPhaseMark *mark)
+{
+    mark->active = stats_target != NULL;
+    mark->previous = current_phase;
+    if (!mark->active)
+        return;
+
+    double now = stats_clock();
+    if (current_phase >= 0)
+        stats_target->seconds[current_phase] += now - phase_started;
+    current_phase = (int)phase;
+    phase_started = now;
+}
+
+void json_phase_leave(const JsonPhaseMark *mark)
+{
+    if (!mark->active)
+        return;
+
+    /* Collection may have stopped inside the phase */
+    if (stats_target && current_phase >= 0)
+    {
+        double now = stats_clock();
+        stats_target->seconds[current_phase] += now - phase_started;
+        phase_started = now;
+    }
+    else
+    {
+        phase_started = stats_clock();
+    }
+    current_phase = mark->previous;
+}
@@ -0,0 +1,211 @@
+/* json_arena.c */
+#include "json_internal.h"
+#include <stddef.h>
+
+/* Round a size up to the arena alignment */
+static size_t arena_align(size_t size)
+{
+    return (size + JSON_ARENA_ALIGNMENT - 1) & ~(JSON_ARENA_ALIGNMENT - 1);
+}
+
+/* Pointer to the first data byte of a chunk */
+static char *chunk_data(JsonArenaChunk *chunk)
+{
+    return (char *)chunk + arena_align(sizeof(JsonArenaChunk));
+}
+
+/* Initialise an empty arena. The allocator is copied, NULL means the
+   global one */
+void json_arena_init(JsonArena *arena, size_t chunk_size, const JsonAllocator *allocator)
+{
+    arena->chunks = NULL;
+    arena->chunk_size = chunk_size ? chunk_size : JSON_ARENA_DEFAULT_CHUNK_SIZE;
+    if (allocator)
+        arena->allocator = *allocator;
+    else
+        memset(&arena->allocator, 0, sizeof(arena->allocator));
+}
+
+/* Release every chunk owned by the arena */
+void json_arena_release(JsonArena *arena)
+{
+    JsonArenaChunk *chunk = arena->chunks;
+    while (chunk)
+    {
+        JsonArenaChunk *next = chunk->next;
+        json_allocator_free(&arena->allocator, chunk);
+        chunk = next;
+    }
+    arena->chunks = NULL;
+}
+
+/* Forget every allocation but keep the current chunk for reuse */
+void json_arena_reset(JsonArena *arena)
+{
+    JsonArenaChunk *chunk = arena->chunks;
+    if (!chunk)
+        return;
+
+    JsonArenaChunk *older = chunk->next;
+    while (older)
+    {
+        JsonArenaChunk *next = older->next;
+        json_allocator_free(&arena->allocator, older);
+        older = next;
+    }
+    chunk->next = NULL;
+    chunk->used = 0;
+}
+
+/* Add a new chunk able to hold at least size bytes */
+static JsonArenaChunk *arena_add_chunk(JsonArena *arena, size_t size)
+{
+    size_t capacity = arena->chunk_size;
+    int dedicated = 0;
+
+    /* Large blocks get their own chunk so the current one is not wasted */
+    if (size > capacity / 4)
+    {
+        capacity = size;
+        dedicated = 1;
+    }
+
+    JsonArenaChunk *chunk = (JsonArenaChunk *)json_allocator_alloc(&arena->allocator,
+                                                                 arena_align(sizeof(JsonArenaChunk)) + capacity);
+    if (!chunk)
+    {
+        return NULL;
+    }
+    chunk->used = 0;
+    chunk->capacity = capacity;
+
+    if (dedicated && arena->chunks)
+    {
+        /* Keep bumping in the current chunk, the dedicated one goes behind it */
+        chunk->next = arena->chunks->next;
+        arena->chunks->next = chunk;
+    }
+    else
+    {
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+    }
+    return chunk;
+}
+
+/* Allocate size bytes from the arena */
+void *json_arena_alloc(JsonArena *arena, size_t size)
+{
+    size = arena_align(size ? size : 1);
+
+    JsonArenaChunk *chunk = arena->chunks;
+    if (!chunk || chunk->capacity - chunk->used < size)
+    {
+        chunk = arena_add_chunk(arena, size);
+        if (!chunk)
+        {
+            return NULL;
+        }
+    }
+
+    void *ptr = chunk_data(chunk) + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+/* Grow an arena block, extending in place when it is the latest allocation */
+void *json_arena_realloc(JsonArena *arena, void *ptr, size_t old_size, size_t new_size)
+{
+    if (!ptr)
+    {
+        return json_arena_alloc(arena, new_size);
+    }
+
+    JsonArenaChunk *chunk = arena->chunks;
+    size_t old_aligned = arena_align(old_size);
+    size_t new_aligned = arena_align(new_size);
+
+    if (chunk && (char *)ptr + old_aligned == chunk_data(chunk) + chunk->used &&
+        chunk->used - old_aligned + new_aligned <= chunk->capacity)
+    {
+        chunk->used = chunk->used - old_aligned + new_aligned;
+        return ptr;
+    }
+
+    if (new_size <= old_size)
+    {
+        return ptr;
+    }
+
+    void *new_ptr = json_arena_alloc(arena, new_size);
+    if (new_ptr)
+    {
+        memcpy(new_ptr, ptr, old_size);
+    }
+    return new_ptr;
+}
+
+/* Give back the unused tail of the latest allocation */
+void json_arena_shrink(JsonArena *arena, void *ptr, size_t old_size, size_t new_size)
+{
+    json_arena_realloc(arena, ptr, old_size, new_size);
+}
+
+/* Create a document with an empty arena and no root */
+JsonDocument *json_document_create_empty(const JsonAllocator *allocator)
+{
+    JsonArena arena;
+    json_arena_init(&arena, JSON_ARENA_DEFAULT_CHUNK_SIZE, allocator);
+
+    /* The document header lives in its own arena */
+    JsonDocument *doc = (JsonDocument *)json_arena_alloc(&arena, sizeof(JsonDocument));
+    if (!doc)
+    {
+        json_arena_release(&arena);
+        return NULL;
+    }
+
+    doc->root = NULL;
+    doc->arena = arena;
+    doc->source.data = "";
+    doc->source.length = 0;
+    doc->source.map_base = NULL;
+    doc->source.map_length = 0;
+    doc->source.heap = NULL;
+    memset(&doc->lazy, 0, sizeof(doc->lazy));
+    doc->lazy.allocator = &doc->arena.allocator;
+    doc->keys = NULL;
+    return doc;
+}
+
+/* Document owning a document arena. Document nodes point at the arena
+   embedded in their JsonDocument, so the header is found from it */
+JsonDocument *json_arena_document(JsonArena *arena)
+{
+    return (JsonDocument *)((char *)arena - offsetof(JsonDocument, arena));
+}
+
+/* Root value of a parsed document */
+JsonValue *json_document_root(const JsonDocument *doc)
+{
+    return doc ? doc->root : NULL;
+}
+
+JsonKeyTable *json_document_key_table(const JsonDocument *doc)
+{
+    return doc ? doc->keys : NULL;
+}
+
+/* Release a document and every value it owns */
+void json_document_free(JsonDocument *doc)
+{
+    if (!doc)
+        return;
+
+    /* Copy the arena out first, the document itself lives inside it */
+    JsonArena arena = doc->arena;
+    json_allocator_free(&arena.allocator, doc->lazy.spans);
+    json_key_table_free(doc->keys);
+    json_file_view_close(&doc->source);
+    json_arena_release(&arena);
+}
@@ -0,0 +1,521 @@
+/* json_batch.c */
+#include "json_internal.h"
+
+/* Parallel ingest of newline-delimited files. Every file is mapped and cut
+   into chunks that end on a newline, so no record spans two chunks. Chunk
+   k goes to worker k % N; a worker takes its own chunks lowest first and,
+   once it runs dry, steals the highest pending chunk of another worker.
+   Taking work in roughly file order keeps the number of finished but
+   undelivered chunks small when results must come out in order */
+
+#if defined(__unix__) || defined(__APPLE__)
+#define JSON_HAVE_PTHREADS 1
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#define JSON_BATCH_DEFAULT_CHUNK_SIZE (1024 * 1024)
+#define JSON_BATCH_MAX_THREADS 256
+
+#ifdef JSON_HAVE_PTHREADS
+typedef pthread_mutex_t BatchLock;
+#define BATCH_LOCK_INIT(lock) pthread_mutex_init((lock), NULL)
+#define BATCH_LOCK_DESTROY(lock) pthread_mutex_destroy(lock)
+#define BATCH_LOCK(lock) pthread_mutex_lock(lock)
+#define BATCH_UNLOCK(lock) pthread_mutex_unlock(lock)
+#else
+/* Without threads the calling thread does all the work */
+typedef int BatchLock;
+#define BATCH_LOCK_INIT(lock) ((void)(lock))
+#define BATCH_LOCK_DESTROY(lock) ((void)(lock))
+#define BATCH_LOCK(lock) ((void)(lock))
+#define BATCH_UNLOCK(lock) ((void)(lock))
+#endif
+
+const JsonBatchConfig JSON_BATCH_DEFAULT = {
+    .threads = 0,
+    .chunk_size = 0,
+    .ordered = 1,
+    .parse = {.zero_copy_strings = 0},
+};
+
+static JSON_THREAD_LOCAL JsonError batch_error;
+
+const JsonError *json_get_batch_error(void)
+{
+    return &batch_error;
+}
+
+/* One parsed record waiting for delivery */
+typedef struct
+{
+    size_t offset;
+    JsonValue *value;
+    JsonError *error; /* Arena copy, set when value is NULL */
+} BatchItem;
+
+/* Parsed records of a chunk, with the memory that holds them */
+typedef struct
+{
+    JsonArena arena;
+    BatchItem *items;
+    size_t count;
+    size_t capacity;
+} BatchResults;
+
+typedef struct
+{
+    size_t file;
+    size_t start; /* Byte range within the file */
+    size_t end;
+    int done;             /* Parsed, results are waiting (ordered mode) */
+    BatchResults results; /* Owned by the chunk while done is set */
+} BatchChunk;
+
+/* Chunks head..tail-1 of a worker: chunk indices worker + k * worker_count */
+typedef struct
+{
+    BatchLock lock;
+    size_t head;
+    size_t tail;
+} WorkerQueue;
+
+typedef struct
+{
+    const JsonBatchConfig *config;
+    const char *const *filenames;
+    JsonFileView *views;
+    BatchChunk *chunks;
+    size_t chunk_count;
+    WorkerQueue *queues;
+    size_t worker_count;
+    JsonBatchCallback callback;
+    void *user_data;
+
+    /* Everything below is guarded by lock */
+    BatchLock lock;
+    int stopped;         /* Callback returned 0 or memory ran out */
+    int out_of_memory;
+    int delivering;      /* A worker is delivering chunks in order */
+    size_t next_chunk;   /* Next chunk to deliver in order */
+    BatchResults *spare; /* Recycled results of delivered chunks */
+    size_t spare_count;
+    JsonBatchStats stats;
+} BatchRun;
+
+typedef struct
+{
+    BatchRun *run;
+    size_t index;
+#ifdef JSON_HAVE_PTHREADS
+    pthread_t thread;
+#endif
+} BatchWorker;
+
+static void results_init(BatchResults *results)
+{
+    json_arena_init(&results->arena, JSON_ARENA_DEFAULT_CHUNK_SIZE, NULL);
+    results->items = NULL;
+    results->count = 0;
+    results->capacity = 0;
+}
+
+static void results_release(BatchResults *results)
+{
+    json_arena_release(&results->arena);
+    json_heap_free(results->items);
+    results_init(results);
+}
+
+/* Empty the results but keep their memory */
+static void results_reset(BatchResults *results)
+{
+    json_arena_reset(&results->arena);
+    results->count = 0;
+}
+
+static int results_add(BatchResults *results, size_t offset, JsonValue *value, const JsonError *error)
+{
+    if (results->count == results->capacity)
+    {
+        size_t capacity = results->capacity ? results->capacity * 2 : 256;
+        BatchItem *items = (BatchItem *)json_heap_realloc(results->items, capacity * sizeof(BatchItem));
+        if (!items)
+            return 0;
+        results->items = items;
+        results->capacity = capacity;
+    }
+
+    BatchItem *item = &results->items[results->count];
+    item->offset = offset;
+    item->value = value;
+    item->error = NULL;
+    if (!value)
+    {
+        item->error = (JsonError *)json_arena_alloc(&results->arena, sizeof(JsonError));
+        if (!item->error)
+            return 0;
+        *item->error = *error;
+    }
+    results->count++;
+    return 1;
+}
+
+/* Parse every non-blank line of a chunk */
+static int parse_chunk(const BatchRun *run, const BatchChunk *chunk, BatchResults *results)
+{
+    const char *data = run->views[chunk->file].data;
+    const char *p = data + chunk->start;
+    const char *end = data + chunk->end;
+    int zero_copy = run->config->parse.zero_copy_strings;
+
+    while (p < end)
+    {
+        const char *newline = (const char *)memchr(p, '\n', (size_t)(end - p));
+        const char *line_end = newline ? newline : end;
+        const char *first = json_skip_whitespace(p, line_end);
+        if (first < line_end)
+        {
+            JsonError error;
+            JsonValue *value = json_parse_arena_r(&results->arena, first, (size_t)(line_end - first),
+                                                  zero_copy, NULL, run->config->parse.max_depth, &error);
+            if (!results_add(results, (size_t)(first - data), value, &error))
+                return 0;
+        }
+        p = line_end + 1;
+    }
+    return 1;
+}
+
+/* Hand the records of a chunk to the callback. Returns 0 to stop */
+static int deliver_results(BatchRun *run, const BatchChunk *chunk, const BatchResults *results,
+                           size_t *errors)
+{
+    JsonBatchRecord record;
+    record.filename = run->filenames[chunk->file];
+    record.file_index = chunk->file;
+
+    for (size_t i = 0; i < results->count; i++)
+    {
+        const BatchItem *item = &results->items[i];
+        record.offset = item->offset;
+        record.value = item->value;
+        record.error = item->error;
+        if (!item->value)
+            (*errors)++;
+        if (!run->callback(&record, run->user_data))
+            return 0;
+    }
+    return 1;
+}
+
+/* Ordered mode: park the chunk's results and, unless another worker is
+   already doing it, deliver every chunk that is next in line. Returns the
+   results the worker parses its following chunk into */
+static BatchResults deliver_in_order(BatchRun *run, size_t index, BatchResults results)
+{
+    BatchLock *lock = &run->lock;
+    BatchResults next;
+
+    BATCH_LOCK(lock);
+    run->chunks[index].results = results;
+    run->chunks[index].done = 1;
+    if (run->spare_count)
+    {
+        next = run->spare[--run->spare_count];
+    }
+    else
+    {
+        results_init(&next);
+    }
+
+    if (!run->delivering)
+    {
+        run->delivering = 1;
+        while (!run->stopped && run->next_chunk < run->chunk_count && run->chunks[run->next_chunk].done)
+        {
+            BatchChunk *chunk = &run->chunks[run->next_chunk++];
+            size_t errors = 0;
+
+            /* Callbacks run outside the lock; delivering keeps them serial */
+            BATCH_UNLOCK(lock);
+            int keep_going = deliver_results(run, chunk, &chunk->results, &errors);
+            BATCH_LOCK(lock);
+
+            run->stats.records += chunk->results.count;
+            run->stats.errors += errors;
+            if (!keep_going)
+                run->stopped = 1;
+            results_reset(&chunk->results);
+            run->spare[run->spare_count++] = chunk->results;
+            results_init(&chunk->results);
+            chunk->done = 0;
+        }
+        run->delivering = 0;
+    }
+    BATCH_UNLOCK(lock);
+    return next;
+}
+
+/* Next chunk for a worker: its own lowest, else another worker's highest */
+static int take_chunk(BatchRun *run, size_t worker, size_t *index)
+{
+    size_t workers = run->worker_count;
+    WorkerQueue *own = &run->queues[worker];
+
+    BATCH_LOCK(&own->lock);
+    if (own->head < own->tail)
+    {
+        *index = worker + own->head++ * workers;
+        BATCH_UNLOCK(&own->lock);
+        return 1;
+    }
+    BATCH_UNLOCK(&own->lock);
+
+    for (size_t i = 1; i < workers; i++)
+    {
+        size_t victim = (worker + i) % workers;
+        WorkerQueue *queue = &run->queues[victim];
+        BATCH_LOCK(&queue->lock);
+        if (queue->head < queue->tail)
+        {
+            *index = victim + --queue->tail * workers;
+            BATCH_UNLOCK(&queue->lock);
+            return 1;
+        }
+        BATCH_UNLOCK(&queue->lock);
+    }
+    return 0;
+}
+
+static int run_stopped(BatchRun *run)
+{
+    BATCH_LOCK(&run->lock);
+    int stopped = run->stopped;
+    BATCH_UNLOCK(&run->lock);
+    return stopped;
+}
+
+static void stop_run(BatchRun *run, int out_of_memory)
+{
+    BATCH_LOCK(&run->lock);
+    run->stopped = 1;
+    if (out_of_memory)
+        run->out_of_memory = 1;
+    BATCH_UNLOCK(&run->lock);
+}
+
+static void *worker_main(void *arg)
+{
+    BatchWorker *worker = (BatchWorker *)arg;
+    BatchRun *run = worker->run;
+    BatchResults results; /* This worker's arena while it parses */
+    size_t index;
+
+    results_init(&results);
+    while (!run_stopped(run) && take_chunk(run, worker->index, &index))
+    {
+        BatchChunk *chunk = &run->chunks[index];
+        if (!parse_chunk(run, chunk, &results))
+        {
+            stop_run(run, 1);
+            break;
+        }
+
+        if (run->config->ordered)
+        {
+            results = deliver_in_order(run, index, results);
+            continue;
+        }
+
+        size_t errors = 0;
+        int keep_going = deliver_results(run, chunk, &results, &errors);
+        BATCH_LOCK(&run->lock);
+        run->stats.records += results.count;
+        run->stats.errors += errors;
+        if (!keep_going)
+            run->stopped = 1;
+        BATCH_UNLOCK(&run->lock);
+        results_reset(&results);
+    }
+    results_release(&results);
+    return NULL;
+}
+
+/* Cut a file into chunks of about chunk_size bytes that end after a newline */
+static int split_file(BatchChunk **chunks, size_t *count, size_t *capacity, size_t file,
+                      const JsonFileView *view, size_t chunk_size)
+{
+    size_t start = 0;
+    while (start < view->length)
+    {
+        size_t end = view->length;
+        if (view->length - start > chunk_size)
+        {
+            const char *newline = (const char *)memchr(view->data + start + chunk_size, '\n',
+                                                       view->length - start - chunk_size);
+            if (newline)
+                end = (size_t)(newline - view->data) + 1;
+        }
+
+        if (*count == *capacity)
+        {
+            size_t grown = *capacity ? *capacity * 2 : 16;
+            BatchChunk *resized = (BatchChunk *)json_heap_realloc(*chunks, grown * sizeof(BatchChunk));
+            if (!resized)
+                return 0;
+            *chunks = resized;
+            *capacity = grown;
+        }
+
+        BatchChunk *chunk = &(*chunks)[(*count)++];
+        chunk->file = file;
+        chunk->start = start;
+        chunk->end = end;
+        chunk->done = 0;
+        results_init(&chunk->results);
+        start = end;
+    }
+    return 1;
+}
+
+static size_t default_thread_count(void)
+{
+#if defined(JSON_HAVE_PTHREADS) && defined(_SC_NPROCESSORS_ONLN)
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus > 0)
+        return (size_t)cpus;
+#endif
+    return 1;
+}
+
+/* Parse the newline-delimited records of all files in parallel */
+int json_batch_process_files(const char *const *filenames, size_t count, const JsonBatchConfig *config,
+                             JsonBatchCallback callback, void *user_data, JsonBatchStats *stats)
+{
+    json_error_clear(&batch_error);
+    if (stats)
+        memset(stats, 0, sizeof(*stats));
+    if (!config)
+        config = &JSON_BATCH_DEFAULT;
+    if ((!filenames && count) || !callback)
+    {
+        json_error_set(&batch_error, JSON_ERROR_INVALID_VALUE, "Invalid parameters for batch processing");
+        return 0;
+    }
+
+    BatchRun run;
+    memset(&run, 0, sizeof(run));
+    run.config = config;
+    run.filenames = filenames;
+    run.callback = callback;
+    run.user_data = user_data;
+
+    int result = 0;
+    size_t opened = 0;
+    size_t chunk_capacity = 0;
+    size_t chunk_size = config->chunk_size ? config->chunk_size : JSON_BATCH_DEFAULT_CHUNK_SIZE;
+    BatchWorker *workers = NULL;
+
+    run.views = (JsonFileView *)json_heap_calloc(count ? count : 1, sizeof(JsonFileView));
+    if (!run.views)
+    {
+        json_error_set(&batch_error, JSON_ERROR_MEMORY_ALLOCATION, "Failed to allocate batch state");
+        return 0;
+    }
+    for (; opened < count; opened++)
+    {
+        if (!json_file_view_open(&run.views[opened], filenames[opened], &batch_error))
+            goto cleanup;
+        run.stats.bytes += run.views[opened].length;
+        if (!split_file(&run.chunks, &run.chunk_count, &chunk_capacity, opened, &run.views[opened], chunk_size))
+        {
+            json_error_set(&batch_error, JSON_ERROR_MEMORY_ALLOCATION, "Failed to allocate batch chunks");
+            goto cleanup;
+        }
+    }
+    run.stats.files = count;
+    run.stats.chunks = run.chunk_count;
+
+    /* More workers than chunks would only spin */
+    size_t threads = config->threads ? config->threads : default_thread_count();
+#ifndef JSON_HAVE_PTHREADS
+    threads = 1;
+#endif
+    if (threads > JSON_BATCH_MAX_THREADS)
+        threads = JSON_BATCH_MAX_THREADS;
+    if (threads > run.chunk_count)
+        threads = run.chunk_count ? run.chunk_count : 1;
+    run.worker_count = threads;
+
+    run.queues = (WorkerQueue *)json_heap_calloc(threads, sizeof(WorkerQueue));
+    run.spare = (BatchResults *)json_heap_calloc(run.chunk_count ? run.chunk_count : 1, sizeof(BatchResults));
+    workers = (BatchWorker *)json_heap_calloc(threads, sizeof(BatchWorker));
+    if (!run.queues || !run.spare || !workers)
+    {
+        json_error_set(&batch_error, JSON_ERROR_MEMORY_ALLOCATION, "Failed to allocate batch workers");
+        goto cleanup;
+    }
+
+    BATCH_LOCK_INIT(&run.lock);
+    for (size_t i = 0; i < threads; i++)
+    {
+        BATCH_LOCK_INIT(&run.queues[i].lock);
+        run.queues[i].head = 0;
+        run.queues[i].tail = run.chunk_count > i ? (run.chunk_count - i + threads - 1) / threads : 0;
+        workers[i].run = &run;
+        workers[i].index = i;
+    }
+
+    /* The calling thread is worker 0. Chunks of a worker that could not be
+       started are stolen by the others */
+    size_t started = 1;
+#ifdef JSON_HAVE_PTHREADS
+    int running[JSON_BATCH_MAX_THREADS] = {0};
+    for (size_t i = 1; i < threads; i++)
+    {
+        running[i] = pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) == 0;
+        started += (size_t)running[i];
+    }
+#endif
+    worker_main(&workers[0]);
+#ifdef JSON_HAVE_PTHREADS
+    for (size_t i = 1; i < threads; i++)
+    {
+        if (running[i])
+            pthread_join(workers[i].thread, NULL);
+    }
+#endif
+    run.stats.threads = started;
+
+    for (size_t i = 0; i < threads; i++)
+        BATCH_LOCK_DESTROY(&run.queues[i].lock);
+    BATCH_LOCK_DESTROY(&run.lock);
+
+    /* A callback that stopped the batch is not an error */
+    if (run.out_of_memory)
+        json_error_set(&batch_error, JSON_ERROR_MEMORY_ALLOCATION, "Out of memory while parsing batch");
+    result = !run.stopped;
+
+cleanup:
+    if (stats)
+        *stats = run.stats;
+    for (size_t i = 0; i < run.chunk_count; i++)
+        results_release(&run.chunks[i].results);
+    for (size_t i = 0; i < run.spare_count; i++)
+        results_release(&run.spare[i]);
+    for (size_t i = 0; i < opened; i++)
+        json_file_view_close(&run.views[i]);
+    json_heap_free(run.views);
+    json_heap_free(run.chunks);
+    json_heap_free(run.queues);
+    json_heap_free(run.spare);
+    json_heap_free(workers);
+    return result;
+}
+
+int json_batch_process_file(const char *filename, const JsonBatchConfig *config,
+                            JsonBatchCallback callback, void *user_data, JsonBatchStats *stats)
+{
+    return json_batch_process_files(&filename, 1, config, callback, user_data, stats);
+}
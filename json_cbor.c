@@ -0,0 +1,1035 @@
+/* json_cbor.c */
+#include "json_internal.h"
+#include <math.h>
+
+/* CBOR (RFC 8949) encoding of the value model. The encoder writes the
+   preferred serialization: the shortest argument for every head, definite
+   lengths, and the shortest float that keeps a number's exact value.
+   Numbers flagged JSON_VALUE_INTEGER become CBOR integers, so both kinds
+   of number come back as they were. The decoder also takes indefinite
+   lengths and skips tags; byte strings, map keys that are not text and
+   simple values other than false, true, null and undefined are rejected.
+   Neither side recurses, nesting depth is bounded by json_get_max_depth() */
+
+#define CBOR_SINK_BUFFER_SIZE (16 * 1024)
+#define CBOR_READER_BUFFER_SIZE (64 * 1024)
+#define CBOR_STACK_INITIAL 32
+
+/* Major types, the top three bits of an initial byte */
+enum
+{
+    CBOR_UNSIGNED,
+    CBOR_NEGATIVE,
+    CBOR_BYTES,
+    CBOR_TEXT,
+    CBOR_ARRAY,
+    CBOR_MAP,
+    CBOR_TAG,
+    CBOR_SIMPLE
+};
+
+#define CBOR_INDEFINITE 31  /* Additional information of an indefinite length */
+#define CBOR_BREAK 0xFF     /* Ends an indefinite-length item */
+
+/* Output buffer. With a sink it has a fixed size and is flushed whenever
+   it fills; without one it grows, copying out of borrowed storage */
+typedef struct
+{
+    char *buffer;
+    size_t size;
+    size_t capacity;
+    JsonWriteCallback sink;
+    void *sink_data;
+    int borrowed;
+    JsonError *error;
+} CborWriter;
+
+static int writer_flush(CborWriter *writer)
+{
+    if (writer->size == 0)
+        return 1;
+    JsonPhaseMark mark;
+    json_phase_enter(JSON_PHASE_WRITE, &mark);
+    int written = writer->sink(writer->buffer, writer->size, writer->sink_data);
+    json_phase_leave(&mark);
+    if (!written)
+    {
+        json_error_set(writer->error, JSON_ERROR_FILE_WRITE, "Failed to write CBOR output");
+        return 0;
+    }
+    writer->size = 0;
+    return 1;
+}
+
+static int writer_grow(CborWriter *writer, size_t additional)
+{
+    size_t capacity = writer->capacity ? writer->capacity * 2 : 1024;
+    while (writer->size + additional > capacity)
+        capacity *= 2;
+
+    char *buffer;
+    if (writer->borrowed)
+    {
+        buffer = (char *)json_heap_alloc(capacity);
+        if (buffer)
+            memcpy(buffer, writer->buffer, writer->size);
+    }
+    else
+    {
+        buffer = (char *)json_heap_realloc(writer->buffer, capacity);
+    }
+    if (!buffer)
+    {
+        json_error_set(writer->error, JSON_ERROR_MEMORY_ALLOCATION, "Failed to grow CBOR buffer");
+        return 0;
+    }
+    writer->buffer = buffer;
+    writer->capacity = capacity;
+    writer->borrowed = 0;
+    JSON_STATS_ADD(builder_reallocs, 1);
+    return 1;
+}
+
+/* Strings longer than a sink's buffer are passed through it in pieces */
+static int writer_bytes(CborWriter *writer, const void *data, size_t length)
+{
+    const char *bytes = (const char *)data;
+    while (writer->size + length > writer->capacity)
+    {
+        if (!writer->sink)
+        {
+            if (!writer_grow(writer, length))
+                return 0;
+            break;
+        }
+        size_t room = writer->capacity - writer->size;
+        memcpy(writer->buffer + writer->size, bytes, room);
+        writer->size += room;
+        bytes += room;
+        length -= room;
+        if (!writer_flush(writer))
+            return 0;
+    }
+    memcpy(writer->buffer + writer->size, bytes, length);
+    writer->size += length;
+    return 1;
+}
+
+/* Initial byte and big-endian argument, in the shortest form */
+static int write_head(CborWriter *writer, unsigned major, uint64_t argument)
+{
+    unsigned char head[9];
+    size_t bytes;
+    if (argument < 24)
+    {
+        head[0] = (unsigned char)(major << 5 | argument);
+        return writer_bytes(writer, head, 1);
+    }
+    if (argument <= 0xFF)
+        bytes = 1;
+    else if (argument <= 0xFFFF)
+        bytes = 2;
+    else if (argument <= 0xFFFFFFFFu)
+        bytes = 4;
+    else
+        bytes = 8;
+
+    head[0] = (unsigned char)(major << 5 | (bytes == 1 ? 24 : bytes == 2 ? 25 : bytes == 4 ? 26 : 27));
+    for (size_t i = 0; i < bytes; i++)
+        head[bytes - i] = (unsigned char)(argument >> (8 * i));
+    return writer_bytes(writer, head, bytes + 1);
+}
+
+/* Half-precision bits of f, if the conversion is exact */
+static int float_to_half(float f, uint16_t *half)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+    int exponent = (int)((bits >> 23) & 0xFF) - 127;
+    uint32_t mantissa = bits & 0x7FFFFF;
+
+    if (exponent == 128)
+    {
+        if (mantissa)
+            return 0; /* NaN payloads are not kept */
+        *half = (uint16_t)(sign | 0x7C00);
+        return 1;
+    }
+    if (exponent == -127)
+    {
+        if (mantissa)
+            return 0; /* Single-precision subnormals are too small */
+        *half = sign;
+        return 1;
+    }
+    if (exponent > 15 || exponent < -24)
+        return 0;
+    if (exponent >= -14)
+    {
+        if (mantissa & 0x1FFF)
+            return 0;
+        *half = (uint16_t)(sign | (uint32_t)(exponent + 15) << 10 | mantissa >> 13);
+        return 1;
+    }
+
+    /* Half-precision subnormal: the value in units of 2^-24 */
+    uint32_t full = 0x800000 | mantissa;
+    int shift = -(exponent + 1);
+    if (full & ((1u << shift) - 1))
+        return 0;
+    *half = (uint16_t)(sign | full >> shift);
+    return 1;
+}
+
+static int write_number(CborWriter *writer, double number)
+{
+    unsigned char out[9];
+    if (isnan(number))
+    {
+        /* The canonical quiet NaN */
+        static const unsigned char nan[] = {0xF9, 0x7E, 0x00};
+        return writer_bytes(writer, nan, sizeof(nan));
+    }
+
+    float single = (float)number;
+    if ((double)single == number)
+    {
+        uint16_t half;
+        if (float_to_half(single, &half))
+        {
+            out[0] = 0xF9;
+            out[1] = (unsigned char)(half >> 8);
+            out[2] = (unsigned char)half;
+            return writer_bytes(writer, out, 3);
+        }
+        uint32_t bits;
+        memcpy(&bits, &single, sizeof(bits));
+        out[0] = 0xFA;
+        for (int i = 0; i < 4; i++)
+            out[4 - i] = (unsigned char)(bits >> (8 * i));
+        return writer_bytes(writer, out, 5);
+    }
+
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(bits));
+    out[0] = 0xFB;
+    for (int i = 0; i < 8; i++)
+        out[8 - i] = (unsigned char)(bits >> (8 * i));
+    return writer_bytes(writer, out, 9);
+}
+
+/* Write a value that needs no frame */
+static int write_scalar(CborWriter *writer, const JsonValue *value)
+{
+    static const unsigned char simple_null = 0xF6, simple_true = 0xF5, simple_false = 0xF4;
+    if (!value || value->type == JSON_NULL)
+        return writer_bytes(writer, &simple_null, 1);
+
+    switch (value->type)
+    {
+    case JSON_BOOLEAN:
+        return writer_bytes(writer, value->value.boolean ? &simple_true : &simple_false, 1);
+
+    case JSON_NUMBER:
+        if (value->flags & JSON_VALUE_INTEGER)
+        {
+            if (value->integer < 0)
+                return write_head(writer, CBOR_NEGATIVE, (uint64_t)(-1 - value->integer));
+            return write_head(writer, CBOR_UNSIGNED, (uint64_t)value->integer);
+        }
+        return write_number(writer, value->value.number);
+
+    case JSON_STRING:
+        return write_head(writer, CBOR_TEXT, value->length) &&
+               writer_bytes(writer, value->value.string, value->length);
+
+    default:
+        return 0;
+    }
+}
+
+/* One open array or object */
+typedef struct
+{
+    const JsonValue *container;
+    size_t next;                /* Array: next item */
+    const JsonKeyValue *pair;   /* Object: next member */
+} EncodeFrame;
+
+/* Start a value: scalars are written whole, containers write their head
+   and push a frame */
+static int encode_open(CborWriter *writer, JsonStack *stack, const JsonValue *value)
+{
+    if (!value || (value->type != JSON_ARRAY && value->type != JSON_OBJECT))
+        return write_scalar(writer, value);
+
+    if (!JSON_VALUE_READY(value))
+    {
+        json_error_set(writer->error, JSON_ERROR_MEMORY_ALLOCATION, "Failed to build lazy container");
+        return 0;
+    }
+    int is_array = value->type == JSON_ARRAY;
+    size_t count = is_array ? value->value.array->size : value->value.object->size;
+    if (!write_head(writer, is_array ? CBOR_ARRAY : CBOR_MAP, count))
+        return 0;
+
+    EncodeFrame *frame = (EncodeFrame *)json_stack_push(stack);
+    if (!frame)
+    {
+        json_error_set(writer->error, JSON_ERROR_MEMORY_ALLOCATION, "Failed to grow encoder stack");
+        return 0;
+    }
+    frame->container = value;
+    frame->next = 0;
+    frame->pair = is_array ? NULL : value->value.object->pairs;
+    return 1;
+}
+
+static int encode_value(CborWriter *writer, const JsonValue *root)
+{
+    EncodeFrame initial[CBOR_STACK_INITIAL];
+    JsonStack stack;
+    json_stack_init(&stack, initial, CBOR_STACK_INITIAL, sizeof(EncodeFrame));
+
+    int ok = encode_open(writer, &stack, root);
+    while (ok && stack.count)
+    {
+        EncodeFrame *frame = JSON_STACK_TOP(&stack, EncodeFrame);
+        const JsonValue *member;
+        if (frame->container->type == JSON_ARRAY)
+        {
+            const JsonArray *array = frame->container->value.array;
+            if (frame->next == array->size)
+            {
+                stack.count--;
+                continue;
+            }
+            member = array->items[frame->next++];
+        }
+        else
+        {
+            const JsonKeyValue *pair = frame->pair;
+            if (!pair)
+            {
+                stack.count--;
+                continue;
+            }
+            frame->pair = pair->next;
+            ok = write_head(writer, CBOR_TEXT, pair->key_length) &&
+                 writer_bytes(writer, pair->key, pair->key_length);
+            member = pair->value;
+        }
+        ok = ok && encode_open(writer, &stack, member);
+    }
+
+    json_stack_release(&stack);
+    return ok;
+}
+
+int json_cbor_encode(const JsonValue *value, JsonFormatBuffer *buffer, JsonError *error)
+{
+    json_error_clear(error);
+    if (!value || !buffer)
+    {
+        json_error_set(error, JSON_ERROR_INVALID_VALUE, "NULL value or buffer passed to json_cbor_encode");
+        return 0;
+    }
+
+    CborWriter writer = {buffer->data, 0, buffer->capacity, NULL, NULL, buffer->data && !buffer->owned, error};
+    JsonPhaseMark mark;
+    json_phase_enter(JSON_PHASE_FORMAT, &mark);
+    /* The trailing NUL keeps the buffer's invariant; it is not part of the item */
+    int ok = encode_value(&writer, value) && writer_bytes(&writer, "", 1);
+    json_phase_leave(&mark);
+
+    buffer->data = writer.buffer;
+    buffer->capacity = writer.capacity;
+    buffer->owned = buffer->data && !writer.borrowed;
+    buffer->length = ok ? writer.size - 1 : 0;
+    if (buffer->data)
+        buffer->data[buffer->length] = '\0';
+    return ok;
+}
+
+int json_cbor_write_callback(const JsonValue *value, JsonWriteCallback callback, void *user_data,
+                             JsonError *error)
+{
+    json_error_clear(error);
+    if (!value || !callback)
+    {
+        json_error_set(error, JSON_ERROR_INVALID_VALUE, "NULL value or callback passed to json_cbor_write_callback");
+        return 0;
+    }
+
+    char *buffer = (char *)json_heap_alloc(CBOR_SINK_BUFFER_SIZE);
+    if (!buffer)
+    {
+        json_error_set(error, JSON_ERROR_MEMORY_ALLOCATION, "Failed to allocate output buffer");
+        return 0;
+    }
+    CborWriter writer = {buffer, 0, CBOR_SINK_BUFFER_SIZE, callback, user_data, 0, error};
+    JsonPhaseMark mark;
+    json_phase_enter(JSON_PHASE_FORMAT, &mark);
+    int ok = encode_value(&writer, value) && writer_flush(&writer);
+    json_phase_leave(&mark);
+    json_heap_free(writer.buffer);
+    return ok;
+}
+
+static int stream_sink(const char *data, size_t length, void *user_data)
+{
+    return fwrite(data, 1, length, (FILE *)user_data) == length;
+}
+
+int json_cbor_write_stream(const JsonValue *value, FILE *stream, JsonError *error)
+{
+    if (!stream)
+    {
+        json_error_set(error, JSON_ERROR_INVALID_VALUE, "NULL stream passed to json_cbor_write_stream");
+        return 0;
+    }
+    return json_cbor_write_callback(value, stream_sink, stream, error);
+}
+
+static int write_file_stream(const JsonValue *value, FILE *stream, void *context)
+{
+    return json_cbor_write_stream(value, stream, (JsonError *)context);
+}
+
+/* Same temporary file, buffering and rename as json_write_file_ex() */
+int json_cbor_write_file(const JsonValue *value, const char *filename, const JsonFileWriteConfig *config,
+                         JsonError *error)
+{
+    json_error_clear(error);
+    JsonPhaseMark mark;
+    json_phase_enter(JSON_PHASE_WRITE, &mark);
+    int ok = json_write_file_with(value, filename, config, write_file_stream, error);
+    json_phase_leave(&mark);
+    if (!ok && error && error->code == JSON_ERROR_NONE)
+    {
+        const JsonError *file_error = json_get_file_error();
+        json_error_set(error, file_error->code, file_error->message);
+    }
+    return ok;
+}
+
+/* Decoder over one buffer. Strings are created straight from the input;
+   the chunks of an indefinite-length string are joined in a scratch
+   buffer, one for keys and one for values */
+typedef struct
+{
+    char *data;
+    size_t length;
+    size_t capacity;
+} CborScratch;
+
+typedef struct
+{
+    const unsigned char *start;
+    const unsigned char *p;
+    const unsigned char *end;
+    size_t base_offset;     /* Stream offset of start, for error positions */
+    size_t max_depth;
+    int truncated;          /* The error was running out of input */
+    CborScratch scratch[2];
+    JsonError *error;
+} CborDecoder;
+
+/* Errors give the offset of the item's first byte. line is 0 and column
+   the offset counted from 1 */
+static int decode_error(CborDecoder *decoder, JsonErrorCode code, const char *message,
+                        const unsigned char *at)
+{
+    if (!decoder->error)
+        return 0;
+    size_t offset = decoder->base_offset + (size_t)(at - decoder->start);
+    char text[sizeof(decoder->error->message)];
+    snprintf(text, sizeof(text), "%s at byte %zu", message, offset);
+    json_error_set(decoder->error, code, text);
+    decoder->error->column = offset + 1;
+    return 0;
+}
+
+static int truncated(CborDecoder *decoder, const unsigned char *at)
+{
+    decoder->truncated = 1;
+    return decode_error(decoder, JSON_ERROR_CBOR_TRUNCATED, "CBOR item is cut off", at);
+}
+
+/* Initial byte and argument. Indefinite lengths report info 31 with a
+   zero argument; float arguments are the raw bits */
+static int read_head(CborDecoder *decoder, unsigned *major, unsigned *info, uint64_t *argument)
+{
+    const unsigned char *at = decoder->p;
+    if (at >= decoder->end)
+        return truncated(decoder, at);
+
+    *major = *at >> 5;
+    *info = *at & 31;
+    decoder->p++;
+    *argument = 0;
+    if (*info < 24)
+    {
+        *argument = *info;
+        return 1;
+    }
+    if (*info == CBOR_INDEFINITE)
+    {
+        if (*major == CBOR_UNSIGNED || *major == CBOR_NEGATIVE || *major == CBOR_TAG)
+            return decode_error(decoder, JSON_ERROR_CBOR_MALFORMED, "Indefinite length on a non-container", at);
+        return 1;
+    }
+    if (*info > 27)
+        return decode_error(decoder, JSON_ERROR_CBOR_MALFORMED, "Reserved additional information", at);
+
+    size_t bytes = (size_t)1 << (*info - 24);
+    if ((size_t)(decoder->end - decoder->p) < bytes)
+        return truncated(decoder, at);
+    for (size_t i = 0; i < bytes; i++)
+        *argument = *argument << 8 | decoder->p[i];
+    decoder->p += bytes;
+    return 1;
+}
+
+static int scratch_append(CborDecoder *decoder, CborScratch *scratch, const unsigned char *data, size_t length)
+{
+    if (length == 0)
+        return 1;
+    if (scratch->length + length > scratch->capacity)
+    {
+        size_t capacity = scratch->capacity ? scratch->capacity : 256;
+        while (scratch->length + length > capacity)
+            capacity *= 2;
+        char *grown = (char *)json_heap_realloc(scratch->data, capacity);
+        if (!grown)
+            return decode_error(decoder, JSON_ERROR_MEMORY_ALLOCATION, "Failed to join string chunks",
+                                decoder->p);
+        scratch->data = grown;
+        scratch->capacity = capacity;
+    }
+    memcpy(scratch->data + scratch->length, data, length);
+    scratch->length += length;
+    return 1;
+}
+
+/* Text string whose head was just read. Definite strings point into the
+   input, indefinite ones into scratch */
+static int read_text(CborDecoder *decoder, unsigned info, uint64_t argument, CborScratch *scratch,
+                     const char **text, size_t *length)
+{
+    const unsigned char *at = decoder->p;
+    if (info != CBOR_INDEFINITE)
+    {
+        if (argument > (uint64_t)(decoder->end - at))
+            return truncated(decoder, at);
+        *text = (const char *)at;
+        *length = (size_t)argument;
+        decoder->p += argument;
+        return 1;
+    }
+
+    scratch->length = 0;
+    for (;;)
+    {
+        const unsigned char *chunk = decoder->p;
+        if (chunk >= decoder->end)
+            return truncated(decoder, chunk);
+        if (*chunk == CBOR_BREAK)
+        {
+            decoder->p++;
+            break;
+        }
+        unsigned major, chunk_info;
+        uint64_t chunk_length;
+        if (!read_head(decoder, &major, &chunk_info, &chunk_length))
+            return 0;
+        if (major != CBOR_TEXT || chunk_info == CBOR_INDEFINITE)
+            return decode_error(decoder, JSON_ERROR_CBOR_MALFORMED, "Invalid chunk in indefinite-length string",
+                                chunk);
+        if (chunk_length > (uint64_t)(decoder->end - decoder->p))
+            return truncated(decoder, chunk);
+        if (!scratch_append(decoder, scratch, decoder->p, (size_t)chunk_length))
+            return 0;
+        decoder->p += chunk_length;
+    }
+    *text = scratch->data ? scratch->data : "";
+    *length = scratch->length;
+    return 1;
+}
+
+/* Head of the next data item, after any tags */
+static int read_item_head(CborDecoder *decoder, unsigned *major, unsigned *info, uint64_t *argument)
+{
+    do
+    {
+        if (!read_head(decoder, major, info, argument))
+            return 0;
+    } while (*major == CBOR_TAG);
+    return 1;
+}
+
+static int read_key(CborDecoder *decoder, const char **key, size_t *length)
+{
+    const unsigned char *at = decoder->p;
+    unsigned major, info;
+    uint64_t argument;
+    if (!read_item_head(decoder, &major, &info, &argument))
+        return 0;
+    if (major != CBOR_TEXT)
+        return decode_error(decoder, JSON_ERROR_CBOR_UNSUPPORTED, "Map key is not a text string", at);
+    return read_text(decoder, info, argument, &decoder->scratch[0], key, length);
+}
+
+static double half_to_double(uint16_t half)
+{
+    int exponent = (half >> 10) & 0x1F;
+    int mantissa = half & 0x3FF;
+    double value;
+    if (exponent == 0)
+        value = ldexp(mantissa, -24);
+    else if (exponent != 31)
+        value = ldexp(mantissa + 1024, exponent - 25);
+    else
+        value = mantissa ? NAN : INFINITY;
+    return half & 0x8000 ? -value : value;
+}
+
+/* Value for a head other than an array or map, NULL after an error */
+static JsonValue *decode_scalar(CborDecoder *decoder, unsigned major, unsigned info, uint64_t argument,
+                                const unsigned char *at)
+{
+    JsonValue *value = NULL;
+    switch (major)
+    {
+    case CBOR_UNSIGNED:
+        value = argument <= INT64_MAX ? json_create_integer((int64_t)argument) : json_create_number((double)argument);
+        break;
+
+    case CBOR_NEGATIVE:
+        value = argument <= INT64_MAX ? json_create_integer(-1 - (int64_t)argument)
+                                      : json_create_number(-1.0 - (double)argument);
+        break;
+
+    case CBOR_TEXT:
+    {
+        const char *text;
+        size_t length;
+        if (!read_text(decoder, info, argument, &decoder->scratch[1], &text, &length))
+            return NULL;
+        value = json_create_string_length(text, length);
+        break;
+    }
+
+    case CBOR_SIMPLE:
+        if (info == 20 || info == 21)
+        {
+            value = json_create_boolean(info == 21);
+        }
+        else if (info == 22 || info == 23)
+        {
+            value = json_create_null(); /* undefined has no JSON counterpart */
+        }
+        else if (info >= 25 && info <= 27)
+        {
+            double number;
+            if (info == 25)
+            {
+                number = half_to_double((uint16_t)argument);
+            }
+            else if (info == 26)
+            {
+                uint32_t bits = (uint32_t)argument;
+                float single;
+                memcpy(&single, &bits, sizeof(single));
+                number = single;
+            }
+            else
+            {
+                memcpy(&number, &argument, sizeof(number));
+            }
+            value = json_create_number(number);
+        }
+        else if (info == CBOR_INDEFINITE)
+        {
+            decode_error(decoder, JSON_ERROR_CBOR_MALFORMED, "Unexpected break", at);
+            return NULL;
+        }
+        else
+        {
+            decode_error(decoder, JSON_ERROR_CBOR_UNSUPPORTED, "Unsupported simple value", at);
+            return NULL;
+        }
+        break;
+
+    default: /* CBOR_BYTES */
+        decode_error(decoder, JSON_ERROR_CBOR_UNSUPPORTED, "Byte strings are not supported", at);
+        return NULL;
+    }
+
+    if (!value)
+        decode_error(decoder, JSON_ERROR_MEMORY_ALLOCATION, "Failed to allocate value", at);
+    return value;
+}
+
+/* One open array or map */
+typedef struct
+{
+    JsonValue *container;
+    uint64_t remaining;     /* Members still to come, unless indefinite */
+    int indefinite;
+} DecodeFrame;
+
+/* Decode one data item at decoder->p. Members are attached as soon as
+   they are created, so the root owns everything decoded so far */
+static JsonValue *decode_item(CborDecoder *decoder)
+{
+    DecodeFrame initial[CBOR_STACK_INITIAL];
+    JsonStack stack;
+    json_stack_init(&stack, initial, CBOR_STACK_INITIAL, sizeof(DecodeFrame));
+    JsonValue *root = NULL;
+    int ok = 1;
+
+    for (;;)
+    {
+        DecodeFrame *frame = stack.count ? JSON_STACK_TOP(&stack, DecodeFrame) : NULL;
+        const char *key = NULL;
+        size_t key_length = 0;
+        if (frame)
+        {
+            if (frame->indefinite && decoder->p >= decoder->end)
+            {
+                ok = truncated(decoder, decoder->p);
+                break;
+            }
+            if (frame->indefinite ? *decoder->p == CBOR_BREAK : frame->remaining == 0)
+            {
+                decoder->p += frame->indefinite;
+                if (--stack.count == 0)
+                    break;
+                continue;
+            }
+            frame->remaining--;
+            if (frame->container->type == JSON_OBJECT && !read_key(decoder, &key, &key_length))
+            {
+                ok = 0;
+                break;
+            }
+        }
+
+        const unsigned char *at = decoder->p;
+        unsigned major, info;
+        uint64_t argument;
+        if (!read_item_head(decoder, &major, &info, &argument))
+        {
+            ok = 0;
+            break;
+        }
+
+        JsonValue *value;
+        int is_container = major == CBOR_ARRAY || major == CBOR_MAP;
+        if (is_container)
+        {
+            value = major == CBOR_ARRAY ? json_create_array() : json_create_object();
+            if (!value)
+                decode_error(decoder, JSON_ERROR_MEMORY_ALLOCATION, "Failed to allocate value", at);
+        }
+        else
+        {
+            value = decode_scalar(decoder, major, info, argument, at);
+        }
+        if (!value)
+        {
+            ok = 0;
+            break;
+        }
+
+        if (!frame)
+        {
+            root = value;
+        }
+        else
+        {
+            int attached = frame->container->type == JSON_ARRAY
+                               ? json_array_append(frame->container, value)
+                               : json_object_set_length(frame->container, key, key_length, value);
+            if (!attached)
+            {
+                json_free(value);
+                ok = decode_error(decoder, JSON_ERROR_MEMORY_ALLOCATION, "Failed to add member", at);
+                break;
+            }
+        }
+
+        if (!is_container)
+        {
+            if (!frame)
+                break; /* A scalar root */
+            continue;
+        }
+        if (stack.count >= decoder->max_depth)
+        {
+            ok = decode_error(decoder, JSON_ERROR_MAXIMUM_NESTING_REACHED, "Maximum nesting depth exceeded", at);
+            break;
+        }
+        DecodeFrame *open = (DecodeFrame *)json_stack_push(&stack);
+        if (!open)
+        {
+            ok = decode_error(decoder, JSON_ERROR_MEMORY_ALLOCATION, "Failed to grow decoder stack", at);
+            break;
+        }
+        open->container = value;
+        open->indefinite = info == CBOR_INDEFINITE;
+        /* A map's remaining count is in members, one key and value each */
+        open->remaining = argument;
+    }
+
+    json_stack_release(&stack);
+    if (!ok)
+    {
+        json_free(root);
+        return NULL;
+    }
+    return root;
+}
+
+static void decoder_init(CborDecoder *decoder, const void *data, size_t length, size_t base_offset,
+                         JsonError *error)
+{
+    decoder->start = (const unsigned char *)data;
+    decoder->p = decoder->start;
+    decoder->end = decoder->start + length;
+    decoder->base_offset = base_offset;
+    decoder->max_depth = json_get_max_depth();
+    decoder->truncated = 0;
+    memset(decoder->scratch, 0, sizeof(decoder->scratch));
+    decoder->error = error;
+}
+
+static void decoder_release(CborDecoder *decoder)
+{
+    json_heap_free(decoder->scratch[0].data);
+    json_heap_free(decoder->scratch[1].data);
+}
+
+JsonValue *json_cbor_decode(const void *data, size_t length, size_t *used, JsonError *error)
+{
+    json_error_clear(error);
+    if (!data && length)
+    {
+        json_error_set(error, JSON_ERROR_INVALID_VALUE, "NULL data passed to json_cbor_decode");
+        return NULL;
+    }
+
+    CborDecoder decoder;
+    decoder_init(&decoder, data ? data : "", length, 0, error);
+    JsonPhaseMark mark;
+    json_phase_enter(JSON_PHASE_PARSE, &mark);
+    JsonValue *value = decode_item(&decoder);
+    json_phase_leave(&mark);
+    decoder_release(&decoder);
+
+    if (value && used)
+    {
+        *used = (size_t)(decoder.p - decoder.start);
+    }
+    else if (value && decoder.p != decoder.end)
+    {
+        json_free(value);
+        decode_error(&decoder, JSON_ERROR_CBOR_MALFORMED, "Unexpected data after CBOR item", decoder.p);
+        return NULL;
+    }
+    return value;
+}
+
+/* Whole files and streams hold exactly one item */
+static JsonValue *decode_view(JsonFileView *view, JsonError *error)
+{
+    JsonValue *value = json_cbor_decode(view->data, view->length, NULL, error);
+    json_file_view_close(view);
+    return value;
+}
+
+JsonValue *json_cbor_read_file(const char *filename, JsonError *error)
+{
+    json_error_clear(error);
+    if (!filename)
+    {
+        json_error_set(error, JSON_ERROR_INVALID_VALUE, "NULL filename passed to json_cbor_read_file");
+        return NULL;
+    }
+    JsonFileView view;
+    if (!json_file_view_open(&view, filename, error))
+        return NULL;
+    return decode_view(&view, error);
+}
+
+JsonValue *json_cbor_read_stream(FILE *stream, JsonError *error)
+{
+    json_error_clear(error);
+    if (!stream)
+    {
+        json_error_set(error, JSON_ERROR_INVALID_VALUE, "NULL stream passed to json_cbor_read_stream");
+        return NULL;
+    }
+    JsonFileView view;
+    if (!json_file_view_open_stream(&view, stream, error))
+        return NULL;
+    return decode_view(&view, error);
+}
+
+/* Reader for a CBOR sequence (RFC 8742): items back to back with nothing
+   between them. An item cut by the end of the buffer is decoded again
+   once more data is in; the buffer only grows for an item larger than it */
+struct JsonCborReader
+{
+    FILE *file;
+    int owns_file;
+    unsigned char *buffer;
+    size_t buffer_size;
+    size_t start;           /* Next item */
+    size_t end;             /* End of buffered data */
+    size_t offset;          /* Stream offset of buffer[0] */
+    int eof;
+};
+
+static JsonCborReader *reader_create(FILE *file, int owns_file, size_t buffer_size, JsonError *error)
+{
+    JsonCborReader *reader = (JsonCborReader *)json_heap_calloc(1, sizeof(JsonCborReader));
+    if (reader)
+    {
+        reader->buffer_size = buffer_size ? buffer_size : CBOR_READER_BUFFER_SIZE;
+        reader->buffer = (unsigned char *)json_heap_alloc(reader->buffer_size);
+    }
+    if (!reader || !reader->buffer)
+    {
+        json_heap_free(reader);
+        if (owns_file)
+            fclose(file);
+        json_error_set(error, JSON_ERROR_MEMORY_ALLOCATION, "Failed to allocate CBOR reader");
+        return NULL;
+    }
+    reader->file = file;
+    reader->owns_file = owns_file;
+    return reader;
+}
+
+JsonCborReader *json_cbor_reader_create(const char *filename, size_t buffer_size, JsonError *error)
+{
+    json_error_clear(error);
+    FILE *file = filename ? fopen(filename, "rb") : NULL;
+    if (!file)
+    {
+        json_error_set(error, JSON_ERROR_FILE_READ, "Failed to open file for reading");
+        return NULL;
+    }
+    return reader_create(file, 1, buffer_size, error);
+}
+
+JsonCborReader *json_cbor_reader_create_stream(FILE *stream, size_t buffer_size, JsonError *error)
+{
+    json_error_clear(error);
+    if (!stream)
+    {
+        json_error_set(error, JSON_ERROR_INVALID_VALUE, "NULL stream passed to json_cbor_reader_create_stream");
+        return NULL;
+    }
+    return reader_create(stream, 0, buffer_size, error);
+}
+
+/* Move the unconsumed bytes to the front, grow a full buffer and read */
+static int reader_refill(JsonCborReader *reader, JsonError *error)
+{
+    if (reader->start > 0)
+    {
+        memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->offset += reader->start;
+        reader->start = 0;
+    }
+    if (reader->end == reader->buffer_size)
+    {
+        unsigned char *grown = (unsigned char *)json_heap_realloc(reader->buffer, reader->buffer_size * 2);
+        if (!grown)
+        {
+            json_error_set(error, JSON_ERROR_MEMORY_ALLOCATION, "Failed to grow read buffer");
+            return 0;
+        }
+        reader->buffer = grown;
+        reader->buffer_size *= 2;
+    }
+
+    size_t space = reader->buffer_size - reader->end;
+    JsonPhaseMark mark;
+    json_phase_enter(JSON_PHASE_READ, &mark);
+    size_t bytes = fread(reader->buffer + reader->end, 1, space, reader->file);
+    json_phase_leave(&mark);
+    reader->end += bytes;
+    if (bytes < space)
+    {
+        if (ferror(reader->file))
+        {
+            json_error_set(error, JSON_ERROR_FILE_READ, "Failed to read from file");
+            return 0;
+        }
+        reader->eof = 1;
+    }
+    return 1;
+}
+
+JsonValue *json_cbor_reader_next(JsonCborReader *reader, JsonError *error)
+{
+    json_error_clear(error);
+    if (!reader)
+    {
+        json_error_set(error, JSON_ERROR_INVALID_VALUE, "NULL reader passed to json_cbor_reader_next");
+        return NULL;
+    }
+
+    for (;;)
+    {
+        if (reader->start == reader->end)
+        {
+            if (reader->eof)
+                return NULL; /* Clean end of the sequence */
+            if (!reader_refill(reader, error))
+                return NULL;
+            continue;
+        }
+
+        /* Decode with a local error: a cut item is not an error yet */
+        JsonError local;
+        CborDecoder decoder;
+        decoder_init(&decoder, reader->buffer + reader->start, reader->end - reader->start,
+                     reader->offset + reader->start, &local);
+        JsonPhaseMark mark;
+        json_phase_enter(JSON_PHASE_PARSE, &mark);
+        JsonValue *value = decode_item(&decoder);
+        json_phase_leave(&mark);
+        decoder_release(&decoder);
+
+        if (value)
+        {
+            reader->start += (size_t)(decoder.p - decoder.start);
+            return value;
+        }
+        if (!decoder.truncated || reader->eof)
+        {
+            if (error)
+                *error = local;
+            return NULL;
+        }
+        if (!reader_refill(reader, error))
+            return NULL;
+    }
+}
+
+void json_cbor_reader_free(JsonCborReader *reader)
+{
+    if (!reader)
+        return;
+    if (reader->owns_file)
+        fclose(reader->file);
+    json_heap_free(reader->buffer);
+    json_heap_free(reader);
+}
@@ -0,0 +1,302 @@
+/* json_columns.c */
+#include "json_internal.h"
+#include <math.h>
+
+/* Columnar extraction. The records are visited once; every later filter
+   and aggregate is a loop over doubles and 64-bit bitmap words, which the
+   compiler can keep in registers or vectorise. Words that are fully
+   selected - the common case after a clean pass - take the branch-free
+   loops */
+
+#define ALL_ROWS (~(uint64_t)0)
+
+static size_t popcount64(uint64_t word)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (size_t)__builtin_popcountll(word);
+#else
+    size_t count = 0;
+    while (word)
+    {
+        word &= word - 1;
+        count++;
+    }
+    return count;
+#endif
+}
+
+/* Set bit of one row */
+static void bitmap_set(uint64_t *bitmap, size_t row)
+{
+    bitmap[row / 64] |= (uint64_t)1 << (row % 64);
+}
+
+/* One block per column: values, then the three bitmaps, then the name */
+static int column_init(JsonColumn *column, const char *field, size_t rows)
+{
+    size_t words = JSON_BITMAP_WORDS(rows);
+    size_t name_length = strlen(field);
+    size_t bytes = rows * sizeof(double) + 3 * words * sizeof(uint64_t) + name_length + 1;
+
+    char *block = (char *)json_heap_calloc(1, bytes);
+    if (!block)
+        return 0;
+
+    column->values = (double *)block;
+    column->valid = (uint64_t *)(block + rows * sizeof(double));
+    column->present = column->valid + words;
+    column->integers = column->present + words;
+    column->name = (char *)(column->integers + words);
+    memcpy(column->name, field, name_length + 1);
+    column->name_length = name_length;
+    column->valid_count = 0;
+    return 1;
+}
+
+static void column_store(JsonColumn *column, size_t row, const JsonValue *value)
+{
+    bitmap_set(column->present, row);
+    if (!value || value->type != JSON_NUMBER || isnan(value->value.number))
+        return;
+
+    column->values[row] = value->value.number;
+    bitmap_set(column->valid, row);
+    column->valid_count++;
+    /* Only integers the double holds exactly are formatted as integers */
+    if ((value->flags & JSON_VALUE_INTEGER) && (double)value->integer == value->value.number &&
+        fabs(value->value.number) < 9007199254740992.0)
+        bitmap_set(column->integers, row);
+}
+
+JsonColumns *json_columns_extract(const JsonValue *array, const char *const *fields, size_t field_count)
+{
+    if (!array || array->type != JSON_ARRAY || (field_count && !fields) || !JSON_VALUE_READY(array))
+        return NULL;
+
+    size_t rows = array->value.array->size;
+    size_t words = JSON_BITMAP_WORDS(rows);
+    JsonColumns *columns = (JsonColumns *)json_heap_calloc(1, sizeof(JsonColumns));
+    uint32_t *hashes = (uint32_t *)json_heap_alloc((field_count ? field_count : 1) * sizeof(uint32_t));
+    if (!columns || !hashes)
+    {
+        json_heap_free(columns);
+        json_heap_free(hashes);
+        return NULL;
+    }
+
+    columns->rows = rows;
+    columns->records = (uint64_t *)json_heap_calloc(words ? words : 1, sizeof(uint64_t));
+    columns->columns = (JsonColumn *)json_heap_calloc(field_count ? field_count : 1, sizeof(JsonColumn));
+    int ok = columns->records && columns->columns;
+    for (size_t f = 0; ok && f < field_count; f++)
+    {
+        ok = fields[f] && column_init(&columns->columns[f], fields[f], rows);
+        if (ok)
+        {
+            columns->column_count++;
+            hashes[f] = json_hash_key(fields[f], columns->columns[f].name_length);
+        }
+    }
+
+    /* One walk over each record's pairs; pairs carry their key hash */
+    for (size_t row = 0; ok && row < rows; row++)
+    {
+        const JsonValue *record = array->value.array->items[row];
+        if (!record || record->type != JSON_OBJECT)
+            continue;
+        if (!JSON_VALUE_READY(record))
+        {
+            ok = 0;
+            break;
+        }
+        bitmap_set(columns->records, row);
+
+        for (const JsonKeyValue *pair = record->value.object->pairs; pair; pair = pair->next)
+        {
+            for (size_t f = 0; f < field_count; f++)
+            {
+                JsonColumn *column = &columns->columns[f];
+                if (pair->hash == hashes[f] && pair->key_length == column->name_length &&
+                    memcmp(pair->key, column->name, column->name_length) == 0)
+                {
+                    column_store(column, row, pair->value);
+                    break;
+                }
+            }
+        }
+    }
+
+    json_heap_free(hashes);
+    if (!ok)
+    {
+        json_columns_free(columns);
+        return NULL;
+    }
+    return columns;
+}
+
+void json_columns_free(JsonColumns *columns)
+{
+    if (!columns)
+        return;
+    if (columns->columns)
+    {
+        for (size_t f = 0; f < columns->column_count; f++)
+            json_heap_free(columns->columns[f].values);
+    }
+    json_heap_free(columns->columns);
+    json_heap_free(columns->records);
+    json_heap_free(columns);
+}
+
+const JsonColumn *json_columns_find(const JsonColumns *columns, const char *field)
+{
+    if (!columns || !field)
+        return NULL;
+    for (size_t f = 0; f < columns->column_count; f++)
+    {
+        if (strcmp(columns->columns[f].name, field) == 0)
+            return &columns->columns[f];
+    }
+    return NULL;
+}
+
+size_t json_columns_count(const JsonColumns *columns, const uint64_t *selection)
+{
+    if (!columns || !selection)
+        return 0;
+    size_t count = 0;
+    for (size_t w = 0; w < JSON_BITMAP_WORDS(columns->rows); w++)
+        count += popcount64(selection[w]);
+    return count;
+}
+
+size_t json_columns_select_all(const JsonColumns *columns, uint64_t *selection)
+{
+    if (!columns || !selection)
+        return 0;
+    memcpy(selection, columns->records, JSON_BITMAP_WORDS(columns->rows) * sizeof(uint64_t));
+    return json_columns_count(columns, selection);
+}
+
+size_t json_columns_select_clean(const JsonColumns *columns, const JsonColumn *column,
+                                 uint64_t *selection, JsonCleanStats *stats)
+{
+    if (!columns || !column || !selection)
+        return 0;
+
+    size_t words = JSON_BITMAP_WORDS(columns->rows);
+    size_t before = 0, kept = 0;
+    for (size_t w = 0; w < words; w++)
+    {
+        uint64_t selected = selection[w] & columns->records[w];
+        before += popcount64(selected);
+        selection[w] = selected & (~column->present[w] | column->valid[w]);
+        kept += popcount64(selection[w]);
+    }
+
+    if (stats)
+    {
+        stats->original_count = columns->rows;
+        stats->cleaned_count = kept;
+        stats->removed_count = before - kept;
+    }
+    return kept;
+}
+
+size_t json_columns_select_range(const JsonColumns *columns, const JsonColumn *column,
+                                 double min, double max, uint64_t *selection)
+{
+    if (!columns || !column || !selection)
+        return 0;
+
+    size_t words = JSON_BITMAP_WORDS(columns->rows);
+    size_t kept = 0;
+    for (size_t w = 0; w < words; w++)
+    {
+        uint64_t candidates = selection[w] & column->valid[w];
+        if (!candidates)
+        {
+            selection[w] = 0;
+            continue;
+        }
+
+        const double *values = column->values + w * 64;
+        size_t count = w + 1 < words ? 64 : columns->rows - w * 64;
+        uint64_t in_range = 0;
+        for (size_t i = 0; i < count; i++)
+            in_range |= (uint64_t)((values[i] >= min) & (values[i] <= max)) << i;
+
+        selection[w] = candidates & in_range;
+        kept += popcount64(selection[w]);
+    }
+    return kept;
+}
+
+void json_column_stats(const JsonColumns *columns, const JsonColumn *column,
+                       const uint64_t *selection, JsonColumnStats *stats)
+{
+    if (!stats)
+        return;
+    stats->count = 0;
+    stats->sum = 0.0;
+    stats->min = stats->max = stats->mean = NAN;
+    if (!columns || !column)
+        return;
+
+    /* Four accumulators break the dependency chain of the full-word loop */
+    double sum[4] = {0.0, 0.0, 0.0, 0.0};
+    double low = INFINITY, high = -INFINITY;
+    size_t count = 0;
+    size_t words = JSON_BITMAP_WORDS(columns->rows);
+
+    for (size_t w = 0; w < words; w++)
+    {
+        uint64_t rows = column->valid[w] & (selection ? selection[w] : ALL_ROWS);
+        if (!rows)
+            continue;
+
+        const double *values = column->values + w * 64;
+        if (rows == ALL_ROWS)
+        {
+            for (size_t i = 0; i < 64; i += 4)
+            {
+                for (size_t lane = 0; lane < 4; lane++)
+                {
+                    double v = values[i + lane];
+                    sum[lane] += v;
+                    low = v < low ? v : low;
+                    high = v > high ? v : high;
+                }
+            }
+            count += 64;
+            continue;
+        }
+
+        while (rows)
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            size_t i = (size_t)__builtin_ctzll(rows);
+#else
+            size_t i = 0;
+            while (!((rows >> i) & 1u))
+                i++;
+#endif
+            double v = values[i];
+            sum[0] += v;
+            low = v < low ? v : low;
+            high = v > high ? v : high;
+            count++;
+            rows &= rows - 1;
+        }
+    }
+
+    stats->count = count;
+    stats->sum = (sum[0] + sum[1]) + (sum[2] + sum[3]);
+    if (count)
+    {
+        stats->min = low;
+        stats->max = high;
+        stats->mean = stats->sum / (double)count;
+    }
+}
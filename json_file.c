@@ -1,11 +1,12 @@
 /* json_file.c */
-#include "json.h"
+#include "json_internal.h"
+#include <ctype.h>
 
 #define DEFAULT_BUFFER_SIZE (8192)
 #define DEFAULT_TEMP_SUFFIX ".tmp"
 
-/* File operation error state */
-static JsonError file_error = {
+/* File operation error state, one per thread */
+static JSON_THREAD_LOCAL JsonError file_error = {
     .code = JSON_ERROR_NONE,
     .line = 0,
     .column = 0,
@@ -35,19 +36,13 @@ int json_write_stream(const JsonValue* value, FILE* stream) {
         return 0;
     }
 
-    /* Format the value using compact formatting by default */
-    char* json_str = json_format_string(value, &JSON_FORMAT_COMPACT);
-    if (!json_str) {
-        set_file_error(JSON_ERROR_MEMORY_ALLOCATION, "Failed to format JSON");
-        return 0;
-    }
-
-    size_t len = strlen(json_str);
-    size_t written = fwrite(json_str, 1, len, stream);
-    free(json_str);
-
-    if (written != len) {
-        set_file_error(JSON_ERROR_FILE_WRITE, "Failed to write complete data to stream");
+    /* Stream the value using compact formatting by default */
+    if (!json_format_stream(value, stream, &JSON_FORMAT_COMPACT)) {
+        if (ferror(stream)) {
+            set_file_error(JSON_ERROR_FILE_WRITE, "Failed to write complete data to stream");
+        } else {
+            set_file_error(JSON_ERROR_MEMORY_ALLOCATION, "Failed to format JSON");
+        }
         return 0;
     }
 
@@ -60,44 +55,14 @@ JsonValue* json_parse_stream(FILE* stream) {
         return NULL;
     }
 
-    long current_pos = ftell(stream);
-    if (current_pos < 0) {
-        set_file_error(JSON_ERROR_FILE_READ, "Failed to determine stream position");
-        return NULL;
-    }
-
-    if (fseek(stream, 0, SEEK_END) != 0) {
-        set_file_error(JSON_ERROR_FILE_READ, "Failed to seek stream");
-        return NULL;
-    }
-
-    long size = ftell(stream);
-    if (size < 0) {
-        set_file_error(JSON_ERROR_FILE_READ, "Failed to determine stream size");
-        return NULL;
-    }
-
-    if (fseek(stream, current_pos, SEEK_SET) != 0) {
-        set_file_error(JSON_ERROR_FILE_READ, "Failed to restore stream position");
-        return NULL;
-    }
-
-    char* buffer = (char*)malloc(size + 1);
-    if (!buffer) {
-        set_file_error(JSON_ERROR_MEMORY_ALLOCATION, "Failed to allocate buffer for file reading");
-        return NULL;
-    }
-
-    size_t read_size = fread(buffer, 1, size, stream);
-    if (read_size != (size_t)size) {
-        set_file_error(JSON_ERROR_FILE_READ, "Failed to read complete stream");
-        free(buffer);
+    /* Map (or read) the rest of the stream and parse it in place */
+    JsonFileView view;
+    if (!json_file_view_open_stream(&view, stream, &file_error)) {
         return NULL;
     }
 
-    buffer[size] = '\0';
-    JsonValue* result = json_parse_string(buffer);
-    free(buffer);
+    JsonValue* result = json_parse_buffer(view.data, view.length);
+    json_file_view_close(&view);
 
     if (!result) {
         const JsonError* parse_error = json_get_last_error();
@@ -108,7 +73,7 @@ JsonValue* json_parse_stream(FILE* stream) {
 }
 
 /* Basic file writing */
-int json_write_file(const JsonValue* value, const char* filename) {
+static int write_file(const JsonValue* value, const char* filename) {
     if (!value || !filename) {
         set_file_error(JSON_ERROR_INVALID_VALUE, "Invalid parameters for file writing");
         return 0;
@@ -136,6 +101,15 @@ int json_write_file(const JsonValue* value, const char* filename) {
     return 1;
 }
 
+/* File writes count as the write phase, except the formatting inside */
+int json_write_file(const JsonValue* value, const char* filename) {
+    JsonPhaseMark mark;
+    json_phase_enter(JSON_PHASE_WRITE, &mark);
+    int result = write_file(value, filename);
+    json_phase_leave(&mark);
+    return result;
+}
+
 /* Partial file reading */
 JsonFileReader* json_file_reader_create(const char* filename, size_t buffer_size) {
     if (!filename) {
@@ -143,7 +117,7 @@ JsonFileReader* json_file_reader_create(const char* filename, size_t buffer_size
         return NULL;
     }
 
-    JsonFileReader* reader = (JsonFileReader*)malloc(sizeof(JsonFileReader));
+    JsonFileReader* reader = (JsonFileReader*)json_heap_calloc(1, sizeof(JsonFileReader));
     if (!reader) {
         set_file_error(JSON_ERROR_MEMORY_ALLOCATION, "Failed to allocate file reader");
         return NULL;
@@ -152,16 +126,17 @@ JsonFileReader* json_file_reader_create(const char* filename, size_t buffer_size
     reader->file = fopen(filename, "rb");
     if (!reader->file) {
         set_file_error(JSON_ERROR_FILE_READ, "Failed to open file for reading");
-        free(reader);
+        json_heap_free(reader);
         return NULL;
     }
 
-    reader->buffer_size = buffer_size ? buffer_size : DEFAULT_BUFFER_SIZE;
-    reader->buffer = (char*)malloc(reader->buffer_size);
+    /* One byte is kept free to NUL terminate a value in place */
+    reader->buffer_size = buffer_size > 1 ? buffer_size : DEFAULT_BUFFER_SIZE;
+    reader->buffer = (char*)json_heap_alloc(reader->buffer_size);
     if (!reader->buffer) {
         set_file_error(JSON_ERROR_MEMORY_ALLOCATION, "Failed to allocate read buffer");
         fclose(reader->file);
-        free(reader);
+        json_heap_free(reader);
         return NULL;
     }
 
@@ -169,25 +144,178 @@ JsonFileReader* json_file_reader_create(const char* filename, size_t buffer_size
     return reader;
 }
 
+/* Bytes that end a bare scalar (number, true, false, null) */
+static int is_value_delimiter(char c) {
+    return isspace((unsigned char)c) || c == '[' || c == ']' || c == '{' ||
+           c == '}' || c == ',' || c == ':' || c == '"';
+}
+
+/* Scan for the end of the top-level value starting at data_start. The scan
+   state is kept in the reader so a refill continues where it stopped.
+   Returns the end offset, or 0 if more data is needed */
+static size_t find_value_end(JsonFileReader* reader) {
+    const char* buffer = reader->buffer;
+    size_t pos = reader->scan_pos;
+
+    /* Anything not starting a container or string is a bare scalar */
+    char first = buffer[reader->data_start];
+    if (first != '[' && first != '{' && first != '"') {
+        if (is_value_delimiter(first)) {
+            /* Stray delimiter: hand it to the parser on its own */
+            reader->scan_pos = reader->data_start + 1;
+            return reader->scan_pos;
+        }
+        while (pos < reader->data_end && !is_value_delimiter(buffer[pos])) {
+            pos++;
+        }
+        reader->scan_pos = pos;
+        if (pos < reader->data_end || reader->eof) {
+            return pos;
+        }
+        return 0;
+    }
+
+    while (pos < reader->data_end) {
+        char c = buffer[pos++];
+        if (reader->scan_in_string) {
+            if (reader->scan_escape) {
+                reader->scan_escape = 0;
+            } else if (c == '\\') {
+                reader->scan_escape = 1;
+            } else if (c == '"') {
+                reader->scan_in_string = 0;
+                if (reader->scan_depth == 0) {
+                    reader->scan_pos = pos;
+                    return pos;
+                }
+            }
+        } else if (c == '"') {
+            reader->scan_in_string = 1;
+        } else if (c == '[' || c == '{') {
+            reader->scan_depth++;
+        } else if (c == ']' || c == '}') {
+            if (reader->scan_depth > 0 && --reader->scan_depth == 0) {
+                reader->scan_pos = pos;
+                return pos;
+            }
+        }
+    }
+
+    reader->scan_pos = pos;
+    return 0;
+}
+
+/* Move unconsumed data to the front of the buffer, grow it if it is full,
+   and read more. Returns 0 on error */
+static int refill_reader(JsonFileReader* reader) {
+    size_t start = reader->data_start;
+    if (start > 0) {
+        memmove(reader->buffer, reader->buffer + start, reader->data_end - start);
+        reader->data_end -= start;
+        reader->scan_pos -= start;
+        reader->data_start = 0;
+    }
+
+    if (reader->data_end + 1 >= reader->buffer_size) {
+        size_t new_size = reader->buffer_size * 2;
+        char* new_buffer = (char*)json_heap_realloc(reader->buffer, new_size);
+        if (!new_buffer) {
+            set_file_error(JSON_ERROR_MEMORY_ALLOCATION, "Failed to grow read buffer");
+            return 0;
+        }
+        reader->buffer = new_buffer;
+        reader->buffer_size = new_size;
+    }
+
+    size_t space = reader->buffer_size - 1 - reader->data_end;
+    JsonPhaseMark mark;
+    json_phase_enter(JSON_PHASE_READ, &mark);
+    size_t bytes = fread(reader->buffer + reader->data_end, 1, space, reader->file);
+    json_phase_leave(&mark);
+    reader->data_end += bytes;
+    reader->bytes_read += bytes;
+
+    if (bytes < space) {
+        if (ferror(reader->file)) {
+            set_file_error(JSON_ERROR_FILE_READ, "Failed to read from file");
+            return 0;
+        }
+        reader->eof = 1;
+    }
+    return 1;
+}
+
+/* Return the next top-level value in the file. Values may span any number
+   of refills; the caller owns the result and frees it with json_free() */
 JsonValue* json_file_reader_next(JsonFileReader* reader) {
     if (!reader || !reader->file || !reader->buffer) {
         set_file_error(JSON_ERROR_INVALID_VALUE, "Invalid file reader");
         return NULL;
     }
+    file_error.code = JSON_ERROR_NONE;
 
-    size_t bytes = fread(reader->buffer, 1, reader->buffer_size - 1, reader->file);
-    if (bytes == 0) {
-        if (feof(reader->file)) {
+    /* Skip whitespace between values */
+    for (;;) {
+        while (reader->data_start < reader->data_end &&
+               isspace((unsigned char)reader->buffer[reader->data_start])) {
+            reader->data_start++;
+        }
+        if (reader->data_start < reader->data_end) {
+            break;
+        }
+        if (reader->eof) {
             return NULL; /* Normal EOF */
         }
-        set_file_error(JSON_ERROR_FILE_READ, "Failed to read from file");
-        return NULL;
+        reader->data_start = reader->data_end = 0;
+        if (!refill_reader(reader)) {
+            return NULL;
+        }
     }
 
-    reader->buffer[bytes] = '\0';
-    reader->bytes_read += bytes;
+    reader->scan_pos = reader->data_start;
+    reader->scan_depth = 0;
+    reader->scan_in_string = 0;
+    reader->scan_escape = 0;
+
+    size_t end;
+    while ((end = find_value_end(reader)) == 0) {
+        if (reader->eof) {
+            /* Truncated value: let the parser report what is wrong */
+            end = reader->data_end;
+            break;
+        }
+        if (!refill_reader(reader)) {
+            return NULL;
+        }
+    }
+
+    /* Parse the value in place; the spare byte holds the terminator */
+    char saved = reader->buffer[end];
+    reader->buffer[end] = '\0';
+    JsonValue* value;
+    if (reader->keys) {
+        JsonError error;
+        value = json_parse_buffer_keys_r(reader->buffer + reader->data_start, end - reader->data_start,
+                                         reader->keys, &error);
+        if (!value) {
+            set_file_error(error.code, error.message);
+        }
+    } else {
+        value = json_parse_string(reader->buffer + reader->data_start);
+        if (!value) {
+            const JsonError* parse_error = json_get_last_error();
+            set_file_error(parse_error->code, parse_error->message);
+        }
+    }
+    reader->buffer[end] = saved;
+    reader->data_start = end;
+    return value;
+}
 
-    return json_parse_string(reader->buffer);
+void json_file_reader_set_key_table(JsonFileReader* reader, JsonKeyTable* keys) {
+    if (reader) {
+        reader->keys = keys;
+    }
 }
 
 void json_file_reader_free(JsonFileReader* reader) {
@@ -195,14 +323,15 @@ void json_file_reader_free(JsonFileReader* reader) {
         if (reader->file) {
             fclose(reader->file);
         }
-        free(reader->buffer);
-        free(reader);
+        json_heap_free(reader->buffer);
+        json_heap_free(reader);
     }
 }
 
-/* File writing with configuration */
-int json_write_file_ex(const JsonValue* value, const char* filename,
-                      const JsonFileWriteConfig* config) {
+/* File writing with configuration, for any stream writer */
+int json_write_file_with(const JsonValue* value, const char* filename,
+                         const JsonFileWriteConfig* config,
+                         JsonStreamWriter writer, void* context) {
     if (!value || !filename) {
         set_file_error(JSON_ERROR_INVALID_VALUE, "Invalid parameters for file writing");
         return 0;
@@ -219,7 +348,7 @@ int json_write_file_ex(const JsonValue* value, const char* filename,
 
     /* Create temporary filename */
     size_t temp_name_len = strlen(filename) + strlen(cfg->temp_suffix) + 1;
-    char* temp_filename = (char*)malloc(temp_name_len);
+    char* temp_filename = (char*)json_heap_alloc(temp_name_len);
     if (!temp_filename) {
         set_file_error(JSON_ERROR_MEMORY_ALLOCATION, "Failed to allocate temporary filename");
         return 0;
@@ -231,21 +360,21 @@ int json_write_file_ex(const JsonValue* value, const char* filename,
     FILE* file = fopen(temp_filename, "wb");
     if (!file) {
         set_file_error(JSON_ERROR_FILE_WRITE, "Failed to create temporary file");
-        free(temp_filename);
+        json_heap_free(temp_filename);
         return 0;
     }
 
     /* Set up buffering if requested */
     char* buffer = NULL;
     if (cfg->buffer_size > 0) {
-        buffer = (char*)malloc(cfg->buffer_size);
+        buffer = (char*)json_heap_alloc(cfg->buffer_size);
         if (buffer) {
             setvbuf(file, buffer, _IOFBF, cfg->buffer_size);
         }
     }
 
-    /* Write JSON to temporary file */
-    int success = json_write_stream(value, file);
+    /* Write the value to the temporary file */
+    int success = writer(value, file, context);
 
     /* Flush and close */
     if (success && cfg->sync_on_close) {
@@ -256,7 +385,7 @@ int json_write_file_ex(const JsonValue* value, const char* filename,
     }
 
     fclose(file);
-    free(buffer);
+    json_heap_free(buffer);
 
     if (success) {
         /* Rename temporary file to target filename */
@@ -279,6 +408,20 @@ int json_write_file_ex(const JsonValue* value, const char* filename,
         remove(temp_filename); /* Clean up temp file on failure */
     }
 
-    free(temp_filename);
+    json_heap_free(temp_filename);
     return success;
-}
\ No newline at end of file
+}
+
+static int write_json_stream(const JsonValue* value, FILE* stream, void* context) {
+    (void)context;
+    return json_write_stream(value, stream);
+}
+
+int json_write_file_ex(const JsonValue* value, const char* filename,
+                      const JsonFileWriteConfig* config) {
+    JsonPhaseMark mark;
+    json_phase_enter(JSON_PHASE_WRITE, &mark);
+    int result = json_write_file_with(value, filename, config, write_json_stream, NULL);
+    json_phase_leave(&mark);
+    return result;
+}
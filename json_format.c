@@ -1,8 +1,18 @@
 /* json_format.c */
-#include "json.h"
+#include "json_internal.h"
 #include <math.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#include <errno.h>
 
-static JsonError current_error;
+#define JSON_FORMAT_SINK_BUFFER_SIZE (16 * 1024)
+#define JSON_FORMAT_INITIAL_CAPACITY 1024
+#define JSON_FORMAT_INDENT_RUN 256 /* Indentation copied per memcpy */
+
+static JSON_THREAD_LOCAL JsonError current_error; /* One per thread */
 
 static void set_format_error(JsonErrorCode code, const char *message)
 {
@@ -51,7 +61,9 @@ const JsonFormatConfig JSON_FORMAT_PRETTY = {
     .sort_object_keys = 1,
 };
 
-/* Helper struct for string building */
+/* Helper struct for string building. With a sink the buffer has a fixed
+   size and is flushed to the sink whenever it fills up. A measuring
+   builder has no buffer and only counts the bytes it would write */
 typedef struct
 {
     char *buffer;
@@ -59,6 +71,15 @@ typedef struct
     size_t capacity;
     const JsonFormatConfig *config;
     int indent_level;
+    JsonWriteCallback sink; /* NULL to grow the buffer instead */
+    void *sink_data;
+    int sink_failed;        /* Set once the sink reported an error */
+    int borrowed;           /* buffer is the caller's: grow by copying, never free */
+    int measuring;
+    size_t indent_length;
+    size_t line_end_length;
+    size_t indent_run_length; /* indent_run holds a whole number of indent strings */
+    char indent_run[JSON_FORMAT_INDENT_RUN];
 } StringBuilder;
 
 /* Helper to skip values around NaN */
@@ -67,45 +88,86 @@ static int should_skip_value(const JsonValue *value)
     return value && value->type == JSON_NUMBER && isnan(value->value.number);
 }
 
-/* Pretty Print functions */
-static StringBuilder *string_builder_create(const JsonFormatConfig *config)
+/* Set up a builder over buffer, which may be NULL with capacity 0. The
+   builder lives on the caller's stack; only its buffer is ever allocated.
+   The config string lengths and the indent run are worked out once here,
+   so no append needs strlen() */
+static void string_builder_init(StringBuilder *sb, const JsonFormatConfig *config, char *buffer, size_t capacity)
 {
-    StringBuilder *sb = (StringBuilder *)malloc(sizeof(StringBuilder));
-    if (!sb)
+    sb->buffer = buffer;
+    sb->size = 0;
+    sb->capacity = capacity;
+    sb->config = config;
+    sb->indent_level = 0;
+    sb->sink = NULL;
+    sb->sink_data = NULL;
+    sb->sink_failed = 0;
+    sb->borrowed = 0;
+    sb->measuring = 0;
+    sb->indent_length = strlen(config->indent_string);
+    sb->line_end_length = strlen(config->line_end);
+
+    sb->indent_run_length = 0;
+    if (sb->indent_length && sb->indent_length <= sizeof(sb->indent_run))
     {
-        set_format_error(JSON_ERROR_FORMAT_MEMORY_ALLOCATION, "Failed to allocate StringBuilder");
-        return NULL;
+        while (sb->indent_run_length + sb->indent_length <= sizeof(sb->indent_run))
+        {
+            memcpy(sb->indent_run + sb->indent_run_length, config->indent_string, sb->indent_length);
+            sb->indent_run_length += sb->indent_length;
+        }
     }
+}
 
-    sb->capacity = 1024; /* Initial capacity */
-    sb->buffer = (char *)malloc(sb->capacity);
-
-    if (!sb->buffer)
+/* Hand the buffered output to the sink */
+static int string_builder_flush(StringBuilder *sb)
+{
+    if (sb->sink_failed)
+        return 0;
+    if (sb->size == 0)
+        return 1;
+    JsonPhaseMark mark;
+    json_phase_enter(JSON_PHASE_WRITE, &mark);
+    int written = sb->sink(sb->buffer, sb->size, sb->sink_data);
+    json_phase_leave(&mark);
+    if (!written)
     {
-        free(sb);
-        set_format_error(JSON_ERROR_FORMAT_MEMORY_ALLOCATION, "Failed to allocate StringBuilder buffer");
-        return NULL;
+        sb->sink_failed = 1;
+        set_format_error(JSON_ERROR_FORMAT_FILE_WRITE, "Failed to write formatted JSON");
+        return 0;
     }
-
     sb->size = 0;
-    sb->buffer[0] = '\0';
-    sb->config = config;
-    sb->indent_level = 0;
-    return sb;
+    return 1;
 }
 
 /* Ensure the string builder has enough capacity */
 static int string_builder_ensure_capacity(StringBuilder *sb, size_t additional)
 {
-    if (sb->size + additional >= sb->capacity)
+    if (sb->sink && sb->size + additional > sb->capacity)
+    {
+        /* Flush first; only grow for a single append larger than the buffer */
+        if (!string_builder_flush(sb))
+            return 0;
+    }
+    if (sb->size + additional > sb->capacity)
     {
-        size_t new_capacity = sb->capacity * 2;
-        while (sb->size + additional >= new_capacity)
+        size_t new_capacity = sb->capacity ? sb->capacity * 2 : JSON_FORMAT_INITIAL_CAPACITY;
+        while (sb->size + additional > new_capacity)
         {
             new_capacity *= 2;
         }
 
-        char *new_buffer = (char *)realloc(sb->buffer, new_capacity);
+        char *new_buffer;
+        if (sb->borrowed)
+        {
+            /* Leave the caller's storage as it is */
+            new_buffer = (char *)json_heap_alloc(new_capacity);
+            if (new_buffer)
+                memcpy(new_buffer, sb->buffer, sb->size);
+        }
+        else
+        {
+            new_buffer = (char *)json_heap_realloc(sb->buffer, new_capacity);
+        }
         if (!new_buffer)
         {
             set_format_error(JSON_ERROR_FORMAT_MEMORY_ALLOCATION, "Failed to relocate StringBuilder buffer");
@@ -114,22 +176,97 @@ static int string_builder_ensure_capacity(StringBuilder *sb, size_t additional)
 
         sb->buffer = new_buffer;
         sb->capacity = new_capacity;
+        sb->borrowed = 0;
+        JSON_STATS_ADD(builder_reallocs, 1);
+    }
+    return 1;
+}
+
+/* Append length bytes of str to the builder. The buffer is NUL
+   terminated only once the document is complete */
+static int string_builder_append_length(StringBuilder *sb, const char *str, size_t length)
+{
+    if (sb->measuring)
+    {
+        sb->size += length;
+        return 1;
     }
+    if (!string_builder_ensure_capacity(sb, length + 1))
+        return 0;
+
+    memcpy(sb->buffer + sb->size, str, length);
+    sb->size += length;
     return 1;
 }
 
-/* Append a string to the builder */
-static int string_builder_append(StringBuilder *sb, const char *str)
+/* NUL terminate the output; the appends leave room for it */
+static int string_builder_terminate(StringBuilder *sb)
 {
-    size_t len = strlen(str);
-    if (!string_builder_ensure_capacity(sb, len + 1))
+    if (!string_builder_ensure_capacity(sb, 1))
         return 0;
+    sb->buffer[sb->size] = '\0';
+    return 1;
+}
+
+/* Append a string literal */
+#define string_builder_append_literal(sb, literal) \
+    string_builder_append_length((sb), (literal), sizeof(literal) - 1)
 
-    strcpy(sb->buffer + sb->size, str);
-    sb->size += len;
+/* Append count spaces */
+static int string_builder_append_spaces(StringBuilder *sb, int count)
+{
+    static const char spaces[] = "                ";
+    while (count > 0)
+    {
+        size_t chunk = count < (int)sizeof(spaces) - 1 ? (size_t)count : sizeof(spaces) - 1;
+        if (!string_builder_append_length(sb, spaces, chunk))
+            return 0;
+        count -= (int)chunk;
+    }
     return 1;
 }
 
+/* Append the configured line ending */
+static int string_builder_append_line_end(StringBuilder *sb)
+{
+    return string_builder_append_length(sb, sb->config->line_end, sb->line_end_length);
+}
+
+/* Longest text the number formats below write for num, for measuring
+   without calling snprintf(). Rounding may carry into one more digit */
+static size_t number_length_bound(const JsonFormatConfig *config, double num)
+{
+    size_t fraction = config->precision ? (size_t)config->precision + 1 : 0;
+    size_t scientific = 2 + fraction + 5; /* Sign, digit, fraction, "e+308" */
+    double magnitude = fabs(num);
+    size_t bound;
+
+    switch (config->number_format)
+    {
+    case JSON_NUMBER_FORMAT_DECIMAL:
+    {
+        /* Integer digits, counted without libm; the cap keeps this short
+           for numbers too long to format anyway */
+        size_t digits = 1;
+        for (double limit = 10.0; magnitude >= limit && digits < 32; limit *= 10.0)
+            digits++;
+        bound = 1 + digits + 1 + fraction; /* Sign, digits, carry, fraction */
+        break;
+    }
+
+    case JSON_NUMBER_FORMAT_SCIENTIFIC:
+        bound = scientific;
+        break;
+
+    case JSON_NUMBER_FORMAT_AUTO:
+    default:
+        /* Decimal only below 100000: at most six integer digits */
+        bound = (magnitude < 0.0001 || magnitude > 100000.0) ? scientific : 1 + 6 + fraction;
+        break;
+    }
+    return bound < 32 ? bound : 31; /* Longer numbers fail to format */
+}
+
 /* Format and append a number */
 static int string_builder_append_number(StringBuilder *sb, double num)
 {
@@ -148,6 +285,12 @@ static int string_builder_append_number(StringBuilder *sb, double num)
         return 0;
     }
 
+    if (sb->measuring && sb->config->number_format != JSON_NUMBER_FORMAT_SHORTEST)
+    {
+        sb->size += number_length_bound(sb->config, num);
+        return 1;
+    }
+
     char buffer[32];
     int len;
 
@@ -161,6 +304,10 @@ static int string_builder_append_number(StringBuilder *sb, double num)
         len = snprintf(buffer, sizeof(buffer), "%.*e", sb->config->precision, num);
         break;
 
+    case JSON_NUMBER_FORMAT_SHORTEST:
+        len = json_number_format_shortest(num, buffer);
+        break;
+
     case JSON_NUMBER_FORMAT_AUTO:
     default:
         if (fabs(num) < 0.0001 || fabs(num) > 100000.0)
@@ -174,276 +321,609 @@ static int string_builder_append_number(StringBuilder *sb, double num)
         break;
     }
 
-    if (len < 0 || len >= sizeof(buffer))
+    if (len < 0 || len >= (int)sizeof(buffer))
         return 0;
-    return string_builder_append(sb, buffer);
+    return string_builder_append_length(sb, buffer, (size_t)len);
+}
+
+/* Append an exact integer (numbers flagged JSON_VALUE_INTEGER) */
+static int string_builder_append_integer(StringBuilder *sb, int64_t num)
+{
+    char buffer[24];
+    char *end = buffer + sizeof(buffer);
+    char *p = end;
+    /* Work on the magnitude as unsigned so INT64_MIN does not overflow */
+    uint64_t magnitude = num < 0 ? 0 - (uint64_t)num : (uint64_t)num;
+
+    do
+    {
+        *--p = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+    if (num < 0)
+        *--p = '-';
+
+    return string_builder_append_length(sb, p, (size_t)(end - p));
 }
 
-/* Append current indentaion level */
+/* Append current indentaion level, a run of indent strings at a time */
 static int string_builder_append_indent(StringBuilder *sb)
 {
-    for (int i = 0; i < sb->indent_level; i++)
+    if (!sb->indent_length || sb->indent_level <= 0)
+        return 1; /* Compact output: nothing to repeat, however deep */
+
+    size_t total = sb->indent_length * (size_t)sb->indent_level;
+    if (!sb->indent_run_length)
     {
-        if (!string_builder_append(sb, sb->config->indent_string))
+        /* Indent strings longer than the run go one level at a time */
+        for (int i = 0; i < sb->indent_level; i++)
+        {
+            if (!string_builder_append_length(sb, sb->config->indent_string, sb->indent_length))
+                return 0;
+        }
+        return 1;
+    }
+    while (total > 0)
+    {
+        size_t chunk = total < sb->indent_run_length ? total : sb->indent_run_length;
+        if (!string_builder_append_length(sb, sb->indent_run, chunk))
             return 0;
+        total -= chunk;
     }
     return 1;
 }
 
-/* Helper function for string escapting */
-static int string_builder_append_escaped_string(StringBuilder *sb, const char *str)
+/* First byte in [p, end) that must be escaped. Short runs are scanned
+   here; longer ones go to the vector kernels, 16 or 32 bytes per step */
+static const char *find_escape(const char *p, const char *end)
 {
-    if (!string_builder_append(sb, "\""))
-        return 0;
+    if (end - p >= 16)
+        return json_scan_string(p, end);
+    while (p < end && *p != '"' && *p != '\\' && (unsigned char)*p >= 0x20)
+        p++;
+    return p;
+}
 
-    for (const char *p = str; *p; p++)
+/* Write the quoted, escaped form of a string. Shared with the key tables,
+   which keep the result for every interned key. Runs that need no
+   escaping are copied with one memcpy each */
+size_t json_escape_string(char *out, const char *str, size_t length)
+{
+    static const char hex[] = "0123456789abcdef";
+    const char *end = str + length;
+    char *p = out;
+    *p++ = '"';
+    while (str < end)
     {
-        char escaped[8];
-        switch (*p)
+        const char *special = find_escape(str, end);
+        memcpy(p, str, (size_t)(special - str));
+        p += special - str;
+        if (special == end)
+            break;
+        str = special + 1;
+
+        unsigned char byte = (unsigned char)*special;
+        switch (byte)
         {
         case '"':
-            strcpy(escaped, "\\\"");
+            *p++ = '\\';
+            *p++ = '"';
             break;
         case '\\':
-            strcpy(escaped, "\\\\");
+            *p++ = '\\';
+            *p++ = '\\';
             break;
         case '\b':
-            strcpy(escaped, "\\b");
+            *p++ = '\\';
+            *p++ = 'b';
             break;
         case '\f':
-            strcpy(escaped, "\\f");
+            *p++ = '\\';
+            *p++ = 'f';
             break;
         case '\n':
-            strcpy(escaped, "\\n");
+            *p++ = '\\';
+            *p++ = 'n';
             break;
         case '\r':
-            strcpy(escaped, "\\r");
+            *p++ = '\\';
+            *p++ = 'r';
             break;
         case '\t':
-            strcpy(escaped, "\\t");
+            *p++ = '\\';
+            *p++ = 't';
             break;
         default:
-            if ((unsigned char)*p < 32)
-            {
-                snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char)*p);
-            }
-            else
-            {
-                escaped[0] = *p;
-                escaped[1] = '\0';
-            }
+            /* Any other control character */
+            memcpy(p, "\\u00", 4);
+            p[4] = hex[byte >> 4];
+            p[5] = hex[byte & 15];
+            p += 6;
             break;
         }
-        if (!string_builder_append(sb, escaped))
-            return 0;
     }
+    *p++ = '"';
+    return (size_t)(p - out);
+}
 
-    return string_builder_append(sb, "\"");
+/* Length json_escape_string() writes for str, quotes included */
+static size_t escaped_length(const char *str, size_t length)
+{
+    const char *end = str + length;
+    size_t total = length + 2;
+    for (const char *special = find_escape(str, end); special < end; special = find_escape(special + 1, end))
+    {
+        unsigned char byte = (unsigned char)*special;
+        if (byte == '"' || byte == '\\' || byte == '\b' || byte == '\f' || byte == '\n' || byte == '\r' ||
+            byte == '\t')
+            total += 1;
+        else
+            total += 5;
+    }
+    return total;
 }
 
-/* Forward declaration for recursive formatting */
-static int format_value(StringBuilder *sb, const JsonValue *value);
+/* Helper function for string escapting */
+static int string_builder_append_escaped_string(StringBuilder *sb, const char *str, size_t length)
+{
+    if (sb->measuring)
+    {
+        sb->size += escaped_length(str, length);
+        return 1;
+    }
+    /* Reserve for the worst case unless that would grow a buffer the
+       exact length fits in */
+    size_t needed = JSON_ESCAPED_MAX(length);
+    if (sb->size + needed + 1 > sb->capacity)
+        needed = escaped_length(str, length);
+    if (!string_builder_ensure_capacity(sb, needed + 1))
+        return 0;
+
+    sb->size += json_escape_string(sb->buffer + sb->size, str, length);
+    return 1;
+}
+
+/* Helper structure for sorting object keys */
+typedef struct
+{
+    const char *key;
+    size_t key_length;
+    JsonValue *value;
+    uint32_t flags;
+} KeyValuePair;
+
+/* Comparision functiuon for sorting keys */
+static int compare_keys(const void *a, const void *b)
+{
+    const KeyValuePair *pa = (const KeyValuePair *)a;
+    const KeyValuePair *pb = (const KeyValuePair *)b;
+    size_t common = pa->key_length < pb->key_length ? pa->key_length : pb->key_length;
+    int result = memcmp(pa->key, pb->key, common);
+    if (result != 0)
+        return result;
+    return (pa->key_length > pb->key_length) - (pa->key_length < pb->key_length);
+}
+
+/* One open array or object. Containers are formatted from an explicit
+   stack rather than by recursion, so the depth of the tree does not matter.
+   The members of every open object sit on a shared stack of pairs */
+typedef struct
+{
+    const JsonValue *container;
+    size_t next;            /* Array: next item; object: next entry on the pair stack */
+    size_t end;             /* Object: end of its entries on the pair stack */
+    size_t base;            /* Object: start of its entries on the pair stack */
+    size_t formatted_count; /* Array: items written so far */
+    int simple_array;
+} FormatFrame;
+
+#define FORMAT_INITIAL_FRAMES JSON_MAX_NESTING_DEPTH
+#define FORMAT_INITIAL_PAIRS 64
+
+typedef struct
+{
+    JsonStack frames;
+    JsonStack pairs;
+} FormatStacks;
+
+/* Format a value that needs no frame */
+static int format_scalar(StringBuilder *sb, const JsonValue *value)
+{
+    if (!value)
+        return string_builder_append_literal(sb, "null");
+
+    switch (value->type)
+    {
+    case JSON_NULL:
+        return string_builder_append_literal(sb, "null");
+
+    case JSON_BOOLEAN:
+        if (value->value.boolean)
+            return string_builder_append_literal(sb, "true");
+        return string_builder_append_literal(sb, "false");
+
+    case JSON_NUMBER:
+        if (value->flags & JSON_VALUE_INTEGER)
+            return string_builder_append_integer(sb, value->integer);
+        return string_builder_append_number(sb, value->value.number);
+
+    case JSON_STRING:
+        return string_builder_append_escaped_string(sb, value->value.string, value->length);
+
+    default:
+        return 0;
+    }
+}
 
-/* Format an array */
-static int format_array(StringBuilder *sb, const JsonValue *value)
+/* Open an array */
+static int open_array(StringBuilder *sb, FormatStacks *stacks, const JsonValue *value)
 {
-    if (!string_builder_append(sb, "["))
+    if (!string_builder_append_literal(sb, "["))
         return 0;
 
     JsonArray *array = value->value.array;
     int simple_array = sb->config->inline_simple_arrays;
-    size_t valid_count = 0; // Track number of non-NaN values
 
     /* Check if array is "simple" (contains only primitive values) */
     if (simple_array)
     {
-        for (size_t i = 0; i < array->size; i++)
+        for (size_t i = 0; simple_array && i < array->size; i++)
         {
             JsonValue *item = array->items[i];
-            if (!should_skip_value(item))
+            if (item && (item->type == JSON_ARRAY || item->type == JSON_OBJECT))
             {
-                valid_count++;
-                if (item->type == JSON_ARRAY || item->type == JSON_OBJECT)
-                {
-                    simple_array = 0;
-                }
+                simple_array = 0;
             }
         }
     }
 
     if (!simple_array)
     {
-        string_builder_append(sb, sb->config->line_end);
+        string_builder_append_line_end(sb);
         sb->indent_level++;
     }
 
-    size_t formatted_count = 0; // Track how many values we've formatted
+    FormatFrame *frame = (FormatFrame *)json_stack_push(&stacks->frames);
+    if (!frame)
+        return 0;
+    frame->container = value;
+    frame->next = 0;
+    frame->formatted_count = 0;
+    frame->simple_array = simple_array;
+    return 1;
+}
 
-    for (size_t i = 0; i < array->size; i++)
+/* Next array item to format, after its separator and indentation. 0
+   once every item is written */
+static int next_item(StringBuilder *sb, FormatFrame *frame, const JsonValue **item)
+{
+    JsonArray *array = frame->container->value.array;
+    while (frame->next < array->size)
     {
-        JsonValue *item = array->items[i];
+        JsonValue *candidate = array->items[frame->next++];
 
         /* Skip NaN values */
-        if (should_skip_value(item))
-        {
+        if (should_skip_value(candidate))
             continue;
-        }
 
-        if (!simple_array)
+        /* Only add comma between valid items */
+        if (frame->formatted_count > 0)
         {
-            string_builder_append_indent(sb);
-        }
-
-        if (!format_value(sb, item))
-            return 0;
-
-        formatted_count++;
-        if (formatted_count < valid_count)
-        { // Only add comma if not last valid item
-            string_builder_append(sb, ",");
-            if (simple_array)
+            string_builder_append_literal(sb, ",");
+            if (frame->simple_array)
             {
-                for (int j = 0; j < sb->config->spaces_after_comma; j++)
-                {
-                    string_builder_append(sb, " ");
-                }
+                string_builder_append_spaces(sb, sb->config->spaces_after_comma);
             }
             else
             {
-                string_builder_append(sb, sb->config->line_end);
+                string_builder_append_line_end(sb);
             }
         }
+        if (!frame->simple_array)
+        {
+            string_builder_append_indent(sb);
+        }
+        frame->formatted_count++;
+        *item = candidate;
+        return 1;
     }
+    return 0;
+}
 
-    if (!simple_array)
+static int close_array(StringBuilder *sb, const FormatFrame *frame)
+{
+    if (!frame->simple_array)
     {
         sb->indent_level--;
-        string_builder_append(sb, sb->config->line_end);
+        string_builder_append_line_end(sb);
         string_builder_append_indent(sb);
     }
 
-    return string_builder_append(sb, "]");
+    return string_builder_append_literal(sb, "]");
 }
 
-/* Helper structure for sorting object keys */
-typedef struct
-{
-    const char *key;
-    JsonValue *value;
-} KeyValuePair;
-
-/* Comparision functiuon for sorting keys */
-static int compare_keys(const void *a, const void *b)
+/* Open an object, leaving out NaN members. Empty objects are written
+   whole and get no frame */
+static int open_object(StringBuilder *sb, FormatStacks *stacks, const JsonValue *value)
 {
-    return strcmp(((KeyValuePair *)a)->key, ((KeyValuePair *)b)->key);
-}
-
-/* Format an object Modified to properly handle keys and NaN values */
-static int format_object(StringBuilder* sb, const JsonValue* value) {
-    if (!string_builder_append(sb, "{")) return 0;
+    if (!string_builder_append_literal(sb, "{")) return 0;
 
-    JsonObject* object = value->value.object;
+    JsonObject *object = value->value.object;
     if (!object->pairs) {
-        return string_builder_append(sb, "}");
+        return string_builder_append_literal(sb, "}");
     }
 
-    string_builder_append(sb, sb->config->line_end);
+    string_builder_append_line_end(sb);
     sb->indent_level++;
 
-    /* Count valid pairs and collect them */
-    size_t valid_pair_count = 0;
-    KeyValuePair* pairs = NULL;
-    JsonKeyValue* current = object->pairs;
-
-    /* First pass: count valid pairs */
-    while (current) {
-        if (!should_skip_value(current->value)) {
-            valid_pair_count++;
-        }
-        current = current->next;
-    }
-
-    if (valid_pair_count > 0) {
-        /* Allocate array for sorting/processing */
-        pairs = (KeyValuePair*)malloc(valid_pair_count * sizeof(KeyValuePair));
-        if (!pairs) return 0;
-
-        /* Second pass: fill array with non-NaN values */
-        current = object->pairs;
-        size_t idx = 0;
-        while (current && idx < valid_pair_count) {
-            if (!should_skip_value(current->value)) {
-                pairs[idx].key = current->key;
-                pairs[idx].value = current->value;
-                idx++;
-            }
-            current = current->next;
+    /* Collect the valid pairs on the pair stack */
+    size_t base = stacks->pairs.count;
+    for (JsonKeyValue *current = object->pairs; current; current = current->next) {
+        if (should_skip_value(current->value)) {
+            continue;
         }
-
-        /* Sort if configured to do so */
-        if (sb->config->sort_object_keys) {
-            qsort(pairs, valid_pair_count, sizeof(KeyValuePair), compare_keys);
+        KeyValuePair *pair = (KeyValuePair *)json_stack_push(&stacks->pairs);
+        if (!pair) {
+            stacks->pairs.count = base;
+            return 0;
         }
+        pair->key = current->key;
+        pair->key_length = current->key_length;
+        pair->value = current->value;
+        pair->flags = current->flags;
+    }
 
-        /* Format all valid pairs */
-        for (size_t i = 0; i < valid_pair_count; i++) {
-            string_builder_append_indent(sb);
-            string_builder_append_escaped_string(sb, pairs[i].key);
-            string_builder_append(sb, ":");
+    /* Sort if configured to do so */
+    size_t count = stacks->pairs.count - base;
+    if (sb->config->sort_object_keys && count > 1 && !sb->measuring) {
+        qsort(JSON_STACK_AT(&stacks->pairs, KeyValuePair, base), count, sizeof(KeyValuePair), compare_keys);
+    }
 
-            for (int j = 0; j < sb->config->spaces_after_colon; j++) {
-                string_builder_append(sb, " ");
-            }
+    FormatFrame *frame = (FormatFrame *)json_stack_push(&stacks->frames);
+    if (!frame) {
+        stacks->pairs.count = base;
+        return 0;
+    }
+    frame->container = value;
+    frame->base = base;
+    frame->next = base;
+    frame->end = stacks->pairs.count;
+    return 1;
+}
 
-            if (!format_value(sb, pairs[i].value)) {
-                free(pairs);
-                return 0;
-            }
+/* Write the separator and key of the next member, 0 once every member is
+   written */
+static int next_member(StringBuilder *sb, FormatStacks *stacks, FormatFrame *frame, const JsonValue **value)
+{
+    if (frame->next == frame->end) {
+        return 0;
+    }
 
-            if (i < valid_pair_count - 1) {
-                string_builder_append(sb, ",");
-                string_builder_append(sb, sb->config->line_end);
-            }
-        }
+    const KeyValuePair *pair = JSON_STACK_AT(&stacks->pairs, KeyValuePair, frame->next);
+    if (frame->next > frame->base) {
+        string_builder_append_literal(sb, ",");
+        string_builder_append_line_end(sb);
+    }
+    frame->next++;
 
-        free(pairs);
+    string_builder_append_indent(sb);
+    if (pair->flags & JSON_KEY_INTERNED) {
+        /* Escaped once by the key table */
+        const JsonKeyEntry *entry = JSON_KEY_ENTRY(pair->key);
+        string_builder_append_length(sb, entry->escaped, entry->escaped_length);
+    } else {
+        string_builder_append_escaped_string(sb, pair->key, pair->key_length);
     }
+    string_builder_append_literal(sb, ":");
 
+    string_builder_append_spaces(sb, sb->config->spaces_after_colon);
+    *value = pair->value;
+    return 1;
+}
+
+static int close_object(StringBuilder *sb, FormatStacks *stacks, const FormatFrame *frame)
+{
+    stacks->pairs.count = frame->base;
     sb->indent_level--;
-    string_builder_append(sb, sb->config->line_end);
+    string_builder_append_line_end(sb);
     string_builder_append_indent(sb);
-    return string_builder_append(sb, "}");
+    return string_builder_append_literal(sb, "}");
+}
+
+/* Start a value: scalars are written whole, containers push a frame */
+static int open_value(StringBuilder *sb, FormatStacks *stacks, const JsonValue *value)
+{
+    if (!value || (value->type != JSON_ARRAY && value->type != JSON_OBJECT))
+        return format_scalar(sb, value);
+
+    if (!JSON_VALUE_READY(value))
+    {
+        set_format_error(JSON_ERROR_FORMAT_MEMORY_ALLOCATION, "Failed to build lazy container");
+        return 0;
+    }
+    return value->type == JSON_ARRAY ? open_array(sb, stacks, value) : open_object(sb, stacks, value);
 }
 
 /* Format any JSON value */
 static int format_value(StringBuilder *sb, const JsonValue *value)
 {
-    if (!value)
-        return string_builder_append(sb, "null");
+    FormatFrame initial_frames[FORMAT_INITIAL_FRAMES];
+    KeyValuePair initial_pairs[FORMAT_INITIAL_PAIRS];
+    FormatStacks stacks;
+    json_stack_init(&stacks.frames, initial_frames, FORMAT_INITIAL_FRAMES, sizeof(FormatFrame));
+    json_stack_init(&stacks.pairs, initial_pairs, FORMAT_INITIAL_PAIRS, sizeof(KeyValuePair));
+
+    int ok = open_value(sb, &stacks, value);
+    while (ok && stacks.frames.count)
+    {
+        FormatFrame *frame = JSON_STACK_TOP(&stacks.frames, FormatFrame);
+        const JsonValue *member;
+        int is_array = frame->container->type == JSON_ARRAY;
+        if (is_array ? next_item(sb, frame, &member) : next_member(sb, &stacks, frame, &member))
+        {
+            ok = open_value(sb, &stacks, member);
+            continue;
+        }
 
-    switch (value->type)
+        stacks.frames.count--;
+        ok = is_array ? close_array(sb, frame) : close_object(sb, &stacks, frame);
+    }
+
+    json_stack_release(&stacks.frames);
+    json_stack_release(&stacks.pairs);
+    return ok;
+}
+
+/* Extracted columns as an array of records. Each row is formatted through
+   format_value() from one reused scratch object, so the output follows
+   every formatting option without building a tree */
+static int format_columns(StringBuilder *sb, const JsonColumns *columns, const uint64_t *selection)
+{
+    size_t fields = columns->column_count;
+    JsonKeyValue *pairs = (JsonKeyValue *)json_heap_alloc((fields ? fields : 1) *
+                                                          (sizeof(JsonKeyValue) + sizeof(JsonValue)));
+    if (!pairs)
     {
-    case JSON_NULL:
-        return string_builder_append(sb, "null");
+        set_format_error(JSON_ERROR_FORMAT_MEMORY_ALLOCATION, "Failed to allocate record buffer");
+        return 0;
+    }
+    JsonValue *cells = (JsonValue *)(pairs + fields);
+    JsonObject object;
+    memset(&object, 0, sizeof(object));
+    JsonValue record;
+    memset(&record, 0, sizeof(record));
+    record.type = JSON_OBJECT;
+    record.value.object = &object;
+
+    for (size_t f = 0; f < fields; f++)
+    {
+        pairs[f].key = columns->columns[f].name;
+        pairs[f].key_length = columns->columns[f].name_length;
+        pairs[f].value = &cells[f];
+        pairs[f].hash = 0;
+        pairs[f].flags = 0;
+        memset(&cells[f], 0, sizeof(cells[f]));
+        cells[f].type = JSON_NUMBER;
+    }
 
-    case JSON_BOOLEAN:
-        return string_builder_append(sb, value->value.boolean ? "true" : "false");
+    int ok = string_builder_append_literal(sb, "[");
+    size_t emitted = 0;
+    for (size_t row = 0; ok && row < columns->rows; row++)
+    {
+        if (!JSON_BITMAP_TEST(selection ? selection : columns->records, row) ||
+            !JSON_BITMAP_TEST(columns->records, row))
+            continue;
 
-    case JSON_NUMBER:
-        return string_builder_append_number(sb, value->value.number);
+        /* Link the fields this row has */
+        JsonKeyValue **link = &object.pairs;
+        for (size_t f = 0; f < fields; f++)
+        {
+            const JsonColumn *column = &columns->columns[f];
+            if (!JSON_BITMAP_TEST(column->valid, row))
+                continue;
+            cells[f].value.number = column->values[row];
+            cells[f].flags = JSON_BITMAP_TEST(column->integers, row) ? JSON_VALUE_INTEGER : 0;
+            cells[f].integer = (int64_t)column->values[row];
+            *link = &pairs[f];
+            link = &pairs[f].next;
+        }
+        *link = NULL;
 
-    case JSON_STRING:
-        return string_builder_append_escaped_string(sb, value->value.string);
+        if (emitted == 0)
+        {
+            string_builder_append_line_end(sb);
+            sb->indent_level++;
+        }
+        else
+        {
+            string_builder_append_literal(sb, ",");
+            string_builder_append_line_end(sb);
+        }
+        string_builder_append_indent(sb);
+        ok = format_value(sb, &record);
+        emitted++;
+    }
 
-    case JSON_ARRAY:
-        return format_array(sb, value);
+    if (ok && emitted)
+    {
+        sb->indent_level--;
+        string_builder_append_line_end(sb);
+        string_builder_append_indent(sb);
+    }
+    json_heap_free(pairs);
+    return ok && string_builder_append_literal(sb, "]");
+}
 
-    case JSON_OBJECT:
-        return format_object(sb, value);
+/* Check the configuration and format value into sb, including the final
+   line endings. A NULL value formats columns instead */
+static int format_document(StringBuilder *sb, const JsonValue *value, const JsonColumns *columns,
+                           const uint64_t *selection)
+{
+    const JsonFormatConfig *config = sb->config;
 
-    default:
+    int formatted = value ? format_value(sb, value) : format_columns(sb, columns, selection);
+    if (!formatted || sb->sink_failed)
+    {
+        if (current_error.code == JSON_ERROR_NONE)
+        {
+            set_format_error(JSON_ERROR_FORMAT_ERROR, "Failed to format JSON value");
+        }
         return 0;
     }
+
+    /* Add final newline if configured */
+    if (config->line_end[0])
+    {
+        if (!string_builder_append_line_end(sb))
+        {
+            set_format_error(JSON_ERROR_FORMAT_BUFFER_OVERFLOW, "Failed to append final newline");
+            return 0;
+        }
+        string_builder_append_line_end(sb);
+    }
+    return !sb->sink_failed;
+}
+
+/* Resolve and validate a format configuration. Returns NULL if invalid */
+static const JsonFormatConfig *resolve_config(const JsonFormatConfig *config)
+{
+    if (!config)
+        config = &JSON_FORMAT_DEFAULT;
+
+    if (!config->indent_string || !config->line_end ||
+        config->spaces_after_colon < 0 || config->spaces_after_comma < 0 ||
+        config->max_inline_length < 0 || config->precision < 0)
+    {
+        set_format_error(JSON_ERROR_FORMAT_INVALID_CONFIG,
+                         "Invalid format configuration");
+        return NULL;
+    }
+    return config;
+}
+
+/* Format a value, or columns when value is NULL, into a new string */
+static char *format_to_string(const JsonValue *value, const JsonColumns *columns,
+                              const uint64_t *selection, const JsonFormatConfig *config)
+{
+    config = resolve_config(config);
+    if (!config)
+        return NULL;
+
+    StringBuilder sb;
+    string_builder_init(&sb, config, NULL, 0);
+
+    JsonPhaseMark mark;
+    json_phase_enter(JSON_PHASE_FORMAT, &mark);
+    int formatted = format_document(&sb, value, columns, selection) && string_builder_terminate(&sb);
+    json_phase_leave(&mark);
+    if (!formatted)
+    {
+        json_heap_free(sb.buffer);
+        return NULL;
+    }
+
+    /* The builder's buffer becomes the result */
+    return sb.buffer;
 }
 
 /* Public formatting function */
@@ -457,57 +937,235 @@ char *json_format_string(const JsonValue *value, const JsonFormatConfig *config)
         set_format_error(JSON_ERROR_FORMAT_NULL_INPUT, "NULL value passed to json_format_string");
         return NULL;
     }
+    return format_to_string(value, NULL, NULL, config);
+}
+
+/* Reusable output buffers. The builder takes the buffer over for one
+   document and hands back whatever storage it ended with */
+void json_format_buffer_init(JsonFormatBuffer *buffer, char *storage, size_t capacity)
+{
+    if (!buffer)
+        return;
+    buffer->data = capacity ? storage : NULL;
+    buffer->length = 0;
+    buffer->capacity = buffer->data ? capacity : 0;
+    buffer->owned = 0;
+    if (buffer->data)
+        buffer->data[0] = '\0';
+}
+
+int json_format_buffer_reserve(JsonFormatBuffer *buffer, size_t length)
+{
+    if (!buffer)
+        return 0;
+    if (length < buffer->capacity)
+        return 1; /* Room for the NUL as well */
+
+    char *data;
+    if (buffer->owned)
+    {
+        data = (char *)json_heap_realloc(buffer->data, length + 1);
+    }
+    else
+    {
+        data = (char *)json_heap_alloc(length + 1);
+        if (data && buffer->data)
+            memcpy(data, buffer->data, buffer->length + 1);
+    }
+    if (!data)
+    {
+        set_format_error(JSON_ERROR_FORMAT_MEMORY_ALLOCATION, "Failed to reserve output buffer");
+        return 0;
+    }
+    if (!buffer->data)
+        data[0] = '\0';
+    buffer->data = data;
+    buffer->capacity = length + 1;
+    buffer->owned = 1;
+    return 1;
+}
+
+void json_format_buffer_release(JsonFormatBuffer *buffer)
+{
+    if (!buffer)
+        return;
+    if (buffer->owned)
+        json_heap_free(buffer->data);
+    json_format_buffer_init(buffer, NULL, 0);
+}
+
+/* The pre-pass runs the formatter without output: strings and integers
+   are measured exactly, other numbers by their longest possible text and
+   keys are not sorted. The result is never below the formatted length */
+size_t json_format_estimate(const JsonValue *value, const JsonFormatConfig *config)
+{
+    current_error.code = JSON_ERROR_NONE;
 
+    if (!value)
+    {
+        set_format_error(JSON_ERROR_FORMAT_NULL_INPUT, "NULL value passed to json_format_estimate");
+        return 0;
+    }
+    config = resolve_config(config);
     if (!config)
-        config = &JSON_FORMAT_DEFAULT;
+        return 0;
 
-    /* Validate config */
-    if (!config->indent_string || !config->line_end ||
-        config->spaces_after_colon < 0 || config->spaces_after_comma < 0 ||
-        config->max_inline_length < 0 || config->precision < 0)
+    StringBuilder sb;
+    string_builder_init(&sb, config, NULL, 0);
+    sb.measuring = 1;
+
+    JsonPhaseMark mark;
+    json_phase_enter(JSON_PHASE_FORMAT, &mark);
+    int measured = format_document(&sb, value, NULL, NULL);
+    json_phase_leave(&mark);
+    return measured ? sb.size : 0;
+}
+
+int json_format_into(const JsonValue *value, const JsonFormatConfig *config, JsonFormatBuffer *buffer)
+{
+    current_error.code = JSON_ERROR_NONE;
+
+    if (!value || !buffer)
     {
-        set_format_error(JSON_ERROR_FORMAT_INVALID_CONFIG,
-                         "Invalid format configuration");
-        return NULL;
+        set_format_error(JSON_ERROR_FORMAT_NULL_INPUT, "NULL value or buffer passed to json_format_into");
+        return 0;
     }
+    config = resolve_config(config);
+    if (!config)
+        return 0;
+
+    StringBuilder sb;
+    string_builder_init(&sb, config, buffer->data, buffer->capacity);
+    sb.borrowed = buffer->data && !buffer->owned;
+
+    JsonPhaseMark mark;
+    json_phase_enter(JSON_PHASE_FORMAT, &mark);
+    int formatted = format_document(&sb, value, NULL, NULL) && string_builder_terminate(&sb);
+    json_phase_leave(&mark);
+
+    /* Keep the storage the builder ended with, even after a failure */
+    buffer->data = sb.buffer;
+    buffer->capacity = sb.capacity;
+    buffer->owned = buffer->data && !sb.borrowed;
+    buffer->length = formatted ? sb.size : 0;
+    if (buffer->data)
+        buffer->data[buffer->length] = '\0';
+    return formatted;
+}
 
-    StringBuilder *sb = string_builder_create(config);
-    if (!sb)
-        return NULL; /* Error already set by string builder create */
+char *json_format_columns(const JsonColumns *columns, const uint64_t *selection,
+                          const JsonFormatConfig *config)
+{
+    current_error.code = JSON_ERROR_NONE;
 
-    if (!format_value(sb, value))
+    if (!columns)
     {
-        if (current_error.code == JSON_ERROR_NONE)
-        {
-            set_format_error(JSON_ERROR_FORMAT_ERROR, "Failed to format JSON value");
-        }
-        free(sb->buffer);
-        free(sb);
+        set_format_error(JSON_ERROR_FORMAT_NULL_INPUT, "NULL columns passed to json_format_columns");
         return NULL;
     }
+    return format_to_string(NULL, columns, selection, config);
+}
 
-    /* Add final newline if configured */
-    if (config->line_end[0])
+/* Streaming output: the document is formatted through a fixed buffer that
+   is handed to callback whenever it fills, so memory use does not depend
+   on the size of the output */
+static int format_to_callback(const JsonValue *value, const JsonColumns *columns,
+                              const uint64_t *selection, const JsonFormatConfig *config,
+                              JsonWriteCallback callback, void *user_data)
+{
+    config = resolve_config(config);
+    if (!config)
+        return 0;
+
+    char *buffer = (char *)json_heap_alloc(JSON_FORMAT_SINK_BUFFER_SIZE);
+    if (!buffer)
+    {
+        set_format_error(JSON_ERROR_FORMAT_MEMORY_ALLOCATION, "Failed to allocate output buffer");
+        return 0;
+    }
+    StringBuilder sb;
+    string_builder_init(&sb, config, buffer, JSON_FORMAT_SINK_BUFFER_SIZE);
+    sb.sink = callback;
+    sb.sink_data = user_data;
+
+    JsonPhaseMark mark;
+    json_phase_enter(JSON_PHASE_FORMAT, &mark);
+    int success = format_document(&sb, value, columns, selection) && string_builder_flush(&sb);
+    json_phase_leave(&mark);
+
+    json_heap_free(sb.buffer);
+    return success;
+}
+
+int json_format_callback(const JsonValue *value, const JsonFormatConfig *config,
+                         JsonWriteCallback callback, void *user_data)
+{
+    current_error.code = JSON_ERROR_NONE;
+
+    if (!value || !callback)
+    {
+        set_format_error(JSON_ERROR_FORMAT_NULL_INPUT, "NULL value or callback passed to json_format_callback");
+        return 0;
+    }
+    return format_to_callback(value, NULL, NULL, config, callback, user_data);
+}
+
+int json_format_columns_callback(const JsonColumns *columns, const uint64_t *selection,
+                                 const JsonFormatConfig *config, JsonWriteCallback callback,
+                                 void *user_data)
+{
+    current_error.code = JSON_ERROR_NONE;
+
+    if (!columns || !callback)
     {
-        if (!string_builder_append(sb, config->line_end))
+        set_format_error(JSON_ERROR_FORMAT_NULL_INPUT,
+                         "NULL columns or callback passed to json_format_columns_callback");
+        return 0;
+    }
+    return format_to_callback(NULL, columns, selection, config, callback, user_data);
+}
+
+/* Sinks for FILE* streams and file descriptors */
+static int stream_sink(const char *data, size_t length, void *user_data)
+{
+    return fwrite(data, 1, length, (FILE *)user_data) == length;
+}
+
+static int fd_sink(const char *data, size_t length, void *user_data)
+{
+    int fd = *(const int *)user_data;
+    while (length > 0)
+    {
+#ifdef _WIN32
+        int written = _write(fd, data, (unsigned int)length);
+#else
+        ssize_t written = write(fd, data, length);
+#endif
+        if (written < 0)
         {
-            set_format_error(JSON_ERROR_FORMAT_BUFFER_OVERFLOW, "Failed to append final newline");
-            free(sb->buffer);
-            free(sb);
-            return NULL;
+            if (errno == EINTR)
+                continue;
+            return 0;
         }
-        string_builder_append(sb, config->line_end);
+        data += written;
+        length -= (size_t)written;
     }
+    return 1;
+}
 
-    char *result = strdup(sb->buffer);
-    if (!result)
+int json_format_stream(const JsonValue *value, FILE *stream, const JsonFormatConfig *config)
+{
+    if (!stream)
     {
-        set_format_error(JSON_ERROR_FORMAT_MEMORY_ALLOCATION, "Failed to duplicate final string");
-        return NULL;
+        set_format_error(JSON_ERROR_FORMAT_NULL_INPUT, "NULL stream passed to json_format_stream");
+        return 0;
     }
-    free(sb->buffer);
-    free(sb);
-    return result;
+    return json_format_callback(value, config, stream_sink, stream);
+}
+
+int json_format_fd(const JsonValue *value, int fd, const JsonFormatConfig *config)
+{
+    return json_format_callback(value, config, fd_sink, &fd);
 }
 
 /* File output function */
@@ -518,34 +1176,28 @@ int json_format_file(const JsonValue *value, const char *filename, const JsonFor
         set_format_error(JSON_ERROR_FORMAT_NULL_INPUT, "NULL filename passed to json_format_file");
         return 0;
     }
-    char *formatted = json_format_string(value, config);
-    if (!formatted)
+    if (!value)
     {
-        /* Error alredy set by json_format_string */
+        set_format_error(JSON_ERROR_FORMAT_NULL_INPUT, "NULL value passed to json_format_file");
         return 0;
     }
 
+    JsonPhaseMark mark;
+    json_phase_enter(JSON_PHASE_WRITE, &mark);
     FILE *file = fopen(filename, "w");
     if (!file)
     {
+        json_phase_leave(&mark);
         set_format_error(JSON_ERROR_FORMAT_FILE_WRITE, "Failed to open output file for writing");
-        free(formatted);
         return 0;
     }
 
-    size_t len = strlen(formatted);
-    size_t written = fwrite(formatted, 1, len, file);
-
-    if (written != len)
+    int success = json_format_stream(value, file, config);
+    if (fclose(file) != 0 && success)
     {
         set_format_error(JSON_ERROR_FORMAT_FILE_WRITE, "Failed to write complete formatted JSON to file");
-        fclose(file);
-        free(formatted);
-        return 0;
+        success = 0;
     }
-
-    fclose(file);
-    free(formatted);
-
-    return written == len;
-}
\ No newline at end of file
+    json_phase_leave(&mark);
+    return success;
+}
@@ -0,0 +1,496 @@
+/* json_index.c */
+#include "json_internal.h"
+
+/* Random access into a file holding one large array or object. A single
+   pass over the mapped file, 64 bytes at a time with the tape's block
+   classifier, records where every top-level element (or member key and
+   value) starts and ends; nothing is parsed. Element i is then parsed on
+   its own from the mapping. The offsets can be saved to a sidecar file,
+   which is mapped back without a scan.
+
+   Sidecar layout, in host byte order: an IndexHeader, then per element
+   the offset and length of its text, for objects preceded by the offset
+   and length of the quoted key. The header records the indexed file's
+   length and a hash of its first and last bytes, so an index is not used
+   with a file whose length or ends have since changed; an edit elsewhere
+   that keeps the length goes unnoticed */
+
+#define INDEX_MAGIC "JSONIDX1"
+#define INDEX_BYTE_ORDER 0x01020304u
+#define INDEX_HASH_SPAN 4096        /* Bytes hashed at each end of the file */
+#define INDEX_INITIAL_CAPACITY 1024 /* Entry words allocated by the first growth */
+#define INDEX_NO_COLON ((size_t)-1)
+
+typedef struct
+{
+    char magic[8];
+    uint32_t byte_order;
+    uint32_t type;              /* JSON_ARRAY or JSON_OBJECT */
+    uint64_t source_length;
+    uint64_t source_hash;
+    uint64_t count;
+} IndexHeader;
+
+struct JsonIndex
+{
+    JsonFileView source;
+    JsonFileView sidecar;       /* Holds entries when loaded from a file */
+    const uint64_t *entries;
+    uint64_t *owned;            /* Entries of a scanned index */
+    size_t count;
+    size_t stride;              /* Words per element: 2, or 4 for objects */
+    JsonType type;
+};
+
+static uint64_t source_hash(const char *data, size_t length)
+{
+    size_t span = length < INDEX_HASH_SPAN ? length : INDEX_HASH_SPAN;
+    return (uint64_t)json_hash_key(data, span) << 32 | json_hash_key(data + length - span, span);
+}
+
+/* Scan state */
+typedef struct
+{
+    const char *data;
+    size_t length;
+    int is_object;
+    uint64_t *entries;
+    size_t words;
+    size_t capacity;
+    size_t element_start;       /* Just past the '[', '{' or ',' before the element */
+    size_t colon;               /* Member's ':', INDEX_NO_COLON before it */
+    JsonError *error;
+} IndexScan;
+
+static int scan_error(IndexScan *scan, JsonErrorCode code, const char *message, size_t offset)
+{
+    if (!scan->error)
+        return 0;
+    json_error_set(scan->error, code, message);
+    json_text_position(scan->data, scan->data + offset, &scan->error->line, &scan->error->column);
+    return 0;
+}
+
+/* Trim [*start, *end) of surrounding whitespace */
+static void trim(const IndexScan *scan, size_t *start, size_t *end)
+{
+    *start = (size_t)(json_skip_whitespace(scan->data + *start, scan->data + *end) - scan->data);
+    while (*end > *start && json_is_space(scan->data[*end - 1]))
+        (*end)--;
+}
+
+static int push_span(IndexScan *scan, size_t start, size_t end)
+{
+    if (scan->words + 2 > scan->capacity)
+    {
+        size_t capacity = scan->capacity ? scan->capacity * 2 : INDEX_INITIAL_CAPACITY;
+        uint64_t *grown = (uint64_t *)json_heap_realloc(scan->entries, capacity * sizeof(uint64_t));
+        if (!grown)
+            return scan_error(scan, JSON_ERROR_MEMORY_ALLOCATION, "Failed to grow index", start);
+        scan->entries = grown;
+        scan->capacity = capacity;
+    }
+    scan->entries[scan->words++] = start;
+    scan->entries[scan->words++] = end - start;
+    return 1;
+}
+
+/* Record the element that ends at the ',' or closing bracket at end */
+static int finish_element(IndexScan *scan, size_t end, int closing)
+{
+    size_t start = scan->element_start;
+    trim(scan, &start, &end);
+    if (start == end)
+    {
+        /* Only an empty container may end without an element */
+        if (closing && scan->words == 0 && scan->colon == INDEX_NO_COLON)
+            return 1;
+        return scan_error(scan, JSON_ERROR_INVALID_VALUE, "Missing element", start);
+    }
+    if (!scan->is_object)
+        return push_span(scan, start, end);
+
+    if (scan->colon == INDEX_NO_COLON || scan->colon < start)
+        return scan_error(scan, JSON_ERROR_EXPECTED_COLON, "Expected ':' after object key", start);
+    size_t key_end = scan->colon, value_start = scan->colon + 1;
+    trim(scan, &start, &key_end);
+    trim(scan, &value_start, &end);
+    if (key_end - start < 2 || scan->data[start] != '"' || scan->data[key_end - 1] != '"')
+        return scan_error(scan, JSON_ERROR_EXPECTED_KEY, "Expected string key", start);
+    if (value_start == end)
+        return scan_error(scan, JSON_ERROR_INVALID_VALUE, "Missing member value", value_start);
+    scan->colon = INDEX_NO_COLON;
+    return push_span(scan, start, key_end) && push_span(scan, value_start, end);
+}
+
+/* Walk the structural bytes outside strings from the top-level opener at
+   start. Returns the offset of its closing bracket, 0 after an error */
+static size_t scan_elements(IndexScan *scan, size_t start)
+{
+    const char *data = scan->data;
+    uint64_t escape_carry = 0, in_string = 0;
+    size_t depth = 0;
+
+    for (size_t offset = start; offset < scan->length; offset += 64)
+    {
+        const char *block = data + offset;
+        char padded[64];
+        if (scan->length - offset < 64)
+        {
+            /* Whitespace padding never adds a structural byte */
+            memset(padded, ' ', sizeof(padded));
+            memcpy(padded, block, scan->length - offset);
+            block = padded;
+        }
+
+        JsonBlockMasks masks;
+        json_classify_block(block, &masks);
+        uint64_t escaped = json_find_escaped(masks.backslash, &escape_carry);
+        uint64_t inside = json_prefix_xor(masks.quote & ~escaped) ^ in_string;
+        in_string = (uint64_t)0 - (inside >> 63);
+
+        for (uint64_t bits = masks.structural & ~inside; bits; bits &= bits - 1)
+        {
+            size_t at = offset + json_lowest_bit64(bits);
+            switch (data[at])
+            {
+            case '[':
+            case '{':
+                if (depth++ == 0)
+                    scan->element_start = at + 1;
+                break;
+
+            case ']':
+            case '}':
+                if (--depth == 0)
+                {
+                    if ((data[at] == '}') != scan->is_object)
+                        return scan_error(scan, JSON_ERROR_UNEXPECTED_CHAR, "Mismatched closing bracket", at);
+                    return finish_element(scan, at, 1) ? at : 0;
+                }
+                break;
+
+            case ',':
+                if (depth == 1)
+                {
+                    if (!finish_element(scan, at, 0))
+                        return 0;
+                    scan->element_start = at + 1;
+                }
+                break;
+
+            default: /* ':' */
+                if (depth == 1 && scan->is_object)
+                {
+                    if (scan->colon != INDEX_NO_COLON)
+                        return scan_error(scan, JSON_ERROR_EXPECTED_COMMA_OR_BRACE, "Expected ',' or '}'", at);
+                    scan->colon = at;
+                }
+                break;
+            }
+        }
+    }
+
+    if (in_string)
+        return scan_error(scan, JSON_ERROR_UNTERMINATED_STRING, "Unterminated string", scan->length);
+    return scan_error(scan, scan->is_object ? JSON_ERROR_EXPECTED_COMMA_OR_BRACE : JSON_ERROR_EXPECTED_COMMA_OR_BRACKET,
+                      "Unexpected end of input", scan->length);
+}
+
+static JsonIndex *index_alloc(void)
+{
+    return (JsonIndex *)json_heap_calloc(1, sizeof(JsonIndex));
+}
+
+JsonIndex *json_index_build(const char *filename, JsonError *error)
+{
+    json_error_clear(error);
+    JsonIndex *index = index_alloc();
+    if (!index)
+    {
+        json_error_set(error, JSON_ERROR_MEMORY_ALLOCATION, "Failed to allocate index");
+        return NULL;
+    }
+    if (!json_file_view_open(&index->source, filename, error))
+    {
+        json_heap_free(index);
+        return NULL;
+    }
+
+    JsonPhaseMark mark;
+    json_phase_enter(JSON_PHASE_PARSE, &mark);
+    const char *data = index->source.data;
+    size_t length = index->source.length;
+    IndexScan scan = {data, length, 0, NULL, 0, 0, 0, INDEX_NO_COLON, error};
+    size_t start = (size_t)(json_skip_whitespace(data, data + length) - data);
+    size_t end = 0;
+    if (start == length || (data[start] != '[' && data[start] != '{'))
+    {
+        scan_error(&scan, JSON_ERROR_INVALID_VALUE, "Indexed files must hold an array or an object", start);
+    }
+    else
+    {
+        scan.is_object = data[start] == '{';
+        end = scan_elements(&scan, start);
+        if (end && json_skip_whitespace(data + end + 1, data + length) != data + length)
+            end = scan_error(&scan, JSON_ERROR_UNEXPECTED_CHAR, "Unexpected data after the indexed value", end + 1);
+    }
+    json_phase_leave(&mark);
+
+    if (!end)
+    {
+        json_heap_free(scan.entries);
+        json_index_free(index);
+        return NULL;
+    }
+    index->owned = scan.entries;
+    index->entries = scan.entries;
+    index->type = scan.is_object ? JSON_OBJECT : JSON_ARRAY;
+    index->stride = scan.is_object ? 4 : 2;
+    index->count = scan.words / index->stride;
+    return index;
+}
+
+/* Written to a temporary file that replaces index_filename once complete */
+int json_index_save(const JsonIndex *index, const char *index_filename, JsonError *error)
+{
+    json_error_clear(error);
+    if (!index || !index_filename)
+    {
+        json_error_set(error, JSON_ERROR_INVALID_VALUE, "NULL index or filename passed to json_index_save");
+        return 0;
+    }
+
+    size_t name_length = strlen(index_filename) + sizeof(".tmp");
+    char *temp_filename = (char *)json_heap_alloc(name_length);
+    if (!temp_filename)
+    {
+        json_error_set(error, JSON_ERROR_MEMORY_ALLOCATION, "Failed to allocate temporary filename");
+        return 0;
+    }
+    snprintf(temp_filename, name_length, "%s.tmp", index_filename);
+
+    IndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.byte_order = INDEX_BYTE_ORDER;
+    header.type = (uint32_t)index->type;
+    header.source_length = index->source.length;
+    header.source_hash = source_hash(index->source.data, index->source.length);
+    header.count = index->count;
+
+    JsonPhaseMark mark;
+    json_phase_enter(JSON_PHASE_WRITE, &mark);
+    size_t words = index->count * index->stride;
+    FILE *file = fopen(temp_filename, "wb");
+    int ok = file && fwrite(&header, sizeof(header), 1, file) == 1 &&
+             (words == 0 || fwrite(index->entries, sizeof(uint64_t), words, file) == words);
+    if (file && fclose(file) != 0)
+        ok = 0;
+    if (ok)
+    {
+        remove(index_filename);
+        ok = rename(temp_filename, index_filename) == 0;
+    }
+    json_phase_leave(&mark);
+
+    if (!ok)
+    {
+        remove(temp_filename);
+        json_error_set(error, JSON_ERROR_FILE_WRITE, "Failed to write index file");
+    }
+    json_heap_free(temp_filename);
+    return ok;
+}
+
+JsonIndex *json_index_open(const char *filename, const char *index_filename, JsonError *error)
+{
+    json_error_clear(error);
+    JsonIndex *index = index_alloc();
+    if (!index)
+    {
+        json_error_set(error, JSON_ERROR_MEMORY_ALLOCATION, "Failed to allocate index");
+        return NULL;
+    }
+    if (!json_file_view_open(&index->sidecar, index_filename, error) ||
+        !json_file_view_open(&index->source, filename, error))
+    {
+        json_index_free(index);
+        return NULL;
+    }
+
+    IndexHeader header;
+    const JsonFileView *sidecar = &index->sidecar;
+    if (sidecar->length < sizeof(header))
+    {
+        json_error_set(error, JSON_ERROR_INDEX_INVALID, "Index file is too short");
+        json_index_free(index);
+        return NULL;
+    }
+    memcpy(&header, sidecar->data, sizeof(header));
+    size_t stride = header.type == JSON_OBJECT ? 4 : 2;
+    if (memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) != 0 || header.byte_order != INDEX_BYTE_ORDER ||
+        (header.type != JSON_ARRAY && header.type != JSON_OBJECT) ||
+        header.count > (sidecar->length - sizeof(header)) / (stride * sizeof(uint64_t)) ||
+        sidecar->length != sizeof(header) + header.count * stride * sizeof(uint64_t))
+    {
+        json_error_set(error, JSON_ERROR_INDEX_INVALID, "Not a valid index file");
+        json_index_free(index);
+        return NULL;
+    }
+    if (header.source_length != index->source.length ||
+        header.source_hash != source_hash(index->source.data, index->source.length))
+    {
+        json_error_set(error, JSON_ERROR_INDEX_STALE, "Index does not match the file");
+        json_index_free(index);
+        return NULL;
+    }
+
+    /* Mappings and heap copies are both aligned for the words after the header */
+    index->entries = (const uint64_t *)(sidecar->data + sizeof(header));
+    index->type = (JsonType)header.type;
+    index->stride = stride;
+    index->count = (size_t)header.count;
+
+    /* A damaged sidecar of the right size must not point outside the file,
+       and key entries must span a quoted string */
+    for (size_t i = 0; i < index->count * stride; i += 2)
+    {
+        uint64_t start = index->entries[i], length = index->entries[i + 1];
+        if (start > index->source.length || length > index->source.length - start)
+        {
+            json_error_set(error, JSON_ERROR_INDEX_INVALID, "Index entry outside the file");
+            json_index_free(index);
+            return NULL;
+        }
+        const char *text = index->source.data + start;
+        if (stride == 4 && i % 4 == 0 && (length < 2 || text[0] != '"' || text[length - 1] != '"'))
+        {
+            json_error_set(error, JSON_ERROR_INDEX_INVALID, "Index key entry is not a string");
+            json_index_free(index);
+            return NULL;
+        }
+    }
+    return index;
+}
+
+void json_index_free(JsonIndex *index)
+{
+    if (!index)
+        return;
+    json_file_view_close(&index->source);
+    json_file_view_close(&index->sidecar);
+    json_heap_free(index->owned);
+    json_heap_free(index);
+}
+
+JsonType json_index_type(const JsonIndex *index)
+{
+    return index ? index->type : JSON_NULL;
+}
+
+size_t json_index_count(const JsonIndex *index)
+{
+    return index ? index->count : 0;
+}
+
+const char *json_index_text(const JsonIndex *index, size_t i, size_t *length)
+{
+    if (!index || i >= index->count)
+    {
+        if (length)
+            *length = 0;
+        return NULL;
+    }
+    const uint64_t *entry = index->entries + i * index->stride + (index->stride - 2);
+    if (length)
+        *length = (size_t)entry[1];
+    return index->source.data + entry[0];
+}
+
+const char *json_index_key(const JsonIndex *index, size_t i, size_t *length)
+{
+    if (!index || i >= index->count || index->type != JSON_OBJECT)
+    {
+        if (length)
+            *length = 0;
+        return NULL;
+    }
+    const uint64_t *entry = index->entries + i * index->stride;
+    if (length)
+        *length = (size_t)entry[1] - 2;
+    return index->source.data + entry[0] + 1;
+}
+
+JsonValue *json_index_get(const JsonIndex *index, size_t i, JsonError *error)
+{
+    size_t length;
+    const char *text = json_index_text(index, i, &length);
+    if (!text)
+    {
+        json_error_clear(error);
+        json_error_set(error, JSON_ERROR_INVALID_VALUE, "Index out of range");
+        return NULL;
+    }
+    return json_parse_buffer_r(text, length, error);
+}
+
+JsonValue *json_index_get_range(const JsonIndex *index, size_t first, size_t count, JsonError *error)
+{
+    json_error_clear(error);
+    if (!index || first > index->count || count > index->count - first)
+    {
+        json_error_set(error, JSON_ERROR_INVALID_VALUE, "Index range out of bounds");
+        return NULL;
+    }
+    JsonValue *range = json_create_array();
+    if (!range)
+    {
+        json_error_set(error, JSON_ERROR_MEMORY_ALLOCATION, "Failed to allocate array");
+        return NULL;
+    }
+    for (size_t i = first; i < first + count; i++)
+    {
+        JsonValue *element = json_index_get(index, i, error);
+        if (!element || !json_array_append(range, element))
+        {
+            if (element)
+            {
+                json_free(element);
+                json_error_set(error, JSON_ERROR_MEMORY_ALLOCATION, "Failed to add element");
+            }
+            json_free(range);
+            return NULL;
+        }
+    }
+    return range;
+}
+
+/* Keys without escapes are compared in place, others once decoded. The
+   search runs from the end, so a duplicated key finds the last member,
+   whose value is the one the parser keeps */
+size_t json_index_find(const JsonIndex *index, const char *key)
+{
+    if (!index || !key || index->type != JSON_OBJECT)
+        return JSON_INDEX_NOT_FOUND;
+
+    size_t key_length = strlen(key);
+    for (size_t i = index->count; i-- > 0;)
+    {
+        size_t length;
+        const char *raw = json_index_key(index, i, &length);
+        if (!memchr(raw, '\\', length))
+        {
+            if (length == key_length && memcmp(raw, key, length) == 0)
+                return i;
+            continue;
+        }
+        JsonValue *decoded = json_parse_buffer_r(raw - 1, length + 2, NULL);
+        int match = decoded && decoded->type == JSON_STRING && decoded->length == key_length &&
+                    memcmp(decoded->value.string, key, key_length) == 0;
+        json_free(decoded);
+        if (match)
+            return i;
+    }
+    return JSON_INDEX_NOT_FOUND;
+}
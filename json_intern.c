@@ -0,0 +1,167 @@
+/* json_intern.c */
+#include "json_internal.h"
+
+/* Key-intern tables. Records of one shape repeat the same handful of keys
+   millions of times; with a table each distinct key is stored, hashed and
+   escaped once, and every pair using it points at the shared copy */
+
+#define KEY_TABLE_CHUNK_SIZE 4096
+#define KEY_TABLE_INITIAL_SLOTS 64
+
+struct JsonKeyTable
+{
+    JsonArena *arena;       /* Entries: own_arena, or the document's */
+    JsonArena own_arena;
+    JsonKeyEntry **slots;   /* Open addressing, power of two, load <= 1/2 */
+    size_t capacity;
+    size_t count;
+};
+
+static JsonKeyTable *key_table_init(JsonKeyTable *table, JsonArena *arena)
+{
+    table->arena = arena;
+    table->capacity = KEY_TABLE_INITIAL_SLOTS;
+    table->count = 0;
+    table->slots = (JsonKeyEntry **)json_allocator_alloc(&arena->allocator,
+                                                         table->capacity * sizeof(JsonKeyEntry *));
+    if (!table->slots)
+        return NULL;
+    memset(table->slots, 0, table->capacity * sizeof(JsonKeyEntry *));
+    return table;
+}
+
+JsonKeyTable *json_key_table_create(const JsonAllocator *allocator)
+{
+    JsonKeyTable *table = (JsonKeyTable *)json_allocator_alloc(allocator, sizeof(JsonKeyTable));
+    if (!table)
+        return NULL;
+
+    json_arena_init(&table->own_arena, KEY_TABLE_CHUNK_SIZE, allocator);
+    if (!key_table_init(table, &table->own_arena))
+    {
+        json_allocator_free(allocator, table);
+        return NULL;
+    }
+    return table;
+}
+
+/* Table whose header and entries live in an existing arena, released
+   together with it. Only the slots need json_key_table_free() */
+JsonKeyTable *json_key_table_create_in(JsonArena *arena)
+{
+    JsonKeyTable *table = (JsonKeyTable *)json_arena_alloc(arena, sizeof(JsonKeyTable));
+    if (!table)
+        return NULL;
+    return key_table_init(table, arena);
+}
+
+void json_key_table_free(JsonKeyTable *table)
+{
+    if (!table)
+        return;
+
+    json_allocator_free(&table->arena->allocator, table->slots);
+    if (table->arena == &table->own_arena)
+    {
+        JsonAllocator allocator = table->own_arena.allocator;
+        json_arena_release(&table->own_arena);
+        json_allocator_free(&allocator, table);
+    }
+}
+
+size_t json_key_table_size(const JsonKeyTable *table)
+{
+    return table ? table->count : 0;
+}
+
+static int key_table_grow(JsonKeyTable *table)
+{
+    size_t capacity = table->capacity * 2;
+    JsonKeyEntry **slots = (JsonKeyEntry **)json_allocator_alloc(&table->arena->allocator,
+                                                                 capacity * sizeof(JsonKeyEntry *));
+    if (!slots)
+        return 0;
+    memset(slots, 0, capacity * sizeof(JsonKeyEntry *));
+
+    size_t mask = capacity - 1;
+    for (size_t i = 0; i < table->capacity; i++)
+    {
+        JsonKeyEntry *entry = table->slots[i];
+        if (!entry)
+            continue;
+        size_t slot = entry->hash & mask;
+        while (slots[slot])
+            slot = (slot + 1) & mask;
+        slots[slot] = entry;
+    }
+
+    json_allocator_free(&table->arena->allocator, table->slots);
+    table->slots = slots;
+    table->capacity = capacity;
+    return 1;
+}
+
+/* Entry for a key, added on first sight */
+const JsonKeyEntry *json_key_table_entry(JsonKeyTable *table, const char *key, size_t length)
+{
+    uint32_t hash = json_hash_key(key, length);
+    size_t mask = table->capacity - 1;
+    size_t slot = hash & mask;
+    for (JsonKeyEntry *entry; (entry = table->slots[slot]); slot = (slot + 1) & mask)
+    {
+        if (entry->hash == hash && entry->length == length && memcmp(entry->key, key, length) == 0)
+            return entry;
+    }
+
+    if ((table->count + 1) * 2 > table->capacity)
+    {
+        if (!key_table_grow(table))
+            return NULL;
+        mask = table->capacity - 1;
+        slot = hash & mask;
+        while (table->slots[slot])
+            slot = (slot + 1) & mask;
+    }
+
+    /* The key and its escaped form share one block */
+    char escaped[256];
+    char *spelled = escaped;
+    if (JSON_ESCAPED_MAX(length) + 1 > sizeof(escaped))
+    {
+        spelled = (char *)json_heap_alloc(JSON_ESCAPED_MAX(length) + 1);
+        if (!spelled)
+            return NULL;
+    }
+    size_t escaped_length = json_escape_string(spelled, key, length);
+
+    JsonKeyEntry *entry = (JsonKeyEntry *)json_arena_alloc(table->arena,
+                                                           sizeof(JsonKeyEntry) + length + 1 + escaped_length + 1);
+    if (entry)
+    {
+        char *copy = entry->key + length + 1;
+        memcpy(copy, spelled, escaped_length);
+        copy[escaped_length] = '\0';
+        memcpy(entry->key, key, length);
+        entry->key[length] = '\0';
+        entry->hash = hash;
+        entry->length = length;
+        entry->escaped = copy;
+        entry->escaped_length = escaped_length;
+    }
+    if (spelled != escaped)
+        json_heap_free(spelled);
+    if (!entry)
+        return NULL;
+
+    table->slots[slot] = entry;
+    table->count++;
+    return entry;
+}
+
+const char *json_key_table_intern(JsonKeyTable *table, const char *key, size_t length)
+{
+    if (!table || !key)
+        return NULL;
+    const JsonKeyEntry *entry = json_key_table_entry(table, key, length);
+    return entry ? entry->key : NULL;
+}
@@ -0,0 +1,297 @@
+/* json_internal.h */
+#ifndef JSON_INTERNAL_H
+#define JSON_INTERNAL_H
+
+/* Private helpers shared between the library's source files.
+   Nothing in here is part of the public API declared in json.h */
+
+#include "json.h"
+#include <stddef.h>
+
+/* Storage class for the per-thread legacy error state behind
+   json_get_*_error() */
+#if defined(_MSC_VER)
+#define JSON_THREAD_LOCAL __declspec(thread)
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define JSON_THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__) || defined(__clang__)
+#define JSON_THREAD_LOCAL __thread
+#else
+#define JSON_THREAD_LOCAL
+#endif
+
+/* Error helpers (json.c) */
+void json_error_clear(JsonError* error);
+void json_error_set(JsonError* error, JsonErrorCode code, const char* message);
+
+/* Allocation through a JsonAllocator (json_alloc.c). A NULL allocator, or
+   one without functions, means the global allocator */
+void* json_allocator_alloc(const JsonAllocator* allocator, size_t size);
+void* json_allocator_realloc(const JsonAllocator* allocator, void* ptr, size_t size);
+void json_allocator_free(const JsonAllocator* allocator, void* ptr);
+
+/* Global allocator shorthands for the library's own heap memory */
+void* json_heap_alloc(size_t size);
+void* json_heap_calloc(size_t count, size_t size);
+void* json_heap_realloc(void* ptr, size_t size);
+void json_heap_free(void* ptr);
+
+/* Growable stack of fixed-size frames (json_alloc.c), for walking nested
+   arrays and objects without recursion. It starts in storage the caller
+   provides, usually a small array of its own, and moves to the heap only
+   when the nesting gets deeper than that */
+typedef struct {
+    void* frames;
+    size_t count;
+    size_t capacity;
+    size_t frame_size;
+    void* initial;          /* Caller storage, never freed */
+    size_t initial_capacity;
+} JsonStack;
+
+void json_stack_init(JsonStack* stack, void* initial, size_t capacity, size_t frame_size);
+void* json_stack_push(JsonStack* stack); /* Uninitialised top frame, NULL if it cannot grow */
+void json_stack_release(JsonStack* stack);
+
+#define JSON_STACK_AT(stack, type, i) ((type*)(stack)->frames + (i))
+#define JSON_STACK_TOP(stack, type) JSON_STACK_AT(stack, type, (stack)->count - 1)
+
+/* Statistics target of the calling thread, NULL when not collecting */
+JsonStats* json_stats_active(void);
+
+#define JSON_STATS_ADD(field, amount) \
+    do { \
+        JsonStats* json_stats_ = json_stats_active(); \
+        if (json_stats_) \
+            json_stats_->field += (amount); \
+    } while (0)
+
+/* Phase timing. Entering a phase pauses the enclosing one, so every
+   interval is charged to exactly one phase */
+typedef struct {
+    int active;             /* Statistics were being collected on entry */
+    int previous;           /* Phase to resume, -1 for none */
+} JsonPhaseMark;
+
+void json_phase_enter(JsonPhase phase, JsonPhaseMark* mark);
+double json_clock_seconds(void);    /* Monotonic wall clock behind the phase timing */
+void json_phase_leave(const JsonPhaseMark* mark);
+void json_stats_depth(size_t depth);
+
+#define JSON_ARENA_DEFAULT_CHUNK_SIZE (64 * 1024)
+#define JSON_ARENA_ALIGNMENT (sizeof(void*) > sizeof(double) ? sizeof(void*) : sizeof(double))
+
+/* One bump-allocated chunk of arena memory */
+typedef struct JsonArenaChunk {
+    struct JsonArenaChunk* next;
+    size_t used;
+    size_t capacity;
+    /* Chunk data follows the header */
+} JsonArenaChunk;
+
+/* Arena allocator: allocations are never freed individually */
+struct JsonArena {
+    JsonArenaChunk* chunks;   /* Current chunk first, older chunks follow */
+    size_t chunk_size;        /* Size used for regular chunks */
+    JsonAllocator allocator;  /* Source of the chunks, zeroed for the global allocator */
+};
+
+/* Whole-file input (json_mmap.c): a read-only mapping where possible,
+   a heap copy otherwise. data is not NUL terminated */
+typedef struct {
+    const char* data;
+    size_t length;
+    void* map_base;         /* mmap() region, NULL if not mapped */
+    size_t map_length;
+    char* heap;             /* Heap copy when the file could not be mapped */
+} JsonFileView;
+
+/* Atomic file writing behind json_write_file_ex() (json_file.c): writer
+   fills a temporary file that is then renamed over filename. Failures
+   outside writer are reported through json_get_file_error() */
+typedef int (*JsonStreamWriter)(const JsonValue* value, FILE* stream, void* context);
+int json_write_file_with(const JsonValue* value, const char* filename,
+                         const JsonFileWriteConfig* config,
+                         JsonStreamWriter writer, void* context);
+
+int json_file_view_open(JsonFileView* view, const char* filename, JsonError* error);
+int json_file_view_open_stream(JsonFileView* view, FILE* stream, JsonError* error);
+void json_file_view_close(JsonFileView* view);
+
+/* Span of one array or object, recorded by the validator for lazy
+   documents. Spans are stored in the order of their opening brackets */
+typedef struct {
+    size_t start;           /* Offset of the opening bracket */
+    size_t end;             /* Offset just past the closing bracket */
+    size_t descendants;     /* Containers nested anywhere inside, to skip to the next sibling */
+} JsonLazySpan;
+
+/* Skip index of a lazy document. A JSON_VALUE_LAZY node stores the number
+   of its span in length */
+typedef struct {
+    const char* input;
+    size_t length;
+    int zero_copy;
+    const JsonAllocator* allocator; /* The document's, for spans */
+    JsonLazySpan* spans;    /* Heap array, NULL for eager documents */
+    size_t count;
+    size_t capacity;
+} JsonLazyIndex;
+
+/* Arena-backed document */
+struct JsonDocument {
+    JsonValue* root;
+    JsonArena arena;
+    JsonFileView source;    /* Input kept alive for zero-copy views into a file */
+    JsonLazyIndex lazy;
+    JsonKeyTable* keys;     /* Shared keys with intern_keys, NULL otherwise */
+};
+
+/* One interned key (json_intern.c). Interned key pointers point at key, so
+   the entry of a JSON_KEY_INTERNED pair is found from its key alone */
+typedef struct {
+    uint32_t hash;
+    size_t length;
+    const char* escaped;    /* Quoted and escaped, NUL terminated */
+    size_t escaped_length;
+    char key[];             /* NUL terminated copy of the key */
+} JsonKeyEntry;
+
+#define JSON_KEY_ENTRY(interned_key) \
+    ((const JsonKeyEntry*)((const char*)(interned_key) - offsetof(JsonKeyEntry, key)))
+
+const JsonKeyEntry* json_key_table_entry(JsonKeyTable* table, const char* key, size_t length);
+/* Table kept in an arena, for documents; json_key_table_free() releases
+   only its slots */
+JsonKeyTable* json_key_table_create_in(JsonArena* arena);
+
+/* Hash of an object key (json.c), as stored in JsonKeyValue.hash */
+uint32_t json_hash_key(const char* key, size_t length);
+/* json_object_get() for a key whose json_hash_key() is already known */
+JsonValue* json_object_get_hashed(const JsonValue* object, const char* key, size_t length, uint32_t hash);
+
+/* Longest output of json_escape_string() for length input bytes */
+#define JSON_ESCAPED_MAX(length) ((length) * 6 + 2)
+
+/* Write the quoted, escaped form of a string to out (json_format.c), which
+   must have room for JSON_ESCAPED_MAX(length) bytes. Returns its length */
+size_t json_escape_string(char* out, const char* str, size_t length);
+
+/* Arena functions (json_arena.c) */
+void json_arena_init(JsonArena* arena, size_t chunk_size, const JsonAllocator* allocator);
+void json_arena_release(JsonArena* arena);
+void json_arena_reset(JsonArena* arena);
+void* json_arena_alloc(JsonArena* arena, size_t size);
+void* json_arena_realloc(JsonArena* arena, void* ptr, size_t old_size, size_t new_size);
+void json_arena_shrink(JsonArena* arena, void* ptr, size_t old_size, size_t new_size);
+JsonDocument* json_document_create_empty(const JsonAllocator* allocator);
+JsonDocument* json_arena_document(JsonArena* arena);
+
+/* Nesting limit for a max_depth argument (json_parser.c): the value
+   itself, or json_get_max_depth() for 0 */
+size_t json_resolve_max_depth(size_t max_depth);
+
+/* Parse one value into a caller-owned arena (json_parser.c), with keys
+   from an optional intern table. error must not be NULL */
+JsonValue* json_parse_arena_r(JsonArena* arena, const char* data, size_t length, int zero_copy,
+                              JsonKeyTable* keys, size_t max_depth, JsonError* error);
+
+/* Validate an input and record the span of every container
+   (json_validate.c), for lazy documents */
+int json_validate_index_r(const char* data, size_t length, JsonLazyIndex* index, size_t max_depth,
+                          JsonError* error);
+
+/* Run the parser's grammar without building anything (json_parser.c).
+   Allocates only for nesting deeper than JSON_MAX_NESTING_DEPTH; error
+   receives exactly what a parse would report */
+int json_parse_check_r(const char* data, size_t length, size_t max_depth, JsonError* error);
+
+/* Heap value of one complete scalar token (json_parser.c), with the
+   parser's errors located relative to data */
+JsonValue* json_parse_scalar_r(const char* data, size_t length, const char** end, JsonError* error);
+
+/* Parser messages the push parser reports word for word (json_parser.c) */
+#define JSON_MESSAGE_EXPECTED_STRING_START "Expected '\"' at start of string"
+
+/* Build the members of a JSON_VALUE_LAZY container (json_parser.c) */
+int json_lazy_expand(JsonValue* value);
+
+/* True once a container's members can be read directly */
+#define JSON_VALUE_READY(value) \
+    (!((value)->flags & JSON_VALUE_LAZY) || json_lazy_expand((JsonValue*)(value)))
+
+/* Tape parse with a nesting limit (json_tape.c) */
+JsonTape* json_tape_parse_depth_r(const char* data, size_t length, size_t max_depth, JsonError* error);
+
+/* Tree of a whole tape built into an arena (json_tape.c) */
+JsonValue* json_tape_materialize_arena(const JsonTape* tape, JsonArena* arena);
+
+/* Value allocation shared by the builders and the parser (json.c).
+   A NULL arena means the regular heap, as used by json_create_*() */
+JsonValue* json_value_alloc(JsonArena* arena, JsonType type);
+char* json_string_alloc(JsonArena* arena, size_t length);
+int json_object_set_owned_key(JsonValue* object, char* key, size_t key_length, JsonValue* value);
+int json_object_set_length(JsonValue* object, const char* key, size_t key_length, JsonValue* value);
+int json_object_adopt_pairs(JsonObject* object, JsonKeyValue* pairs, size_t count);
+int json_object_set_interned(JsonValue* object, const char* interned_key, JsonValue* value);
+
+/* Result of json_number_parse() (json_number.c) */
+typedef struct {
+    double number;
+    int64_t integer;        /* Exact value when is_integer is set */
+    int is_integer;         /* Integer literal that fits in int64_t */
+    JsonErrorCode error;    /* JSON_ERROR_NONE on success */
+    const char* message;    /* Error message, NULL on success */
+    const char* end;        /* End of the number, or the offending position */
+} JsonNumberParse;
+
+int json_number_parse(const char* p, const char* end, JsonNumberParse* out);
+
+/* Shortest round-trip formatting of finite doubles (json_number.c) */
+#define JSON_NUMBER_SHORTEST_MAX 32
+int json_number_format_shortest(double value, char* buffer);
+
+/* Byte scanning kernels (json_simd.c). All of them stop at end */
+const char* json_scan_string(const char* p, const char* end);
+const char* json_skip_whitespace(const char* p, const char* end);
+
+/* Whitespace as the parser skips it: isspace() in the C locale, which
+   adds vertical tab and form feed to JSON's four */
+static inline int json_is_space(char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+void json_text_position(const char* input, const char* position, size_t* line, size_t* column);
+
+/* Character classes of one 64-byte block, bit i for byte i */
+typedef struct {
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t whitespace;
+    uint64_t structural;    /* { } [ ] : , */
+    uint64_t control;       /* Bytes below 0x20, including whitespace */
+} JsonBlockMasks;
+
+void json_classify_block(const char* block, JsonBlockMasks* masks);
+
+/* String tracking across blocks: quote parity and escaped bytes, with
+   *carry set when the last byte of a block escapes the next block's first */
+uint64_t json_prefix_xor(uint64_t bits);
+
+/* Position of the lowest set bit of a non-zero mask */
+static inline unsigned json_lowest_bit64(uint64_t mask)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_ctzll(mask);
+#else
+    unsigned index = 0;
+    while (!(mask & 1u)) {
+        mask >>= 1;
+        index++;
+    }
+    return index;
+#endif
+}
+uint64_t json_find_escaped(uint64_t backslash, uint64_t* carry);
+
+#endif /* JSON_INTERNAL_H */
@@ -0,0 +1,194 @@
+/* json_mmap.c */
+#define _POSIX_C_SOURCE 200809L /* fileno */
+#include "json_internal.h"
+
+/* Whole-file input for the parser and validator. Regular files are mapped
+   read-only with a sequential access hint; anything that cannot be mapped
+   (pipes, platforms without mmap) is read into a heap buffer instead. The
+   data is never NUL terminated, callers use the length */
+
+#if defined(__unix__) || defined(__APPLE__)
+#define JSON_HAVE_MMAP 1
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define JSON_FILE_READ_CHUNK (64 * 1024)
+
+static void view_reset(JsonFileView *view)
+{
+    view->data = "";
+    view->length = 0;
+    view->map_base = NULL;
+    view->map_length = 0;
+    view->heap = NULL;
+}
+
+/* Read the rest of a stream into the heap */
+static int read_into_heap(JsonFileView *view, FILE *file, JsonError *error)
+{
+    size_t capacity = JSON_FILE_READ_CHUNK;
+    size_t length = 0;
+    char *buffer = (char *)json_heap_alloc(capacity);
+    if (!buffer)
+    {
+        json_error_set(error, JSON_ERROR_MEMORY_ALLOCATION, "Could not allocate memory for file contents");
+        return 0;
+    }
+
+    for (;;)
+    {
+        if (length == capacity)
+        {
+            char *grown = (char *)json_heap_realloc(buffer, capacity * 2);
+            if (!grown)
+            {
+                json_heap_free(buffer);
+                json_error_set(error, JSON_ERROR_MEMORY_ALLOCATION, "Could not allocate memory for file contents");
+                return 0;
+            }
+            buffer = grown;
+            capacity *= 2;
+        }
+        size_t bytes = fread(buffer + length, 1, capacity - length, file);
+        length += bytes;
+        if (bytes == 0)
+            break;
+    }
+
+    if (ferror(file))
+    {
+        json_heap_free(buffer);
+        json_error_set(error, JSON_ERROR_FILE_READ, "Could not read entire file");
+        return 0;
+    }
+
+    view->heap = buffer;
+    view->data = buffer;
+    view->length = length;
+    return 1;
+}
+
+#ifdef JSON_HAVE_MMAP
+/* Map a regular file from offset to its end. Returns 0 if the file cannot
+   be mapped, in which case the caller falls back to reading it */
+static int map_fd(JsonFileView *view, int fd, size_t offset)
+{
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode))
+        return 0;
+
+    size_t size = (size_t)info.st_size;
+    if (offset >= size)
+    {
+        view_reset(view); /* Nothing left: empty input */
+        return 1;
+    }
+
+    void *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED)
+        return 0;
+#ifdef MADV_SEQUENTIAL
+    madvise(base, size, MADV_SEQUENTIAL);
+#endif
+
+    view->map_base = base;
+    view->map_length = size;
+    view->data = (const char *)base + offset;
+    view->length = size - offset;
+    return 1;
+}
+#endif
+
+/* Open filename for parsing. Returns 0 with error filled in on failure */
+static int open_file(JsonFileView *view, const char *filename, JsonError *error)
+{
+    view_reset(view);
+    if (!filename)
+    {
+        json_error_set(error, JSON_ERROR_INVALID_VALUE, "Filename is NULL");
+        return 0;
+    }
+
+#ifdef JSON_HAVE_MMAP
+    int fd = open(filename, O_RDONLY);
+    if (fd >= 0)
+    {
+        int mapped = map_fd(view, fd, 0);
+        close(fd);
+        if (mapped)
+            return 1;
+    }
+#endif
+
+    FILE *file = fopen(filename, "rb");
+    if (!file)
+    {
+        char message[256];
+        snprintf(message, sizeof(message), "Could not open file: %s", filename);
+        json_error_set(error, JSON_ERROR_INVALID_VALUE, message);
+        return 0;
+    }
+    int result = read_into_heap(view, file, error);
+    fclose(file);
+    return result;
+}
+
+/* Take the rest of stream, from its current position, as input. The
+   stream is left positioned at its end */
+static int open_stream(JsonFileView *view, FILE *stream, JsonError *error)
+{
+    view_reset(view);
+    if (!stream)
+    {
+        json_error_set(error, JSON_ERROR_INVALID_VALUE, "NULL stream pointer");
+        return 0;
+    }
+
+#ifdef JSON_HAVE_MMAP
+    long position = ftell(stream);
+    if (position >= 0 && map_fd(view, fileno(stream), (size_t)position))
+    {
+        fseek(stream, 0, SEEK_END);
+        return 1;
+    }
+#endif
+
+    return read_into_heap(view, stream, error);
+}
+
+/* Both count as the read phase. A mapping only costs its page faults
+   later, which are charged to whoever touches the data first */
+int json_file_view_open(JsonFileView *view, const char *filename, JsonError *error)
+{
+    JsonPhaseMark mark;
+    json_phase_enter(JSON_PHASE_READ, &mark);
+    int result = open_file(view, filename, error);
+    json_phase_leave(&mark);
+    return result;
+}
+
+int json_file_view_open_stream(JsonFileView *view, FILE *stream, JsonError *error)
+{
+    JsonPhaseMark mark;
+    json_phase_enter(JSON_PHASE_READ, &mark);
+    int result = open_stream(view, stream, error);
+    json_phase_leave(&mark);
+    return result;
+}
+
+void json_file_view_close(JsonFileView *view)
+{
+    if (!view)
+        return;
+#ifdef JSON_HAVE_MMAP
+    if (view->map_base)
+    {
+        munmap(view->map_base, view->map_length);
+    }
+#endif
+    json_heap_free(view->heap);
+    view_reset(view);
+}
@@ -0,0 +1,1997 @@
+/* json_number.c */
+#include "json_internal.h"
+#include <float.h>
+#include <math.h>
+
+/* Number conversion used by the parser and formatter. Numbers are read
+   in place: integers come straight from the digit run, decimals go
+   through the exact Clinger fast path or the Eisel-Lemire algorithm, and
+   only inputs neither can decide are handed to strtod() */
+
+#define JSON_NUMBER_MAX_DIGITS 19       /* Significant digits that always fit in a uint64_t */
+#define JSON_NUMBER_FALLBACK_DIGITS 768 /* Digits kept for the strtod() fallback */
+#define POW10_TABLE_MIN (-342)
+#define POW10_TABLE_MAX 308
+
+/* 128-bit approximations (rounded down) of 10^q, normalized so that the
+   top bit is set, for q in [POW10_TABLE_MIN, POW10_TABLE_MAX] */
+static const uint64_t pow10_table[][2] = {
+    {0xEEF453D6923BD65AULL, 0x113FAA2906A13B3FULL}, /* 1e-342 */
+    {0x9558B4661B6565F8ULL, 0x4AC7CA59A424C507ULL}, /* 1e-341 */
+    {0xBAAEE17FA23EBF76ULL, 0x5D79BCF00D2DF649ULL}, /* 1e-340 */
+    {0xE95A99DF8ACE6F53ULL, 0xF4D82C2C107973DCULL}, /* 1e-339 */
+    {0x91D8A02BB6C10594ULL, 0x79071B9B8A4BE869ULL}, /* 1e-338 */
+    {0xB64EC836A47146F9ULL, 0x9748E2826CDEE284ULL}, /* 1e-337 */
+    {0xE3E27A444D8D98B7ULL, 0xFD1B1B2308169B25ULL}, /* 1e-336 */
+    {0x8E6D8C6AB0787F72ULL, 0xFE30F0F5E50E20F7ULL}, /* 1e-335 */
+    {0xB208EF855C969F4FULL, 0xBDBD2D335E51A935ULL}, /* 1e-334 */
+    {0xDE8B2B66B3BC4723ULL, 0xAD2C788035E61382ULL}, /* 1e-333 */
+    {0x8B16FB203055AC76ULL, 0x4C3BCB5021AFCC31ULL}, /* 1e-332 */
+    {0xADDCB9E83C6B1793ULL, 0xDF4ABE242A1BBF3DULL}, /* 1e-331 */
+    {0xD953E8624B85DD78ULL, 0xD71D6DAD34A2AF0DULL}, /* 1e-330 */
+    {0x87D4713D6F33AA6BULL, 0x8672648C40E5AD68ULL}, /* 1e-329 */
+    {0xA9C98D8CCB009506ULL, 0x680EFDAF511F18C2ULL}, /* 1e-328 */
+    {0xD43BF0EFFDC0BA48ULL, 0x0212BD1B2566DEF2ULL}, /* 1e-327 */
+    {0x84A57695FE98746DULL, 0x014BB630F7604B57ULL}, /* 1e-326 */
+    {0xA5CED43B7E3E9188ULL, 0x419EA3BD35385E2DULL}, /* 1e-325 */
+    {0xCF42894A5DCE35EAULL, 0x52064CAC828675B9ULL}, /* 1e-324 */
+    {0x818995CE7AA0E1B2ULL, 0x7343EFEBD1940993ULL}, /* 1e-323 */
+    {0xA1EBFB4219491A1FULL, 0x1014EBE6C5F90BF8ULL}, /* 1e-322 */
+    {0xCA66FA129F9B60A6ULL, 0xD41A26E077774EF6ULL}, /* 1e-321 */
+    {0xFD00B897478238D0ULL, 0x8920B098955522B4ULL}, /* 1e-320 */
+    {0x9E20735E8CB16382ULL, 0x55B46E5F5D5535B0ULL}, /* 1e-319 */
+    {0xC5A890362FDDBC62ULL, 0xEB2189F734AA831DULL}, /* 1e-318 */
+    {0xF712B443BBD52B7BULL, 0xA5E9EC7501D523E4ULL}, /* 1e-317 */
+    {0x9A6BB0AA55653B2DULL, 0x47B233C92125366EULL}, /* 1e-316 */
+    {0xC1069CD4EABE89F8ULL, 0x999EC0BB696E840AULL}, /* 1e-315 */
+    {0xF148440A256E2C76ULL, 0xC00670EA43CA250DULL}, /* 1e-314 */
+    {0x96CD2A865764DBCAULL, 0x380406926A5E5728ULL}, /* 1e-313 */
+    {0xBC807527ED3E12BCULL, 0xC605083704F5ECF2ULL}, /* 1e-312 */
+    {0xEBA09271E88D976BULL, 0xF7864A44C633682EULL}, /* 1e-311 */
+    {0x93445B8731587EA3ULL, 0x7AB3EE6AFBE0211DULL}, /* 1e-310 */
+    {0xB8157268FDAE9E4CULL, 0x5960EA05BAD82964ULL}, /* 1e-309 */
+    {0xE61ACF033D1A45DFULL, 0x6FB92487298E33BDULL}, /* 1e-308 */
+    {0x8FD0C16206306BABULL, 0xA5D3B6D479F8E056ULL}, /* 1e-307 */
+    {0xB3C4F1BA87BC8696ULL, 0x8F48A4899877186CULL}, /* 1e-306 */
+    {0xE0B62E2929ABA83CULL, 0x331ACDABFE94DE87ULL}, /* 1e-305 */
+    {0x8C71DCD9BA0B4925ULL, 0x9FF0C08B7F1D0B14ULL}, /* 1e-304 */
+    {0xAF8E5410288E1B6FULL, 0x07ECF0AE5EE44DD9ULL}, /* 1e-303 */
+    {0xDB71E91432B1A24AULL, 0xC9E82CD9F69D6150ULL}, /* 1e-302 */
+    {0x892731AC9FAF056EULL, 0xBE311C083A225CD2ULL}, /* 1e-301 */
+    {0xAB70FE17C79AC6CAULL, 0x6DBD630A48AAF406ULL}, /* 1e-300 */
+    {0xD64D3D9DB981787DULL, 0x092CBBCCDAD5B108ULL}, /* 1e-299 */
+    {0x85F0468293F0EB4EULL, 0x25BBF56008C58EA5ULL}, /* 1e-298 */
+    {0xA76C582338ED2621ULL, 0xAF2AF2B80AF6F24EULL}, /* 1e-297 */
+    {0xD1476E2C07286FAAULL, 0x1AF5AF660DB4AEE1ULL}, /* 1e-296 */
+    {0x82CCA4DB847945CAULL, 0x50D98D9FC890ED4DULL}, /* 1e-295 */
+    {0xA37FCE126597973CULL, 0xE50FF107BAB528A0ULL}, /* 1e-294 */
+    {0xCC5FC196FEFD7D0CULL, 0x1E53ED49A96272C8ULL}, /* 1e-293 */
+    {0xFF77B1FCBEBCDC4FULL, 0x25E8E89C13BB0F7AULL}, /* 1e-292 */
+    {0x9FAACF3DF73609B1ULL, 0x77B191618C54E9ACULL}, /* 1e-291 */
+    {0xC795830D75038C1DULL, 0xD59DF5B9EF6A2417ULL}, /* 1e-290 */
+    {0xF97AE3D0D2446F25ULL, 0x4B0573286B44AD1DULL}, /* 1e-289 */
+    {0x9BECCE62836AC577ULL, 0x4EE367F9430AEC32ULL}, /* 1e-288 */
+    {0xC2E801FB244576D5ULL, 0x229C41F793CDA73FULL}, /* 1e-287 */
+    {0xF3A20279ED56D48AULL, 0x6B43527578C1110FULL}, /* 1e-286 */
+    {0x9845418C345644D6ULL, 0x830A13896B78AAA9ULL}, /* 1e-285 */
+    {0xBE5691EF416BD60CULL, 0x23CC986BC656D553ULL}, /* 1e-284 */
+    {0xEDEC366B11C6CB8FULL, 0x2CBFBE86B7EC8AA8ULL}, /* 1e-283 */
+    {0x94B3A202EB1C3F39ULL, 0x7BF7D71432F3D6A9ULL}, /* 1e-282 */
+    {0xB9E08A83A5E34F07ULL, 0xDAF5CCD93FB0CC53ULL}, /* 1e-281 */
+    {0xE858AD248F5C22C9ULL, 0xD1B3400F8F9CFF68ULL}, /* 1e-280 */
+    {0x91376C36D99995BEULL, 0x23100809B9C21FA1ULL}, /* 1e-279 */
+    {0xB58547448FFFFB2DULL, 0xABD40A0C2832A78AULL}, /* 1e-278 */
+    {0xE2E69915B3FFF9F9ULL, 0x16C90C8F323F516CULL}, /* 1e-277 */
+    {0x8DD01FAD907FFC3BULL, 0xAE3DA7D97F6792E3ULL}, /* 1e-276 */
+    {0xB1442798F49FFB4AULL, 0x99CD11CFDF41779CULL}, /* 1e-275 */
+    {0xDD95317F31C7FA1DULL, 0x40405643D711D583ULL}, /* 1e-274 */
+    {0x8A7D3EEF7F1CFC52ULL, 0x482835EA666B2572ULL}, /* 1e-273 */
+    {0xAD1C8EAB5EE43B66ULL, 0xDA3243650005EECFULL}, /* 1e-272 */
+    {0xD863B256369D4A40ULL, 0x90BED43E40076A82ULL}, /* 1e-271 */
+    {0x873E4F75E2224E68ULL, 0x5A7744A6E804A291ULL}, /* 1e-270 */
+    {0xA90DE3535AAAE202ULL, 0x711515D0A205CB36ULL}, /* 1e-269 */
+    {0xD3515C2831559A83ULL, 0x0D5A5B44CA873E03ULL}, /* 1e-268 */
+    {0x8412D9991ED58091ULL, 0xE858790AFE9486C2ULL}, /* 1e-267 */
+    {0xA5178FFF668AE0B6ULL, 0x626E974DBE39A872ULL}, /* 1e-266 */
+    {0xCE5D73FF402D98E3ULL, 0xFB0A3D212DC8128FULL}, /* 1e-265 */
+    {0x80FA687F881C7F8EULL, 0x7CE66634BC9D0B99ULL}, /* 1e-264 */
+    {0xA139029F6A239F72ULL, 0x1C1FFFC1EBC44E80ULL}, /* 1e-263 */
+    {0xC987434744AC874EULL, 0xA327FFB266B56220ULL}, /* 1e-262 */
+    {0xFBE9141915D7A922ULL, 0x4BF1FF9F0062BAA8ULL}, /* 1e-261 */
+    {0x9D71AC8FADA6C9B5ULL, 0x6F773FC3603DB4A9ULL}, /* 1e-260 */
+    {0xC4CE17B399107C22ULL, 0xCB550FB4384D21D3ULL}, /* 1e-259 */
+    {0xF6019DA07F549B2BULL, 0x7E2A53A146606A48ULL}, /* 1e-258 */
+    {0x99C102844F94E0FBULL, 0x2EDA7444CBFC426DULL}, /* 1e-257 */
+    {0xC0314325637A1939ULL, 0xFA911155FEFB5308ULL}, /* 1e-256 */
+    {0xF03D93EEBC589F88ULL, 0x793555AB7EBA27CAULL}, /* 1e-255 */
+    {0x96267C7535B763B5ULL, 0x4BC1558B2F3458DEULL}, /* 1e-254 */
+    {0xBBB01B9283253CA2ULL, 0x9EB1AAEDFB016F16ULL}, /* 1e-253 */
+    {0xEA9C227723EE8BCBULL, 0x465E15A979C1CADCULL}, /* 1e-252 */
+    {0x92A1958A7675175FULL, 0x0BFACD89EC191EC9ULL}, /* 1e-251 */
+    {0xB749FAED14125D36ULL, 0xCEF980EC671F667BULL}, /* 1e-250 */
+    {0xE51C79A85916F484ULL, 0x82B7E12780E7401AULL}, /* 1e-249 */
+    {0x8F31CC0937AE58D2ULL, 0xD1B2ECB8B0908810ULL}, /* 1e-248 */
+    {0xB2FE3F0B8599EF07ULL, 0x861FA7E6DCB4AA15ULL}, /* 1e-247 */
+    {0xDFBDCECE67006AC9ULL, 0x67A791E093E1D49AULL}, /* 1e-246 */
+    {0x8BD6A141006042BDULL, 0xE0C8BB2C5C6D24E0ULL}, /* 1e-245 */
+    {0xAECC49914078536DULL, 0x58FAE9F773886E18ULL}, /* 1e-244 */
+    {0xDA7F5BF590966848ULL, 0xAF39A475506A899EULL}, /* 1e-243 */
+    {0x888F99797A5E012DULL, 0x6D8406C952429603ULL}, /* 1e-242 */
+    {0xAAB37FD7D8F58178ULL, 0xC8E5087BA6D33B83ULL}, /* 1e-241 */
+    {0xD5605FCDCF32E1D6ULL, 0xFB1E4A9A90880A64ULL}, /* 1e-240 */
+    {0x855C3BE0A17FCD26ULL, 0x5CF2EEA09A55067FULL}, /* 1e-239 */
+    {0xA6B34AD8C9DFC06FULL, 0xF42FAA48C0EA481EULL}, /* 1e-238 */
+    {0xD0601D8EFC57B08BULL, 0xF13B94DAF124DA26ULL}, /* 1e-237 */
+    {0x823C12795DB6CE57ULL, 0x76C53D08D6B70858ULL}, /* 1e-236 */
+    {0xA2CB1717B52481EDULL, 0x54768C4B0C64CA6EULL}, /* 1e-235 */
+    {0xCB7DDCDDA26DA268ULL, 0xA9942F5DCF7DFD09ULL}, /* 1e-234 */
+    {0xFE5D54150B090B02ULL, 0xD3F93B35435D7C4CULL}, /* 1e-233 */
+    {0x9EFA548D26E5A6E1ULL, 0xC47BC5014A1A6DAFULL}, /* 1e-232 */
+    {0xC6B8E9B0709F109AULL, 0x359AB6419CA1091BULL}, /* 1e-231 */
+    {0xF867241C8CC6D4C0ULL, 0xC30163D203C94B62ULL}, /* 1e-230 */
+    {0x9B407691D7FC44F8ULL, 0x79E0DE63425DCF1DULL}, /* 1e-229 */
+    {0xC21094364DFB5636ULL, 0x985915FC12F542E4ULL}, /* 1e-228 */
+    {0xF294B943E17A2BC4ULL, 0x3E6F5B7B17B2939DULL}, /* 1e-227 */
+    {0x979CF3CA6CEC5B5AULL, 0xA705992CEECF9C42ULL}, /* 1e-226 */
+    {0xBD8430BD08277231ULL, 0x50C6FF782A838353ULL}, /* 1e-225 */
+    {0xECE53CEC4A314EBDULL, 0xA4F8BF5635246428ULL}, /* 1e-224 */
+    {0x940F4613AE5ED136ULL, 0x871B7795E136BE99ULL}, /* 1e-223 */
+    {0xB913179899F68584ULL, 0x28E2557B59846E3FULL}, /* 1e-222 */
+    {0xE757DD7EC07426E5ULL, 0x331AEADA2FE589CFULL}, /* 1e-221 */
+    {0x9096EA6F3848984FULL, 0x3FF0D2C85DEF7621ULL}, /* 1e-220 */
+    {0xB4BCA50B065ABE63ULL, 0x0FED077A756B53A9ULL}, /* 1e-219 */
+    {0xE1EBCE4DC7F16DFBULL, 0xD3E8495912C62894ULL}, /* 1e-218 */
+    {0x8D3360F09CF6E4BDULL, 0x64712DD7ABBBD95CULL}, /* 1e-217 */
+    {0xB080392CC4349DECULL, 0xBD8D794D96AACFB3ULL}, /* 1e-216 */
+    {0xDCA04777F541C567ULL, 0xECF0D7A0FC5583A0ULL}, /* 1e-215 */
+    {0x89E42CAAF9491B60ULL, 0xF41686C49DB57244ULL}, /* 1e-214 */
+    {0xAC5D37D5B79B6239ULL, 0x311C2875C522CED5ULL}, /* 1e-213 */
+    {0xD77485CB25823AC7ULL, 0x7D633293366B828BULL}, /* 1e-212 */
+    {0x86A8D39EF77164BCULL, 0xAE5DFF9C02033197ULL}, /* 1e-211 */
+    {0xA8530886B54DBDEBULL, 0xD9F57F830283FDFCULL}, /* 1e-210 */
+    {0xD267CAA862A12D66ULL, 0xD072DF63C324FD7BULL}, /* 1e-209 */
+    {0x8380DEA93DA4BC60ULL, 0x4247CB9E59F71E6DULL}, /* 1e-208 */
+    {0xA46116538D0DEB78ULL, 0x52D9BE85F074E608ULL}, /* 1e-207 */
+    {0xCD795BE870516656ULL, 0x67902E276C921F8BULL}, /* 1e-206 */
+    {0x806BD9714632DFF6ULL, 0x00BA1CD8A3DB53B6ULL}, /* 1e-205 */
+    {0xA086CFCD97BF97F3ULL, 0x80E8A40ECCD228A4ULL}, /* 1e-204 */
+    {0xC8A883C0FDAF7DF0ULL, 0x6122CD128006B2CDULL}, /* 1e-203 */
+    {0xFAD2A4B13D1B5D6CULL, 0x796B805720085F81ULL}, /* 1e-202 */
+    {0x9CC3A6EEC6311A63ULL, 0xCBE3303674053BB0ULL}, /* 1e-201 */
+    {0xC3F490AA77BD60FCULL, 0xBEDBFC4411068A9CULL}, /* 1e-200 */
+    {0xF4F1B4D515ACB93BULL, 0xEE92FB5515482D44ULL}, /* 1e-199 */
+    {0x991711052D8BF3C5ULL, 0x751BDD152D4D1C4AULL}, /* 1e-198 */
+    {0xBF5CD54678EEF0B6ULL, 0xD262D45A78A0635DULL}, /* 1e-197 */
+    {0xEF340A98172AACE4ULL, 0x86FB897116C87C34ULL}, /* 1e-196 */
+    {0x9580869F0E7AAC0EULL, 0xD45D35E6AE3D4DA0ULL}, /* 1e-195 */
+    {0xBAE0A846D2195712ULL, 0x8974836059CCA109ULL}, /* 1e-194 */
+    {0xE998D258869FACD7ULL, 0x2BD1A438703FC94BULL}, /* 1e-193 */
+    {0x91FF83775423CC06ULL, 0x7B6306A34627DDCFULL}, /* 1e-192 */
+    {0xB67F6455292CBF08ULL, 0x1A3BC84C17B1D542ULL}, /* 1e-191 */
+    {0xE41F3D6A7377EECAULL, 0x20CABA5F1D9E4A93ULL}, /* 1e-190 */
+    {0x8E938662882AF53EULL, 0x547EB47B7282EE9CULL}, /* 1e-189 */
+    {0xB23867FB2A35B28DULL, 0xE99E619A4F23AA43ULL}, /* 1e-188 */
+    {0xDEC681F9F4C31F31ULL, 0x6405FA00E2EC94D4ULL}, /* 1e-187 */
+    {0x8B3C113C38F9F37EULL, 0xDE83BC408DD3DD04ULL}, /* 1e-186 */
+    {0xAE0B158B4738705EULL, 0x9624AB50B148D445ULL}, /* 1e-185 */
+    {0xD98DDAEE19068C76ULL, 0x3BADD624DD9B0957ULL}, /* 1e-184 */
+    {0x87F8A8D4CFA417C9ULL, 0xE54CA5D70A80E5D6ULL}, /* 1e-183 */
+    {0xA9F6D30A038D1DBCULL, 0x5E9FCF4CCD211F4CULL}, /* 1e-182 */
+    {0xD47487CC8470652BULL, 0x7647C3200069671FULL}, /* 1e-181 */
+    {0x84C8D4DFD2C63F3BULL, 0x29ECD9F40041E073ULL}, /* 1e-180 */
+    {0xA5FB0A17C777CF09ULL, 0xF468107100525890ULL}, /* 1e-179 */
+    {0xCF79CC9DB955C2CCULL, 0x7182148D4066EEB4ULL}, /* 1e-178 */
+    {0x81AC1FE293D599BFULL, 0xC6F14CD848405530ULL}, /* 1e-177 */
+    {0xA21727DB38CB002FULL, 0xB8ADA00E5A506A7CULL}, /* 1e-176 */
+    {0xCA9CF1D206FDC03BULL, 0xA6D90811F0E4851CULL}, /* 1e-175 */
+    {0xFD442E4688BD304AULL, 0x908F4A166D1DA663ULL}, /* 1e-174 */
+    {0x9E4A9CEC15763E2EULL, 0x9A598E4E043287FEULL}, /* 1e-173 */
+    {0xC5DD44271AD3CDBAULL, 0x40EFF1E1853F29FDULL}, /* 1e-172 */
+    {0xF7549530E188C128ULL, 0xD12BEE59E68EF47CULL}, /* 1e-171 */
+    {0x9A94DD3E8CF578B9ULL, 0x82BB74F8301958CEULL}, /* 1e-170 */
+    {0xC13A148E3032D6E7ULL, 0xE36A52363C1FAF01ULL}, /* 1e-169 */
+    {0xF18899B1BC3F8CA1ULL, 0xDC44E6C3CB279AC1ULL}, /* 1e-168 */
+    {0x96F5600F15A7B7E5ULL, 0x29AB103A5EF8C0B9ULL}, /* 1e-167 */
+    {0xBCB2B812DB11A5DEULL, 0x7415D448F6B6F0E7ULL}, /* 1e-166 */
+    {0xEBDF661791D60F56ULL, 0x111B495B3464AD21ULL}, /* 1e-165 */
+    {0x936B9FCEBB25C995ULL, 0xCAB10DD900BEEC34ULL}, /* 1e-164 */
+    {0xB84687C269EF3BFBULL, 0x3D5D514F40EEA742ULL}, /* 1e-163 */
+    {0xE65829B3046B0AFAULL, 0x0CB4A5A3112A5112ULL}, /* 1e-162 */
+    {0x8FF71A0FE2C2E6DCULL, 0x47F0E785EABA72ABULL}, /* 1e-161 */
+    {0xB3F4E093DB73A093ULL, 0x59ED216765690F56ULL}, /* 1e-160 */
+    {0xE0F218B8D25088B8ULL, 0x306869C13EC3532CULL}, /* 1e-159 */
+    {0x8C974F7383725573ULL, 0x1E414218C73A13FBULL}, /* 1e-158 */
+    {0xAFBD2350644EEACFULL, 0xE5D1929EF90898FAULL}, /* 1e-157 */
+    {0xDBAC6C247D62A583ULL, 0xDF45F746B74ABF39ULL}, /* 1e-156 */
+    {0x894BC396CE5DA772ULL, 0x6B8BBA8C328EB783ULL}, /* 1e-155 */
+    {0xAB9EB47C81F5114FULL, 0x066EA92F3F326564ULL}, /* 1e-154 */
+    {0xD686619BA27255A2ULL, 0xC80A537B0EFEFEBDULL}, /* 1e-153 */
+    {0x8613FD0145877585ULL, 0xBD06742CE95F5F36ULL}, /* 1e-152 */
+    {0xA798FC4196E952E7ULL, 0x2C48113823B73704ULL}, /* 1e-151 */
+    {0xD17F3B51FCA3A7A0ULL, 0xF75A15862CA504C5ULL}, /* 1e-150 */
+    {0x82EF85133DE648C4ULL, 0x9A984D73DBE722FBULL}, /* 1e-149 */
+    {0xA3AB66580D5FDAF5ULL, 0xC13E60D0D2E0EBBAULL}, /* 1e-148 */
+    {0xCC963FEE10B7D1B3ULL, 0x318DF905079926A8ULL}, /* 1e-147 */
+    {0xFFBBCFE994E5C61FULL, 0xFDF17746497F7052ULL}, /* 1e-146 */
+    {0x9FD561F1FD0F9BD3ULL, 0xFEB6EA8BEDEFA633ULL}, /* 1e-145 */
+    {0xC7CABA6E7C5382C8ULL, 0xFE64A52EE96B8FC0ULL}, /* 1e-144 */
+    {0xF9BD690A1B68637BULL, 0x3DFDCE7AA3C673B0ULL}, /* 1e-143 */
+    {0x9C1661A651213E2DULL, 0x06BEA10CA65C084EULL}, /* 1e-142 */
+    {0xC31BFA0FE5698DB8ULL, 0x486E494FCFF30A62ULL}, /* 1e-141 */
+    {0xF3E2F893DEC3F126ULL, 0x5A89DBA3C3EFCCFAULL}, /* 1e-140 */
+    {0x986DDB5C6B3A76B7ULL, 0xF89629465A75E01CULL}, /* 1e-139 */
+    {0xBE89523386091465ULL, 0xF6BBB397F1135823ULL}, /* 1e-138 */
+    {0xEE2BA6C0678B597FULL, 0x746AA07DED582E2CULL}, /* 1e-137 */
+    {0x94DB483840B717EFULL, 0xA8C2A44EB4571CDCULL}, /* 1e-136 */
+    {0xBA121A4650E4DDEBULL, 0x92F34D62616CE413ULL}, /* 1e-135 */
+    {0xE896A0D7E51E1566ULL, 0x77B020BAF9C81D17ULL}, /* 1e-134 */
+    {0x915E2486EF32CD60ULL, 0x0ACE1474DC1D122EULL}, /* 1e-133 */
+    {0xB5B5ADA8AAFF80B8ULL, 0x0D819992132456BAULL}, /* 1e-132 */
+    {0xE3231912D5BF60E6ULL, 0x10E1FFF697ED6C69ULL}, /* 1e-131 */
+    {0x8DF5EFABC5979C8FULL, 0xCA8D3FFA1EF463C1ULL}, /* 1e-130 */
+    {0xB1736B96B6FD83B3ULL, 0xBD308FF8A6B17CB2ULL}, /* 1e-129 */
+    {0xDDD0467C64BCE4A0ULL, 0xAC7CB3F6D05DDBDEULL}, /* 1e-128 */
+    {0x8AA22C0DBEF60EE4ULL, 0x6BCDF07A423AA96BULL}, /* 1e-127 */
+    {0xAD4AB7112EB3929DULL, 0x86C16C98D2C953C6ULL}, /* 1e-126 */
+    {0xD89D64D57A607744ULL, 0xE871C7BF077BA8B7ULL}, /* 1e-125 */
+    {0x87625F056C7C4A8BULL, 0x11471CD764AD4972ULL}, /* 1e-124 */
+    {0xA93AF6C6C79B5D2DULL, 0xD598E40D3DD89BCFULL}, /* 1e-123 */
+    {0xD389B47879823479ULL, 0x4AFF1D108D4EC2C3ULL}, /* 1e-122 */
+    {0x843610CB4BF160CBULL, 0xCEDF722A585139BAULL}, /* 1e-121 */
+    {0xA54394FE1EEDB8FEULL, 0xC2974EB4EE658828ULL}, /* 1e-120 */
+    {0xCE947A3DA6A9273EULL, 0x733D226229FEEA32ULL}, /* 1e-119 */
+    {0x811CCC668829B887ULL, 0x0806357D5A3F525FULL}, /* 1e-118 */
+    {0xA163FF802A3426A8ULL, 0xCA07C2DCB0CF26F7ULL}, /* 1e-117 */
+    {0xC9BCFF6034C13052ULL, 0xFC89B393DD02F0B5ULL}, /* 1e-116 */
+    {0xFC2C3F3841F17C67ULL, 0xBBAC2078D443ACE2ULL}, /* 1e-115 */
+    {0x9D9BA7832936EDC0ULL, 0xD54B944B84AA4C0DULL}, /* 1e-114 */
+    {0xC5029163F384A931ULL, 0x0A9E795E65D4DF11ULL}, /* 1e-113 */
+    {0xF64335BCF065D37DULL, 0x4D4617B5FF4A16D5ULL}, /* 1e-112 */
+    {0x99EA0196163FA42EULL, 0x504BCED1BF8E4E45ULL}, /* 1e-111 */
+    {0xC06481FB9BCF8D39ULL, 0xE45EC2862F71E1D6ULL}, /* 1e-110 */
+    {0xF07DA27A82C37088ULL, 0x5D767327BB4E5A4CULL}, /* 1e-109 */
+    {0x964E858C91BA2655ULL, 0x3A6A07F8D510F86FULL}, /* 1e-108 */
+    {0xBBE226EFB628AFEAULL, 0x890489F70A55368BULL}, /* 1e-107 */
+    {0xEADAB0ABA3B2DBE5ULL, 0x2B45AC74CCEA842EULL}, /* 1e-106 */
+    {0x92C8AE6B464FC96FULL, 0x3B0B8BC90012929DULL}, /* 1e-105 */
+    {0xB77ADA0617E3BBCBULL, 0x09CE6EBB40173744ULL}, /* 1e-104 */
+    {0xE55990879DDCAABDULL, 0xCC420A6A101D0515ULL}, /* 1e-103 */
+    {0x8F57FA54C2A9EAB6ULL, 0x9FA946824A12232DULL}, /* 1e-102 */
+    {0xB32DF8E9F3546564ULL, 0x47939822DC96ABF9ULL}, /* 1e-101 */
+    {0xDFF9772470297EBDULL, 0x59787E2B93BC56F7ULL}, /* 1e-100 */
+    {0x8BFBEA76C619EF36ULL, 0x57EB4EDB3C55B65AULL}, /* 1e-99 */
+    {0xAEFAE51477A06B03ULL, 0xEDE622920B6B23F1ULL}, /* 1e-98 */
+    {0xDAB99E59958885C4ULL, 0xE95FAB368E45ECEDULL}, /* 1e-97 */
+    {0x88B402F7FD75539BULL, 0x11DBCB0218EBB414ULL}, /* 1e-96 */
+    {0xAAE103B5FCD2A881ULL, 0xD652BDC29F26A119ULL}, /* 1e-95 */
+    {0xD59944A37C0752A2ULL, 0x4BE76D3346F0495FULL}, /* 1e-94 */
+    {0x857FCAE62D8493A5ULL, 0x6F70A4400C562DDBULL}, /* 1e-93 */
+    {0xA6DFBD9FB8E5B88EULL, 0xCB4CCD500F6BB952ULL}, /* 1e-92 */
+    {0xD097AD07A71F26B2ULL, 0x7E2000A41346A7A7ULL}, /* 1e-91 */
+    {0x825ECC24C873782FULL, 0x8ED400668C0C28C8ULL}, /* 1e-90 */
+    {0xA2F67F2DFA90563BULL, 0x728900802F0F32FAULL}, /* 1e-89 */
+    {0xCBB41EF979346BCAULL, 0x4F2B40A03AD2FFB9ULL}, /* 1e-88 */
+    {0xFEA126B7D78186BCULL, 0xE2F610C84987BFA8ULL}, /* 1e-87 */
+    {0x9F24B832E6B0F436ULL, 0x0DD9CA7D2DF4D7C9ULL}, /* 1e-86 */
+    {0xC6EDE63FA05D3143ULL, 0x91503D1C79720DBBULL}, /* 1e-85 */
+    {0xF8A95FCF88747D94ULL, 0x75A44C6397CE912AULL}, /* 1e-84 */
+    {0x9B69DBE1B548CE7CULL, 0xC986AFBE3EE11ABAULL}, /* 1e-83 */
+    {0xC24452DA229B021BULL, 0xFBE85BADCE996168ULL}, /* 1e-82 */
+    {0xF2D56790AB41C2A2ULL, 0xFAE27299423FB9C3ULL}, /* 1e-81 */
+    {0x97C560BA6B0919A5ULL, 0xDCCD879FC967D41AULL}, /* 1e-80 */
+    {0xBDB6B8E905CB600FULL, 0x5400E987BBC1C920ULL}, /* 1e-79 */
+    {0xED246723473E3813ULL, 0x290123E9AAB23B68ULL}, /* 1e-78 */
+    {0x9436C0760C86E30BULL, 0xF9A0B6720AAF6521ULL}, /* 1e-77 */
+    {0xB94470938FA89BCEULL, 0xF808E40E8D5B3E69ULL}, /* 1e-76 */
+    {0xE7958CB87392C2C2ULL, 0xB60B1D1230B20E04ULL}, /* 1e-75 */
+    {0x90BD77F3483BB9B9ULL, 0xB1C6F22B5E6F48C2ULL}, /* 1e-74 */
+    {0xB4ECD5F01A4AA828ULL, 0x1E38AEB6360B1AF3ULL}, /* 1e-73 */
+    {0xE2280B6C20DD5232ULL, 0x25C6DA63C38DE1B0ULL}, /* 1e-72 */
+    {0x8D590723948A535FULL, 0x579C487E5A38AD0EULL}, /* 1e-71 */
+    {0xB0AF48EC79ACE837ULL, 0x2D835A9DF0C6D851ULL}, /* 1e-70 */
+    {0xDCDB1B2798182244ULL, 0xF8E431456CF88E65ULL}, /* 1e-69 */
+    {0x8A08F0F8BF0F156BULL, 0x1B8E9ECB641B58FFULL}, /* 1e-68 */
+    {0xAC8B2D36EED2DAC5ULL, 0xE272467E3D222F3FULL}, /* 1e-67 */
+    {0xD7ADF884AA879177ULL, 0x5B0ED81DCC6ABB0FULL}, /* 1e-66 */
+    {0x86CCBB52EA94BAEAULL, 0x98E947129FC2B4E9ULL}, /* 1e-65 */
+    {0xA87FEA27A539E9A5ULL, 0x3F2398D747B36224ULL}, /* 1e-64 */
+    {0xD29FE4B18E88640EULL, 0x8EEC7F0D19A03AADULL}, /* 1e-63 */
+    {0x83A3EEEEF9153E89ULL, 0x1953CF68300424ACULL}, /* 1e-62 */
+    {0xA48CEAAAB75A8E2BULL, 0x5FA8C3423C052DD7ULL}, /* 1e-61 */
+    {0xCDB02555653131B6ULL, 0x3792F412CB06794DULL}, /* 1e-60 */
+    {0x808E17555F3EBF11ULL, 0xE2BBD88BBEE40BD0ULL}, /* 1e-59 */
+    {0xA0B19D2AB70E6ED6ULL, 0x5B6ACEAEAE9D0EC4ULL}, /* 1e-58 */
+    {0xC8DE047564D20A8BULL, 0xF245825A5A445275ULL}, /* 1e-57 */
+    {0xFB158592BE068D2EULL, 0xEED6E2F0F0D56712ULL}, /* 1e-56 */
+    {0x9CED737BB6C4183DULL, 0x55464DD69685606BULL}, /* 1e-55 */
+    {0xC428D05AA4751E4CULL, 0xAA97E14C3C26B886ULL}, /* 1e-54 */
+    {0xF53304714D9265DFULL, 0xD53DD99F4B3066A8ULL}, /* 1e-53 */
+    {0x993FE2C6D07B7FABULL, 0xE546A8038EFE4029ULL}, /* 1e-52 */
+    {0xBF8FDB78849A5F96ULL, 0xDE98520472BDD033ULL}, /* 1e-51 */
+    {0xEF73D256A5C0F77CULL, 0x963E66858F6D4440ULL}, /* 1e-50 */
+    {0x95A8637627989AADULL, 0xDDE7001379A44AA8ULL}, /* 1e-49 */
+    {0xBB127C53B17EC159ULL, 0x5560C018580D5D52ULL}, /* 1e-48 */
+    {0xE9D71B689DDE71AFULL, 0xAAB8F01E6E10B4A6ULL}, /* 1e-47 */
+    {0x9226712162AB070DULL, 0xCAB3961304CA70E8ULL}, /* 1e-46 */
+    {0xB6B00D69BB55C8D1ULL, 0x3D607B97C5FD0D22ULL}, /* 1e-45 */
+    {0xE45C10C42A2B3B05ULL, 0x8CB89A7DB77C506AULL}, /* 1e-44 */
+    {0x8EB98A7A9A5B04E3ULL, 0x77F3608E92ADB242ULL}, /* 1e-43 */
+    {0xB267ED1940F1C61CULL, 0x55F038B237591ED3ULL}, /* 1e-42 */
+    {0xDF01E85F912E37A3ULL, 0x6B6C46DEC52F6688ULL}, /* 1e-41 */
+    {0x8B61313BBABCE2C6ULL, 0x2323AC4B3B3DA015ULL}, /* 1e-40 */
+    {0xAE397D8AA96C1B77ULL, 0xABEC975E0A0D081AULL}, /* 1e-39 */
+    {0xD9C7DCED53C72255ULL, 0x96E7BD358C904A21ULL}, /* 1e-38 */
+    {0x881CEA14545C7575ULL, 0x7E50D64177DA2E54ULL}, /* 1e-37 */
+    {0xAA242499697392D2ULL, 0xDDE50BD1D5D0B9E9ULL}, /* 1e-36 */
+    {0xD4AD2DBFC3D07787ULL, 0x955E4EC64B44E864ULL}, /* 1e-35 */
+    {0x84EC3C97DA624AB4ULL, 0xBD5AF13BEF0B113EULL}, /* 1e-34 */
+    {0xA6274BBDD0FADD61ULL, 0xECB1AD8AEACDD58EULL}, /* 1e-33 */
+    {0xCFB11EAD453994BAULL, 0x67DE18EDA5814AF2ULL}, /* 1e-32 */
+    {0x81CEB32C4B43FCF4ULL, 0x80EACF948770CED7ULL}, /* 1e-31 */
+    {0xA2425FF75E14FC31ULL, 0xA1258379A94D028DULL}, /* 1e-30 */
+    {0xCAD2F7F5359A3B3EULL, 0x096EE45813A04330ULL}, /* 1e-29 */
+    {0xFD87B5F28300CA0DULL, 0x8BCA9D6E188853FCULL}, /* 1e-28 */
+    {0x9E74D1B791E07E48ULL, 0x775EA264CF55347DULL}, /* 1e-27 */
+    {0xC612062576589DDAULL, 0x95364AFE032A819DULL}, /* 1e-26 */
+    {0xF79687AED3EEC551ULL, 0x3A83DDBD83F52204ULL}, /* 1e-25 */
+    {0x9ABE14CD44753B52ULL, 0xC4926A9672793542ULL}, /* 1e-24 */
+    {0xC16D9A0095928A27ULL, 0x75B7053C0F178293ULL}, /* 1e-23 */
+    {0xF1C90080BAF72CB1ULL, 0x5324C68B12DD6338ULL}, /* 1e-22 */
+    {0x971DA05074DA7BEEULL, 0xD3F6FC16EBCA5E03ULL}, /* 1e-21 */
+    {0xBCE5086492111AEAULL, 0x88F4BB1CA6BCF584ULL}, /* 1e-20 */
+    {0xEC1E4A7DB69561A5ULL, 0x2B31E9E3D06C32E5ULL}, /* 1e-19 */
+    {0x9392EE8E921D5D07ULL, 0x3AFF322E62439FCFULL}, /* 1e-18 */
+    {0xB877AA3236A4B449ULL, 0x09BEFEB9FAD487C2ULL}, /* 1e-17 */
+    {0xE69594BEC44DE15BULL, 0x4C2EBE687989A9B3ULL}, /* 1e-16 */
+    {0x901D7CF73AB0ACD9ULL, 0x0F9D37014BF60A10ULL}, /* 1e-15 */
+    {0xB424DC35095CD80FULL, 0x538484C19EF38C94ULL}, /* 1e-14 */
+    {0xE12E13424BB40E13ULL, 0x2865A5F206B06FB9ULL}, /* 1e-13 */
+    {0x8CBCCC096F5088CBULL, 0xF93F87B7442E45D3ULL}, /* 1e-12 */
+    {0xAFEBFF0BCB24AAFEULL, 0xF78F69A51539D748ULL}, /* 1e-11 */
+    {0xDBE6FECEBDEDD5BEULL, 0xB573440E5A884D1BULL}, /* 1e-10 */
+    {0x89705F4136B4A597ULL, 0x31680A88F8953030ULL}, /* 1e-9 */
+    {0xABCC77118461CEFCULL, 0xFDC20D2B36BA7C3DULL}, /* 1e-8 */
+    {0xD6BF94D5E57A42BCULL, 0x3D32907604691B4CULL}, /* 1e-7 */
+    {0x8637BD05AF6C69B5ULL, 0xA63F9A49C2C1B10FULL}, /* 1e-6 */
+    {0xA7C5AC471B478423ULL, 0x0FCF80DC33721D53ULL}, /* 1e-5 */
+    {0xD1B71758E219652BULL, 0xD3C36113404EA4A8ULL}, /* 1e-4 */
+    {0x83126E978D4FDF3BULL, 0x645A1CAC083126E9ULL}, /* 1e-3 */
+    {0xA3D70A3D70A3D70AULL, 0x3D70A3D70A3D70A3ULL}, /* 1e-2 */
+    {0xCCCCCCCCCCCCCCCCULL, 0xCCCCCCCCCCCCCCCCULL}, /* 1e-1 */
+    {0x8000000000000000ULL, 0x0000000000000000ULL}, /* 1e0 */
+    {0xA000000000000000ULL, 0x0000000000000000ULL}, /* 1e1 */
+    {0xC800000000000000ULL, 0x0000000000000000ULL}, /* 1e2 */
+    {0xFA00000000000000ULL, 0x0000000000000000ULL}, /* 1e3 */
+    {0x9C40000000000000ULL, 0x0000000000000000ULL}, /* 1e4 */
+    {0xC350000000000000ULL, 0x0000000000000000ULL}, /* 1e5 */
+    {0xF424000000000000ULL, 0x0000000000000000ULL}, /* 1e6 */
+    {0x9896800000000000ULL, 0x0000000000000000ULL}, /* 1e7 */
+    {0xBEBC200000000000ULL, 0x0000000000000000ULL}, /* 1e8 */
+    {0xEE6B280000000000ULL, 0x0000000000000000ULL}, /* 1e9 */
+    {0x9502F90000000000ULL, 0x0000000000000000ULL}, /* 1e10 */
+    {0xBA43B74000000000ULL, 0x0000000000000000ULL}, /* 1e11 */
+    {0xE8D4A51000000000ULL, 0x0000000000000000ULL}, /* 1e12 */
+    {0x9184E72A00000000ULL, 0x0000000000000000ULL}, /* 1e13 */
+    {0xB5E620F480000000ULL, 0x0000000000000000ULL}, /* 1e14 */
+    {0xE35FA931A0000000ULL, 0x0000000000000000ULL}, /* 1e15 */
+    {0x8E1BC9BF04000000ULL, 0x0000000000000000ULL}, /* 1e16 */
+    {0xB1A2BC2EC5000000ULL, 0x0000000000000000ULL}, /* 1e17 */
+    {0xDE0B6B3A76400000ULL, 0x0000000000000000ULL}, /* 1e18 */
+    {0x8AC7230489E80000ULL, 0x0000000000000000ULL}, /* 1e19 */
+    {0xAD78EBC5AC620000ULL, 0x0000000000000000ULL}, /* 1e20 */
+    {0xD8D726B7177A8000ULL, 0x0000000000000000ULL}, /* 1e21 */
+    {0x878678326EAC9000ULL, 0x0000000000000000ULL}, /* 1e22 */
+    {0xA968163F0A57B400ULL, 0x0000000000000000ULL}, /* 1e23 */
+    {0xD3C21BCECCEDA100ULL, 0x0000000000000000ULL}, /* 1e24 */
+    {0x84595161401484A0ULL, 0x0000000000000000ULL}, /* 1e25 */
+    {0xA56FA5B99019A5C8ULL, 0x0000000000000000ULL}, /* 1e26 */
+    {0xCECB8F27F4200F3AULL, 0x0000000000000000ULL}, /* 1e27 */
+    {0x813F3978F8940984ULL, 0x4000000000000000ULL}, /* 1e28 */
+    {0xA18F07D736B90BE5ULL, 0x5000000000000000ULL}, /* 1e29 */
+    {0xC9F2C9CD04674EDEULL, 0xA400000000000000ULL}, /* 1e30 */
+    {0xFC6F7C4045812296ULL, 0x4D00000000000000ULL}, /* 1e31 */
+    {0x9DC5ADA82B70B59DULL, 0xF020000000000000ULL}, /* 1e32 */
+    {0xC5371912364CE305ULL, 0x6C28000000000000ULL}, /* 1e33 */
+    {0xF684DF56C3E01BC6ULL, 0xC732000000000000ULL}, /* 1e34 */
+    {0x9A130B963A6C115CULL, 0x3C7F400000000000ULL}, /* 1e35 */
+    {0xC097CE7BC90715B3ULL, 0x4B9F100000000000ULL}, /* 1e36 */
+    {0xF0BDC21ABB48DB20ULL, 0x1E86D40000000000ULL}, /* 1e37 */
+    {0x96769950B50D88F4ULL, 0x1314448000000000ULL}, /* 1e38 */
+    {0xBC143FA4E250EB31ULL, 0x17D955A000000000ULL}, /* 1e39 */
+    {0xEB194F8E1AE525FDULL, 0x5DCFAB0800000000ULL}, /* 1e40 */
+    {0x92EFD1B8D0CF37BEULL, 0x5AA1CAE500000000ULL}, /* 1e41 */
+    {0xB7ABC627050305ADULL, 0xF14A3D9E40000000ULL}, /* 1e42 */
+    {0xE596B7B0C643C719ULL, 0x6D9CCD05D0000000ULL}, /* 1e43 */
+    {0x8F7E32CE7BEA5C6FULL, 0xE4820023A2000000ULL}, /* 1e44 */
+    {0xB35DBF821AE4F38BULL, 0xDDA2802C8A800000ULL}, /* 1e45 */
+    {0xE0352F62A19E306EULL, 0xD50B2037AD200000ULL}, /* 1e46 */
+    {0x8C213D9DA502DE45ULL, 0x4526F422CC340000ULL}, /* 1e47 */
+    {0xAF298D050E4395D6ULL, 0x9670B12B7F410000ULL}, /* 1e48 */
+    {0xDAF3F04651D47B4CULL, 0x3C0CDD765F114000ULL}, /* 1e49 */
+    {0x88D8762BF324CD0FULL, 0xA5880A69FB6AC800ULL}, /* 1e50 */
+    {0xAB0E93B6EFEE0053ULL, 0x8EEA0D047A457A00ULL}, /* 1e51 */
+    {0xD5D238A4ABE98068ULL, 0x72A4904598D6D880ULL}, /* 1e52 */
+    {0x85A36366EB71F041ULL, 0x47A6DA2B7F864750ULL}, /* 1e53 */
+    {0xA70C3C40A64E6C51ULL, 0x999090B65F67D924ULL}, /* 1e54 */
+    {0xD0CF4B50CFE20765ULL, 0xFFF4B4E3F741CF6DULL}, /* 1e55 */
+    {0x82818F1281ED449FULL, 0xBFF8F10E7A8921A4ULL}, /* 1e56 */
+    {0xA321F2D7226895C7ULL, 0xAFF72D52192B6A0DULL}, /* 1e57 */
+    {0xCBEA6F8CEB02BB39ULL, 0x9BF4F8A69F764490ULL}, /* 1e58 */
+    {0xFEE50B7025C36A08ULL, 0x02F236D04753D5B4ULL}, /* 1e59 */
+    {0x9F4F2726179A2245ULL, 0x01D762422C946590ULL}, /* 1e60 */
+    {0xC722F0EF9D80AAD6ULL, 0x424D3AD2B7B97EF5ULL}, /* 1e61 */
+    {0xF8EBAD2B84E0D58BULL, 0xD2E0898765A7DEB2ULL}, /* 1e62 */
+    {0x9B934C3B330C8577ULL, 0x63CC55F49F88EB2FULL}, /* 1e63 */
+    {0xC2781F49FFCFA6D5ULL, 0x3CBF6B71C76B25FBULL}, /* 1e64 */
+    {0xF316271C7FC3908AULL, 0x8BEF464E3945EF7AULL}, /* 1e65 */
+    {0x97EDD871CFDA3A56ULL, 0x97758BF0E3CBB5ACULL}, /* 1e66 */
+    {0xBDE94E8E43D0C8ECULL, 0x3D52EEED1CBEA317ULL}, /* 1e67 */
+    {0xED63A231D4C4FB27ULL, 0x4CA7AAA863EE4BDDULL}, /* 1e68 */
+    {0x945E455F24FB1CF8ULL, 0x8FE8CAA93E74EF6AULL}, /* 1e69 */
+    {0xB975D6B6EE39E436ULL, 0xB3E2FD538E122B44ULL}, /* 1e70 */
+    {0xE7D34C64A9C85D44ULL, 0x60DBBCA87196B616ULL}, /* 1e71 */
+    {0x90E40FBEEA1D3A4AULL, 0xBC8955E946FE31CDULL}, /* 1e72 */
+    {0xB51D13AEA4A488DDULL, 0x6BABAB6398BDBE41ULL}, /* 1e73 */
+    {0xE264589A4DCDAB14ULL, 0xC696963C7EED2DD1ULL}, /* 1e74 */
+    {0x8D7EB76070A08AECULL, 0xFC1E1DE5CF543CA2ULL}, /* 1e75 */
+    {0xB0DE65388CC8ADA8ULL, 0x3B25A55F43294BCBULL}, /* 1e76 */
+    {0xDD15FE86AFFAD912ULL, 0x49EF0EB713F39EBEULL}, /* 1e77 */
+    {0x8A2DBF142DFCC7ABULL, 0x6E3569326C784337ULL}, /* 1e78 */
+    {0xACB92ED9397BF996ULL, 0x49C2C37F07965404ULL}, /* 1e79 */
+    {0xD7E77A8F87DAF7FBULL, 0xDC33745EC97BE906ULL}, /* 1e80 */
+    {0x86F0AC99B4E8DAFDULL, 0x69A028BB3DED71A3ULL}, /* 1e81 */
+    {0xA8ACD7C0222311BCULL, 0xC40832EA0D68CE0CULL}, /* 1e82 */
+    {0xD2D80DB02AABD62BULL, 0xF50A3FA490C30190ULL}, /* 1e83 */
+    {0x83C7088E1AAB65DBULL, 0x792667C6DA79E0FAULL}, /* 1e84 */
+    {0xA4B8CAB1A1563F52ULL, 0x577001B891185938ULL}, /* 1e85 */
+    {0xCDE6FD5E09ABCF26ULL, 0xED4C0226B55E6F86ULL}, /* 1e86 */
+    {0x80B05E5AC60B6178ULL, 0x544F8158315B05B4ULL}, /* 1e87 */
+    {0xA0DC75F1778E39D6ULL, 0x696361AE3DB1C721ULL}, /* 1e88 */
+    {0xC913936DD571C84CULL, 0x03BC3A19CD1E38E9ULL}, /* 1e89 */
+    {0xFB5878494ACE3A5FULL, 0x04AB48A04065C723ULL}, /* 1e90 */
+    {0x9D174B2DCEC0E47BULL, 0x62EB0D64283F9C76ULL}, /* 1e91 */
+    {0xC45D1DF942711D9AULL, 0x3BA5D0BD324F8394ULL}, /* 1e92 */
+    {0xF5746577930D6500ULL, 0xCA8F44EC7EE36479ULL}, /* 1e93 */
+    {0x9968BF6ABBE85F20ULL, 0x7E998B13CF4E1ECBULL}, /* 1e94 */
+    {0xBFC2EF456AE276E8ULL, 0x9E3FEDD8C321A67EULL}, /* 1e95 */
+    {0xEFB3AB16C59B14A2ULL, 0xC5CFE94EF3EA101EULL}, /* 1e96 */
+    {0x95D04AEE3B80ECE5ULL, 0xBBA1F1D158724A12ULL}, /* 1e97 */
+    {0xBB445DA9CA61281FULL, 0x2A8A6E45AE8EDC97ULL}, /* 1e98 */
+    {0xEA1575143CF97226ULL, 0xF52D09D71A3293BDULL}, /* 1e99 */
+    {0x924D692CA61BE758ULL, 0x593C2626705F9C56ULL}, /* 1e100 */
+    {0xB6E0C377CFA2E12EULL, 0x6F8B2FB00C77836CULL}, /* 1e101 */
+    {0xE498F455C38B997AULL, 0x0B6DFB9C0F956447ULL}, /* 1e102 */
+    {0x8EDF98B59A373FECULL, 0x4724BD4189BD5EACULL}, /* 1e103 */
+    {0xB2977EE300C50FE7ULL, 0x58EDEC91EC2CB657ULL}, /* 1e104 */
+    {0xDF3D5E9BC0F653E1ULL, 0x2F2967B66737E3EDULL}, /* 1e105 */
+    {0x8B865B215899F46CULL, 0xBD79E0D20082EE74ULL}, /* 1e106 */
+    {0xAE67F1E9AEC07187ULL, 0xECD8590680A3AA11ULL}, /* 1e107 */
+    {0xDA01EE641A708DE9ULL, 0xE80E6F4820CC9495ULL}, /* 1e108 */
+    {0x884134FE908658B2ULL, 0x3109058D147FDCDDULL}, /* 1e109 */
+    {0xAA51823E34A7EEDEULL, 0xBD4B46F0599FD415ULL}, /* 1e110 */
+    {0xD4E5E2CDC1D1EA96ULL, 0x6C9E18AC7007C91AULL}, /* 1e111 */
+    {0x850FADC09923329EULL, 0x03E2CF6BC604DDB0ULL}, /* 1e112 */
+    {0xA6539930BF6BFF45ULL, 0x84DB8346B786151CULL}, /* 1e113 */
+    {0xCFE87F7CEF46FF16ULL, 0xE612641865679A63ULL}, /* 1e114 */
+    {0x81F14FAE158C5F6EULL, 0x4FCB7E8F3F60C07EULL}, /* 1e115 */
+    {0xA26DA3999AEF7749ULL, 0xE3BE5E330F38F09DULL}, /* 1e116 */
+    {0xCB090C8001AB551CULL, 0x5CADF5BFD3072CC5ULL}, /* 1e117 */
+    {0xFDCB4FA002162A63ULL, 0x73D9732FC7C8F7F6ULL}, /* 1e118 */
+    {0x9E9F11C4014DDA7EULL, 0x2867E7FDDCDD9AFAULL}, /* 1e119 */
+    {0xC646D63501A1511DULL, 0xB281E1FD541501B8ULL}, /* 1e120 */
+    {0xF7D88BC24209A565ULL, 0x1F225A7CA91A4226ULL}, /* 1e121 */
+    {0x9AE757596946075FULL, 0x3375788DE9B06958ULL}, /* 1e122 */
+    {0xC1A12D2FC3978937ULL, 0x0052D6B1641C83AEULL}, /* 1e123 */
+    {0xF209787BB47D6B84ULL, 0xC0678C5DBD23A49AULL}, /* 1e124 */
+    {0x9745EB4D50CE6332ULL, 0xF840B7BA963646E0ULL}, /* 1e125 */
+    {0xBD176620A501FBFFULL, 0xB650E5A93BC3D898ULL}, /* 1e126 */
+    {0xEC5D3FA8CE427AFFULL, 0xA3E51F138AB4CEBEULL}, /* 1e127 */
+    {0x93BA47C980E98CDFULL, 0xC66F336C36B10137ULL}, /* 1e128 */
+    {0xB8A8D9BBE123F017ULL, 0xB80B0047445D4184ULL}, /* 1e129 */
+    {0xE6D3102AD96CEC1DULL, 0xA60DC059157491E5ULL}, /* 1e130 */
+    {0x9043EA1AC7E41392ULL, 0x87C89837AD68DB2FULL}, /* 1e131 */
+    {0xB454E4A179DD1877ULL, 0x29BABE4598C311FBULL}, /* 1e132 */
+    {0xE16A1DC9D8545E94ULL, 0xF4296DD6FEF3D67AULL}, /* 1e133 */
+    {0x8CE2529E2734BB1DULL, 0x1899E4A65F58660CULL}, /* 1e134 */
+    {0xB01AE745B101E9E4ULL, 0x5EC05DCFF72E7F8FULL}, /* 1e135 */
+    {0xDC21A1171D42645DULL, 0x76707543F4FA1F73ULL}, /* 1e136 */
+    {0x899504AE72497EBAULL, 0x6A06494A791C53A8ULL}, /* 1e137 */
+    {0xABFA45DA0EDBDE69ULL, 0x0487DB9D17636892ULL}, /* 1e138 */
+    {0xD6F8D7509292D603ULL, 0x45A9D2845D3C42B6ULL}, /* 1e139 */
+    {0x865B86925B9BC5C2ULL, 0x0B8A2392BA45A9B2ULL}, /* 1e140 */
+    {0xA7F26836F282B732ULL, 0x8E6CAC7768D7141EULL}, /* 1e141 */
+    {0xD1EF0244AF2364FFULL, 0x3207D795430CD926ULL}, /* 1e142 */
+    {0x8335616AED761F1FULL, 0x7F44E6BD49E807B8ULL}, /* 1e143 */
+    {0xA402B9C5A8D3A6E7ULL, 0x5F16206C9C6209A6ULL}, /* 1e144 */
+    {0xCD036837130890A1ULL, 0x36DBA887C37A8C0FULL}, /* 1e145 */
+    {0x802221226BE55A64ULL, 0xC2494954DA2C9789ULL}, /* 1e146 */
+    {0xA02AA96B06DEB0FDULL, 0xF2DB9BAA10B7BD6CULL}, /* 1e147 */
+    {0xC83553C5C8965D3DULL, 0x6F92829494E5ACC7ULL}, /* 1e148 */
+    {0xFA42A8B73ABBF48CULL, 0xCB772339BA1F17F9ULL}, /* 1e149 */
+    {0x9C69A97284B578D7ULL, 0xFF2A760414536EFBULL}, /* 1e150 */
+    {0xC38413CF25E2D70DULL, 0xFEF5138519684ABAULL}, /* 1e151 */
+    {0xF46518C2EF5B8CD1ULL, 0x7EB258665FC25D69ULL}, /* 1e152 */
+    {0x98BF2F79D5993802ULL, 0xEF2F773FFBD97A61ULL}, /* 1e153 */
+    {0xBEEEFB584AFF8603ULL, 0xAAFB550FFACFD8FAULL}, /* 1e154 */
+    {0xEEAABA2E5DBF6784ULL, 0x95BA2A53F983CF38ULL}, /* 1e155 */
+    {0x952AB45CFA97A0B2ULL, 0xDD945A747BF26183ULL}, /* 1e156 */
+    {0xBA756174393D88DFULL, 0x94F971119AEEF9E4ULL}, /* 1e157 */
+    {0xE912B9D1478CEB17ULL, 0x7A37CD5601AAB85DULL}, /* 1e158 */
+    {0x91ABB422CCB812EEULL, 0xAC62E055C10AB33AULL}, /* 1e159 */
+    {0xB616A12B7FE617AAULL, 0x577B986B314D6009ULL}, /* 1e160 */
+    {0xE39C49765FDF9D94ULL, 0xED5A7E85FDA0B80BULL}, /* 1e161 */
+    {0x8E41ADE9FBEBC27DULL, 0x14588F13BE847307ULL}, /* 1e162 */
+    {0xB1D219647AE6B31CULL, 0x596EB2D8AE258FC8ULL}, /* 1e163 */
+    {0xDE469FBD99A05FE3ULL, 0x6FCA5F8ED9AEF3BBULL}, /* 1e164 */
+    {0x8AEC23D680043BEEULL, 0x25DE7BB9480D5854ULL}, /* 1e165 */
+    {0xADA72CCC20054AE9ULL, 0xAF561AA79A10AE6AULL}, /* 1e166 */
+    {0xD910F7FF28069DA4ULL, 0x1B2BA1518094DA04ULL}, /* 1e167 */
+    {0x87AA9AFF79042286ULL, 0x90FB44D2F05D0842ULL}, /* 1e168 */
+    {0xA99541BF57452B28ULL, 0x353A1607AC744A53ULL}, /* 1e169 */
+    {0xD3FA922F2D1675F2ULL, 0x42889B8997915CE8ULL}, /* 1e170 */
+    {0x847C9B5D7C2E09B7ULL, 0x69956135FEBADA11ULL}, /* 1e171 */
+    {0xA59BC234DB398C25ULL, 0x43FAB9837E699095ULL}, /* 1e172 */
+    {0xCF02B2C21207EF2EULL, 0x94F967E45E03F4BBULL}, /* 1e173 */
+    {0x8161AFB94B44F57DULL, 0x1D1BE0EEBAC278F5ULL}, /* 1e174 */
+    {0xA1BA1BA79E1632DCULL, 0x6462D92A69731732ULL}, /* 1e175 */
+    {0xCA28A291859BBF93ULL, 0x7D7B8F7503CFDCFEULL}, /* 1e176 */
+    {0xFCB2CB35E702AF78ULL, 0x5CDA735244C3D43EULL}, /* 1e177 */
+    {0x9DEFBF01B061ADABULL, 0x3A0888136AFA64A7ULL}, /* 1e178 */
+    {0xC56BAEC21C7A1916ULL, 0x088AAA1845B8FDD0ULL}, /* 1e179 */
+    {0xF6C69A72A3989F5BULL, 0x8AAD549E57273D45ULL}, /* 1e180 */
+    {0x9A3C2087A63F6399ULL, 0x36AC54E2F678864BULL}, /* 1e181 */
+    {0xC0CB28A98FCF3C7FULL, 0x84576A1BB416A7DDULL}, /* 1e182 */
+    {0xF0FDF2D3F3C30B9FULL, 0x656D44A2A11C51D5ULL}, /* 1e183 */
+    {0x969EB7C47859E743ULL, 0x9F644AE5A4B1B325ULL}, /* 1e184 */
+    {0xBC4665B596706114ULL, 0x873D5D9F0DDE1FEEULL}, /* 1e185 */
+    {0xEB57FF22FC0C7959ULL, 0xA90CB506D155A7EAULL}, /* 1e186 */
+    {0x9316FF75DD87CBD8ULL, 0x09A7F12442D588F2ULL}, /* 1e187 */
+    {0xB7DCBF5354E9BECEULL, 0x0C11ED6D538AEB2FULL}, /* 1e188 */
+    {0xE5D3EF282A242E81ULL, 0x8F1668C8A86DA5FAULL}, /* 1e189 */
+    {0x8FA475791A569D10ULL, 0xF96E017D694487BCULL}, /* 1e190 */
+    {0xB38D92D760EC4455ULL, 0x37C981DCC395A9ACULL}, /* 1e191 */
+    {0xE070F78D3927556AULL, 0x85BBE253F47B1417ULL}, /* 1e192 */
+    {0x8C469AB843B89562ULL, 0x93956D7478CCEC8EULL}, /* 1e193 */
+    {0xAF58416654A6BABBULL, 0x387AC8D1970027B2ULL}, /* 1e194 */
+    {0xDB2E51BFE9D0696AULL, 0x06997B05FCC0319EULL}, /* 1e195 */
+    {0x88FCF317F22241E2ULL, 0x441FECE3BDF81F03ULL}, /* 1e196 */
+    {0xAB3C2FDDEEAAD25AULL, 0xD527E81CAD7626C3ULL}, /* 1e197 */
+    {0xD60B3BD56A5586F1ULL, 0x8A71E223D8D3B074ULL}, /* 1e198 */
+    {0x85C7056562757456ULL, 0xF6872D5667844E49ULL}, /* 1e199 */
+    {0xA738C6BEBB12D16CULL, 0xB428F8AC016561DBULL}, /* 1e200 */
+    {0xD106F86E69D785C7ULL, 0xE13336D701BEBA52ULL}, /* 1e201 */
+    {0x82A45B450226B39CULL, 0xECC0024661173473ULL}, /* 1e202 */
+    {0xA34D721642B06084ULL, 0x27F002D7F95D0190ULL}, /* 1e203 */
+    {0xCC20CE9BD35C78A5ULL, 0x31EC038DF7B441F4ULL}, /* 1e204 */
+    {0xFF290242C83396CEULL, 0x7E67047175A15271ULL}, /* 1e205 */
+    {0x9F79A169BD203E41ULL, 0x0F0062C6E984D386ULL}, /* 1e206 */
+    {0xC75809C42C684DD1ULL, 0x52C07B78A3E60868ULL}, /* 1e207 */
+    {0xF92E0C3537826145ULL, 0xA7709A56CCDF8A82ULL}, /* 1e208 */
+    {0x9BBCC7A142B17CCBULL, 0x88A66076400BB691ULL}, /* 1e209 */
+    {0xC2ABF989935DDBFEULL, 0x6ACFF893D00EA435ULL}, /* 1e210 */
+    {0xF356F7EBF83552FEULL, 0x0583F6B8C4124D43ULL}, /* 1e211 */
+    {0x98165AF37B2153DEULL, 0xC3727A337A8B704AULL}, /* 1e212 */
+    {0xBE1BF1B059E9A8D6ULL, 0x744F18C0592E4C5CULL}, /* 1e213 */
+    {0xEDA2EE1C7064130CULL, 0x1162DEF06F79DF73ULL}, /* 1e214 */
+    {0x9485D4D1C63E8BE7ULL, 0x8ADDCB5645AC2BA8ULL}, /* 1e215 */
+    {0xB9A74A0637CE2EE1ULL, 0x6D953E2BD7173692ULL}, /* 1e216 */
+    {0xE8111C87C5C1BA99ULL, 0xC8FA8DB6CCDD0437ULL}, /* 1e217 */
+    {0x910AB1D4DB9914A0ULL, 0x1D9C9892400A22A2ULL}, /* 1e218 */
+    {0xB54D5E4A127F59C8ULL, 0x2503BEB6D00CAB4BULL}, /* 1e219 */
+    {0xE2A0B5DC971F303AULL, 0x2E44AE64840FD61DULL}, /* 1e220 */
+    {0x8DA471A9DE737E24ULL, 0x5CEAECFED289E5D2ULL}, /* 1e221 */
+    {0xB10D8E1456105DADULL, 0x7425A83E872C5F47ULL}, /* 1e222 */
+    {0xDD50F1996B947518ULL, 0xD12F124E28F77719ULL}, /* 1e223 */
+    {0x8A5296FFE33CC92FULL, 0x82BD6B70D99AAA6FULL}, /* 1e224 */
+    {0xACE73CBFDC0BFB7BULL, 0x636CC64D1001550BULL}, /* 1e225 */
+    {0xD8210BEFD30EFA5AULL, 0x3C47F7E05401AA4EULL}, /* 1e226 */
+    {0x8714A775E3E95C78ULL, 0x65ACFAEC34810A71ULL}, /* 1e227 */
+    {0xA8D9D1535CE3B396ULL, 0x7F1839A741A14D0DULL}, /* 1e228 */
+    {0xD31045A8341CA07CULL, 0x1EDE48111209A050ULL}, /* 1e229 */
+    {0x83EA2B892091E44DULL, 0x934AED0AAB460432ULL}, /* 1e230 */
+    {0xA4E4B66B68B65D60ULL, 0xF81DA84D5617853FULL}, /* 1e231 */
+    {0xCE1DE40642E3F4B9ULL, 0x36251260AB9D668EULL}, /* 1e232 */
+    {0x80D2AE83E9CE78F3ULL, 0xC1D72B7C6B426019ULL}, /* 1e233 */
+    {0xA1075A24E4421730ULL, 0xB24CF65B8612F81FULL}, /* 1e234 */
+    {0xC94930AE1D529CFCULL, 0xDEE033F26797B627ULL}, /* 1e235 */
+    {0xFB9B7CD9A4A7443CULL, 0x169840EF017DA3B1ULL}, /* 1e236 */
+    {0x9D412E0806E88AA5ULL, 0x8E1F289560EE864EULL}, /* 1e237 */
+    {0xC491798A08A2AD4EULL, 0xF1A6F2BAB92A27E2ULL}, /* 1e238 */
+    {0xF5B5D7EC8ACB58A2ULL, 0xAE10AF696774B1DBULL}, /* 1e239 */
+    {0x9991A6F3D6BF1765ULL, 0xACCA6DA1E0A8EF29ULL}, /* 1e240 */
+    {0xBFF610B0CC6EDD3FULL, 0x17FD090A58D32AF3ULL}, /* 1e241 */
+    {0xEFF394DCFF8A948EULL, 0xDDFC4B4CEF07F5B0ULL}, /* 1e242 */
+    {0x95F83D0A1FB69CD9ULL, 0x4ABDAF101564F98EULL}, /* 1e243 */
+    {0xBB764C4CA7A4440FULL, 0x9D6D1AD41ABE37F1ULL}, /* 1e244 */
+    {0xEA53DF5FD18D5513ULL, 0x84C86189216DC5EDULL}, /* 1e245 */
+    {0x92746B9BE2F8552CULL, 0x32FD3CF5B4E49BB4ULL}, /* 1e246 */
+    {0xB7118682DBB66A77ULL, 0x3FBC8C33221DC2A1ULL}, /* 1e247 */
+    {0xE4D5E82392A40515ULL, 0x0FABAF3FEAA5334AULL}, /* 1e248 */
+    {0x8F05B1163BA6832DULL, 0x29CB4D87F2A7400EULL}, /* 1e249 */
+    {0xB2C71D5BCA9023F8ULL, 0x743E20E9EF511012ULL}, /* 1e250 */
+    {0xDF78E4B2BD342CF6ULL, 0x914DA9246B255416ULL}, /* 1e251 */
+    {0x8BAB8EEFB6409C1AULL, 0x1AD089B6C2F7548EULL}, /* 1e252 */
+    {0xAE9672ABA3D0C320ULL, 0xA184AC2473B529B1ULL}, /* 1e253 */
+    {0xDA3C0F568CC4F3E8ULL, 0xC9E5D72D90A2741EULL}, /* 1e254 */
+    {0x8865899617FB1871ULL, 0x7E2FA67C7A658892ULL}, /* 1e255 */
+    {0xAA7EEBFB9DF9DE8DULL, 0xDDBB901B98FEEAB7ULL}, /* 1e256 */
+    {0xD51EA6FA85785631ULL, 0x552A74227F3EA565ULL}, /* 1e257 */
+    {0x8533285C936B35DEULL, 0xD53A88958F87275FULL}, /* 1e258 */
+    {0xA67FF273B8460356ULL, 0x8A892ABAF368F137ULL}, /* 1e259 */
+    {0xD01FEF10A657842CULL, 0x2D2B7569B0432D85ULL}, /* 1e260 */
+    {0x8213F56A67F6B29BULL, 0x9C3B29620E29FC73ULL}, /* 1e261 */
+    {0xA298F2C501F45F42ULL, 0x8349F3BA91B47B8FULL}, /* 1e262 */
+    {0xCB3F2F7642717713ULL, 0x241C70A936219A73ULL}, /* 1e263 */
+    {0xFE0EFB53D30DD4D7ULL, 0xED238CD383AA0110ULL}, /* 1e264 */
+    {0x9EC95D1463E8A506ULL, 0xF4363804324A40AAULL}, /* 1e265 */
+    {0xC67BB4597CE2CE48ULL, 0xB143C6053EDCD0D5ULL}, /* 1e266 */
+    {0xF81AA16FDC1B81DAULL, 0xDD94B7868E94050AULL}, /* 1e267 */
+    {0x9B10A4E5E9913128ULL, 0xCA7CF2B4191C8326ULL}, /* 1e268 */
+    {0xC1D4CE1F63F57D72ULL, 0xFD1C2F611F63A3F0ULL}, /* 1e269 */
+    {0xF24A01A73CF2DCCFULL, 0xBC633B39673C8CECULL}, /* 1e270 */
+    {0x976E41088617CA01ULL, 0xD5BE0503E085D813ULL}, /* 1e271 */
+    {0xBD49D14AA79DBC82ULL, 0x4B2D8644D8A74E18ULL}, /* 1e272 */
+    {0xEC9C459D51852BA2ULL, 0xDDF8E7D60ED1219EULL}, /* 1e273 */
+    {0x93E1AB8252F33B45ULL, 0xCABB90E5C942B503ULL}, /* 1e274 */
+    {0xB8DA1662E7B00A17ULL, 0x3D6A751F3B936243ULL}, /* 1e275 */
+    {0xE7109BFBA19C0C9DULL, 0x0CC512670A783AD4ULL}, /* 1e276 */
+    {0x906A617D450187E2ULL, 0x27FB2B80668B24C5ULL}, /* 1e277 */
+    {0xB484F9DC9641E9DAULL, 0xB1F9F660802DEDF6ULL}, /* 1e278 */
+    {0xE1A63853BBD26451ULL, 0x5E7873F8A0396973ULL}, /* 1e279 */
+    {0x8D07E33455637EB2ULL, 0xDB0B487B6423E1E8ULL}, /* 1e280 */
+    {0xB049DC016ABC5E5FULL, 0x91CE1A9A3D2CDA62ULL}, /* 1e281 */
+    {0xDC5C5301C56B75F7ULL, 0x7641A140CC7810FBULL}, /* 1e282 */
+    {0x89B9B3E11B6329BAULL, 0xA9E904C87FCB0A9DULL}, /* 1e283 */
+    {0xAC2820D9623BF429ULL, 0x546345FA9FBDCD44ULL}, /* 1e284 */
+    {0xD732290FBACAF133ULL, 0xA97C177947AD4095ULL}, /* 1e285 */
+    {0x867F59A9D4BED6C0ULL, 0x49ED8EABCCCC485DULL}, /* 1e286 */
+    {0xA81F301449EE8C70ULL, 0x5C68F256BFFF5A74ULL}, /* 1e287 */
+    {0xD226FC195C6A2F8CULL, 0x73832EEC6FFF3111ULL}, /* 1e288 */
+    {0x83585D8FD9C25DB7ULL, 0xC831FD53C5FF7EABULL}, /* 1e289 */
+    {0xA42E74F3D032F525ULL, 0xBA3E7CA8B77F5E55ULL}, /* 1e290 */
+    {0xCD3A1230C43FB26FULL, 0x28CE1BD2E55F35EBULL}, /* 1e291 */
+    {0x80444B5E7AA7CF85ULL, 0x7980D163CF5B81B3ULL}, /* 1e292 */
+    {0xA0555E361951C366ULL, 0xD7E105BCC332621FULL}, /* 1e293 */
+    {0xC86AB5C39FA63440ULL, 0x8DD9472BF3FEFAA7ULL}, /* 1e294 */
+    {0xFA856334878FC150ULL, 0xB14F98F6F0FEB951ULL}, /* 1e295 */
+    {0x9C935E00D4B9D8D2ULL, 0x6ED1BF9A569F33D3ULL}, /* 1e296 */
+    {0xC3B8358109E84F07ULL, 0x0A862F80EC4700C8ULL}, /* 1e297 */
+    {0xF4A642E14C6262C8ULL, 0xCD27BB612758C0FAULL}, /* 1e298 */
+    {0x98E7E9CCCFBD7DBDULL, 0x8038D51CB897789CULL}, /* 1e299 */
+    {0xBF21E44003ACDD2CULL, 0xE0470A63E6BD56C3ULL}, /* 1e300 */
+    {0xEEEA5D5004981478ULL, 0x1858CCFCE06CAC74ULL}, /* 1e301 */
+    {0x95527A5202DF0CCBULL, 0x0F37801E0C43EBC8ULL}, /* 1e302 */
+    {0xBAA718E68396CFFDULL, 0xD30560258F54E6BAULL}, /* 1e303 */
+    {0xE950DF20247C83FDULL, 0x47C6B82EF32A2069ULL}, /* 1e304 */
+    {0x91D28B7416CDD27EULL, 0x4CDC331D57FA5441ULL}, /* 1e305 */
+    {0xB6472E511C81471DULL, 0xE0133FE4ADF8E952ULL}, /* 1e306 */
+    {0xE3D8F9E563A198E5ULL, 0x58180FDDD97723A6ULL}, /* 1e307 */
+    {0x8E679C2F5E44FF8FULL, 0x570F09EAA7EA7648ULL}, /* 1e308 */
+};
+
+/* Powers of ten that are exact doubles */
+static const double exact_pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static int is_digit(char c)
+{
+    return (unsigned char)(c - '0') < 10;
+}
+
+/* Full 64x64 -> 128-bit product */
+static void multiply_u64(uint64_t a, uint64_t b, uint64_t *hi, uint64_t *lo)
+{
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 product = (unsigned __int128)a * b;
+    *hi = (uint64_t)(product >> 64);
+    *lo = (uint64_t)product;
+#else
+    uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+    uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+    uint64_t low = a_lo * b_lo;
+    uint64_t mid1 = a_hi * b_lo;
+    uint64_t mid2 = a_lo * b_hi;
+    uint64_t high = a_hi * b_hi;
+    uint64_t carry = ((low >> 32) + (uint32_t)mid1 + (uint32_t)mid2) >> 32;
+    *lo = low + (mid1 << 32) + (mid2 << 32);
+    *hi = high + (mid1 >> 32) + (mid2 >> 32) + carry;
+#endif
+}
+
+static int leading_zeros(uint64_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_clzll(x);
+#else
+    int count = 0;
+    while (!(x & 0x8000000000000000ULL))
+    {
+        x <<= 1;
+        count++;
+    }
+    return count;
+#endif
+}
+
+/* Eisel-Lemire: convert mantissa * 10^exp10 to the nearest double.
+   Returns 0 when the result cannot be decided this way */
+static int eisel_lemire(uint64_t mantissa, int exp10, int negative, double *out)
+{
+    if (mantissa == 0)
+    {
+        *out = negative ? -0.0 : 0.0;
+        return 1;
+    }
+    if (exp10 < POW10_TABLE_MIN || exp10 > POW10_TABLE_MAX)
+    {
+        return 0;
+    }
+
+    int lz = leading_zeros(mantissa);
+    mantissa <<= lz;
+    /* floor(log2(10) * exp10) + 64 + bias */
+    int64_t exp2 = (int64_t)(((217706 * exp10) >> 16) + 64 + 1023) - lz;
+
+    const uint64_t *power = pow10_table[exp10 - POW10_TABLE_MIN];
+    uint64_t hi, lo;
+    multiply_u64(mantissa, power[0], &hi, &lo);
+
+    /* The truncated power may be too small; widen when the low bits are ambiguous */
+    if ((hi & 0x1FF) == 0x1FF && lo + mantissa < mantissa)
+    {
+        uint64_t hi2, lo2;
+        multiply_u64(mantissa, power[1], &hi2, &lo2);
+        uint64_t merged_hi = hi;
+        uint64_t merged_lo = lo + hi2;
+        if (merged_lo < lo)
+        {
+            merged_hi++;
+        }
+        if ((merged_hi & 0x1FF) == 0x1FF && merged_lo + 1 == 0 && lo2 + mantissa < mantissa)
+        {
+            return 0;
+        }
+        hi = merged_hi;
+        lo = merged_lo;
+    }
+
+    /* Keep 54 bits, then round to 53 */
+    uint64_t msb = hi >> 63;
+    uint64_t bits = hi >> (msb + 9);
+    exp2 -= (int64_t)(1 ^ msb);
+
+    /* Exactly halfway between two doubles: let strtod decide */
+    if (lo == 0 && (hi & 0x1FF) == 0 && (bits & 3) == 1)
+    {
+        return 0;
+    }
+
+    bits += bits & 1;
+    bits >>= 1;
+    if (bits >> 53)
+    {
+        bits >>= 1;
+        exp2++;
+    }
+
+    /* Subnormal, zero, infinite or NaN results take the slow path */
+    if (exp2 <= 0 || exp2 >= 0x7FF)
+    {
+        return 0;
+    }
+
+    uint64_t raw = ((uint64_t)exp2 << 52) | (bits & 0x000FFFFFFFFFFFFFULL);
+    if (negative)
+    {
+        raw |= 0x8000000000000000ULL;
+    }
+    memcpy(out, &raw, sizeof(*out));
+    return 1;
+}
+
+/* Slow path: rebuild the number as "<digits>e<exponent>" with no decimal
+   point, so the result does not depend on the locale. Digits beyond the
+   buffer are replaced by a sticky '1', which keeps the rounding correct */
+static double strtod_fallback(const char *digits_start, const char *digits_end,
+                              int negative, int64_t exp10)
+{
+    char buffer[JSON_NUMBER_FALLBACK_DIGITS + 32];
+    size_t pos = 0;
+    int dropped_nonzero = 0;
+
+    if (negative)
+    {
+        buffer[pos++] = '-';
+    }
+    size_t digits_begin = pos;
+    for (const char *p = digits_start; p < digits_end; p++)
+    {
+        if (!is_digit(*p) || (*p == '0' && pos == digits_begin))
+        {
+            continue; /* Decimal point or leading zero */
+        }
+        if (pos - digits_begin < JSON_NUMBER_FALLBACK_DIGITS)
+        {
+            buffer[pos++] = *p;
+        }
+        else
+        {
+            exp10++;
+            if (*p != '0')
+                dropped_nonzero = 1;
+        }
+    }
+    if (pos == digits_begin)
+    {
+        buffer[pos++] = '0';
+    }
+    if (dropped_nonzero)
+    {
+        buffer[pos++] = '1';
+        exp10--;
+    }
+    snprintf(buffer + pos, sizeof(buffer) - pos, "e%lld", (long long)exp10);
+    return strtod(buffer, NULL);
+}
+
+static void set_number_error(JsonNumberParse *out, const char *position,
+                             JsonErrorCode code, const char *message)
+{
+    out->error = code;
+    out->message = message;
+    out->end = position;
+}
+
+/* Parse the JSON number starting at p. Returns 1 on success with out->end
+   just past the number; returns 0 with out->error, out->message and
+   out->end (the offending position) set otherwise */
+int json_number_parse(const char *p, const char *end, JsonNumberParse *out)
+{
+    out->number = 0.0;
+    out->integer = 0;
+    out->is_integer = 0;
+    out->error = JSON_ERROR_NONE;
+    out->message = NULL;
+
+    int negative = 0;
+    if (p < end && *p == '-')
+    {
+        negative = 1;
+        p++;
+        if (p >= end || !is_digit(*p))
+        {
+            set_number_error(out, p, JSON_ERROR_INVALID_NUMBER, "Expected a digit after minus sign");
+            return 0;
+        }
+    }
+
+    /* Integer part */
+    const char *digits_start = p;
+    uint64_t mantissa = 0;
+    int significant = 0;    /* Significant digits seen */
+    int64_t exp10 = 0;      /* Decimal exponent of the last digit kept in mantissa */
+    int64_t fraction_digits = 0;
+    int64_t exponent = 0;   /* Explicit exponent after 'e' */
+
+    if (p < end && *p == '0')
+    {
+        p++;
+        if (p < end && is_digit(*p))
+        {
+            set_number_error(out, p, JSON_ERROR_INVALID_NUMBER, "Leading zeros are not allowed");
+            return 0;
+        }
+    }
+    else if (p < end && is_digit(*p))
+    {
+        while (p < end && is_digit(*p))
+        {
+            if (significant < JSON_NUMBER_MAX_DIGITS)
+            {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                if (mantissa)
+                    significant++;
+            }
+            else
+            {
+                exp10++;
+                significant++;
+            }
+            p++;
+        }
+    }
+    else
+    {
+        set_number_error(out, p, JSON_ERROR_INVALID_NUMBER, "Expected a digit");
+        return 0;
+    }
+
+    int is_integer = 1;
+
+    /* Fractional part */
+    if (p < end && *p == '.')
+    {
+        is_integer = 0;
+        p++;
+        if (p >= end || !is_digit(*p))
+        {
+            set_number_error(out, p, JSON_ERROR_INVALID_NUMBER, "Expected digit after decimal point");
+            return 0;
+        }
+        while (p < end && is_digit(*p))
+        {
+            if (significant < JSON_NUMBER_MAX_DIGITS)
+            {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                exp10--;
+                if (mantissa)
+                    significant++;
+            }
+            else
+            {
+                significant++;
+            }
+            fraction_digits++;
+            p++;
+        }
+    }
+    const char *digits_end = p;
+
+    /* Exponent */
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        is_integer = 0;
+        p++;
+        int exp_negative = 0;
+        if (p < end && (*p == '+' || *p == '-'))
+        {
+            exp_negative = (*p == '-');
+            p++;
+        }
+        if (p >= end || !is_digit(*p))
+        {
+            set_number_error(out, p, JSON_ERROR_INVALID_NUMBER, "Expected digit in exponent");
+            return 0;
+        }
+        while (p < end && is_digit(*p))
+        {
+            /* Anything this large is zero or infinite anyway */
+            if (exponent < 100000)
+                exponent = exponent * 10 + (*p - '0');
+            p++;
+        }
+        if (exp_negative)
+            exponent = -exponent;
+        exp10 += exponent;
+    }
+    out->end = p;
+
+    int truncated = significant > JSON_NUMBER_MAX_DIGITS;
+
+    /* Integers that fit keep their exact value ("-0" stays a double) */
+    if (is_integer && !truncated && !(negative && mantissa == 0))
+    {
+        if (!negative && mantissa <= (uint64_t)INT64_MAX)
+        {
+            out->is_integer = 1;
+            out->integer = (int64_t)mantissa;
+        }
+        else if (negative && mantissa <= (uint64_t)INT64_MAX + 1)
+        {
+            out->is_integer = 1;
+            out->integer = (int64_t)(0 - mantissa);
+        }
+        /* Integer to double conversion is correctly rounded */
+        out->number = negative ? -(double)mantissa : (double)mantissa;
+        return 1;
+    }
+
+    double number;
+#if FLT_EVAL_METHOD == 0
+    /* Clinger: both operands are exact, so one rounding gives the right answer */
+    if (!truncated && mantissa <= (1ULL << 53) && exp10 >= -22 && exp10 <= 22)
+    {
+        number = (double)mantissa;
+        number = exp10 < 0 ? number / exact_pow10[-exp10] : number * exact_pow10[exp10];
+        out->number = negative ? -number : number;
+        return 1;
+    }
+#endif
+
+    if (exp10 >= INT32_MIN / 2 && exp10 <= INT32_MAX / 2 &&
+        eisel_lemire(mantissa, (int)exp10, negative, &number))
+    {
+        /* With dropped digits the value lies between mantissa and mantissa+1 */
+        double upper;
+        if (!truncated ||
+            (eisel_lemire(mantissa + 1, (int)exp10, negative, &upper) && upper == number))
+        {
+            out->number = number;
+            return 1;
+        }
+    }
+
+    out->number = strtod_fallback(digits_start, digits_end, negative, exponent - fraction_digits);
+    return 1;
+}
+
+/* Shortest round-trip formatting (Ryu, Ulf Adams 2018). The digits are the
+   shortest sequence that still parses back to the same double */
+
+#define RYU_POW5_INV_BITCOUNT 125
+#define RYU_POW5_BITCOUNT 125
+
+/* ceil(2^(bitlength(5^i) - 1 + 125) / 5^i) as {low, high} */
+static const uint64_t ryu_pow5_inv_split[342][2] = {
+    {0x0000000000000001ULL, 0x2000000000000000ULL},
+    {0x999999999999999AULL, 0x1999999999999999ULL},
+    {0x47AE147AE147AE15ULL, 0x147AE147AE147AE1ULL},
+    {0x6C8B4395810624DEULL, 0x10624DD2F1A9FBE7ULL},
+    {0x7A786C226809D496ULL, 0x1A36E2EB1C432CA5ULL},
+    {0x61F9F01B866E43ABULL, 0x14F8B588E368F084ULL},
+    {0xB4C7F34938583622ULL, 0x10C6F7A0B5ED8D36ULL},
+    {0x87A6520EC08D236AULL, 0x1AD7F29ABCAF4857ULL},
+    {0x9FB841A566D74F88ULL, 0x15798EE2308C39DFULL},
+    {0xE62D01511F12A607ULL, 0x112E0BE826D694B2ULL},
+    {0xD6AE6881CB5109A4ULL, 0x1B7CDFD9D7BDBAB7ULL},
+    {0xDEF1ED34A2A73AEAULL, 0x15FD7FE17964955FULL},
+    {0x7F27F0F6E885C8BBULL, 0x119799812DEA1119ULL},
+    {0x650CB4BE40D60DF8ULL, 0x1C25C268497681C2ULL},
+    {0xEA70909833DE7193ULL, 0x16849B86A12B9B01ULL},
+    {0x21F3A6E0297EC143ULL, 0x1203AF9EE756159BULL},
+    {0x6985D7CD0F313537ULL, 0x1CD2B297D889BC2BULL},
+    {0x2137DFD73F5A90F9ULL, 0x170EF54646D49689ULL},
+    {0xE75FE645CC4873FAULL, 0x12725DD1D243ABA0ULL},
+    {0xA5663D3C7A0D865DULL, 0x1D83C94FB6D2AC34ULL},
+    {0x511E976394D79EB1ULL, 0x179CA10C9242235DULL},
+    {0xDA7EDF82DD794BC1ULL, 0x12E3B40A0E9B4F7DULL},
+    {0x2A6498D1625BAC68ULL, 0x1E392010175EE596ULL},
+    {0xEEB6E0A781E2F053ULL, 0x182DB34012B25144ULL},
+    {0x58924D52CE4F26A9ULL, 0x1357C299A88EA76AULL},
+    {0x27507BB7B07EA441ULL, 0x1EF2D0F5DA7DD8AAULL},
+    {0x52A6C95FC0655034ULL, 0x18C240C4AECB13BBULL},
+    {0x0EEBD44C99EAA690ULL, 0x13CE9A36F23C0FC9ULL},
+    {0xB17953ADC3110A80ULL, 0x1FB0F6BE50601941ULL},
+    {0xC12DDC8B02740867ULL, 0x195A5EFEA6B34767ULL},
+    {0x3424B06F3529A052ULL, 0x14484BFEEBC29F86ULL},
+    {0x901D59F290EE19DBULL, 0x1039D66589687F9EULL},
+    {0x4CFBC31DB4B0295FULL, 0x19F623D5A8A73297ULL},
+    {0x3D9635B15D59BAB2ULL, 0x14C4E977BA1F5BACULL},
+    {0x97AB5E277DE16228ULL, 0x109D8792FB4C4956ULL},
+    {0xF2ABC9D8C9689D0DULL, 0x1A95A5B7F87A0EF0ULL},
+    {0x5BBCA17A3ABA173EULL, 0x154484932D2E725AULL},
+    {0xAFCA1AC82EFB45CBULL, 0x11039D428A8B8EAEULL},
+    {0xB2DCF7A6B1920945ULL, 0x1B38FB9DAA78E44AULL},
+    {0xF57D92EBC141A104ULL, 0x15C72FB1552D836EULL},
+    {0xC46475896767B403ULL, 0x116C262777579C58ULL},
+    {0x6D6D88DBD8A5ECD2ULL, 0x1BE03D0BF225C6F4ULL},
+    {0x8ABE071646EB23DBULL, 0x164CFDA3281E38C3ULL},
+    {0x6EFE6C11D255B649ULL, 0x11D7314F534B609CULL},
+    {0xB197134FB6EF8A0EULL, 0x1C8B821885456760ULL},
+    {0x27AC0F72F8BFA1A5ULL, 0x16D601AD376AB91AULL},
+    {0xB95672C260994E1EULL, 0x1244CE242C5560E1ULL},
+    {0xF5571E03CDC21695ULL, 0x1D3AE36D13BBCE35ULL},
+    {0x2AAC18030B01ABABULL, 0x17624F8A762FD82BULL},
+    {0xBBBCE0026F348956ULL, 0x12B50C6EC4F31355ULL},
+    {0x92C7CCD0B1EDA889ULL, 0x1DEE7A4AD4B81EEFULL},
+    {0xDBD30A408E57BA07ULL, 0x17F1FB6F10934BF2ULL},
+    {0x7CA8D50071DFC806ULL, 0x1327FC58DA0F6FF5ULL},
+    {0xFAA7BB33E9660CD6ULL, 0x1EA6608E29B24CBBULL},
+    {0x9552FC298784D711ULL, 0x18851A0B548EA3C9ULL},
+    {0xAAA8C9BAD2D0AC0EULL, 0x139DAE6F76D88307ULL},
+    {0xDDDADC5E1E1AACE3ULL, 0x1F62B0B257C0D1A5ULL},
+    {0x7E48B04B4B488A4FULL, 0x191BC08EAC9A4151ULL},
+    {0xCB6D59D5D5D3A1D9ULL, 0x141633A556E1CDDAULL},
+    {0x3C577B1177DC817BULL, 0x1011C2EAABE7D7E2ULL},
+    {0xC6F25E825960CF2AULL, 0x19B604AAACA62636ULL},
+    {0x6BF518684780A5BBULL, 0x14919D5556EB51C5ULL},
+    {0x232A79ED06008496ULL, 0x10747DDDDF22A7D1ULL},
+    {0xD1DD8FE1A3340756ULL, 0x1A53FC9631D10C81ULL},
+    {0xA7E4731AE8F66C45ULL, 0x150FFD44F4A73D34ULL},
+    {0x531D28E253F8569EULL, 0x10D9976A5D52975DULL},
+    {0xEB61DB03B98D5762ULL, 0x1AF5BF109550F22EULL},
+    {0xBC4E48CFC7A445E8ULL, 0x159165A6DDDA5B58ULL},
+    {0x6371D3D96C836B20ULL, 0x11411E1F17E1E2ADULL},
+    {0x9F1C8628AD9F11CDULL, 0x1B9B6364F3030448ULL},
+    {0xE5B06B53BE18DB0BULL, 0x1615E91D8F359D06ULL},
+    {0xEAF3890FCB4715A2ULL, 0x11AB20E472914A6BULL},
+    {0x44B8DB4C7871BC37ULL, 0x1C45016D841BAA46ULL},
+    {0x03C715D6C6C1635FULL, 0x169D9ABE03495505ULL},
+    {0x3638DE456BCDE919ULL, 0x1217AEFE69077737ULL},
+    {0x56C163A2461641C1ULL, 0x1CF2B1970E725858ULL},
+    {0xDF011C81D1AB67CEULL, 0x17288E1271F51379ULL},
+    {0x7F3416CE4155ECA5ULL, 0x1286D80EC190DC61ULL},
+    {0x6520247D3556476EULL, 0x1DA48CE468E7C702ULL},
+    {0xEA801D30F7783925ULL, 0x17B6D71D20B96C01ULL},
+    {0xBB99B0F3F92CFA84ULL, 0x12F8AC174D612334ULL},
+    {0x5F5C4E532847F739ULL, 0x1E5AACF215683854ULL},
+    {0x7F7D0B75B9D32C2EULL, 0x18488A5B44536043ULL},
+    {0x9930D5F7C7DC2358ULL, 0x136D3B7C36A919CFULL},
+    {0x8EB4898C72F9D226ULL, 0x1F152BF9F10E8FB2ULL},
+    {0x722A07A38F2E41B8ULL, 0x18DDBCC7F40BA628ULL},
+    {0xC1BB394FA5BE9AFAULL, 0x13E497065CD61E86ULL},
+    {0x9C5EC2190930F7F6ULL, 0x1FD424D6FAF030D7ULL},
+    {0x49E56814075A5FF8ULL, 0x197683DF2F268D79ULL},
+    {0x6E51201005E1E660ULL, 0x145ECFE5BF520AC7ULL},
+    {0xF1DA800CD181851AULL, 0x104BD984990E6F05ULL},
+    {0x4FC400148268D4F5ULL, 0x1A12F5A0F4E3E4D6ULL},
+    {0xD96999AA01ED772BULL, 0x14DBF7B3F71CB711ULL},
+    {0xADEE1488018AC5BCULL, 0x10AFF95CC5B09274ULL},
+    {0x497CEDA668DE092CULL, 0x1AB328946F80EA54ULL},
+    {0x3ACA57B853E4D424ULL, 0x155C2076BF9A5510ULL},
+    {0x623B7960431D7683ULL, 0x1116805EFFAEAA73ULL},
+    {0x9D2BF566D1C8BD9EULL, 0x1B5733CB32B110B8ULL},
+    {0x7DBCC452416D647FULL, 0x15DF5CA28EF40D60ULL},
+    {0xCAFD69DB678AB6CCULL, 0x117F7D4ED8C33DE6ULL},
+    {0xAB2F0FC572778ADFULL, 0x1BFF2EE48E052FD7ULL},
+    {0x88F273045B92D580ULL, 0x1665BF1D3E6A8CACULL},
+    {0xD3F528D049424466ULL, 0x11EAFF4A98553D56ULL},
+    {0xB988414D4203A0A3ULL, 0x1CAB3210F3BB9557ULL},
+    {0x6139CDD76802E6E9ULL, 0x16EF5B40C2FC7779ULL},
+    {0xE761717920025254ULL, 0x125915CD68C9F92DULL},
+    {0xA568B58E999D5086ULL, 0x1D5B561574765B7CULL},
+    {0x5120913EE14AA6D2ULL, 0x177C44DDF6C515FDULL},
+    {0xA74D40FF1AA21F0EULL, 0x12C9D0B1923744CAULL},
+    {0x0BAECE64F769CB4AULL, 0x1E0FB44F50586E11ULL},
+    {0x3C8BD850C5EE3C3BULL, 0x180C903F7379F1A7ULL},
+    {0xCA0979DA37F1C9C9ULL, 0x133D4032C2C7F485ULL},
+    {0xA9A8C2F6BFE942DBULL, 0x1EC866B79E0CBA6FULL},
+    {0x2153CF2BCCBA9BE3ULL, 0x18A0522C7E709526ULL},
+    {0x1AA9728970954982ULL, 0x13B374F06526DDB8ULL},
+    {0xF775840F1A88759DULL, 0x1F8587E7083E2F8CULL},
+    {0x5F9136727BA05E17ULL, 0x19379FEC0698260AULL},
+    {0x1940F85B9619E4DFULL, 0x142C7FF0054684D5ULL},
+    {0xE100C6AFAB47EA4CULL, 0x1023998CD1053710ULL},
+    {0xCE67A44C453FDD47ULL, 0x19D28F47B4D524E7ULL},
+    {0xD852E9D69DCCB106ULL, 0x14A8729FC3DDB71FULL},
+    {0x79DBEE454B0A2738ULL, 0x1086C219697E2C19ULL},
+    {0x295FE3A211A9D859ULL, 0x1A71368F0F30468FULL},
+    {0xBAB31C81A7BB137AULL, 0x15275ED8D8F36BA5ULL},
+    {0x6228E39AEC95A92FULL, 0x10EC4BE0AD8F8951ULL},
+    {0x9D0E38F7E0EF7517ULL, 0x1B13AC9AAF4C0EE8ULL},
+    {0xB0D82D931A592A79ULL, 0x15A956E225D67253ULL},
+    {0x8D79BE0F4847552EULL, 0x11544581B7DEC1DCULL},
+    {0x158F967EDA0BBB7CULL, 0x1BBA08CF8C979C94ULL},
+    {0x77A611FF14D62F97ULL, 0x162E6D72D6DFB076ULL},
+    {0xF951A7FF43DE8C79ULL, 0x11BEBDF578B2F391ULL},
+    {0xC21C3FFED2FDAD8EULL, 0x1C6463225AB7EC1CULL},
+    {0x01B0333242648AD8ULL, 0x16B6B5B5155FF017ULL},
+    {0x0159C28E9B83A246ULL, 0x122BC490DDE659ACULL},
+    {0xCEF604175F3903A3ULL, 0x1D12D41AFCA3C2ACULL},
+    {0x725E69AC4C2D9C83ULL, 0x17424348CA1C9BBDULL},
+    {0xF5185489D68AE39CULL, 0x129B69070816E2FDULL},
+    {0xEE8D540FBDAB05C6ULL, 0x1DC574D80CF16B2FULL},
+    {0xBED77672FE226B05ULL, 0x17D12A4670C1228CULL},
+    {0xFF12C528CB4EBC04ULL, 0x130DBB6B8D674ED6ULL},
+    {0xCB513B74787DF9A0ULL, 0x1E7C5F127BD87E24ULL},
+    {0x090DC929F9FE614DULL, 0x18637F41FCAD31B7ULL},
+    {0xA0D7D42194CB810AULL, 0x1382CC34CA2427C5ULL},
+    {0x67BFB9CF5478CE77ULL, 0x1F37AD21436D0C6FULL},
+    {0x1FCC94A5DD2D71F9ULL, 0x18F9574DCF8A7059ULL},
+    {0x7FD6DD517DBDF4C7ULL, 0x13FAAC3E3FA1F37AULL},
+    {0xFFBE2EE8C92FEE0BULL, 0x1FF779FD329CB8C3ULL},
+    {0x6631BF20A0F324D6ULL, 0x1992C7FDC216FA36ULL},
+    {0xB827CC1A1A5C1D78ULL, 0x14756CCB01ABFB5EULL},
+    {0x935309AE7B7CE460ULL, 0x105DF0A267BCC918ULL},
+    {0x1EEB42B0C594A099ULL, 0x1A2FE76A3F9474F4ULL},
+    {0xE58902270476E6E1ULL, 0x14F31F8832DD2A5CULL},
+    {0xB7A0CE859D2BEBE7ULL, 0x10C27FA028B0EEB0ULL},
+    {0x59014A6F61DFDFD8ULL, 0x1AD0CC33744E4AB4ULL},
+    {0xE0CDD525E7E64CADULL, 0x1573D68F903EA229ULL},
+    {0x4D7177518651D6F1ULL, 0x11297872D9CBB4EEULL},
+    {0x7BE8BEE8D6E957E8ULL, 0x1B758D848FAC54B0ULL},
+    {0xFCBA3253DF211320ULL, 0x15F7A46A0C89DD59ULL},
+    {0x63C8284318E74280ULL, 0x1192E9EE706E4AAEULL},
+    {0x060D0D3827D86A66ULL, 0x1C1E43171A4A1117ULL},
+    {0x6B3DA42CECAD21EBULL, 0x167E9C127B6E7412ULL},
+    {0x88FE1CF0BD574E56ULL, 0x11FEE341FC585CDBULL},
+    {0x419694B462254A23ULL, 0x1CCB0536608D615FULL},
+    {0x67ABAA29E81DD4E9ULL, 0x1708D0F84D3DE77FULL},
+    {0xB95621BB2017DD87ULL, 0x126D73F9D764B932ULL},
+    {0xC223692B668C95A5ULL, 0x1D7BECC2F23AC1EAULL},
+    {0xCE82BA891ED6DE1DULL, 0x179657025B6234BBULL},
+    {0xA53562074BDF1818ULL, 0x12DEAC01E2B4F6FCULL},
+    {0x3B889CD87964F359ULL, 0x1E3113363787F194ULL},
+    {0xFC6D4A46C783F5E1ULL, 0x18274291C6065ADCULL},
+    {0x30576E9F06032B1AULL, 0x13529BA7D19EAF17ULL},
+    {0x1A257DCB3CD1DE90ULL, 0x1EEA92A61C311825ULL},
+    {0x481DFE3C30A7E540ULL, 0x18BBA884E35A79B7ULL},
+    {0xD34B31C9C0865100ULL, 0x13C9539D82AEC7C5ULL},
+    {0x5211E942CDA3B4CDULL, 0x1FA885C8D117A609ULL},
+    {0x74DB21023E1C90A4ULL, 0x19539E3A40DFB807ULL},
+    {0xF715B401CB4A0D50ULL, 0x1442E4FB67196005ULL},
+    {0xF8DE299B09080AA7ULL, 0x103583FC527AB337ULL},
+    {0x8E304291A80CDDD7ULL, 0x19EF3993B72AB859ULL},
+    {0x3E8D020E200A4B13ULL, 0x14BF6142F8EEF9E1ULL},
+    {0x653D9B3E80083C0FULL, 0x10991A9BFA58C7E7ULL},
+    {0x6EC8F864000D2CE4ULL, 0x1A8E90F9908E0CA5ULL},
+    {0x8BD3F9E999A423EAULL, 0x153EDA614071A3B7ULL},
+    {0x3CA994BAE1501CBBULL, 0x10FF151A99F482F9ULL},
+    {0xC775BAC49BB3612BULL, 0x1B31BB5DC320D18EULL},
+    {0xD2C4956A16291A89ULL, 0x15C162B168E70E0BULL},
+    {0xDBD0778811BA7BA1ULL, 0x11678227871F3E6FULL},
+    {0x2C80BF401C5D929BULL, 0x1BD8D03F3E9863E6ULL},
+    {0xBD33CC3349E47549ULL, 0x16470CFF6546B651ULL},
+    {0xCA8FD68F6E505DD4ULL, 0x11D270CC51055EA7ULL},
+    {0x4419574BE3B3C953ULL, 0x1C83E7AD4E6EFDD9ULL},
+    {0x0347790982F63AA9ULL, 0x16CFEC8AA52597E1ULL},
+    {0xCF6C60D468C4FBBAULL, 0x123FF06EEA847980ULL},
+    {0xE57A34870E07F92AULL, 0x1D331A4B10D3F59AULL},
+    {0x512E906C0B399422ULL, 0x175C1508DA432AE2ULL},
+    {0xDA8BA6BCD5C7A9B5ULL, 0x12B010D3E1CF5581ULL},
+    {0x90DF712E22D90F87ULL, 0x1DE6815302E5559CULL},
+    {0xDA4C5A8B4F140C6CULL, 0x17EB9AA8CF1DDE16ULL},
+    {0xAEA37BA2A5A9A38AULL, 0x1322E220A5B17E78ULL},
+    {0x7DD25F6AA2A905A9ULL, 0x1E9E369AA2B59727ULL},
+    {0x97DB7F888220D154ULL, 0x187E92154EF7AC1FULL},
+    {0x797C6606CE80A777ULL, 0x139874DDD8C6234CULL},
+    {0x8F2D700AE4010BF1ULL, 0x1F5A549627A36BADULL},
+    {0x0C2459A25000D65AULL, 0x191510781FB5EFBEULL},
+    {0x701D1481D99A4515ULL, 0x1410D9F9B2F7F2FEULL},
+    {0xC017439B147B6A77ULL, 0x100D7B2E28C65BFEULL},
+    {0xCCF205C4ED9243F2ULL, 0x19AF2B7D0E0A2CCAULL},
+    {0x0A5B37D0BE0E9CC2ULL, 0x148C22CA71A1BD6FULL},
+    {0x0848F973CB3EE3CEULL, 0x10701BD527B4978CULL},
+    {0xDA0E5BEC78649FB0ULL, 0x1A4CF9550C5425ACULL},
+    {0x7B3EAFF060507FC0ULL, 0x150A6110D6A9B7BDULL},
+    {0x95CBBFF380406633ULL, 0x10D51A73DEEE2C97ULL},
+    {0xEFAC665266CD7052ULL, 0x1AEE90B964B04758ULL},
+    {0x2623850EB8A459DBULL, 0x158BA6FAB6F36C47ULL},
+    {0x1E82D0D893B6AE49ULL, 0x113C85955F29236CULL},
+    {0xFD9E1AF41F8AB075ULL, 0x1B9408EEFEA838ACULL},
+    {0x97B1AF29B2D559F7ULL, 0x16100725988693BDULL},
+    {0xAC8E25BAF5777B2CULL, 0x11A66C1E139EDC97ULL},
+    {0x7A7D092B2258C513ULL, 0x1C3D79C9B8FE2DBFULL},
+    {0x61FDA0EF4EAD6A76ULL, 0x169794A160CB57CCULL},
+    {0xE7FE1A590BBDEEC5ULL, 0x1212DD4DE7091309ULL},
+    {0xA6635D5B45FCB13AULL, 0x1CEAFBAFD80E84DCULL},
+    {0x851C4AAF6B308DC8ULL, 0x172262F3133ED0B0ULL},
+    {0xD0E36EF2BC26D7D4ULL, 0x1281E8C275CBDA26ULL},
+    {0xB49F17EAC6A48C86ULL, 0x1D9CA79D894629D7ULL},
+    {0x2A18DFEF0550706BULL, 0x17B08617A104EE46ULL},
+    {0x54E0B3259DD9F389ULL, 0x12F39E794D9D8B6BULL},
+    {0x87CDEB6F62F65274ULL, 0x1E5297287C2F4578ULL},
+    {0xD30B22BF825EA85DULL, 0x18421286C9BF6AC6ULL},
+    {0x0F3C1BCC684BB9E4ULL, 0x13680ED23AFF889FULL},
+    {0x18602C7A4079296DULL, 0x1F0CE4839198DA98ULL},
+    {0x46B356C833942124ULL, 0x18D71D360E13E213ULL},
+    {0x388F78A029434DB6ULL, 0x13DF4A91A4DCB4DCULL},
+    {0x5A7F2766A86BAF8AULL, 0x1FCBAA82A1612160ULL},
+    {0x153285EBB9EFBFA2ULL, 0x196FBB9BB44DB44DULL},
+    {0xAA8ED189618C994EULL, 0x145962E2F6A4903DULL},
+    {0xEED8A7A11AD6E10CULL, 0x1047824F2BB6D9CAULL},
+    {0x7E27729B5E249B45ULL, 0x1A0C03B1DF8AF611ULL},
+    {0xFE85F549181D4904ULL, 0x14D6695B193BF80DULL},
+    {0xCB9E5DD4134AA0D0ULL, 0x10AB877C142FF9A4ULL},
+    {0xDF63C9535211014DULL, 0x1AAC0BF9B9E65C3AULL},
+    {0x191CA10F74DA6771ULL, 0x15566FFAFB1EB02FULL},
+    {0xADB080D92A4852C1ULL, 0x1111F32F2F4BC025ULL},
+    {0x15E7348EAA0D5134ULL, 0x1B4FEB7EB212CD09ULL},
+    {0xAB1F5D3EEE710DC4ULL, 0x15D98932280F0A6DULL},
+    {0xBC1917658B8DA49DULL, 0x117AD428200C0857ULL},
+    {0x2CF4F23C127C3A94ULL, 0x1BF7B9D9CCE00D59ULL},
+    {0xF0C3F4FCDB969543ULL, 0x165FC7E170B33DE0ULL},
+    {0x5A365D9716121103ULL, 0x11E6398126F5CB1AULL},
+    {0x9056FC24F01CE804ULL, 0x1CA38F350B22DE90ULL},
+    {0xD9DF301D8CE3ECD0ULL, 0x16E93F5DA2824BA6ULL},
+    {0xE17F59B13D8323DAULL, 0x125432B14ECEA2EBULL},
+    {0x68CBC2B52F38395CULL, 0x1D53844EE47DD179ULL},
+    {0x53D6355DBF602DE3ULL, 0x177603725064A794ULL},
+    {0xA9782AB165E68B1CULL, 0x12C4CF8EA6B6EC76ULL},
+    {0x0F26AAB56FD744FAULL, 0x1E07B27DD78B13F1ULL},
+    {0x3F52222ABFDF6A62ULL, 0x18062864AC6F4327ULL},
+    {0x65DB4E88997F884EULL, 0x1338205089F29C1FULL},
+    {0x6FC54A7428CC0D4AULL, 0x1EC033B40FEA9365ULL},
+    {0x596AA1F68709A43BULL, 0x1899C2F673220F84ULL},
+    {0xADEEE7F86C07B696ULL, 0x13AE3591F5B4D936ULL},
+    {0x497E3FF3E00C5756ULL, 0x1F7D228322BAF524ULL},
+    {0xD464FFF64CD6AC45ULL, 0x1930E868E89590E9ULL},
+    {0x4383FFF83D7889D1ULL, 0x14272053ED4473EEULL},
+    {0xCF9CCCC69793A174ULL, 0x101F4D0FF1038FF1ULL},
+    {0x7F6147A425B90252ULL, 0x19CBAE7FE805B31CULL},
+    {0xCC4DD2E9B7C7350FULL, 0x14A2F1FFECD15C16ULL},
+    {0x3D0B0F215FD290D9ULL, 0x10825B3323DAB012ULL},
+    {0x61AB4B689950E7C1ULL, 0x1A6A2B85062AB350ULL},
+    {0x4E22A2BA1440B967ULL, 0x1521BC6A6B555C40ULL},
+    {0x0B4EE894DD009453ULL, 0x10E7C9EEBC4449CDULL},
+    {0x1217DA87C800ED51ULL, 0x1B0C764AC6D3A948ULL},
+    {0xDB46486CA000BDDAULL, 0x15A391D56BDC876CULL},
+    {0x490506BD4CCD64AFULL, 0x114FA7DDEFE39F8AULL},
+    {0xA8080AC87AE23AB1ULL, 0x1BB2A62FE638FF43ULL},
+    {0x5339A239FBE82EF4ULL, 0x162884F31E93FF69ULL},
+    {0x75C7B4FB2FECF25DULL, 0x11BA03F5B20FFF87ULL},
+    {0x22D92191E647EA2EULL, 0x1C5CD322B67FFF3FULL},
+    {0xB57A8141850654F2ULL, 0x16B0A8E891FFFF65ULL},
+    {0xC4620101373843F5ULL, 0x1226ED86DB3332B7ULL},
+    {0x3A366801F1F39FEEULL, 0x1D0B15A491EB8459ULL},
+    {0xFB5EB99B27F6198BULL, 0x173C115074BC69E0ULL},
+    {0x2F7EFAE2865E7AD6ULL, 0x129674405D6387E7ULL},
+    {0xE597F7D0D6FD9156ULL, 0x1DBD86CD6238D971ULL},
+    {0x8479930D78CADAABULL, 0x17CAD23DE82D7AC1ULL},
+    {0xD06142712D6F1556ULL, 0x1308A831868AC89AULL},
+    {0x4D686A4EAF182222ULL, 0x1E74404F3DAADA91ULL},
+    {0xA453883EF279B4E8ULL, 0x185D003F6488AEDAULL},
+    {0xE9DC6CFF28615D87ULL, 0x137D99CC506D58AEULL},
+    {0xA960AE650D6895A4ULL, 0x1F2F5C7A1A488DE4ULL},
+    {0xBAB3BEB73DED4483ULL, 0x18F2B061AEA07183ULL},
+    {0x2EF6322C318A9D36ULL, 0x13F559E7BEE6C136ULL},
+    {0xE4BD1D13827761F0ULL, 0x1FEEF63F97D79B89ULL},
+    {0x83CA7DA9352C4E5AULL, 0x198BF832DFDFAFA1ULL},
+    {0x9CA1FE20F756A515ULL, 0x146FF9C24CB2F2E7ULL},
+    {0x4A1B31B3F9121DAAULL, 0x1059949B708F28B9ULL},
+    {0x435EB5ECC1B695DDULL, 0x1A28EDC580E50DF5ULL},
+    {0x35E55E57015EDE4AULL, 0x14ED8B04671DA4C4ULL},
+    {0xC4B77EAC0118B1D5ULL, 0x10BE08D0527E1D69ULL},
+    {0xA12597799B5AB622ULL, 0x1AC9A7B3B7302F0FULL},
+    {0x4DB7AC6149155E81ULL, 0x156E1FC2F8F358D9ULL},
+    {0xD7C6238107444B9BULL, 0x1124E63593F5E0ADULL},
+    {0x593D059B3ED3AC2BULL, 0x1B6E3D2286563449ULL},
+    {0xE0FD9E15CBDC89BCULL, 0x15F1CA820511C36DULL},
+    {0xB3FE18116FE3A163ULL, 0x118E3B9B37416924ULL},
+    {0x866359B57FD29BD1ULL, 0x1C16C5C525357507ULL},
+    {0xD1E91491330EE30EULL, 0x16789E3750F790D2ULL},
+    {0x74BA76DA8F3F1C0BULL, 0x11FA182C40C60D75ULL},
+    {0xEDF72490E531C678ULL, 0x1CC359E067A348BBULL},
+    {0x8B2C1D40B75B052DULL, 0x1702AE4D1FB5D3C9ULL},
+    {0x6F567DCD5F7C0424ULL, 0x12688B70E62B0FD4ULL},
+    {0x7EF0C94898C66D06ULL, 0x1D74124E3D11B2EDULL},
+    {0x98C0A106E09EBD9FULL, 0x17900EA4FDA7C257ULL},
+    {0x470080D24D4BCAE6ULL, 0x12D9A550CAEC9B79ULL},
+    {0xD800CE1D487944A2ULL, 0x1E29088144ADC58EULL},
+    {0x1333D8176D2DD082ULL, 0x1820D39A9D57D13FULL},
+    {0xA8F646792424A6CEULL, 0x134D76154AACA765ULL},
+    {0x74BD3D8EA03AA47DULL, 0x1EE25688777AA56FULL},
+    {0x5D64313EE6955064ULL, 0x18B51206C5FBB78CULL},
+    {0x4AB68DCBEBAAA6B7ULL, 0x13C40E6BD1962C70ULL},
+    {0x1124161312AAA457ULL, 0x1FA01712E8F0471AULL},
+    {0xDA8344DC0EEEE9DFULL, 0x194CDF4253F36C14ULL},
+    {0xE2029D7CD8BF2180ULL, 0x143D7F6843292343ULL},
+    {0x4E687DFD7A328133ULL, 0x103132B9CF541C36ULL},
+    {0x4A40C9959050CEB8ULL, 0x19E851294BB9C6BDULL},
+    {0x0833D477A6A70BC6ULL, 0x14B9DA876FC7D231ULL},
+    {0xA02976C61EEC096BULL, 0x1094AED2BFD30E8DULL},
+    {0x004257A364ACDBDFULL, 0x1A877E1DFFB81749ULL},
+    {0xCD01DFB5EA23E319ULL, 0x153931B1996012A0ULL},
+    {0x70CE4C91881CB5AEULL, 0x10FA8E27ADE6754DULL},
+    {0x1AE3ADB5A69455E2ULL, 0x1B2A7D0C4970BBAFULL},
+    {0x7BE957C4854377E8ULL, 0x15BB973D078D62F2ULL},
+    {0xC987796A0435F987ULL, 0x1162DF64060AB58EULL},
+    {0x75A58F1006BCC271ULL, 0x1BD1656CD67788E4ULL},
+    {0xF7B7A5A66BCA3527ULL, 0x16411DF0AB92D3E9ULL},
+    {0x5FC61E1EBCA1C41FULL, 0x11CDB18D560F0FEEULL},
+    {0xFFA363646102D365ULL, 0x1C7C4F4889B1B316ULL},
+    {0x32E91C504D9BDC51ULL, 0x16C9D906D48E28DFULL},
+    {0x8F20E37371497D0EULL, 0x123B140576D820B2ULL},
+    {0x7E9B0585820F2E7CULL, 0x1D2B533BF159CDEAULL},
+    {0xCBAF379E01A5BECAULL, 0x1755DC2FF447D7EEULL},
+    {0x0958F94B348498A1ULL, 0x12AB168CC36CACBFULL},
+};
+
+/* 5^i normalized to 125 bits as {low, high} */
+static const uint64_t ryu_pow5_split[326][2] = {
+    {0x0000000000000000ULL, 0x1000000000000000ULL},
+    {0x0000000000000000ULL, 0x1400000000000000ULL},
+    {0x0000000000000000ULL, 0x1900000000000000ULL},
+    {0x0000000000000000ULL, 0x1F40000000000000ULL},
+    {0x0000000000000000ULL, 0x1388000000000000ULL},
+    {0x0000000000000000ULL, 0x186A000000000000ULL},
+    {0x0000000000000000ULL, 0x1E84800000000000ULL},
+    {0x0000000000000000ULL, 0x1312D00000000000ULL},
+    {0x0000000000000000ULL, 0x17D7840000000000ULL},
+    {0x0000000000000000ULL, 0x1DCD650000000000ULL},
+    {0x0000000000000000ULL, 0x12A05F2000000000ULL},
+    {0x0000000000000000ULL, 0x174876E800000000ULL},
+    {0x0000000000000000ULL, 0x1D1A94A200000000ULL},
+    {0x0000000000000000ULL, 0x12309CE540000000ULL},
+    {0x0000000000000000ULL, 0x16BCC41E90000000ULL},
+    {0x0000000000000000ULL, 0x1C6BF52634000000ULL},
+    {0x0000000000000000ULL, 0x11C37937E0800000ULL},
+    {0x0000000000000000ULL, 0x16345785D8A00000ULL},
+    {0x0000000000000000ULL, 0x1BC16D674EC80000ULL},
+    {0x0000000000000000ULL, 0x1158E460913D0000ULL},
+    {0x0000000000000000ULL, 0x15AF1D78B58C4000ULL},
+    {0x0000000000000000ULL, 0x1B1AE4D6E2EF5000ULL},
+    {0x0000000000000000ULL, 0x10F0CF064DD59200ULL},
+    {0x0000000000000000ULL, 0x152D02C7E14AF680ULL},
+    {0x0000000000000000ULL, 0x1A784379D99DB420ULL},
+    {0x0000000000000000ULL, 0x108B2A2C28029094ULL},
+    {0x0000000000000000ULL, 0x14ADF4B7320334B9ULL},
+    {0x4000000000000000ULL, 0x19D971E4FE8401E7ULL},
+    {0x8800000000000000ULL, 0x1027E72F1F128130ULL},
+    {0xAA00000000000000ULL, 0x1431E0FAE6D7217CULL},
+    {0xD480000000000000ULL, 0x193E5939A08CE9DBULL},
+    {0xC9A0000000000000ULL, 0x1F8DEF8808B02452ULL},
+    {0xBE04000000000000ULL, 0x13B8B5B5056E16B3ULL},
+    {0xAD85000000000000ULL, 0x18A6E32246C99C60ULL},
+    {0xD8E6400000000000ULL, 0x1ED09BEAD87C0378ULL},
+    {0x878FE80000000000ULL, 0x13426172C74D822BULL},
+    {0x6973E20000000000ULL, 0x1812F9CF7920E2B6ULL},
+    {0x03D0DA8000000000ULL, 0x1E17B84357691B64ULL},
+    {0x8262889000000000ULL, 0x12CED32A16A1B11EULL},
+    {0x22FB2AB400000000ULL, 0x178287F49C4A1D66ULL},
+    {0xABB9F56100000000ULL, 0x1D6329F1C35CA4BFULL},
+    {0xCB54395CA0000000ULL, 0x125DFA371A19E6F7ULL},
+    {0xBE2947B3C8000000ULL, 0x16F578C4E0A060B5ULL},
+    {0x2DB399A0BA000000ULL, 0x1CB2D6F618C878E3ULL},
+    {0xFC90400474400000ULL, 0x11EFC659CF7D4B8DULL},
+    {0x7BB4500591500000ULL, 0x166BB7F0435C9E71ULL},
+    {0xDAA16406F5A40000ULL, 0x1C06A5EC5433C60DULL},
+    {0xA8A4DE8459868000ULL, 0x118427B3B4A05BC8ULL},
+    {0xD2CE16256FE82000ULL, 0x15E531A0A1C872BAULL},
+    {0x87819BAECBE22800ULL, 0x1B5E7E08CA3A8F69ULL},
+    {0xF4B1014D3F6D5900ULL, 0x111B0EC57E6499A1ULL},
+    {0x71DD41A08F48AF40ULL, 0x1561D276DDFDC00AULL},
+    {0x0E549208B31ADB10ULL, 0x1ABA4714957D300DULL},
+    {0x28F4DB456FF0C8EAULL, 0x10B46C6CDD6E3E08ULL},
+    {0x33321216CBECFB24ULL, 0x14E1878814C9CD8AULL},
+    {0xBFFE969C7EE839EDULL, 0x1A19E96A19FC40ECULL},
+    {0xF7FF1E21CF512434ULL, 0x105031E2503DA893ULL},
+    {0xF5FEE5AA43256D41ULL, 0x14643E5AE44D12B8ULL},
+    {0x337E9F14D3EEC892ULL, 0x197D4DF19D605767ULL},
+    {0x005E46DA08EA7AB6ULL, 0x1FDCA16E04B86D41ULL},
+    {0xA03AEC4845928CB2ULL, 0x13E9E4E4C2F34448ULL},
+    {0xC849A75A56F72FDEULL, 0x18E45E1DF3B0155AULL},
+    {0x7A5C1130ECB4FBD6ULL, 0x1F1D75A5709C1AB1ULL},
+    {0xEC798ABE93F11D65ULL, 0x13726987666190AEULL},
+    {0xA797ED6E38ED64BFULL, 0x184F03E93FF9F4DAULL},
+    {0x517DE8C9C728BDEFULL, 0x1E62C4E38FF87211ULL},
+    {0xD2EEB17E1C7976B5ULL, 0x12FDBB0E39FB474AULL},
+    {0x87AA5DDDA397D462ULL, 0x17BD29D1C87A191DULL},
+    {0xE994F5550C7DC97BULL, 0x1DAC74463A989F64ULL},
+    {0x11FD195527CE9DEDULL, 0x128BC8ABE49F639FULL},
+    {0xD67C5FAA71C24568ULL, 0x172EBAD6DDC73C86ULL},
+    {0x8C1B77950E32D6C2ULL, 0x1CFA698C95390BA8ULL},
+    {0x57912ABD28DFC639ULL, 0x121C81F7DD43A749ULL},
+    {0xAD75756C7317B7C8ULL, 0x16A3A275D494911BULL},
+    {0x98D2D2C78FDDA5BAULL, 0x1C4C8B1349B9B562ULL},
+    {0x9F83C3BCB9EA8794ULL, 0x11AFD6EC0E14115DULL},
+    {0x0764B4ABE8652979ULL, 0x161BCCA7119915B5ULL},
+    {0x493DE1D6E27E73D7ULL, 0x1BA2BFD0D5FF5B22ULL},
+    {0x6DC6AD264D8F0866ULL, 0x1145B7E285BF98F5ULL},
+    {0xC938586FE0F2CA80ULL, 0x159725DB272F7F32ULL},
+    {0x7B866E8BD92F7D20ULL, 0x1AFCEF51F0FB5EFFULL},
+    {0xAD34051767BDAE34ULL, 0x10DE1593369D1B5FULL},
+    {0x9881065D41AD19C1ULL, 0x15159AF804446237ULL},
+    {0x7EA147F492186032ULL, 0x1A5B01B605557AC5ULL},
+    {0x6F24CCF8DB4F3C1FULL, 0x1078E111C3556CBBULL},
+    {0x4AEE003712230B27ULL, 0x14971956342AC7EAULL},
+    {0xDDA98044D6ABCDF0ULL, 0x19BCDFABC13579E4ULL},
+    {0x0A89F02B062B60B6ULL, 0x10160BCB58C16C2FULL},
+    {0xCD2C6C35C7B638E4ULL, 0x141B8EBE2EF1C73AULL},
+    {0x8077874339A3C71DULL, 0x1922726DBAAE3909ULL},
+    {0xE0956914080CB8E4ULL, 0x1F6B0F092959C74BULL},
+    {0x6C5D61AC8507F38EULL, 0x13A2E965B9D81C8FULL},
+    {0x4774BA17A649F072ULL, 0x188BA3BF284E23B3ULL},
+    {0x1951E89D8FDC6C8FULL, 0x1EAE8CAEF261ACA0ULL},
+    {0x0FD3316279E9C3D9ULL, 0x132D17ED577D0BE4ULL},
+    {0x13C7FDBB186434CFULL, 0x17F85DE8AD5C4EDDULL},
+    {0x58B9FD29DE7D4203ULL, 0x1DF67562D8B36294ULL},
+    {0xB7743E3A2B0E4942ULL, 0x12BA095DC7701D9CULL},
+    {0xE5514DC8B5D1DB92ULL, 0x17688BB5394C2503ULL},
+    {0xDEA5A13AE3465277ULL, 0x1D42AEA2879F2E44ULL},
+    {0x0B2784C4CE0BF38AULL, 0x1249AD2594C37CEBULL},
+    {0xCDF165F6018EF06DULL, 0x16DC186EF9F45C25ULL},
+    {0x416DBF7381F2AC88ULL, 0x1C931E8AB871732FULL},
+    {0x88E497A83137ABD5ULL, 0x11DBF316B346E7FDULL},
+    {0xEB1DBD923D8596CAULL, 0x1652EFDC6018A1FCULL},
+    {0x25E52CF6CCE6FC7DULL, 0x1BE7ABD3781ECA7CULL},
+    {0x97AF3C1A40105DCEULL, 0x1170CB642B133E8DULL},
+    {0xFD9B0B20D0147542ULL, 0x15CCFE3D35D80E30ULL},
+    {0x3D01CDE904199292ULL, 0x1B403DCC834E11BDULL},
+    {0x462120B1A28FFB9BULL, 0x1108269FD210CB16ULL},
+    {0xD7A968DE0B33FA82ULL, 0x154A3047C694FDDBULL},
+    {0xCD93C3158E00F923ULL, 0x1A9CBC59B83A3D52ULL},
+    {0xC07C59ED78C09BB6ULL, 0x10A1F5B813246653ULL},
+    {0xB09B7068D6F0C2A3ULL, 0x14CA732617ED7FE8ULL},
+    {0xDCC24C830CACF34CULL, 0x19FD0FEF9DE8DFE2ULL},
+    {0xC9F96FD1E7EC180FULL, 0x103E29F5C2B18BEDULL},
+    {0x3C77CBC661E71E13ULL, 0x144DB473335DEEE9ULL},
+    {0x8B95BEB7FA60E598ULL, 0x1961219000356AA3ULL},
+    {0x6E7B2E65F8F91EFEULL, 0x1FB969F40042C54CULL},
+    {0xC50CFCFFBB9BB35FULL, 0x13D3E2388029BB4FULL},
+    {0xB6503C3FAA82A037ULL, 0x18C8DAC6A0342A23ULL},
+    {0xA3E44B4F95234844ULL, 0x1EFB1178484134ACULL},
+    {0xE66EAF11BD360D2BULL, 0x135CEAEB2D28C0EBULL},
+    {0xE00A5AD62C839075ULL, 0x183425A5F872F126ULL},
+    {0x980CF18BB7A47493ULL, 0x1E412F0F768FAD70ULL},
+    {0x5F0816F752C6C8DCULL, 0x12E8BD69AA19CC66ULL},
+    {0xF6CA1CB527787B13ULL, 0x17A2ECC414A03F7FULL},
+    {0xF47CA3E2715699D7ULL, 0x1D8BA7F519C84F5FULL},
+    {0xF8CDE66D86D62026ULL, 0x127748F9301D319BULL},
+    {0xF7016008E88BA830ULL, 0x17151B377C247E02ULL},
+    {0xB4C1B80B22AE923CULL, 0x1CDA62055B2D9D83ULL},
+    {0x50F91306F5AD1B65ULL, 0x12087D4358FC8272ULL},
+    {0xE53757C8B318623FULL, 0x168A9C942F3BA30EULL},
+    {0x9E852DBADFDE7ACFULL, 0x1C2D43B93B0A8BD2ULL},
+    {0xA3133C94CBEB0CC1ULL, 0x119C4A53C4E69763ULL},
+    {0x8BD80BB9FEE5CFF1ULL, 0x16035CE8B6203D3CULL},
+    {0xAECE0EA87E9F43EEULL, 0x1B843422E3A84C8BULL},
+    {0x4D40C9294F238A75ULL, 0x1132A095CE492FD7ULL},
+    {0x2090FB73A2EC6D12ULL, 0x157F48BB41DB7BCDULL},
+    {0x68B53A508BA78856ULL, 0x1ADF1AEA12525AC0ULL},
+    {0x417144725748B536ULL, 0x10CB70D24B7378B8ULL},
+    {0x51CD958EED1AE283ULL, 0x14FE4D06DE5056E6ULL},
+    {0xE640FAF2A8619B24ULL, 0x1A3DE04895E46C9FULL},
+    {0xEFE89CD7A93D00F7ULL, 0x1066AC2D5DAEC3E3ULL},
+    {0xEBE2C40D938C4134ULL, 0x14805738B51A74DCULL},
+    {0x26DB7510F86F5181ULL, 0x19A06D06E2611214ULL},
+    {0x9849292A9B4592F1ULL, 0x100444244D7CAB4CULL},
+    {0xBE5B73754216F7ADULL, 0x1405552D60DBD61FULL},
+    {0xADF25052929CB598ULL, 0x1906AA78B912CBA7ULL},
+    {0x996EE4673743E2FFULL, 0x1F485516E7577E91ULL},
+    {0xFFE54EC0828A6DDFULL, 0x138D352E5096AF1AULL},
+    {0xBFDEA270A32D0957ULL, 0x18708279E4BC5AE1ULL},
+    {0x2FD64B0CCBF84BADULL, 0x1E8CA3185DEB719AULL},
+    {0x5DE5EEE7FF7B2F4CULL, 0x1317E5EF3AB32700ULL},
+    {0x755F6AA1FF59FB1FULL, 0x17DDDF6B095FF0C0ULL},
+    {0x92B7454A7F3079E7ULL, 0x1DD55745CBB7ECF0ULL},
+    {0x5BB28B4E8F7E4C30ULL, 0x12A5568B9F52F416ULL},
+    {0xF29F2E22335DDF3CULL, 0x174EAC2E8727B11BULL},
+    {0xEF46F9AAC035570BULL, 0x1D22573A28F19D62ULL},
+    {0xD58C5C0AB8215667ULL, 0x123576845997025DULL},
+    {0x4AEF730D6629AC01ULL, 0x16C2D4256FFCC2F5ULL},
+    {0x9DAB4FD0BFB41701ULL, 0x1C73892ECBFBF3B2ULL},
+    {0xA28B11E277D08E60ULL, 0x11C835BD3F7D784FULL},
+    {0x8B2DD65B15C4B1F9ULL, 0x163A432C8F5CD663ULL},
+    {0x6DF94BF1DB35DE77ULL, 0x1BC8D3F7B3340BFCULL},
+    {0xC4BBCF772901AB0AULL, 0x115D847AD000877DULL},
+    {0x35EAC354F34215CDULL, 0x15B4E5998400A95DULL},
+    {0x8365742A30129B40ULL, 0x1B221EFFE500D3B4ULL},
+    {0xD21F689A5E0BA108ULL, 0x10F5535FEF208450ULL},
+    {0x06A742C0F58E894AULL, 0x1532A837EAE8A565ULL},
+    {0x4851137132F22B9DULL, 0x1A7F5245E5A2CEBEULL},
+    {0xED32AC26BFD75B42ULL, 0x108F936BAF85C136ULL},
+    {0xA87F57306FCD3212ULL, 0x14B378469B673184ULL},
+    {0xD29F2CFC8BC07E97ULL, 0x19E056584240FDE5ULL},
+    {0xA3A37C1DD7584F1EULL, 0x102C35F729689EAFULL},
+    {0x8C8C5B254D2E62E6ULL, 0x14374374F3C2C65BULL},
+    {0x6FAF71EEA079FB9FULL, 0x1945145230B377F2ULL},
+    {0x0B9B4E6A48987A87ULL, 0x1F965966BCE055EFULL},
+    {0x674111026D5F4C94ULL, 0x13BDF7E0360C35B5ULL},
+    {0xC111554308B71FBAULL, 0x18AD75D8438F4322ULL},
+    {0x7155AA93CAE4E7A8ULL, 0x1ED8D34E547313EBULL},
+    {0x26D58A9C5ECF10C9ULL, 0x13478410F4C7EC73ULL},
+    {0xF08AED437682D4FBULL, 0x1819651531F9E78FULL},
+    {0xECADA89454238A3AULL, 0x1E1FBE5A7E786173ULL},
+    {0x73EC895CB4963664ULL, 0x12D3D6F88F0B3CE8ULL},
+    {0x90E7ABB3E1BBC3FDULL, 0x1788CCB6B2CE0C22ULL},
+    {0x352196A0DA2AB4FDULL, 0x1D6AFFE45F818F2BULL},
+    {0x0134FE24885AB11EULL, 0x1262DFEEBBB0F97BULL},
+    {0xC1823DADAA715D65ULL, 0x16FB97EA6A9D37D9ULL},
+    {0x31E2CD19150DB4BFULL, 0x1CBA7DE5054485D0ULL},
+    {0x1F2DC02FAD2890F7ULL, 0x11F48EAF234AD3A2ULL},
+    {0xA6F9303B9872B535ULL, 0x1671B25AEC1D888AULL},
+    {0x50B77C4A7E8F6282ULL, 0x1C0E1EF1A724EAADULL},
+    {0x5272ADAE8F199D91ULL, 0x1188D357087712ACULL},
+    {0x670F591A32E004F6ULL, 0x15EB082CCA94D757ULL},
+    {0x40D32F60BF980633ULL, 0x1B65CA37FD3A0D2DULL},
+    {0x4883FD9C77BF03E0ULL, 0x111F9E62FE44483CULL},
+    {0x5AA4FD0395AEC4D8ULL, 0x156785FBBDD55A4BULL},
+    {0x314E3C447B1A760EULL, 0x1AC1677AAD4AB0DEULL},
+    {0xDED0E5AACCF089C9ULL, 0x10B8E0ACAC4EAE8AULL},
+    {0x96851F15802CAC3BULL, 0x14E718D7D7625A2DULL},
+    {0xFC2666DAE037D74AULL, 0x1A20DF0DCD3AF0B8ULL},
+    {0x9D980048CC22E68EULL, 0x10548B68A044D673ULL},
+    {0x84FE005AFF2BA032ULL, 0x1469AE42C8560C10ULL},
+    {0xA63D8071BEF6883EULL, 0x198419D37A6B8F14ULL},
+    {0xCFCCE08E2EB42A4EULL, 0x1FE52048590672D9ULL},
+    {0x21E00C58DD309A70ULL, 0x13EF342D37A407C8ULL},
+    {0x2A580F6F147CC10DULL, 0x18EB0138858D09BAULL},
+    {0xB4EE134AD99BF150ULL, 0x1F25C186A6F04C28ULL},
+    {0x7114CC0EC80176D2ULL, 0x137798F428562F99ULL},
+    {0xCD59FF127A01D486ULL, 0x18557F31326BBB7FULL},
+    {0xC0B07ED7188249A8ULL, 0x1E6ADEFD7F06AA5FULL},
+    {0xD86E4F466F516E09ULL, 0x1302CB5E6F642A7BULL},
+    {0xCE89E3180B25C98BULL, 0x17C37E360B3D351AULL},
+    {0x822C5BDE0DEF3BEEULL, 0x1DB45DC38E0C8261ULL},
+    {0xF15BB96AC8B58575ULL, 0x1290BA9A38C7D17CULL},
+    {0x2DB2A7C57AE2E6D2ULL, 0x1734E940C6F9C5DCULL},
+    {0x391F51B6D99BA086ULL, 0x1D022390F8B83753ULL},
+    {0x03B3931248014454ULL, 0x1221563A9B732294ULL},
+    {0x04A077D6DA019569ULL, 0x16A9ABC9424FEB39ULL},
+    {0x45C895CC9081FAC3ULL, 0x1C5416BB92E3E607ULL},
+    {0x8B9D5D9FDA513CBAULL, 0x11B48E353BCE6FC4ULL},
+    {0xAE84B507D0E58BE8ULL, 0x1621B1C28AC20BB5ULL},
+    {0x1A25E249C51EEEE3ULL, 0x1BAA1E332D728EA3ULL},
+    {0xF057AD6E1B33554DULL, 0x114A52DFFC679925ULL},
+    {0x6C6D98C9A2002AA1ULL, 0x159CE797FB817F6FULL},
+    {0x4788FEFC0A803549ULL, 0x1B04217DFA61DF4BULL},
+    {0x0CB59F5D8690214EULL, 0x10E294EEBC7D2B8FULL},
+    {0xCFE30734E83429A1ULL, 0x151B3A2A6B9C7672ULL},
+    {0x83DBC9022241340AULL, 0x1A6208B50683940FULL},
+    {0xB2695DA15568C086ULL, 0x107D457124123C89ULL},
+    {0x1F03B509AAC2F0A7ULL, 0x149C96CD6D16CBACULL},
+    {0x26C4A24C1573ACD1ULL, 0x19C3BC80C85C7E97ULL},
+    {0x783AE56F8D684C03ULL, 0x101A55D07D39CF1EULL},
+    {0x16499ECB70C25F03ULL, 0x1420EB449C8842E6ULL},
+    {0x9BDC067E4CF2F6C4ULL, 0x19292615C3AA539FULL},
+    {0x82D3081DE02FB476ULL, 0x1F736F9B3494E887ULL},
+    {0xB1C3E512AC1DD0C9ULL, 0x13A825C100DD1154ULL},
+    {0xDE34DE57572544FCULL, 0x18922F31411455A9ULL},
+    {0x55C215ED2CEE963BULL, 0x1EB6BAFD91596B14ULL},
+    {0xB5994DB43C151DE5ULL, 0x133234DE7AD7E2ECULL},
+    {0xE2FFA1214B1A655EULL, 0x17FEC216198DDBA7ULL},
+    {0xDBBF89699DE0FEB6ULL, 0x1DFE729B9FF15291ULL},
+    {0x2957B5E202AC9F31ULL, 0x12BF07A143F6D39BULL},
+    {0xF3ADA35A8357C6FEULL, 0x176EC98994F48881ULL},
+    {0x70990C31242DB8BDULL, 0x1D4A7BEBFA31AAA2ULL},
+    {0x865FA79EB69C9376ULL, 0x124E8D737C5F0AA5ULL},
+    {0xE7F791866443B854ULL, 0x16E230D05B76CD4EULL},
+    {0xA1F575E7FD54A669ULL, 0x1C9ABD04725480A2ULL},
+    {0xA53969B0FE54E801ULL, 0x11E0B622C774D065ULL},
+    {0x0E87C41D3DEA2202ULL, 0x1658E3AB7952047FULL},
+    {0xD229B5248D64AA82ULL, 0x1BEF1C9657A6859EULL},
+    {0x435A1136D85EEA91ULL, 0x117571DDF6C81383ULL},
+    {0x143095848E76A536ULL, 0x15D2CE55747A1864ULL},
+    {0x193CBAE5B2144E83ULL, 0x1B4781EAD1989E7DULL},
+    {0x2FC5F4CF8F4CB112ULL, 0x110CB132C2FF630EULL},
+    {0xBBB77203731FDD56ULL, 0x154FDD7F73BF3BD1ULL},
+    {0x2AA54E844FE7D4ACULL, 0x1AA3D4DF50AF0AC6ULL},
+    {0xDAA75112B1F0E4EBULL, 0x10A6650B926D66BBULL},
+    {0xD15125575E6D1E26ULL, 0x14CFFE4E7708C06AULL},
+    {0x85A56EAD360865B0ULL, 0x1A03FDE214CAF085ULL},
+    {0x7387652C41C53F8EULL, 0x10427EAD4CFED653ULL},
+    {0x50693E7752368F71ULL, 0x14531E58A03E8BE8ULL},
+    {0x64838E1526C4334EULL, 0x1967E5EEC84E2EE2ULL},
+    {0xFDA4719A70754022ULL, 0x1FC1DF6A7A61BA9AULL},
+    {0xDE86C70086494815ULL, 0x13D92BA28C7D14A0ULL},
+    {0x162878C0A7DB9A1AULL, 0x18CF768B2F9C59C9ULL},
+    {0x5BB296F0D1D280A1ULL, 0x1F03542DFB83703BULL},
+    {0x194F9E5683239064ULL, 0x1362149CBD322625ULL},
+    {0x5FA385EC23EC747EULL, 0x183A99C3EC7EAFAEULL},
+    {0xF78C67672CE7919DULL, 0x1E494034E79E5B99ULL},
+    {0x3AB7C0A07C10BB02ULL, 0x12EDC82110C2F940ULL},
+    {0x4965B0C89B14E9C3ULL, 0x17A93A2954F3B790ULL},
+    {0x5BBF1CFAC1DA2433ULL, 0x1D9388B3AA30A574ULL},
+    {0xB957721CB92856A0ULL, 0x127C35704A5E6768ULL},
+    {0xE7AD4EA3E7726C48ULL, 0x171B42CC5CF60142ULL},
+    {0xA198A24CE14F075AULL, 0x1CE2137F74338193ULL},
+    {0x44FF65700CD16498ULL, 0x120D4C2FA8A030FCULL},
+    {0x563F3ECC1005BDBEULL, 0x16909F3B92C83D3BULL},
+    {0x2BCF0E7F14072D2EULL, 0x1C34C70A777A4C8AULL},
+    {0x5B61690F6C847C3DULL, 0x11A0FC668AAC6FD6ULL},
+    {0xF239C35347A59B4CULL, 0x16093B802D578BCBULL},
+    {0xEEC83428198F021FULL, 0x1B8B8A6038AD6EBEULL},
+    {0x553D20990FF96153ULL, 0x1137367C236C6537ULL},
+    {0x2A8C68BF53F7B9A8ULL, 0x1585041B2C477E85ULL},
+    {0x752F82EF28F5A812ULL, 0x1AE64521F7595E26ULL},
+    {0x093DB1D57999890BULL, 0x10CFEB353A97DAD8ULL},
+    {0x0B8D1E4AD7FFEB4EULL, 0x1503E602893DD18EULL},
+    {0x8E7065DD8DFFE622ULL, 0x1A44DF832B8D45F1ULL},
+    {0xF9063FAA78BFEFD5ULL, 0x106B0BB1FB384BB6ULL},
+    {0xB747CF9516EFEBCAULL, 0x1485CE9E7A065EA4ULL},
+    {0xE519C37A5CABE6BDULL, 0x19A742461887F64DULL},
+    {0xAF301A2C79EB7036ULL, 0x1008896BCF54F9F0ULL},
+    {0xDAFC20B798664C43ULL, 0x140AABC6C32A386CULL},
+    {0x11BB28E57E7FDF54ULL, 0x190D56B873F4C688ULL},
+    {0x1629F31EDE1FD72AULL, 0x1F50AC6690F1F82AULL},
+    {0x4DDA37F34AD3E67AULL, 0x13926BC01A973B1AULL},
+    {0xE150C5F01D88E019ULL, 0x187706B0213D09E0ULL},
+    {0x19A4F76C24EB181FULL, 0x1E94C85C298C4C59ULL},
+    {0xB0071AA39712EF13ULL, 0x131CFD3999F7AFB7ULL},
+    {0x9C08E14C7CD7AAD8ULL, 0x17E43C8800759BA5ULL},
+    {0x030B199F9C0D958EULL, 0x1DDD4BAA0093028FULL},
+    {0x61E6F003C1887D79ULL, 0x12AA4F4A405BE199ULL},
+    {0xBA60AC04B1EA9CD7ULL, 0x1754E31CD072D9FFULL},
+    {0xA8F8D705DE65440DULL, 0x1D2A1BE4048F907FULL},
+    {0xC99B8663AAFF4A88ULL, 0x123A516E82D9BA4FULL},
+    {0xBC0267FC95BF1D2AULL, 0x16C8E5CA239028E3ULL},
+    {0xAB0301FBBB2EE474ULL, 0x1C7B1F3CAC74331CULL},
+    {0xEAE1E13D54FD4EC9ULL, 0x11CCF385EBC89FF1ULL},
+    {0x659A598CAA3CA27BULL, 0x1640306766BAC7EEULL},
+    {0xFF00EFEFD4CBCB1AULL, 0x1BD03C81406979E9ULL},
+    {0x3F6095F5E4FF5EF0ULL, 0x116225D0C841EC32ULL},
+    {0xCF38BB735E3F36ACULL, 0x15BAAF44FA52673EULL},
+    {0x8306EA5035CF0457ULL, 0x1B295B1638E7010EULL},
+    {0x11E4527221A162B6ULL, 0x10F9D8EDE39060A9ULL},
+    {0x565D670EAA09BB64ULL, 0x15384F295C7478D3ULL},
+    {0x2BF4C0D2548C2A3DULL, 0x1A8662F3B3919708ULL},
+    {0x1B78F88374D79A66ULL, 0x1093FDD8503AFE65ULL},
+    {0x625736A4520D8100ULL, 0x14B8FD4E6449BDFEULL},
+    {0xFAED044D6690E140ULL, 0x19E73CA1FD5C2D7DULL},
+    {0xBCD422B0601A8CC8ULL, 0x103085E53E599C6EULL},
+    {0x6C092B5C78212FFAULL, 0x143CA75E8DF0038AULL},
+    {0x070B763396297BF8ULL, 0x194BD136316C046DULL},
+    {0x48CE53C07BB3DAF6ULL, 0x1F9EC583BDC70588ULL},
+    {0x2D80F4584D5068DAULL, 0x13C33B72569C6375ULL},
+    {0x78E1316E60A48310ULL, 0x18B40A4EEC437C52ULL},
+};
+
+/* Bit length of 5^e (1 for e == 0), valid for 0 <= e <= 3528 */
+static int32_t pow5_bits(int32_t e)
+{
+    return (int32_t)(((uint32_t)e * 1217359) >> 19) + 1;
+}
+
+/* floor(log10(2^e)) and floor(log10(5^e)) */
+static uint32_t log10_pow2(int32_t e)
+{
+    return ((uint32_t)e * 78913) >> 18;
+}
+
+static uint32_t log10_pow5(int32_t e)
+{
+    return ((uint32_t)e * 732923) >> 20;
+}
+
+static int multiple_of_pow5(uint64_t value, uint32_t p)
+{
+    uint32_t count = 0;
+    while (value % 5 == 0)
+    {
+        value /= 5;
+        count++;
+    }
+    return count >= p;
+}
+
+static int multiple_of_pow2(uint64_t value, uint32_t p)
+{
+    return (value & ((1ULL << p) - 1)) == 0;
+}
+
+/* (m * mul) >> j for the 128-bit multiplier mul and 64 < j < 128 */
+static uint64_t mul_shift64(uint64_t m, const uint64_t *mul, int32_t j)
+{
+    uint64_t high0, low0, high1, low1;
+    multiply_u64(m, mul[0], &high0, &low0);
+    multiply_u64(m, mul[1], &high1, &low1);
+    (void)low0;
+    uint64_t sum = high0 + low1;
+    if (sum < high0)
+    {
+        high1++;
+    }
+    int32_t shift = j - 64;
+    return (sum >> shift) | (high1 << (64 - shift));
+}
+
+static int decimal_length17(uint64_t v)
+{
+    int length = 1;
+    while (v >= 10)
+    {
+        v /= 10;
+        length++;
+    }
+    return length;
+}
+
+/* Shortest decimal mantissa and exponent for a finite, non-zero double */
+static void ryu_d2d(uint64_t ieee_mantissa, uint32_t ieee_exponent,
+                    uint64_t *out_mantissa, int32_t *out_exponent)
+{
+    int32_t e2;
+    uint64_t m2;
+    if (ieee_exponent == 0)
+    {
+        e2 = 1 - 1023 - 52 - 2;
+        m2 = ieee_mantissa;
+    }
+    else
+    {
+        e2 = (int32_t)ieee_exponent - 1023 - 52 - 2;
+        m2 = (1ULL << 52) | ieee_mantissa;
+    }
+    int accept_bounds = (m2 & 1) == 0;
+
+    /* Interval of valid representations: [4*m2 - 1 - mm_shift, 4*m2 + 2] */
+    uint64_t mv = 4 * m2;
+    uint32_t mm_shift = ieee_mantissa != 0 || ieee_exponent <= 1;
+
+    /* Convert to a decimal power base */
+    uint64_t vr, vp, vm;
+    int32_t e10;
+    int vm_trailing_zeros = 0;
+    int vr_trailing_zeros = 0;
+    if (e2 >= 0)
+    {
+        uint32_t q = log10_pow2(e2) - (e2 > 3);
+        e10 = (int32_t)q;
+        int32_t k = RYU_POW5_INV_BITCOUNT + pow5_bits((int32_t)q) - 1;
+        int32_t i = -e2 + (int32_t)q + k;
+        vr = mul_shift64(4 * m2, ryu_pow5_inv_split[q], i);
+        vp = mul_shift64(4 * m2 + 2, ryu_pow5_inv_split[q], i);
+        vm = mul_shift64(4 * m2 - 1 - mm_shift, ryu_pow5_inv_split[q], i);
+        if (q <= 21)
+        {
+            /* Only one of mp, mv and mm can be a multiple of 5 */
+            if (mv % 5 == 0)
+                vr_trailing_zeros = multiple_of_pow5(mv, q);
+            else if (accept_bounds)
+                vm_trailing_zeros = multiple_of_pow5(mv - 1 - mm_shift, q);
+            else
+                vp -= multiple_of_pow5(mv + 2, q);
+        }
+    }
+    else
+    {
+        uint32_t q = log10_pow5(-e2) - (-e2 > 1);
+        e10 = (int32_t)q + e2;
+        int32_t i = -e2 - (int32_t)q;
+        int32_t k = pow5_bits(i) - RYU_POW5_BITCOUNT;
+        int32_t j = (int32_t)q - k;
+        vr = mul_shift64(4 * m2, ryu_pow5_split[i], j);
+        vp = mul_shift64(4 * m2 + 2, ryu_pow5_split[i], j);
+        vm = mul_shift64(4 * m2 - 1 - mm_shift, ryu_pow5_split[i], j);
+        if (q <= 1)
+        {
+            /* mv = 4 * m2 always has at least two trailing zero bits */
+            vr_trailing_zeros = 1;
+            if (accept_bounds)
+                vm_trailing_zeros = mm_shift == 1;
+            else
+                vp--;
+        }
+        else if (q < 63)
+        {
+            vr_trailing_zeros = multiple_of_pow2(mv, q);
+        }
+    }
+
+    /* Remove digits while the interval still contains a shorter number */
+    int32_t removed = 0;
+    uint64_t output;
+    if (vm_trailing_zeros || vr_trailing_zeros)
+    {
+        /* Rare general case */
+        uint32_t last_removed = 0;
+        while (vp / 10 > vm / 10)
+        {
+            vm_trailing_zeros &= vm % 10 == 0;
+            vr_trailing_zeros &= last_removed == 0;
+            last_removed = (uint32_t)(vr % 10);
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        if (vm_trailing_zeros)
+        {
+            while (vm % 10 == 0)
+            {
+                vr_trailing_zeros &= last_removed == 0;
+                last_removed = (uint32_t)(vr % 10);
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                removed++;
+            }
+        }
+        if (vr_trailing_zeros && last_removed == 5 && vr % 2 == 0)
+        {
+            last_removed = 4; /* Exactly halfway: round to even */
+        }
+        output = vr + ((vr == vm && (!accept_bounds || !vm_trailing_zeros)) || last_removed >= 5);
+    }
+    else
+    {
+        /* Common case */
+        int round_up = 0;
+        if (vp / 100 > vm / 100)
+        {
+            round_up = vr % 100 >= 50;
+            vr /= 100;
+            vp /= 100;
+            vm /= 100;
+            removed += 2;
+        }
+        while (vp / 10 > vm / 10)
+        {
+            round_up = vr % 10 >= 5;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        output = vr + (vr == vm || round_up);
+    }
+
+    *out_mantissa = output;
+    *out_exponent = e10 + removed;
+}
+
+/* Write the shortest representation of a finite double that parses back
+   to the same value. Whole numbers below 2^53 are written as integers,
+   other values in plain decimal notation while the decimal point stays
+   within 21 digits, and in exponent notation otherwise. The buffer must
+   hold JSON_NUMBER_SHORTEST_MAX bytes. Returns the length written */
+int json_number_format_shortest(double value, char *buffer)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    int negative = (int)(bits >> 63);
+    uint64_t ieee_mantissa = bits & ((1ULL << 52) - 1);
+    uint32_t ieee_exponent = (uint32_t)((bits >> 52) & 0x7FF);
+    char *p = buffer;
+
+    if (negative)
+    {
+        *p++ = '-';
+    }
+    if (ieee_exponent == 0 && ieee_mantissa == 0)
+    {
+        *p++ = '0';
+        *p = '\0';
+        return (int)(p - buffer);
+    }
+
+    /* Integer fast path */
+    double magnitude = negative ? -value : value;
+    if (magnitude < 9007199254740992.0 && magnitude == (double)(uint64_t)magnitude)
+    {
+        uint64_t integer = (uint64_t)magnitude;
+        char digits[20];
+        int count = 0;
+        do
+        {
+            digits[count++] = (char)('0' + integer % 10);
+            integer /= 10;
+        } while (integer);
+        while (count)
+        {
+            *p++ = digits[--count];
+        }
+        *p = '\0';
+        return (int)(p - buffer);
+    }
+
+    uint64_t mantissa;
+    int32_t exponent;
+    ryu_d2d(ieee_mantissa, ieee_exponent, &mantissa, &exponent);
+
+    char digits[17];
+    int length = decimal_length17(mantissa);
+    for (int i = length - 1; i >= 0; i--)
+    {
+        digits[i] = (char)('0' + mantissa % 10);
+        mantissa /= 10;
+    }
+
+    /* Position of the decimal point relative to the first digit */
+    int32_t point = exponent + length;
+    if (point > 0 && point <= 21)
+    {
+        for (int32_t i = 0; i < point || i < length; i++)
+        {
+            if (i == point)
+                *p++ = '.';
+            *p++ = i < length ? digits[i] : '0';
+        }
+    }
+    else if (point <= 0 && point > -6)
+    {
+        *p++ = '0';
+        *p++ = '.';
+        for (int32_t i = point; i < 0; i++)
+            *p++ = '0';
+        memcpy(p, digits, (size_t)length);
+        p += length;
+    }
+    else
+    {
+        *p++ = digits[0];
+        if (length > 1)
+        {
+            *p++ = '.';
+            memcpy(p, digits + 1, (size_t)length - 1);
+            p += length - 1;
+        }
+        int32_t e = point - 1;
+        *p++ = 'e';
+        if (e < 0)
+        {
+            *p++ = '-';
+            e = -e;
+        }
+        if (e >= 100)
+            *p++ = (char)('0' + e / 100);
+        if (e >= 10)
+            *p++ = (char)('0' + e / 10 % 10);
+        *p++ = (char)('0' + e % 10);
+    }
+    *p = '\0';
+    return (int)(p - buffer);
+}
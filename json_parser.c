@@ -1,17 +1,59 @@
 /* json_parser.c */
-#include "json.h"
+#include "json_internal.h"
 #include <ctype.h>
 #include <math.h>
 
+/* Member stacks of a compact parse. A finished value sits on top of values
+   until its container closes and moves the members into the document as
+   one block */
+typedef struct {
+    JsonValue* values;
+    size_t count;
+    size_t capacity;
+    JsonKeyValue* keys;     /* Key of every member of the open objects */
+    size_t key_count;
+    size_t key_capacity;
+} CompactBuilder;
+
+/* One open array or object. The parser keeps these on a JsonStack instead
+   of recursing, so deep nesting costs heap memory, not C stack */
+typedef struct {
+    JsonType type;
+    JsonValue* container;   /* NULL in compact parses */
+    size_t base;            /* Compact: values count when the container opened */
+    size_t key_base;        /* Compact: key_count when the container opened */
+    char* key;              /* Object: key of the member being parsed, NULL between members */
+    size_t key_length;
+    int key_is_view;
+    int key_is_interned;
+} ParseFrame;
+
+/* Open containers held without touching the heap */
+#define PARSE_STACK_INITIAL JSON_MAX_NESTING_DEPTH
+
 /* parser state structure */
 typedef struct ParserState {
     const char* input; // Current position in input string
     const char* input_start;
+    const char* input_end;
     size_t input_length;
-    size_t line;
-    size_t column;
     size_t nesting_level;
-    JsonError error;
+    JsonArena* arena; // Arena for document parsing, NULL for heap values
+    int zero_copy;    // Return unescaped strings as views into the input
+    JsonError* error; // Caller's error, or this thread's last_error
+    const JsonLazyIndex* lazy; // Skip index of a lazy document, NULL when parsing eagerly
+    size_t lazy_next;          // Span of the next container the input reaches
+    int check_only;            // Grammar only: nothing is allocated or kept
+    JsonValue scratch;         // Stand-in result of every value in check_only mode
+    CompactBuilder* compact;   // Member stacks of a compact document, NULL otherwise
+    JsonKeyTable* keys;        // Intern table for object keys, NULL to give every pair its own
+    size_t max_depth;          // Deepest nesting accepted
+    const JsonSaxHandler* sax; // Events of a check_only parse, NULL for none
+    void* sax_user_data;
+    size_t sax_skip;           // Nesting level of the container being skipped, 0 for none
+    int sax_stopped;           // A handler asked to stop
+    char* sax_buffer;          // Decoded escaped strings, reused for every one of them
+    size_t sax_capacity;
 } ParserState;
 
 /* Convert a hex character to its integer value */
@@ -24,47 +66,92 @@ static int hex_char_to_int(char c) {
 
 
 
-/* Global error state */
-static JsonError last_error;
+/* Parse configurations */
+const JsonParseConfig JSON_PARSE_DEFAULT = {
+    .zero_copy_strings = 0,
+};
+
+const JsonParseConfig JSON_PARSE_ZERO_COPY = {
+    .zero_copy_strings = 1,
+};
+
+const JsonParseConfig JSON_PARSE_TAPE = {
+    .zero_copy_strings = 0,
+    .engine = JSON_PARSE_ENGINE_TAPE,
+};
+
+const JsonParseConfig JSON_PARSE_LAZY = {
+    .zero_copy_strings = 0,
+    .lazy = 1,
+};
 
-/* Get the last error that occured */
+const JsonParseConfig JSON_PARSE_COMPACT = {
+    .zero_copy_strings = 0,
+    .compact = 1,
+};
+
+/* Error state of the legacy API, one per thread */
+static JSON_THREAD_LOCAL JsonError last_error;
+
+/* Process-wide, like the scanner level: set it before starting threads */
+static size_t default_max_depth = JSON_MAX_NESTING_DEPTH;
+
+void json_set_max_depth(size_t max_depth) {
+    default_max_depth = max_depth ? max_depth : JSON_MAX_NESTING_DEPTH;
+}
+
+size_t json_get_max_depth(void) {
+    return default_max_depth;
+}
+
+size_t json_resolve_max_depth(size_t max_depth) {
+    return max_depth ? max_depth : default_max_depth;
+}
+
+/* Get the last error that occured on this thread */
 const JsonError* json_get_last_error(void) {
     return &last_error;
 }
 /* Initialise parse state */
-static ParserState parser_state_create(const char* input) {
+static ParserState parser_state_create(const char* input, size_t length, JsonError* error) {
     ParserState state = {
         .input = input,
         .input_start = input,
-        .input_length = strlen(input),
-        .line = 1,
-        .column = 1,
+        .input_end = input + length,
+        .input_length = length,
         .nesting_level = 0,
+        .arena = NULL,
+        .zero_copy = 0,
+        .error = error,
+        .lazy = NULL,
+        .lazy_next = 0,
+        .check_only = 0,
+        .compact = NULL,
+        .keys = NULL,
+        .max_depth = default_max_depth,
+        .sax = NULL,
+        .sax_user_data = NULL,
+        .sax_skip = 0,
+        .sax_stopped = 0,
+        .sax_buffer = NULL,
+        .sax_capacity = 0,
     };
 
-    /* Initialise error structure */
-    state.error.code = JSON_ERROR_NONE;
-    state.error.line = 0;
-    state.error.column = 0;
-    state.error.message[0] = '\0';
-    state.error.context[0] = '\0';
-
-    /* Reset global error state */
-    memcpy(&last_error, &state.error, sizeof(JsonError));
-
+    json_error_clear(error);
     return state;
 }
 
-/* Set error information and update global error state */
+/* Record the first error of a parse */
 static void set_parser_error(ParserState* state, JsonErrorCode code, const char* message) {
-    if (state->error.code != JSON_ERROR_NONE) {
+    if (state->error->code != JSON_ERROR_NONE) {
         return; /* Only record the first error */
     }
 
-    state->error.code = code;
-    state->error.line = state->line;
-    state->error.column = state->column;
-    strncpy(state->error.message, message, sizeof(state->error.message) -1);
+    state->error->code = code;
+    /* Line and column are only needed here, so derive them from the offset */
+    json_text_position(state->input_start, state->input, &state->error->line, &state->error->column);
+    strncpy(state->error->message, message, sizeof(state->error->message) -1);
+    state->error->message[sizeof(state->error->message) - 1] = '\0';
 
     /* Capture context around the error location */
     const char* context_start = state->input - 20;
@@ -80,40 +167,190 @@ static void set_parser_error(ParserState* state, JsonErrorCode code, const char*
     /* copy context with ellipsis */
     size_t prefix_len = 0;
     if (context_start > state->input_start) {
-        strcpy(state->error.context, "...");
+        strcpy(state->error->context, "...");
         prefix_len = 3;
     }
 
-    strncpy(state->error.context + prefix_len, context_start, sizeof(state->error.context) - prefix_len - 4);
+    /* The input is not necessarily NUL terminated, copy at most up to its end */
+    size_t copy_length = sizeof(state->error->context) - prefix_len - 4;
+    if (copy_length > (size_t)(state->input_end - context_start)) {
+        copy_length = (size_t)(state->input_end - context_start);
+    }
+    memcpy(state->error->context + prefix_len, context_start, copy_length);
+    state->error->context[prefix_len + copy_length] = '\0';
 
     if (context_start + context_length < state->input_start + state->input_length) {
-        strcat(state->error.context, "...");
+        strcat(state->error->context, "...");
     }
 
-    /* Update global error state */
-    memcpy(&last_error, &state->error, sizeof(JsonError));
+}
+
+/* Current character, or '\0' at the end of the input */
+static char current_char(const ParserState* state) {
+    return state->input < state->input_end ? *state->input : '\0';
+}
 
+/* Check for a literal such as "true" at the current position */
+static int match_literal(const ParserState* state, const char* literal, size_t length) {
+    return (size_t)(state->input_end - state->input) >= length &&
+           memcmp(state->input, literal, length) == 0;
 }
 
 /* Helper function to skup whitespace */
 static void skip_whitespace(ParserState* state) {
-    while (isspace(*state->input)) {
-        if (*state->input == '\n') {
-            state->line++;
-            state->column = 1;
-        } else {
-            state->column++;
+    state->input = json_skip_whitespace(state->input, state->input_end);
+}
+
+/* New slot on top of the member stack of a compact parse */
+static JsonValue* make_compact_value(ParserState* state, JsonType type) {
+    CompactBuilder* compact = state->compact;
+    if (compact->count == compact->capacity) {
+        size_t capacity = compact->capacity ? compact->capacity * 2 : 256;
+        JsonValue* values = (JsonValue*)json_heap_realloc(compact->values, capacity * sizeof(JsonValue));
+        if (!values) {
+            return NULL;
         }
-        state->input++;
+        compact->values = values;
+        compact->capacity = capacity;
+    }
+
+    JsonValue* value = &compact->values[compact->count++];
+    memset(&value->value, 0, sizeof(value->value));
+    value->length = 0;
+    value->type = type;
+    value->flags = JSON_VALUE_ARENA;
+    JSON_STATS_ADD(nodes, 1);
+    return value;
+}
+
+/* Close an array. A compact array's elements move into one block of the
+   document, and the array takes their place on the member stack */
+static JsonValue* finish_array(ParserState* state, const ParseFrame* frame) {
+    CompactBuilder* compact = state->compact;
+    if (!compact) {
+        return frame->container;
+    }
+
+    size_t base = frame->base;
+    size_t count = compact->count - base;
+
+    JsonArray* final = (JsonArray*)json_arena_alloc(state->arena, sizeof(JsonArray));
+    JsonValue* elements = count ? (JsonValue*)json_arena_alloc(state->arena, count * sizeof(JsonValue)) : NULL;
+    JsonValue** items = count ? (JsonValue**)json_arena_alloc(state->arena, count * sizeof(JsonValue*)) : NULL;
+    if (!final || (count && (!elements || !items))) {
+        set_parser_error(state, JSON_ERROR_MEMORY_ALLOCATION, "Failed to append element to array");
+        return NULL;
+    }
+
+    if (count) {
+        memcpy(elements, compact->values + base, count * sizeof(JsonValue));
+    }
+    for (size_t i = 0; i < count; i++) {
+        items[i] = &elements[i];
+    }
+    final->items = items;
+    final->size = count;
+    final->capacity = count;
+    final->arena = state->arena;
+    final->elements = elements;
+
+    compact->count = base;
+    JsonValue* array = make_compact_value(state, JSON_ARRAY);
+    if (!array) {
+        set_parser_error(state, JSON_ERROR_MEMORY_ALLOCATION, "Failed to create array");
+        return NULL;
+    }
+    array->value.array = final;
+    return array;
+}
+
+/* Close an object. A compact object's pairs and values move into two
+   adjacent blocks */
+static JsonValue* finish_object(ParserState* state, const ParseFrame* frame) {
+    CompactBuilder* compact = state->compact;
+    if (!compact) {
+        return frame->container;
+    }
+
+    size_t base = frame->base;
+    size_t key_base = frame->key_base;
+    size_t count = compact->count - base;
+
+    JsonObject* final = (JsonObject*)json_arena_alloc(state->arena, sizeof(JsonObject));
+    JsonKeyValue* pairs = count ? (JsonKeyValue*)json_arena_alloc(state->arena, count * sizeof(JsonKeyValue)) : NULL;
+    JsonValue* values = count ? (JsonValue*)json_arena_alloc(state->arena, count * sizeof(JsonValue)) : NULL;
+    if (!final || (count && (!pairs || !values))) {
+        set_parser_error(state, JSON_ERROR_MEMORY_ALLOCATION, "Failed to add key-value pair to object");
+        return NULL;
+    }
+
+    memset(final, 0, sizeof(*final));
+    final->arena = state->arena;
+    if (count) {
+        memcpy(values, compact->values + base, count * sizeof(JsonValue));
+        memcpy(pairs, compact->keys + key_base, count * sizeof(JsonKeyValue));
+    }
+    for (size_t i = 0; i < count; i++) {
+        pairs[i].value = &values[i];
+    }
+    if (!json_object_adopt_pairs(final, pairs, count)) {
+        set_parser_error(state, JSON_ERROR_MEMORY_ALLOCATION, "Failed to add key-value pair to object");
+        return NULL;
+    }
+
+    /* Duplicate keys leave gaps; close them so pair i owns values[i]. A
+       pair's value never sits before its own slot, so this reads each slot
+       before overwriting it */
+    size_t i = 0;
+    for (JsonKeyValue* pair = final->pairs; pair; pair = pair->next, i++) {
+        values[i] = *pair->value;
+        pair->value = &values[i];
+    }
+
+    compact->count = base;
+    compact->key_count = key_base;
+    JsonValue* object = make_compact_value(state, JSON_OBJECT);
+    if (!object) {
+        set_parser_error(state, JSON_ERROR_MEMORY_ALLOCATION, "Failes to create object");
+        return NULL;
     }
+    object->value.object = final;
+    return object;
 }
 
-/* Forward declarations for recursive descent parser */
-static JsonValue* parse_value(ParserState* state);
-static JsonValue* parse_string(ParserState* state);
-static JsonValue* parse_number(ParserState* state);
-static JsonValue* parse_array(ParserState* state);
-static JsonValue* parse_object(ParserState* state);
+/* Remember the key of the member whose value is on top of the stack */
+static int push_compact_key(ParserState* state, char* key, size_t key_length, uint32_t flags) {
+    CompactBuilder* compact = state->compact;
+    if (compact->key_count == compact->key_capacity) {
+        size_t capacity = compact->key_capacity ? compact->key_capacity * 2 : 64;
+        JsonKeyValue* keys = (JsonKeyValue*)json_heap_realloc(compact->keys, capacity * sizeof(JsonKeyValue));
+        if (!keys) {
+            return 0;
+        }
+        compact->keys = keys;
+        compact->key_capacity = capacity;
+    }
+    JsonKeyValue* entry = &compact->keys[compact->key_count++];
+    entry->key = key;
+    entry->key_length = key_length;
+    entry->flags = flags;
+    return 1;
+}
+
+/* New node for the value being parsed. When only checking, every value
+   shares the scratch node, which json_free() leaves alone */
+static JsonValue* make_value(ParserState* state, JsonType type) {
+    if (state->compact) {
+        return make_compact_value(state, type);
+    }
+    if (state->check_only) {
+        memset(&state->scratch, 0, sizeof(state->scratch));
+        state->scratch.type = type;
+        state->scratch.flags = JSON_VALUE_ARENA;
+        return &state->scratch;
+    }
+    return json_value_alloc(state->arena, type);
+}
 
 /* Convert a 4-digit hex sequence to a Unicode code point */
 static int parse_unicode_escape(ParserState* state, uint32_t* code_point) {
@@ -162,7 +399,6 @@ static size_t unicode_to_utf8(uint32_t code_point, char* output) {
 static size_t process_escape_sequence(ParserState* state, char* output) {
     char c = *state->input;
     state->input++;
-    state->column++;
 
     switch (c) {
         case '"':  output[0] = '"';  return 1;
@@ -183,7 +419,6 @@ static size_t process_escape_sequence(ParserState* state, char* output) {
             if (code_point >= 0xD800 && code_point <= 0xDBFF) {
                 /* This is a high surrogate, must be followed by low surrogate */
                 state->input += 4; /* Skip the 4 hex digits we just read */
-                state->column += 4;
                 
                 if (state->input[0] != '\\' || state->input[1] != 'u') {
                     set_parser_error(state, JSON_ERROR_INVALID_UNICODE,
@@ -192,7 +427,6 @@ static size_t process_escape_sequence(ParserState* state, char* output) {
                 }
                 
                 state->input += 2; /* Skip the \u */
-                state->column += 2;
                 
                 uint32_t low_surrogate;
                 if (!parse_unicode_escape(state, &low_surrogate)) {
@@ -209,13 +443,15 @@ static size_t process_escape_sequence(ParserState* state, char* output) {
                 code_point = 0x10000 + (((code_point - 0xD800) << 10) |
                                       (low_surrogate - 0xDC00));
                 state->input += 4;
-                state->column += 4;
             }
             else if (code_point >= 0xDC00 && code_point <= 0xDFFF) {
                 set_parser_error(state, JSON_ERROR_INVALID_UNICODE,
                                "Unexpected low surrogate");
                 return 0;
             }
+            else {
+                state->input += 4; /* Skip the 4 hex digits */
+            }
             
             size_t utf8_len = unicode_to_utf8(code_point, output);
             if (utf8_len == 0) {
@@ -235,411 +471,277 @@ static size_t process_escape_sequence(ParserState* state, char* output) {
     }
 }
 
-/* Parse a string value */
-static JsonValue* parse_string(ParserState* state) {
-    if (*state->input != '"') {
-        set_parser_error(state, JSON_ERROR_UNEXPECTED_CHAR, "Exoected '\"' at start of string");
+/* Release a string buffer that was allocated by parse_string_contents */
+static void release_string(ParserState* state, char* str, int is_view) {
+    if (!state->arena && !state->check_only && !is_view) {
+        json_heap_free(str);
+    }
+}
+
+/* Buffer for the decoded string of a SAX event, grown to the longest one */
+static char* sax_string_buffer(ParserState* state, size_t size) {
+    if (size > state->sax_capacity) {
+        size_t capacity = state->sax_capacity ? state->sax_capacity : 256;
+        while (capacity < size) {
+            capacity *= 2;
+        }
+        char* buffer = (char*)json_heap_realloc(state->sax_buffer, capacity);
+        if (!buffer) {
+            return NULL;
+        }
+        state->sax_buffer = buffer;
+        state->sax_capacity = capacity;
+    }
+    return state->sax_buffer;
+}
+
+/* Parse a quoted string. Strings without escapes are found in one pass and
+   either copied once or, in zero-copy mode, returned as a view into the
+   input. Escaped strings are decoded into a buffer sized from their encoded
+   length, which escapes never expand. The byte length goes to *length.
+   With want_view set, strings without escapes are always returned as views */
+static char* parse_string_contents(ParserState* state, size_t* length, int* is_view, int want_view) {
+    if (current_char(state) != '"') {
+        set_parser_error(state, JSON_ERROR_UNEXPECTED_CHAR, JSON_MESSAGE_EXPECTED_STRING_START);
         return NULL;
     }
     state->input++; // Skip opening quote
-    state->column++;
-/* First pass: count the maximum possible length needed */
-    const char* scan = state->input;
-    size_t max_length = 0;
-    
-    while (*scan && *scan != '"') {
-        if (*scan == '\\') {
-            scan++;
-            if (!*scan) break;
-            if (*scan == 'u') {
-                /* Unicode escapes can expand to up to 4 bytes in UTF-8 */
-                max_length += 4;
-                scan += 4; /* Skip the 4 hex digits */
-            } else {
-                max_length++;
+    *is_view = 0;
+
+    /* Fast path: find the end of the leading run of plain characters */
+    const char* start = state->input;
+    const char* scan = json_scan_string(start, state->input_end);
+
+    if (scan < state->input_end && *scan == '"') {
+        size_t span = (size_t)(scan - start);
+        state->input = scan + 1; /* Skip closing quote */
+        *length = span;
+
+        /* Heap trees copy short strings into their node or pair */
+        if (want_view || state->zero_copy || state->check_only ||
+            (!state->arena && span <= JSON_INLINE_STRING_MAX)) {
+            *is_view = 1;
+            return (char*)start;
+        }
+
+        char* str = json_string_alloc(state->arena, span);
+        if (!str) {
+            set_parser_error(state, JSON_ERROR_MEMORY_ALLOCATION,
+                            "Failed to allocate memory for string");
+            return NULL;
+        }
+        memcpy(str, start, span);
+        str[span] = '\0';
+        return str;
+    }
+
+    /* Escapes present: locate the closing quote to size the buffer */
+    const char* end = scan;
+    while (end < state->input_end && *end != '"') {
+        if (*end == '\\') {
+            if (end + 1 >= state->input_end) {
+                end = state->input_end;
+                break;
             }
-        } else if ((unsigned char)*scan < 0x20) {
+            end += 2;
+        } else if ((unsigned char)*end < 0x20) {
+            state->input = end;
             set_parser_error(state, JSON_ERROR_INVALID_STRING_CHAR,
                            "Invalid control character in string");
             return NULL;
-        } else {
-            max_length++;
         }
-        scan++;
+        end = json_scan_string(end, state->input_end);
     }
-    
-    if (*scan != '"') {
+
+    if (end >= state->input_end) {
         set_parser_error(state, JSON_ERROR_UNTERMINATED_STRING,
                         "Unterminated string");
         return NULL;
     }
-    
-    /* Allocate buffer for the string */
-    char* str = (char*)malloc(max_length + 1);
+
+    int sax_decode = state->sax && !state->sax_skip;
+    if (state->check_only && !sax_decode) {
+        /* Decode each escape into scratch space and drop the result */
+        state->input = scan;
+        while (current_char(state) != '"') {
+            if (current_char(state) == '\\') {
+                char decoded[4];
+                state->input++;
+                if (process_escape_sequence(state, decoded) == 0) {
+                    return NULL;
+                }
+            } else {
+                state->input = json_scan_string(state->input, end);
+            }
+        }
+        state->input++;
+        *length = 0;
+        *is_view = 1;
+        return (char*)start;
+    }
+
+    /* Allocate buffer for the string; SAX events reuse one */
+    size_t max_length = (size_t)(end - start);
+    char* str = sax_decode ? sax_string_buffer(state, max_length + 1) : json_string_alloc(state->arena, max_length);
     if (!str) {
         set_parser_error(state, JSON_ERROR_MEMORY_ALLOCATION,
                         "Failed to allocate memory for string");
         return NULL;
     }
-    
-    /* Second pass: process the string and handle escapes */
-    size_t pos = 0;
-    while (*state->input != '"') {
-        if (*state->input == '\\') {
+
+    /* Copy the plain prefix, then decode the rest */
+    size_t pos = (size_t)(scan - start);
+    memcpy(str, start, pos);
+    state->input = scan;
+
+    while (current_char(state) != '"') {
+        if (current_char(state) == '\\') {
             state->input++; /* Skip the backslash */
-            state->column++;
             size_t escape_len = process_escape_sequence(state, &str[pos]);
             if (escape_len == 0) {
-                free(str);
+                release_string(state, str, 0);
                 return NULL;
             }
             pos += escape_len;
         } else {
-            str[pos++] = *state->input++;
-            state->column++;
+            /* Copy the run up to the next escape or the closing quote */
+            const char* run = json_scan_string(state->input, end);
+            size_t run_length = (size_t)(run - state->input);
+            memcpy(str + pos, state->input, run_length);
+            pos += run_length;
+            state->input = run;
         }
     }
-    
+
     str[pos] = '\0';
     state->input++; /* Skip closing quote */
-    state->column++;
-    
-    JsonValue* value = json_create_string(str);
-    if (!value) {
-        set_parser_error(state, JSON_ERROR_MEMORY_ALLOCATION,
-                        "Failed to create JSON string value");
-        free(str);
-        return NULL;
+    *length = pos;
+
+    if (state->arena) {
+        /* Hand back the space reserved for escapes that did not expand */
+        json_arena_shrink(state->arena, str, max_length + 1, pos + 1);
     }
-    
-    free(str); /* json_create_string makes its own copy */
-    return value;
+    return str;
 }
 
-/* Parse a number value */
-static JsonValue* parse_number(ParserState* state) {
-   const char* start = state->input;
-
-   // Handle negative numbers 
-   if (*state->input == '-') {
-    state->input++;
-    state->column++;
-    if (!isdigit(*state->input)) {
-        set_parser_error(state, JSON_ERROR_INVALID_NUMBER, "Expected a digit after minus sign");
+/* Parse a string value */
+static JsonValue* parse_string(ParserState* state) {
+    size_t length;
+    int is_view;
+    char* str = parse_string_contents(state, &length, &is_view, 0);
+    if (!str) {
         return NULL;
     }
-   }
 
-   // Parst integer part
-   if (*state->input == '0') {
-    state->input++;
-    state->column++;
-    if (isdigit(*state->input)) {
-        set_parser_error(state, JSON_ERROR_INVALID_NUMBER, "Leading zeros are not allowed");
-        return NULL;
-    }
-   } else if (isdigit(*state->input)) {
-        while(isdigit(*state->input)) {
-            state->input++;
-            state->column++;
+    if (is_view && !state->arena && !state->check_only) {
+        JsonValue* value = json_create_string_length(str, length);
+        if (!value) {
+            set_parser_error(state, JSON_ERROR_MEMORY_ALLOCATION,
+                            "Failed to create JSON string value");
         }
-   } else {
-        set_parser_error(state, JSON_ERROR_INVALID_NUMBER, "Expected a digit");
-        return NULL;
-   }
+        return value;
+    }
 
-   // Parse fractional input
-   if (*state->input == '.') {
-    state->input++;
-    state->column++;
-    if (!isdigit(*state->input)) {
-        set_parser_error(state, JSON_ERROR_INVALID_NUMBER, "Expected digit after decimal point");
+    /* The value adopts the decoded buffer (or view) rather than copying it */
+    JsonValue* value = make_value(state, JSON_STRING);
+    if (!value) {
+        set_parser_error(state, JSON_ERROR_MEMORY_ALLOCATION,
+                        "Failed to create JSON string value");
+        release_string(state, str, is_view);
         return NULL;
     }
-    while (isdigit(*state->input)) {
-        state->input++;
-        state->column++;
-    }
-   }
-
-   // Handle scientific notation
-   if (*state->input == 'e' || *state->input == 'E') {
-    state->input++;
-    state->column++;
 
-    // Handle options plus or minius sign in exponent
-    if (*state->input == '+' || *state->input == '-') {
-        state->input++;
-        state->column++;
+    value->value.string = str;
+    value->length = length;
+    if (is_view) {
+        value->flags |= JSON_VALUE_VIEW;
     }
+    return value;
+}
 
-    // Must have at least one digit in exponent
-    if (!isdigit(*state->input)) {
-        set_parser_error(state, JSON_ERROR_INVALID_NUMBER, "Expected digit in exponent");
+/* Parse a number value */
+static JsonValue* parse_number(ParserState* state) {
+    JsonNumberParse number;
+    if (!json_number_parse(state->input, state->input_end, &number)) {
+        state->input = number.end;
+        set_parser_error(state, number.error, number.message);
         return NULL;
     }
-    while (isdigit(*state->input)) {
-        state->input++;
-        state->column++;
-    }
-
-   }
-
-   // Convert the accumulated string to a number
-   char* number_str = (char*)malloc(state->input - start + 1);
-   if (!number_str) {
-    set_parser_error(state, JSON_ERROR_MEMORY_ALLOCATION, "Failed to allocate memory for number conversion");
-    return NULL;
-   }
+    state->input = number.end;
 
-   strncpy(number_str, start, state->input - start);
-   number_str[state->input - start] = '\0';
-  
-    double number = atof(number_str);
-    free(number_str);
-
-        // Check for NaN/Infinity
-    if (isnan(number)) {
+    /* Check for NaN/Infinity */
+    if (isnan(number.number)) {
         set_parser_error(state, JSON_ERROR_INVALID_NUMBER_NAN,
                         "NaN values are not allowed in JSON");
         return NULL;
     }
-    
-    if (isinf(number)) {
+
+    if (isinf(number.number)) {
         set_parser_error(state, JSON_ERROR_INVALID_NUMBER_INFINITY,
                         "Infinity values are not allowed in JSON");
         return NULL;
     }
 
-   JsonValue* value = json_create_number(number);
-   if (!value) {
-    set_parser_error(state, JSON_ERROR_MEMORY_ALLOCATION, "Failed to create JSON number value");
-    return NULL;
-   }
-
-   return value;
-}
-
-/* Parse an array */
-static JsonValue* parse_array(ParserState* state) {
-    if (*state->input != '[') {
-        set_parser_error(state, JSON_ERROR_UNEXPECTED_CHAR, "Expected '[' at start of array");
+    JsonValue* value = make_value(state, JSON_NUMBER);
+    if (!value) {
+        set_parser_error(state, JSON_ERROR_MEMORY_ALLOCATION, "Failed to create JSON number value");
         return NULL;
     }
 
-    /* Check nesting level before proceeding */
-    if (state->nesting_level >= JSON_MAX_NESTING_DEPTH) {
-        set_parser_error(state, JSON_ERROR_MAXIMUM_NESTING_REACHED, "Maximum nesting depth exceeded");
-        return NULL;
+    value->value.number = number.number;
+    if (number.is_integer) {
+        value->flags |= JSON_VALUE_INTEGER;
+        value->integer = number.integer;
     }
+    return value;
+}
 
-    state->nesting_level++;
-    state->input++; // Skip opening bracket
-    state->column++;
-
-    JsonValue* array = json_create_array();
-    if (!array) {
-        set_parser_error(state, JSON_ERROR_MEMORY_ALLOCATION, "Failed to create array");
-        return NULL;
+/* Add a parsed member. Compact objects collect their members on the stack,
+   interned keys are shared, heap objects copy short plain keys into the
+   pair, everything else takes ownership of the key */
+static int add_member(ParserState* state, JsonValue* object, char* key, size_t key_length,
+                      int key_is_view, int key_is_interned, JsonValue* value) {
+    if (state->compact) {
+        return push_compact_key(state, key, key_length, key_is_interned ? JSON_KEY_INTERNED : 0);
     }
-
-    skip_whitespace(state);
-
-    // Handle empty array 
-    if (*state->input == ']') {
-        state->input++;
-        state->column++;
-        state->nesting_level--; // Decrement nesting level
-        return array;
+    if (key_is_interned) {
+        return json_object_set_interned(object, key, value);
     }
-
-    // Parse array elements
-    while (1)
-    {
-        JsonValue* element = parse_value(state);
-        if (!element) {
-            state->nesting_level--; // Decrement on error
-            json_free(array);
-            return NULL;
-        }
-
-         // The problem is likely here - we might be keeping a reference 
-        // to the element after appending it
-        if (!json_array_append(array, element)) {
-            set_parser_error(state, JSON_ERROR_MEMORY_ALLOCATION,
-                           "Failed to append element to array");
-            json_free(element);  // We might be double-freeing here
-            json_free(array);
-            return NULL;
-        }
-
-        skip_whitespace(state);
-
-        // Check for end of array
-
-        if (*state->input == ']') {
-            state->input++; // move past closing bracket
-            state->column++;
-            state->nesting_level--;
-            return array; //  Successfully parsed array
-        }
-
-        // If not the end we must see a comma
-        if (*state->input != ',') {
-            state->nesting_level--;
-            set_parser_error(state, JSON_ERROR_EXPECTED_COMMA_OR_BRACKET, "Expected ',' or ']' after array element");
-            json_free(array);
-            return NULL;
-        }
-
-        state->input++; // Skip comma
-        state->column++;
-
-        skip_whitespace(state);
-
-        // Check for trailing comma (not allowed in JSON)
-        if (*state->input == ']') {
-            state->nesting_level--;
-            set_parser_error(state, JSON_ERROR_UNEXPECTED_CHAR, "Trailing comma not allowed in array");
-            json_free(array);
-            return NULL;
-        }
+    if (key_is_view && !state->arena) {
+        return json_object_set_length(object, key, key_length, value);
     }
-    
+    return json_object_set_owned_key(object, key, key_length, value);
 }
 
-/* Parse an object */
-static JsonValue* parse_object(ParserState* state) {
-    if (*state->input != '{') {
-        set_parser_error(state, JSON_ERROR_UNEXPECTED_CHAR, "Expected '{' at start of object");
-        return NULL;
-    }
-
-    /* Check nesting level befor proceeding */
-    if (state->nesting_level >= JSON_MAX_NESTING_DEPTH) {
-        set_parser_error(state, JSON_ERROR_MAXIMUM_NESTING_REACHED, "Maximum nesting depth exceeded");
-        return NULL;
-    }
-
-    state->nesting_level++;
-    state->input++;
-    state->column++;
+/* In a lazy document a nested container only gets a placeholder node. Its
+   span was recorded by the validator, so the input jumps straight past it
+   and json_lazy_expand() builds the members when they are first needed */
+static JsonValue* parse_lazy_container(ParserState* state, JsonType type) {
+    size_t span = state->lazy_next;
+    const JsonLazySpan* entry = &state->lazy->spans[span];
 
-    JsonValue* object = json_create_object();
-    if (!object) {
-        state->nesting_level--;
-        set_parser_error(state, JSON_ERROR_MEMORY_ALLOCATION, "Failes to create object");
+    JsonValue* value = make_value(state, type);
+    if (!value) {
+        set_parser_error(state, JSON_ERROR_MEMORY_ALLOCATION, "Failed to create lazy container");
         return NULL;
     }
+    value->flags |= JSON_VALUE_LAZY;
+    value->length = span;
 
-    skip_whitespace(state);
-
-    // Handle empty object
-    if (*state->input == '}') {
-        state->input++;
-        state->column++;
-        return object;
-    }
-
-    // Parse object members
-    while (1) {
-        // Each key must be a string
-        skip_whitespace(state); // I think this is redundant TODO:
-        
-        // Parse key (must be a string)
-        JsonValue* key_value = parse_string(state);
-        if (!key_value) {
-            json_free(object);
-            return NULL;
-        }
-
-        // Make a copy of the key string
-        char* key = strdup(key_value->value.string);
-        json_free(key_value); // We don't need the JsonValue wrapper anymore
-
-        if (!key) {
-            set_parser_error(state, JSON_ERROR_MEMORY_ALLOCATION, "Failed to allocate memory for object key");
-            json_free(object);
-            return NULL;
-        }
-
-        skip_whitespace(state);
-
-        // Expect colon
-        if (*state->input != ':') {
-            set_parser_error(state, JSON_ERROR_EXPECTED_COLON, "Expected ':' after object key");
-            free(key);
-            json_free(object);
-            return NULL;
-        }
-
-        state->input++; //skip colon
-        state->column++;
-
-        skip_whitespace(state);
-
-        // Parse value
-        JsonValue* value = parse_value(state);
-        if (!value) {
-            free(key);
-            json_free(object);
-            return NULL;
-        }
-
-        // Add key-value pair to object
-        if (!json_object_set(object, key, value)) {
-            set_parser_error(state, JSON_ERROR_MEMORY_ALLOCATION, "Failed to add key-value pair to object");
-            free(key);
-            json_free(value);
-            json_free(object);
-            return NULL;
-        }
-
-        free(key);
-        skip_whitespace(state);
-
-        // Check for the end of object
-        if (*state->input == '}') {
-            state->input++;
-            state->column++;
-            return object;
-        }
-
-        if (*state->input != ',') {
-            set_parser_error(state, JSON_ERROR_EXPECTED_COMMA_OR_BRACE, "Expected ',' or '}' after object value");
-            json_free(object);
-            return NULL;
-        }
-
-        state->input++;
-        state->column++;
-
-        // skip whitespace after comma
-        skip_whitespace(state);
-
-        // Check for trailing comma (not allowed in JSON)
-        if (*state->input == '}') {
-            set_parser_error(state, JSON_ERROR_UNEXPECTED_CHAR, "Expected string after comma, got '}'");
-            json_free(object);
-            return NULL;
-        }
-    }
+    state->input = state->input_start + entry->end;
+    state->lazy_next = span + 1 + entry->descendants;
+    return value;
 }
 
-/* Parse any JSON value */
-static JsonValue* parse_value(ParserState* state) {
-    skip_whitespace(state);
-
-    // Store the startin position for error context
-    // const char* start_pos = state->input;
-
-    switch (*state->input)
+/* Parse a value that needs no frame: a scalar, or the placeholder of a
+   lazy container */
+static JsonValue* parse_scalar(ParserState* state) {
+    switch (current_char(state))
     {
     case 'n':   // null
-        if (strncmp(state->input, "null", 4) == 0) {
+        if (match_literal(state, "null", 4)) {
             state->input += 4;
-            state->column += 4;
-            JsonValue* value = json_create_null();
+            JsonValue* value = make_value(state, JSON_NULL);
             if (!value) {
                 set_parser_error(state, JSON_ERROR_MEMORY_ALLOCATION, "Failed to create null value");
                 return NULL;
@@ -652,24 +754,23 @@ static JsonValue* parse_value(ParserState* state) {
         return NULL;
 
     case 't': // true
-        if (strncmp(state->input, "true", 4) == 0) {
+        if (match_literal(state, "true", 4)) {
             state->input += 4;
-            state->column += 4;
-            JsonValue* value = json_create_boolean(1);
+            JsonValue* value = make_value(state, JSON_BOOLEAN);
             if (!value) {
                 set_parser_error(state, JSON_ERROR_MEMORY_ALLOCATION, "Failed to create boolean value");
                 return NULL;
             }
+            value->value.boolean = 1;
             return value;
         }
         set_parser_error(state, JSON_ERROR_INVALID_VALUE, "Invalid token: expected 'true'");
         return NULL;
     
     case 'f': // false
-        if (strncmp(state->input, "false", 5) == 0) {
+        if (match_literal(state, "false", 5)) {
             state->input += 5;
-            state->column += 5;
-            JsonValue* value = json_create_boolean(0);
+            JsonValue* value = make_value(state, JSON_BOOLEAN);
             if (!value) {
                 set_parser_error(state, JSON_ERROR_MEMORY_ALLOCATION, "Failed to create boolean value");
                 return NULL;
@@ -683,10 +784,10 @@ static JsonValue* parse_value(ParserState* state) {
         return parse_string(state);
     
     case '[':
-        return parse_array(state);
+        return parse_lazy_container(state, JSON_ARRAY);
 
     case '{':
-        return parse_object(state);
+        return parse_lazy_container(state, JSON_OBJECT);
 
     case '-':
     case '0':
@@ -707,10 +808,11 @@ static JsonValue* parse_value(ParserState* state) {
     default:
         {
             char message[100];
-            if (isprint(*state->input)) {
-                snprintf(message, sizeof(message), "Unexpected character '%c' at start of value", *state->input);
+            unsigned char c = (unsigned char)current_char(state);
+            if (isprint(c)) {
+                snprintf(message, sizeof(message), "Unexpected character '%c' at start of value", c);
             } else {
-                snprintf(message, sizeof(message), "Unexpected character (code: %d) at start of value", (unsigned char)*state->input);
+                snprintf(message, sizeof(message), "Unexpected character (code: %d) at start of value", c);
             }
             set_parser_error(state, JSON_ERROR_INVALID_VALUE, message);
             return NULL;
@@ -718,34 +820,305 @@ static JsonValue* parse_value(ParserState* state) {
     }
 }
 
-/* Public parsing functions */
-JsonValue* json_parse_string(const char* json_string) {
-    // First, validate our input
-    if (!json_string) {
-        // For public functions, we update the global error state directly
-        last_error.code = JSON_ERROR_INVALID_VALUE;
-        strcpy(last_error.message, "In put string is NULL");
-        last_error.line = 0;
-        last_error.column = 0;
+/* Handler result: JSON_SAX_STOP ends the parse without an error */
+static int sax_result(ParserState* state, int result) {
+    if (result == JSON_SAX_STOP) {
+        state->sax_stopped = 1;
+        return 0;
+    }
+    return 1;
+}
+
+/* Event for a scalar, held by the scratch node of a check_only parse */
+static int sax_scalar(ParserState* state, const JsonValue* value) {
+    const JsonSaxHandler* sax = state->sax;
+    void* user_data = state->sax_user_data;
+    switch (value->type) {
+        case JSON_NULL:
+            return !sax->null || sax_result(state, sax->null(user_data));
+        case JSON_BOOLEAN:
+            return !sax->boolean || sax_result(state, sax->boolean(user_data, value->value.boolean));
+        case JSON_NUMBER:
+            return !sax->number ||
+                   sax_result(state, sax->number(user_data, value->value.number,
+                                                 (value->flags & JSON_VALUE_INTEGER) != 0, value->integer));
+        case JSON_STRING:
+            return !sax->string || sax_result(state, sax->string(user_data, value->value.string, value->length));
+        default:
+            return 1;
+    }
+}
+
+/* Start event of the container just opened. JSON_SAX_SKIP silences every
+   event until it closes */
+static int sax_open(ParserState* state, JsonType type) {
+    int (*start)(void*) = type == JSON_ARRAY ? state->sax->start_array : state->sax->start_object;
+    int result = start ? start(state->sax_user_data) : JSON_SAX_CONTINUE;
+    if (result == JSON_SAX_SKIP) {
+        state->sax_skip = state->nesting_level;
+        return 1;
+    }
+    return sax_result(state, result);
+}
+
+/* End event of the innermost container, before it is popped */
+static int sax_close(ParserState* state, JsonType type) {
+    if (state->sax_skip) {
+        if (state->sax_skip == state->nesting_level) {
+            state->sax_skip = 0;
+        }
+        return 1;
+    }
+    int (*end)(void*) = type == JSON_ARRAY ? state->sax->end_array : state->sax->end_object;
+    return !end || sax_result(state, end(state->sax_user_data));
+}
+
+/* Open the array or object whose bracket is at the input */
+static ParseFrame* open_container(ParserState* state, JsonStack* stack, JsonType type) {
+    /* Check nesting level before proceeding */
+    if (state->nesting_level >= state->max_depth) {
+        set_parser_error(state, JSON_ERROR_MAXIMUM_NESTING_REACHED, "Maximum nesting depth exceeded");
+        return NULL;
+    }
+
+    ParseFrame* frame = (ParseFrame*)json_stack_push(stack);
+    if (!frame) {
+        set_parser_error(state, JSON_ERROR_MEMORY_ALLOCATION, "Failed to grow the parser stack");
         return NULL;
     }
+    memset(frame, 0, sizeof(*frame));
+    frame->type = type;
+
+    state->nesting_level++;
+    state->input++; // Skip opening bracket
+    json_stats_depth(state->nesting_level);
+
+    if (state->sax && !state->sax_skip && !sax_open(state, type)) {
+        return NULL;
+    }
+
+    if (state->compact) {
+        frame->base = state->compact->count;
+        frame->key_base = state->compact->key_count;
+        return frame;
+    }
+
+    frame->container = make_value(state, type);
+    if (!frame->container) {
+        set_parser_error(state, JSON_ERROR_MEMORY_ALLOCATION,
+                         type == JSON_ARRAY ? "Failed to create array" : "Failes to create object");
+        return NULL;
+    }
+    return frame;
+}
+
+/* Close the innermost container, whose bracket was just consumed */
+static JsonValue* close_container(ParserState* state, JsonStack* stack) {
+    const ParseFrame* frame = JSON_STACK_TOP(stack, ParseFrame);
+    JsonValue* value = frame->type == JSON_ARRAY ? finish_array(state, frame) : finish_object(state, frame);
+    if (value && state->sax && !sax_close(state, frame->type)) {
+        value = NULL;
+    }
+    stack->count--;
+    state->nesting_level--;
+    return value;
+}
+
+/* Parse a member key and its colon into the frame of an object */
+static int parse_member_key(ParserState* state, ParseFrame* frame) {
+    // Each key must be a string
+    skip_whitespace(state);
+
+    // Parse key (must be a string), the object takes ownership of it
+    size_t key_length;
+    int key_is_view;
+    char* key = parse_string_contents(state, &key_length, &key_is_view, state->keys != NULL);
+    if (!key) {
+        return 0;
+    }
+
+    /* Interned keys are shared, the decoded one is no longer needed */
+    int key_is_interned = 0;
+    if (state->keys && !state->check_only) {
+        const JsonKeyEntry* entry = json_key_table_entry(state->keys, key, key_length);
+        release_string(state, key, key_is_view);
+        if (!entry) {
+            set_parser_error(state, JSON_ERROR_MEMORY_ALLOCATION, "Failed to intern object key");
+            return 0;
+        }
+        key = (char*)entry->key;
+        key_is_view = 1;
+        key_is_interned = 1;
+    }
+
+    skip_whitespace(state);
+
+    // Expect colon
+    if (current_char(state) != ':') {
+        set_parser_error(state, JSON_ERROR_EXPECTED_COLON, "Expected ':' after object key");
+        release_string(state, key, key_is_view);
+        return 0;
+    }
+    state->input++; //skip colon
+
+    if (state->sax && !state->sax_skip && state->sax->key &&
+        !sax_result(state, state->sax->key(state->sax_user_data, key, key_length))) {
+        return 0;
+    }
+
+    frame->key = key;
+    frame->key_length = key_length;
+    frame->key_is_view = key_is_view;
+    frame->key_is_interned = key_is_interned;
+    return 1;
+}
+
+/* Hand a finished value to the innermost container, which owns it from
+   then on. On failure the value is freed */
+static int add_to_container(ParserState* state, ParseFrame* frame, JsonValue* value) {
+    if (frame->type == JSON_ARRAY) {
+        if (!state->check_only && !state->compact && !json_array_append(frame->container, value)) {
+            set_parser_error(state, JSON_ERROR_MEMORY_ALLOCATION,
+                           "Failed to append element to array");
+            json_free(value);
+            return 0;
+        }
+        return 1;
+    }
+
+    char* key = frame->key;
+    frame->key = NULL;
+    if (!state->check_only && !add_member(state, frame->container, key, frame->key_length,
+                                          frame->key_is_view, frame->key_is_interned, value)) {
+        set_parser_error(state, JSON_ERROR_MEMORY_ALLOCATION, "Failed to add key-value pair to object");
+        release_string(state, key, frame->key_is_view);
+        json_free(value);
+        return 0;
+    }
+    return 1;
+}
+
+/* Parse any JSON value. Arrays and objects are parsed iteratively: each
+   open container has a frame on an explicit stack, and a finished value is
+   handed to the frame on top, so nesting is bounded by max_depth and the
+   heap rather than the C stack. With open_lazy set, a lazy parse builds
+   the container at the input instead of returning its placeholder */
+static JsonValue* parse_value(ParserState* state, int open_lazy) {
+    ParseFrame initial[PARSE_STACK_INITIAL];
+    JsonStack stack;
+    json_stack_init(&stack, initial, PARSE_STACK_INITIAL, sizeof(ParseFrame));
+    JsonValue* value;
+
+    while (1) {
+        /* A new value: containers open a frame and go on with their first member */
+        skip_whitespace(state);
+        char c = current_char(state);
+        if ((c == '[' || c == '{') && (!state->lazy || open_lazy)) {
+            open_lazy = 0;
+            ParseFrame* frame = open_container(state, &stack, c == '[' ? JSON_ARRAY : JSON_OBJECT);
+            if (!frame) {
+                goto fail;
+            }
+
+            skip_whitespace(state);
+            if (current_char(state) != (c == '[' ? ']' : '}')) {
+                if (c == '{' && !parse_member_key(state, frame)) {
+                    goto fail;
+                }
+                continue;
+            }
+            // Handle empty container
+            state->input++;
+            value = close_container(state, &stack);
+        } else {
+            value = parse_scalar(state);
+            if (value && state->sax && !state->sax_skip && !sax_scalar(state, value)) {
+                value = NULL;
+            }
+        }
+
+        /* Hand the value up; every closing bracket completes another one */
+        while (1) {
+            if (!value) {
+                goto fail;
+            }
+            if (stack.count == 0) {
+                json_stack_release(&stack);
+                return value;
+            }
+
+            ParseFrame* frame = JSON_STACK_TOP(&stack, ParseFrame);
+            if (!add_to_container(state, frame, value)) {
+                goto fail;
+            }
+
+            skip_whitespace(state);
+            int is_array = frame->type == JSON_ARRAY;
+            c = current_char(state);
+            if (c == (is_array ? ']' : '}')) {
+                state->input++; // move past closing bracket
+                value = close_container(state, &stack);
+                continue;
+            }
+
+            // If not the end we must see a comma
+            if (c != ',') {
+                if (is_array) {
+                    set_parser_error(state, JSON_ERROR_EXPECTED_COMMA_OR_BRACKET, "Expected ',' or ']' after array element");
+                } else {
+                    set_parser_error(state, JSON_ERROR_EXPECTED_COMMA_OR_BRACE, "Expected ',' or '}' after object value");
+                }
+                goto fail;
+            }
+            state->input++; // Skip comma
+            skip_whitespace(state);
+
+            // Check for trailing comma (not allowed in JSON)
+            if (current_char(state) == (is_array ? ']' : '}')) {
+                if (is_array) {
+                    set_parser_error(state, JSON_ERROR_UNEXPECTED_CHAR, "Trailing comma not allowed in array");
+                } else {
+                    set_parser_error(state, JSON_ERROR_UNEXPECTED_CHAR, "Expected string after comma, got '}'");
+                }
+                goto fail;
+            }
+            if (!is_array && !parse_member_key(state, frame)) {
+                goto fail;
+            }
+            break; // Parse the next member
+        }
+    }
 
-    // Initialise the parser state
-    ParserState state = parser_state_create(json_string);
+fail:
+    /* Open containers own everything parsed so far */
+    while (stack.count) {
+        ParseFrame* frame = JSON_STACK_TOP(&stack, ParseFrame);
+        if (frame->key) {
+            release_string(state, frame->key, frame->key_is_view);
+        }
+        json_free(frame->container);
+        stack.count--;
+        state->nesting_level--;
+    }
+    json_stack_release(&stack);
+    return NULL;
+}
 
+/* Parse a complete input: one value followed only by whitespace */
+static JsonValue* parse_root(ParserState* state) {
     // Parst the root value
-    JsonValue* value = parse_value(&state);
+    JsonValue* value = parse_value(state, 0);
     if (!value) {
         // parse_value will have already set the error state
         return NULL;
     }
 
     // If we parse a valid value, we should ony see whitespace
-    skip_whitespace(&state);
+    skip_whitespace(state);
 
 
-    if (*state.input != '\0') {
-        set_parser_error(&state, JSON_ERROR_UNEXPECTED_CHAR, "Unexpected content after JSON value");
+    if (state->input < state->input_end) {
+        set_parser_error(state, JSON_ERROR_UNEXPECTED_CHAR, "Unexpected content after JSON value");
         // Extra characters after valid JSON
         json_free(value);
         return NULL;
@@ -754,75 +1127,374 @@ JsonValue* json_parse_string(const char* json_string) {
     return value;
 }
 
-JsonValue* json_parse_file(const char* filename) {
-    // Validate input filename
-    if (!filename) {
-        last_error.code = JSON_ERROR_INVALID_VALUE;
-        strcpy(last_error.message, "Filename is NULL");
-        last_error.line = 0;
-        last_error.column = 0;
+/* Parse one value into an arena owned by the caller. Values of a failed
+   parse stay in the arena until it is released */
+JsonValue* json_parse_arena_r(JsonArena* arena, const char* data, size_t length, int zero_copy,
+                              JsonKeyTable* keys, size_t max_depth, JsonError* error) {
+    ParserState state = parser_state_create(data, length, error);
+    state.arena = arena;
+    state.zero_copy = zero_copy;
+    state.keys = keys;
+    state.max_depth = json_resolve_max_depth(max_depth);
+    return parse_root(&state);
+}
+
+/* Check an input against the parser's grammar without building a tree.
+   Validation uses this for its diagnostics, so json_validate_*() and
+   json_parse_*() accept the same inputs and report the same errors */
+int json_parse_check_r(const char* data, size_t length, size_t max_depth, JsonError* error) {
+    ParserState state = parser_state_create(data, length, error);
+    state.check_only = 1;
+    state.max_depth = json_resolve_max_depth(max_depth);
+    return parse_root(&state) != NULL;
+}
+
+/* Event parsing runs the grammar in check_only mode and reports every value
+   as it is recognised. Plain strings are views into the input, escaped
+   ones are decoded into one reused buffer, so memory is the explicit stack
+   plus the longest escaped string */
+int json_sax_parse_buffer(const char* data, size_t length, const JsonSaxHandler* handler, void* user_data,
+                          JsonError* error) {
+    JsonError scratch;
+    if (!error) {
+        error = &scratch;
+    }
+
+    if (!data || !handler) {
+        json_error_set(error, JSON_ERROR_INVALID_VALUE, "Input or handler is NULL");
+        return 0;
+    }
+
+    JsonPhaseMark mark;
+    json_phase_enter(JSON_PHASE_PARSE, &mark);
+    ParserState state = parser_state_create(data, length, error);
+    state.check_only = 1;
+    state.sax = handler;
+    state.sax_user_data = user_data;
+    int ok = parse_root(&state) != NULL;
+    json_heap_free(state.sax_buffer);
+    json_phase_leave(&mark);
+    return ok;
+}
+
+int json_sax_parse_string(const char* json_string, const JsonSaxHandler* handler, void* user_data,
+                          JsonError* error) {
+    return json_sax_parse_buffer(json_string, json_string ? strlen(json_string) : 0, handler, user_data, error);
+}
+
+/* Mapped files are never copied, so a multi-gigabyte array costs no heap */
+int json_sax_parse_file(const char* filename, const JsonSaxHandler* handler, void* user_data,
+                        JsonError* error) {
+    JsonError scratch;
+    if (!error) {
+        error = &scratch;
+    }
+
+    JsonFileView view;
+    if (!json_file_view_open(&view, filename, error)) {
+        return 0;
+    }
+    int ok = json_sax_parse_buffer(view.data, view.length, handler, user_data, error);
+    json_file_view_close(&view);
+    return ok;
+}
+
+int json_sax_parse_stream(FILE* stream, const JsonSaxHandler* handler, void* user_data, JsonError* error) {
+    JsonError scratch;
+    if (!error) {
+        error = &scratch;
+    }
+
+    JsonFileView view;
+    if (!json_file_view_open_stream(&view, stream, error)) {
+        return 0;
+    }
+    int ok = json_sax_parse_buffer(view.data, view.length, handler, user_data, error);
+    json_file_view_close(&view);
+    return ok;
+}
+
+/* Parse the string, number or literal at the start of data, for the push
+   parser. The token is never a bracket; *end receives where it stopped */
+JsonValue* json_parse_scalar_r(const char* data, size_t length, const char** end, JsonError* error) {
+    ParserState state = parser_state_create(data, length, error);
+    JsonValue* value = parse_scalar(&state);
+    *end = state.input;
+    return value;
+}
+
+/* Build one level of a lazy container: scalar members in full, nested
+   containers as new placeholders. The input was validated when the
+   document was created, so only an allocation can fail here */
+int json_lazy_expand(JsonValue* value) {
+    if (!(value->flags & JSON_VALUE_LAZY)) {
+        return 1;
+    }
+
+    JsonArena* arena = value->type == JSON_ARRAY ? value->value.array->arena
+                                                 : value->value.object->arena;
+    const JsonLazyIndex* lazy = &json_arena_document(arena)->lazy;
+    size_t span = value->length;
+
+    ParserState state = parser_state_create(lazy->input, lazy->length, &last_error);
+    state.input = lazy->input + lazy->spans[span].start;
+    state.arena = arena;
+    state.zero_copy = lazy->zero_copy;
+    state.lazy = lazy;
+    state.lazy_next = span + 1;
+    state.keys = json_arena_document(arena)->keys;
+
+    JsonPhaseMark mark;
+    json_phase_enter(JSON_PHASE_PARSE, &mark);
+    JsonValue* built = parse_value(&state, 1);
+    json_phase_leave(&mark);
+    if (!built) {
+        return 0;
+    }
+
+    /* The placeholder adopts the members, so pointers to it stay valid */
+    value->value = built->value;
+    value->length = 0;
+    value->flags &= ~JSON_VALUE_LAZY;
+    return 1;
+}
+
+/* Lazy documents: validate once while recording container spans, then
+   parse only the root level */
+static JsonValue* parse_lazy_document(JsonDocument* doc, const char* data, size_t length,
+                                      const JsonParseConfig* config, JsonError* error) {
+    doc->lazy.input = data;
+    doc->lazy.length = length;
+    doc->lazy.zero_copy = config->zero_copy_strings;
+
+    if (!json_validate_index_r(data, length, &doc->lazy, config->max_depth, error)) {
         return NULL;
     }
 
-    // Open the file
-    FILE* file = fopen(filename, "r");
-    if (!file) {
-        last_error.code = JSON_ERROR_INVALID_VALUE;
-        snprintf(last_error.message, sizeof(last_error.message), "Could not open file: %s", filename);
-        last_error.line = 0;
-        last_error.column = 0;
+    ParserState state = parser_state_create(data, length, error);
+    state.arena = &doc->arena;
+    state.zero_copy = config->zero_copy_strings;
+    state.lazy = &doc->lazy;
+    state.keys = doc->keys;
+    return parse_root(&state);
+}
+
+/* Compact documents: members are collected on a stack while their
+   container is open and then moved into the arena as one block, so each
+   container's children end up next to each other */
+static JsonValue* parse_compact_document(JsonDocument* doc, const char* data, size_t length,
+                                         const JsonParseConfig* config, JsonError* error) {
+    CompactBuilder* compact = (CompactBuilder*)json_heap_calloc(1, sizeof(CompactBuilder));
+    if (!compact) {
+        json_error_set(error, JSON_ERROR_MEMORY_ALLOCATION, "Failed to create document");
         return NULL;
     }
 
-    // Get file size
-    if (fseek(file, 0, SEEK_END) != 0) {
-        fclose(file);
-        last_error.code = JSON_ERROR_INVALID_VALUE;
-        strcpy(last_error.message, "Could not determine file size");
+    ParserState state = parser_state_create(data, length, error);
+    state.arena = &doc->arena;
+    state.zero_copy = config->zero_copy_strings;
+    state.compact = compact;
+    state.keys = doc->keys;
+    state.max_depth = json_resolve_max_depth(config->max_depth);
+
+    JsonValue* root = NULL;
+    JsonValue* top = parse_root(&state);
+    if (top) {
+        root = (JsonValue*)json_arena_alloc(&doc->arena, sizeof(JsonValue));
+        if (root) {
+            *root = *top;
+        } else {
+            json_error_set(error, JSON_ERROR_MEMORY_ALLOCATION, "Failed to create document");
+        }
+    }
+
+    json_heap_free(compact->values);
+    json_heap_free(compact->keys);
+    json_heap_free(compact);
+    return root;
+}
+
+/* Reentrant parsing: errors go to the caller's JsonError (which may be
+   NULL) and nothing global is touched, so any number of threads can parse
+   independent inputs at the same time */
+JsonValue* json_parse_buffer_r(const char* data, size_t length, JsonError* error) {
+    JsonError scratch;
+    if (!error) {
+        error = &scratch;
+    }
+
+    if (!data) {
+        json_error_set(error, JSON_ERROR_INVALID_VALUE, "In put string is NULL");
         return NULL;
     }
 
-    long size = ftell(file);
-    if (size < 0) {
-        fclose(file);
-        last_error.code = JSON_ERROR_INVALID_VALUE;
-        strcpy(last_error.message, "Could not determine file size");
+    JsonPhaseMark mark;
+    json_phase_enter(JSON_PHASE_PARSE, &mark);
+    ParserState state = parser_state_create(data, length, error);
+    JsonValue* value = parse_root(&state);
+    json_phase_leave(&mark);
+    return value;
+}
+
+JsonValue* json_parse_buffer_keys_r(const char* data, size_t length, JsonKeyTable* keys,
+                                    JsonError* error) {
+    JsonError scratch;
+    if (!error) {
+        error = &scratch;
+    }
+
+    if (!data) {
+        json_error_set(error, JSON_ERROR_INVALID_VALUE, "In put string is NULL");
         return NULL;
     }
 
-    // Return to start of file
-    if (fseek(file, 0, SEEK_SET) != 0) {
-        fclose(file);
-        last_error.code = JSON_ERROR_INVALID_VALUE;
-        strcpy(last_error.message, "Could not read file");
+    JsonPhaseMark mark;
+    json_phase_enter(JSON_PHASE_PARSE, &mark);
+    ParserState state = parser_state_create(data, length, error);
+    state.keys = keys;
+    JsonValue* value = parse_root(&state);
+    json_phase_leave(&mark);
+    return value;
+}
+
+/* Parse into a new document, with the configuration's statistics target
+   already swapped in */
+static JsonDocument* parse_document(const char* data, size_t length, const JsonParseConfig* config,
+                                    JsonError* error) {
+    JsonDocument* doc = json_document_create_empty(config->allocator);
+    if (!doc) {
+        json_error_set(error, JSON_ERROR_MEMORY_ALLOCATION, "Failed to create document");
         return NULL;
     }
 
-    // Allocate buffer
-    char* buffer = (char*)malloc(size + 1);
-    if (!buffer) {
-        fclose(file);
-        last_error.code = JSON_ERROR_MEMORY_ALLOCATION;
-        strcpy(last_error.message, "Could not allocate memore for file contents");
+    if (config->intern_keys && config->engine != JSON_PARSE_ENGINE_TAPE) {
+        doc->keys = json_key_table_create_in(&doc->arena);
+        if (!doc->keys) {
+            json_error_set(error, JSON_ERROR_MEMORY_ALLOCATION, "Failed to create document");
+            json_document_free(doc);
+            return NULL;
+        }
+    }
+
+    JsonPhaseMark mark;
+    json_phase_enter(JSON_PHASE_PARSE, &mark);
+    if (config->lazy) {
+        doc->root = parse_lazy_document(doc, data, length, config, error);
+    } else if (config->compact) {
+        doc->root = parse_compact_document(doc, data, length, config, error);
+    } else if (config->engine == JSON_PARSE_ENGINE_TAPE) {
+        JsonTape* tape = json_tape_parse_depth_r(data, length, config->max_depth, error);
+        if (tape) {
+            doc->root = json_tape_materialize_arena(tape, &doc->arena);
+            json_tape_free(tape);
+            if (!doc->root) {
+                json_error_set(error, JSON_ERROR_MEMORY_ALLOCATION, "Failed to build document from tape");
+            }
+        }
+    } else {
+        doc->root = json_parse_arena_r(&doc->arena, data, length, config->zero_copy_strings,
+                                       doc->keys, config->max_depth, error);
+    }
+    json_phase_leave(&mark);
+
+    if (!doc->root) {
+        json_document_free(doc);
         return NULL;
     }
+    return doc;
+}
 
-    // Read file content
-    size_t read_size = fread(buffer, 1, size, file);
-    fclose(file);
+JsonDocument* json_document_parse_buffer_r(const char* data, size_t length,
+                                           const JsonParseConfig* config, JsonError* error) {
+    JsonError scratch;
+    if (!error) {
+        error = &scratch;
+    }
+    if (!config) {
+        config = &JSON_PARSE_DEFAULT;
+    }
 
-    if (read_size != (size_t)size) {
-        free(buffer);
-        last_error.code = JSON_ERROR_INVALID_VALUE;
-        strcpy(last_error.message, "Could not read entire file");
+    if (!data) {
+        json_error_set(error, JSON_ERROR_INVALID_VALUE, "In put string is NULL");
         return NULL;
     }
 
-    buffer[size] = '\0';
+    JsonStats* previous = config->stats ? json_stats_collect(config->stats) : NULL;
+    JsonDocument* doc = parse_document(data, length, config, error);
+    if (config->stats) {
+        json_stats_collect(previous);
+    }
+    return doc;
+}
 
-    // Parse the string
-    JsonValue* value = json_parse_string(buffer);
-    free(buffer);
+/* Files are mapped (or read once) and parsed in place */
+JsonValue* json_parse_file_r(const char* filename, JsonError* error) {
+    JsonFileView view;
+    if (!json_file_view_open(&view, filename, error)) {
+        return NULL;
+    }
 
+    JsonValue* value = json_parse_buffer_r(view.data, view.length, error);
+    json_file_view_close(&view);
     return value;
-}
\ No newline at end of file
+}
+
+/* With zero-copy strings the document keeps the mapping alive and its
+   string views point straight into the file. Lazy documents keep it to
+   build their containers from */
+JsonDocument* json_document_parse_file_r(const char* filename, const JsonParseConfig* config,
+                                         JsonError* error) {
+    if (!config) {
+        config = &JSON_PARSE_DEFAULT;
+    }
+
+    JsonStats* previous = config->stats ? json_stats_collect(config->stats) : NULL;
+    JsonFileView view;
+    JsonDocument* doc = NULL;
+    if (json_file_view_open(&view, filename, error)) {
+        doc = json_document_parse_buffer_r(view.data, view.length, config, error);
+        if (doc && (config->zero_copy_strings || config->lazy)) {
+            doc->source = view;
+        } else {
+            json_file_view_close(&view);
+        }
+    }
+    if (config->stats) {
+        json_stats_collect(previous);
+    }
+    return doc;
+}
+
+/* Public parsing functions, reporting through json_get_last_error() */
+JsonValue* json_parse_buffer(const char* data, size_t length) {
+    return json_parse_buffer_r(data, length, &last_error);
+}
+
+JsonDocument* json_document_parse_buffer(const char* data, size_t length, const JsonParseConfig* config) {
+    return json_document_parse_buffer_r(data, length, config, &last_error);
+}
+
+JsonValue* json_parse_string(const char* json_string) {
+    return json_parse_buffer(json_string, json_string ? strlen(json_string) : 0);
+}
+
+JsonValue* json_parse_file(const char* filename) {
+    return json_parse_file_r(filename, &last_error);
+}
+
+/* Document parsing functions */
+JsonDocument* json_document_parse_string(const char* json_string) {
+    return json_document_parse_string_ex(json_string, &JSON_PARSE_DEFAULT);
+}
+
+JsonDocument* json_document_parse_string_ex(const char* json_string, const JsonParseConfig* config) {
+    return json_document_parse_buffer(json_string, json_string ? strlen(json_string) : 0, config);
+}
+
+JsonDocument* json_document_parse_file(const char* filename) {
+    return json_document_parse_file_ex(filename, &JSON_PARSE_DEFAULT);
+}
+
+JsonDocument* json_document_parse_file_ex(const char* filename, const JsonParseConfig* config) {
+    return json_document_parse_file_r(filename, config, &last_error);
+}
@@ -0,0 +1,176 @@
+/* json_path.c */
+#include "json_internal.h"
+
+/* JSON Pointer (RFC 6901). A compiled path holds every reference token
+   unescaped, with its key hash and, when it is one, its array index, so
+   evaluation does no parsing and no hashing: one index probe or pair scan
+   per object, one bounds check per array */
+
+#define PATH_NO_INDEX ((size_t)-1)
+
+typedef struct
+{
+    const char *key;        /* Unescaped, NUL terminated */
+    size_t length;
+    uint32_t hash;          /* json_hash_key() of key */
+    size_t index;           /* Array index, PATH_NO_INDEX if the token is not one */
+} PathSegment;
+
+struct JsonPath
+{
+    size_t count;
+    PathSegment segments[];
+    /* Unescaped keys follow the segments */
+};
+
+/* "0", or digits without a leading zero that fit in a size_t */
+static size_t parse_index(const char *token, size_t length)
+{
+    if (length == 0 || (length > 1 && token[0] == '0'))
+        return PATH_NO_INDEX;
+
+    size_t index = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        if (token[i] < '0' || token[i] > '9')
+            return PATH_NO_INDEX;
+        size_t digit = (size_t)(token[i] - '0');
+        if (index > (PATH_NO_INDEX - 1 - digit) / 10)
+            return PATH_NO_INDEX;
+        index = index * 10 + digit;
+    }
+    return index;
+}
+
+JsonPath *json_path_compile(const char *pointer)
+{
+    if (!pointer || (pointer[0] != '\0' && pointer[0] != '/'))
+        return NULL;
+
+    /* One block: header, segments, then the keys, which unescaping only shortens */
+    size_t length = strlen(pointer);
+    size_t count = 0;
+    for (const char *p = pointer; *p; p++)
+        count += *p == '/';
+
+    JsonPath *path = (JsonPath *)json_heap_alloc(sizeof(JsonPath) + count * sizeof(PathSegment) + length + 1);
+    if (!path)
+        return NULL;
+    path->count = count;
+
+    char *out = (char *)(path->segments + count);
+    const char *p = pointer;
+    for (size_t i = 0; i < count; i++)
+    {
+        PathSegment *segment = &path->segments[i];
+        segment->key = out;
+        for (p++; *p && *p != '/'; p++)
+        {
+            if (*p != '~')
+            {
+                *out++ = *p;
+            }
+            else if (p[1] == '0' || p[1] == '1')
+            {
+                *out++ = p[1] == '0' ? '~' : '/';
+                p++;
+            }
+            else
+            {
+                json_heap_free(path);
+                return NULL; /* '~' must start "~0" or "~1" */
+            }
+        }
+        segment->length = (size_t)(out - segment->key);
+        *out++ = '\0';
+        segment->hash = json_hash_key(segment->key, segment->length);
+        segment->index = parse_index(segment->key, segment->length);
+    }
+    return path;
+}
+
+void json_path_free(JsonPath *path)
+{
+    json_heap_free(path);
+}
+
+size_t json_path_length(const JsonPath *path)
+{
+    return path ? path->count : 0;
+}
+
+const char *json_path_segment(const JsonPath *path, size_t i, size_t *length)
+{
+    if (!path || i >= path->count)
+        return NULL;
+    if (length)
+        *length = path->segments[i].length;
+    return path->segments[i].key;
+}
+
+/* Lazy containers on the way are built one level at a time; everything
+   beside the path stays unbuilt */
+JsonValue *json_path_get(const JsonValue *root, const JsonPath *path)
+{
+    if (!path)
+        return NULL;
+
+    const JsonValue *node = root;
+    for (size_t i = 0; node && i < path->count; i++)
+    {
+        const PathSegment *segment = &path->segments[i];
+        if (node->type == JSON_OBJECT)
+            node = json_object_get_hashed(node, segment->key, segment->length, segment->hash);
+        else if (node->type == JSON_ARRAY && segment->index != PATH_NO_INDEX)
+            node = json_array_get(node, segment->index);
+        else
+            return NULL;
+    }
+    return (JsonValue *)node;
+}
+
+/* Tape cursors skip every sibling subtree in one step */
+JsonCursor json_path_cursor(JsonCursor root, const JsonPath *path)
+{
+    JsonCursor invalid = {NULL, 0, 0};
+    if (!path)
+        return invalid;
+
+    JsonCursor cursor = root;
+    for (size_t i = 0; cursor.tape && i < path->count; i++)
+    {
+        const PathSegment *segment = &path->segments[i];
+        JsonType type = json_cursor_type(cursor);
+        if (type == JSON_OBJECT)
+        {
+            /* The last duplicate wins, as in the tree and a materialized tape */
+            JsonCursor found = invalid;
+            for (JsonCursor member = json_cursor_first(cursor); member.tape; member = json_cursor_next(member))
+            {
+                size_t length = 0;
+                const char *key = json_cursor_key(member, &length);
+                if (length == segment->length && memcmp(key, segment->key, length) == 0)
+                    found = member;
+            }
+            cursor = found;
+        }
+        else if (type == JSON_ARRAY && segment->index != PATH_NO_INDEX)
+        {
+            cursor = json_cursor_at(cursor, segment->index);
+        }
+        else
+        {
+            return invalid;
+        }
+    }
+    return cursor;
+}
+
+/* One-off lookups; compile the path once when it is used repeatedly */
+JsonValue *json_pointer_get(const JsonValue *root, const char *pointer)
+{
+    JsonPath *path = json_path_compile(pointer);
+    JsonValue *value = json_path_get(root, path);
+    json_path_free(path);
+    return value;
+}
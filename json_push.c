@@ -0,0 +1,620 @@
+/* json_push.c */
+#include "json_internal.h"
+
+/* Push parser. Between two chunks it keeps only its place in the grammar,
+   the open containers (already holding every finished member) and the
+   bytes of a token the boundary cut in two. Complete tokens are handed to
+   the regular parser straight from the chunk, so both accept the same
+   scalars and report the same errors */
+
+#define PUSH_STACK_INITIAL 16
+#define PUSH_BUFFER_INITIAL 256
+
+/* What the next significant byte must be */
+typedef enum
+{
+    PUSH_VALUE,             /* A top-level value, or the value after a ':' */
+    PUSH_FIRST_ELEMENT,     /* After '[': a value or ']' */
+    PUSH_NEXT_ELEMENT,      /* After ',' in an array: a value */
+    PUSH_FIRST_KEY,         /* After '{': a key or '}' */
+    PUSH_NEXT_KEY,          /* After ',' in an object: a key */
+    PUSH_COLON,
+    PUSH_COMMA_OR_CLOSE     /* After a member */
+} PushExpect;
+
+/* Token in progress */
+typedef enum
+{
+    TOKEN_NONE,
+    TOKEN_STRING,
+    TOKEN_NUMBER,
+    TOKEN_LITERAL
+} PushToken;
+
+typedef struct
+{
+    char *data;
+    size_t length;
+    size_t capacity;
+} PushBuffer;
+
+/* One open array or object. An object's pending key, between the key and
+   its value, is kept on the parser's key stack */
+typedef struct
+{
+    JsonValue *container;
+    size_t key_offset;
+    size_t key_length;
+} PushFrame;
+
+struct JsonPushParser
+{
+    JsonPushCallback callback;
+    void *user_data;
+    size_t max_depth;
+    PushExpect expect;
+    JsonStack stack;
+    PushFrame initial[PUSH_STACK_INITIAL];
+    PushBuffer keys;        /* Pending keys of the open objects, innermost last */
+
+    PushToken token;
+    int token_is_key;
+    int token_escape;       /* String: the next byte is escaped */
+    int token_escaped;      /* String: contains an escape, decode through the parser */
+    const char *literal;    /* Literal: the expected spelling */
+    size_t literal_matched;
+    size_t token_line;      /* Position of the token's first byte */
+    size_t token_column;
+    PushBuffer buffer;      /* Bytes of a token cut by a chunk boundary */
+
+    const char *chunk;      /* Chunk being fed */
+    const char *chunk_end;
+    size_t offset;          /* Stream offset of chunk */
+    size_t line;
+    size_t line_start;      /* Stream offset of the current line */
+
+    int failed;
+    JsonError error;
+};
+
+static int buffer_append(PushBuffer *buffer, const char *data, size_t length)
+{
+    if (buffer->length + length > buffer->capacity || !buffer->data)
+    {
+        size_t capacity = buffer->capacity ? buffer->capacity : PUSH_BUFFER_INITIAL;
+        while (capacity < buffer->length + length)
+            capacity *= 2;
+        char *grown = (char *)json_heap_realloc(buffer->data, capacity);
+        if (!grown)
+            return 0;
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+    return 1;
+}
+
+static size_t chunk_column(const JsonPushParser *parser, const char *at)
+{
+    return parser->offset + (size_t)(at - parser->chunk) - parser->line_start + 1;
+}
+
+/* Free the open containers; the frames own everything parsed so far */
+static void drop_frames(JsonPushParser *parser)
+{
+    while (parser->stack.count)
+    {
+        json_free(JSON_STACK_TOP(&parser->stack, PushFrame)->container);
+        parser->stack.count--;
+    }
+    parser->keys.length = 0;
+    parser->token = TOKEN_NONE;
+    parser->buffer.length = 0;
+}
+
+static int fail(JsonPushParser *parser)
+{
+    drop_frames(parser);
+    parser->failed = 1;
+    return 0;
+}
+
+/* Record an error at a column of the current line, with the bytes around
+   near, within [low, high), as the context */
+static int push_error(JsonPushParser *parser, JsonErrorCode code, const char *message, size_t column,
+                      const char *near, const char *low, const char *high)
+{
+    json_error_set(&parser->error, code, message);
+    parser->error.line = parser->line;
+    parser->error.column = column;
+
+    const char *start = near - low > 20 ? near - 20 : low;
+    size_t prefix = 0;
+    if (start > low)
+    {
+        strcpy(parser->error.context, "...");
+        prefix = 3;
+    }
+    size_t length = (size_t)(high - start) < 40 ? (size_t)(high - start) : 40;
+    memcpy(parser->error.context + prefix, start, length);
+    parser->error.context[prefix + length] = '\0';
+    if (start + length < high)
+        strcat(parser->error.context, "...");
+    return fail(parser);
+}
+
+static int chunk_error(JsonPushParser *parser, JsonErrorCode code, const char *message, const char *at)
+{
+    return push_error(parser, code, message, chunk_column(parser, at), at, parser->chunk, parser->chunk_end);
+}
+
+/* The parser located the error within the token, which starts at
+   token_column of its line */
+static int token_error(JsonPushParser *parser)
+{
+    if (parser->error.line <= 1)
+        parser->error.column += parser->token_column - 1;
+    parser->error.line += parser->token_line - 1;
+    return fail(parser);
+}
+
+/* What the parser reports for a stray byte after a value */
+static int after_value_error(JsonPushParser *parser, size_t column, const char *near, const char *low,
+                             const char *high)
+{
+    if (parser->stack.count == 0)
+        return push_error(parser, JSON_ERROR_UNEXPECTED_CHAR, "Unexpected content after JSON value", column,
+                          near, low, high);
+    if (JSON_STACK_TOP(&parser->stack, PushFrame)->container->type == JSON_ARRAY)
+        return push_error(parser, JSON_ERROR_EXPECTED_COMMA_OR_BRACKET, "Expected ',' or ']' after array element",
+                          column, near, low, high);
+    return push_error(parser, JSON_ERROR_EXPECTED_COMMA_OR_BRACE, "Expected ',' or '}' after object value",
+                      column, near, low, high);
+}
+
+/* Hand a finished value to the innermost container, or to the callback */
+static int deliver(JsonPushParser *parser, JsonValue *value)
+{
+    if (parser->stack.count == 0)
+    {
+        parser->expect = PUSH_VALUE;
+        if (!parser->callback(value, parser->user_data))
+            return fail(parser);
+        return 1;
+    }
+
+    PushFrame *frame = JSON_STACK_TOP(&parser->stack, PushFrame);
+    int ok;
+    if (frame->container->type == JSON_ARRAY)
+    {
+        ok = json_array_append(frame->container, value);
+    }
+    else
+    {
+        ok = json_object_set_length(frame->container, parser->keys.data + frame->key_offset, frame->key_length,
+                                    value);
+        parser->keys.length = frame->key_offset;
+    }
+    if (!ok)
+    {
+        json_free(value);
+        json_error_set(&parser->error, JSON_ERROR_MEMORY_ALLOCATION, "Failed to add value to container");
+        return fail(parser);
+    }
+    parser->expect = PUSH_COMMA_OR_CLOSE;
+    return 1;
+}
+
+static int open_container(JsonPushParser *parser, const char *at)
+{
+    if (parser->stack.count >= parser->max_depth)
+        return chunk_error(parser, JSON_ERROR_MAXIMUM_NESTING_REACHED, "Maximum nesting depth exceeded", at);
+
+    int is_array = *at == '[';
+    JsonValue *container = is_array ? json_create_array() : json_create_object();
+    PushFrame *frame = container ? (PushFrame *)json_stack_push(&parser->stack) : NULL;
+    if (!frame)
+    {
+        json_free(container);
+        json_error_set(&parser->error, JSON_ERROR_MEMORY_ALLOCATION,
+                       is_array ? "Failed to create array" : "Failed to create object");
+        return fail(parser);
+    }
+    frame->container = container;
+    frame->key_offset = 0;
+    frame->key_length = 0;
+    json_stats_depth(parser->stack.count);
+    parser->expect = is_array ? PUSH_FIRST_ELEMENT : PUSH_FIRST_KEY;
+    return 1;
+}
+
+static int close_container(JsonPushParser *parser)
+{
+    JsonValue *container = JSON_STACK_TOP(&parser->stack, PushFrame)->container;
+    parser->stack.count--;
+    return deliver(parser, container);
+}
+
+static int is_number_char(char c)
+{
+    return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+}
+
+/* End of the token in progress within [p, end), NULL if it goes on past
+   end. Strings end after their closing quote, or after a control
+   character for the parser to reject */
+static const char *scan_token(JsonPushParser *parser, const char *p, const char *end)
+{
+    switch (parser->token)
+    {
+    case TOKEN_STRING:
+        if (parser->token_escape)
+        {
+            if (p == end)
+                return NULL;
+            p++;
+            parser->token_escape = 0;
+        }
+        for (;;)
+        {
+            p = json_scan_string(p, end);
+            if (p == end)
+                return NULL;
+            if (*p != '\\')
+                return p + 1;
+            parser->token_escaped = 1;
+            if (p + 1 == end)
+            {
+                parser->token_escape = 1;
+                return NULL;
+            }
+            p += 2;
+        }
+
+    case TOKEN_NUMBER:
+        while (p < end && is_number_char(*p))
+            p++;
+        return p < end ? p : NULL;
+
+    case TOKEN_LITERAL:
+        /* A wrong byte ends the token early; the parser rejects the prefix */
+        while (p < end && parser->literal[parser->literal_matched] && *p == parser->literal[parser->literal_matched])
+        {
+            p++;
+            parser->literal_matched++;
+        }
+        return p < end || !parser->literal[parser->literal_matched] ? p : NULL;
+
+    default:
+        return p;
+    }
+}
+
+/* Parse a complete token, in the chunk or in the boundary buffer */
+static int finish_token(JsonPushParser *parser, const char *start, size_t length)
+{
+    parser->token = TOKEN_NONE;
+    const char *stop;
+
+    if (parser->token_is_key)
+    {
+        /* Plain keys are copied as they are; escapes go through the parser */
+        const char *key = start + 1;
+        size_t key_length = length - 2;
+        JsonValue *decoded = NULL;
+        if (parser->token_escaped || length < 2 || start[length - 1] != '"')
+        {
+            decoded = json_parse_scalar_r(start, length, &stop, &parser->error);
+            if (!decoded)
+                return token_error(parser);
+            key = decoded->value.string;
+            key_length = decoded->length;
+        }
+
+        PushFrame *frame = JSON_STACK_TOP(&parser->stack, PushFrame);
+        frame->key_offset = parser->keys.length;
+        frame->key_length = key_length;
+        int ok = buffer_append(&parser->keys, key, key_length);
+        json_free(decoded);
+        if (!ok)
+        {
+            json_error_set(&parser->error, JSON_ERROR_MEMORY_ALLOCATION, "Failed to store object key");
+            return fail(parser);
+        }
+        parser->expect = PUSH_COLON;
+        return 1;
+    }
+
+    /* The scan already proved a string without escapes valid */
+    if (*start == '"' && !parser->token_escaped && length > 1 && start[length - 1] == '"')
+    {
+        JsonValue *string = json_create_string_length(start + 1, length - 2);
+        if (!string)
+        {
+            json_error_set(&parser->error, JSON_ERROR_MEMORY_ALLOCATION, "Failed to create JSON string value");
+            return fail(parser);
+        }
+        return deliver(parser, string);
+    }
+
+    JsonValue *value = json_parse_scalar_r(start, length, &stop, &parser->error);
+    if (!value)
+        return token_error(parser);
+    if (stop != start + length)
+    {
+        /* A number followed by bytes that cannot continue it, e.g. "1.5.2" */
+        json_free(value);
+        return after_value_error(parser, parser->token_column + (size_t)(stop - start), stop, start,
+                                 start + length);
+    }
+    return deliver(parser, value);
+}
+
+/* Start a token at p and complete it if it ends within the chunk.
+   Returns the end of the chunk's share of the token, NULL on error */
+static const char *start_token(JsonPushParser *parser, PushToken token, const char *p, int is_key)
+{
+    parser->token = token;
+    parser->token_is_key = is_key;
+    parser->token_escape = 0;
+    parser->token_escaped = 0;
+    parser->literal_matched = 0;
+    parser->token_line = parser->line;
+    parser->token_column = chunk_column(parser, p);
+    if (token == TOKEN_LITERAL)
+        parser->literal = *p == 't' ? "true" : *p == 'f' ? "false" : "null";
+
+    const char *end = scan_token(parser, token == TOKEN_STRING ? p + 1 : p, parser->chunk_end);
+    if (end)
+        return finish_token(parser, p, (size_t)(end - p)) ? end : NULL;
+
+    parser->buffer.length = 0;
+    if (!buffer_append(&parser->buffer, p, (size_t)(parser->chunk_end - p)))
+    {
+        json_error_set(&parser->error, JSON_ERROR_MEMORY_ALLOCATION, "Failed to buffer partial token");
+        fail(parser);
+        return NULL;
+    }
+    return parser->chunk_end;
+}
+
+/* A value starting at p: containers open a frame, everything else is a token */
+static const char *start_value(JsonPushParser *parser, const char *p)
+{
+    switch (*p)
+    {
+    case '[':
+    case '{':
+        return open_container(parser, p) ? p + 1 : NULL;
+    case '"':
+        return start_token(parser, TOKEN_STRING, p, 0);
+    case 't':
+    case 'f':
+    case 'n':
+        return start_token(parser, TOKEN_LITERAL, p, 0);
+    default:
+        if (*p == '-' || (*p >= '0' && *p <= '9'))
+            return start_token(parser, TOKEN_NUMBER, p, 0);
+        /* Let the parser describe the stray byte */
+        parser->token_line = parser->line;
+        parser->token_column = chunk_column(parser, p);
+        parser->token_is_key = 0;
+        return finish_token(parser, p, 1) ? p + 1 : NULL;
+    }
+}
+
+/* Skip whitespace, counting lines */
+static const char *skip_whitespace(JsonPushParser *parser, const char *p, const char *end)
+{
+    const char *next = json_skip_whitespace(p, end);
+    for (const char *nl = (const char *)memchr(p, '\n', (size_t)(next - p)); nl;
+         nl = (const char *)memchr(nl + 1, '\n', (size_t)(next - nl - 1)))
+    {
+        parser->line++;
+        parser->line_start = parser->offset + (size_t)(nl + 1 - parser->chunk);
+    }
+    return next;
+}
+
+/* One significant byte (or token) in the current state */
+static const char *step(JsonPushParser *parser, const char *p)
+{
+    char c = *p;
+    switch (parser->expect)
+    {
+    case PUSH_FIRST_ELEMENT:
+        if (c == ']')
+            return close_container(parser) ? p + 1 : NULL;
+        return start_value(parser, p);
+
+    case PUSH_NEXT_ELEMENT:
+        if (c == ']')
+        {
+            chunk_error(parser, JSON_ERROR_UNEXPECTED_CHAR, "Trailing comma not allowed in array", p);
+            return NULL;
+        }
+        return start_value(parser, p);
+
+    case PUSH_VALUE:
+        return start_value(parser, p);
+
+    case PUSH_FIRST_KEY:
+    case PUSH_NEXT_KEY:
+        if (c == '}')
+        {
+            if (parser->expect == PUSH_FIRST_KEY)
+                return close_container(parser) ? p + 1 : NULL;
+            chunk_error(parser, JSON_ERROR_UNEXPECTED_CHAR, "Expected string after comma, got '}'", p);
+            return NULL;
+        }
+        if (c != '"')
+        {
+            chunk_error(parser, JSON_ERROR_UNEXPECTED_CHAR, JSON_MESSAGE_EXPECTED_STRING_START, p);
+            return NULL;
+        }
+        return start_token(parser, TOKEN_STRING, p, 1);
+
+    case PUSH_COLON:
+        if (c != ':')
+        {
+            chunk_error(parser, JSON_ERROR_EXPECTED_COLON, "Expected ':' after object key", p);
+            return NULL;
+        }
+        parser->expect = PUSH_VALUE;
+        return p + 1;
+
+    case PUSH_COMMA_OR_CLOSE:
+    {
+        int is_array = JSON_STACK_TOP(&parser->stack, PushFrame)->container->type == JSON_ARRAY;
+        if (c == (is_array ? ']' : '}'))
+            return close_container(parser) ? p + 1 : NULL;
+        if (c == ',')
+        {
+            parser->expect = is_array ? PUSH_NEXT_ELEMENT : PUSH_NEXT_KEY;
+            return p + 1;
+        }
+        after_value_error(parser, chunk_column(parser, p), p, parser->chunk, parser->chunk_end);
+        return NULL;
+    }
+    }
+    return NULL;
+}
+
+static int feed_chunk(JsonPushParser *parser, const char *data, size_t length)
+{
+    const char *p = data;
+    const char *end = data + length;
+    parser->chunk = data;
+    parser->chunk_end = end;
+
+    /* Finish the token the last chunk ended in */
+    if (parser->token != TOKEN_NONE)
+    {
+        const char *token_end = scan_token(parser, p, end);
+        const char *taken = token_end ? token_end : end;
+        if (!buffer_append(&parser->buffer, p, (size_t)(taken - p)))
+        {
+            json_error_set(&parser->error, JSON_ERROR_MEMORY_ALLOCATION, "Failed to buffer partial token");
+            return fail(parser);
+        }
+        if (!token_end)
+            return 1;
+        if (!finish_token(parser, parser->buffer.data, parser->buffer.length))
+            return 0;
+        p = token_end;
+    }
+
+    for (;;)
+    {
+        p = skip_whitespace(parser, p, end);
+        if (p == end)
+            return 1;
+        p = step(parser, p);
+        if (!p)
+            return 0;
+    }
+}
+
+JsonPushParser *json_push_parser_create(JsonPushCallback callback, void *user_data)
+{
+    if (!callback)
+        return NULL;
+    JsonPushParser *parser = (JsonPushParser *)json_heap_calloc(1, sizeof(JsonPushParser));
+    if (!parser)
+        return NULL;
+
+    parser->callback = callback;
+    parser->user_data = user_data;
+    parser->max_depth = json_get_max_depth();
+    json_stack_init(&parser->stack, parser->initial, PUSH_STACK_INITIAL, sizeof(PushFrame));
+    json_push_parser_reset(parser);
+    return parser;
+}
+
+int json_push_parser_feed(JsonPushParser *parser, const char *data, size_t length)
+{
+    if (!parser || parser->failed)
+        return 0;
+    if (!data && length)
+    {
+        json_error_set(&parser->error, JSON_ERROR_INVALID_VALUE, "Input data is NULL");
+        return fail(parser);
+    }
+
+    JsonPhaseMark mark;
+    json_phase_enter(JSON_PHASE_PARSE, &mark);
+    int ok = feed_chunk(parser, data, length);
+    json_phase_leave(&mark);
+    parser->offset += length;
+    return ok;
+}
+
+int json_push_parser_finish(JsonPushParser *parser)
+{
+    if (!parser || parser->failed)
+        return 0;
+
+    /* Nothing follows the buffered token: numbers end here, anything else
+       is reported as cut off by the parser */
+    if (parser->token != TOKEN_NONE && !finish_token(parser, parser->buffer.data, parser->buffer.length))
+        return 0;
+    if (parser->stack.count == 0)
+        return 1;
+
+    /* End of input inside a container, as the parser words it */
+    const char *message = "Unexpected end of input";
+    JsonErrorCode code = JSON_ERROR_UNEXPECTED_CHAR;
+    if (parser->expect == PUSH_FIRST_KEY || parser->expect == PUSH_NEXT_KEY)
+    {
+        message = JSON_MESSAGE_EXPECTED_STRING_START;
+    }
+    else if (parser->expect == PUSH_COLON)
+    {
+        code = JSON_ERROR_EXPECTED_COLON;
+        message = "Expected ':' after object key";
+    }
+    else if (parser->expect == PUSH_COMMA_OR_CLOSE)
+    {
+        static const char nothing[1] = "";
+        return after_value_error(parser, parser->offset - parser->line_start + 1, nothing, nothing, nothing);
+    }
+    json_error_set(&parser->error, code, message);
+    parser->error.line = parser->line;
+    parser->error.column = parser->offset - parser->line_start + 1;
+    return fail(parser);
+}
+
+void json_push_parser_reset(JsonPushParser *parser)
+{
+    if (!parser)
+        return;
+    drop_frames(parser);
+    parser->expect = PUSH_VALUE;
+    parser->offset = 0;
+    parser->line = 1;
+    parser->line_start = 0;
+    parser->failed = 0;
+    json_error_clear(&parser->error);
+}
+
+const JsonError *json_push_parser_error(const JsonPushParser *parser)
+{
+    return parser ? &parser->error : NULL;
+}
+
+size_t json_push_parser_depth(const JsonPushParser *parser)
+{
+    return parser ? parser->stack.count : 0;
+}
+
+void json_push_parser_free(JsonPushParser *parser)
+{
+    if (!parser)
+        return;
+    drop_frames(parser);
+    json_stack_release(&parser->stack);
+    json_heap_free(parser->keys.data);
+    json_heap_free(parser->buffer.data);
+    json_heap_free(parser);
+}
@@ -0,0 +1,548 @@
+/* json_simd.c */
+#include "json_internal.h"
+
+/* Byte scanning kernels used by the parser, validator and formatter.
+   Every kernel has a scalar version; vector versions process 16 (SSE2,
+   NEON) or 32 (AVX2) bytes per step and are picked at runtime */
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define JSON_SIMD_X86 1
+#include <emmintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#include <immintrin.h>
+#define JSON_SIMD_HAVE_AVX2 1
+#define JSON_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64) || (defined(__ARM_NEON) && defined(__arm__))
+#define JSON_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+/* Index of the lowest set bit */
+static unsigned lowest_bit(uint32_t mask)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_ctz(mask);
+#else
+    unsigned index = 0;
+    while (!(mask & 1u))
+    {
+        mask >>= 1;
+        index++;
+    }
+    return index;
+#endif
+}
+
+/* Bytes that end a plain run inside a string literal */
+static int is_string_special_byte(unsigned char c)
+{
+    return c == '"' || c == '\\' || c < 0x20;
+}
+
+/* Scalar kernels */
+static const char *scan_string_scalar(const char *p, const char *end)
+{
+    while (p < end && !is_string_special_byte((unsigned char)*p))
+    {
+        p++;
+    }
+    return p;
+}
+
+static const char *skip_whitespace_scalar(const char *p, const char *end)
+{
+    while (p < end && json_is_space(*p))
+    {
+        p++;
+    }
+    return p;
+}
+
+/* Bytes that delimit values outside strings */
+static int is_structural_byte(unsigned char c)
+{
+    return c == '{' || c == '}' || c == '[' || c == ']' || c == ':' || c == ',';
+}
+
+static void classify_block_scalar(const char *block, JsonBlockMasks *masks)
+{
+    uint64_t quote = 0, backslash = 0, whitespace = 0, structural = 0, control = 0;
+    for (unsigned i = 0; i < 64; i++)
+    {
+        unsigned char c = (unsigned char)block[i];
+        uint64_t bit = (uint64_t)1 << i;
+        if (c < 0x20)
+            control |= bit;
+        if (c == '"')
+            quote |= bit;
+        else if (c == '\\')
+            backslash |= bit;
+        else if (json_is_space((char)c))
+            whitespace |= bit;
+        else if (is_structural_byte(c))
+            structural |= bit;
+    }
+    masks->quote = quote;
+    masks->backslash = backslash;
+    masks->whitespace = whitespace;
+    masks->structural = structural;
+    masks->control = control;
+}
+
+#ifdef JSON_SIMD_X86
+/* SSE2 kernels */
+static const char *scan_string_sse2(const char *p, const char *end)
+{
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control_max = _mm_set1_epi8(0x1F);
+
+    while (end - p >= 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        __m128i special = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                                       _mm_cmpeq_epi8(chunk, backslash));
+        /* Unsigned chunk <= 0x1F */
+        special = _mm_or_si128(special,
+                               _mm_cmpeq_epi8(_mm_max_epu8(chunk, control_max), control_max));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(special);
+        if (mask)
+        {
+            return p + lowest_bit(mask);
+        }
+        p += 16;
+    }
+    return scan_string_scalar(p, end);
+}
+
+static const char *skip_whitespace_sse2(const char *p, const char *end)
+{
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i range = _mm_set1_epi8('\r' - '\t');
+
+    while (end - p >= 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        /* Unsigned (chunk - '\t') <= ('\r' - '\t') covers \t \n \v \f \r */
+        __m128i shifted = _mm_sub_epi8(chunk, tab);
+        __m128i ws = _mm_or_si128(_mm_cmpeq_epi8(chunk, space),
+                                  _mm_cmpeq_epi8(_mm_max_epu8(shifted, range), range));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(ws) ^ 0xFFFFu;
+        if (mask)
+        {
+            return p + lowest_bit(mask);
+        }
+        p += 16;
+    }
+    return skip_whitespace_scalar(p, end);
+}
+
+static void classify_block_sse2(const char *block, JsonBlockMasks *masks)
+{
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i range = _mm_set1_epi8('\r' - '\t');
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i colon = _mm_set1_epi8(':');
+    /* '[' ']' '{' '}' differ from '[' and ']' only in bit 0x20 */
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+    const __m128i open_bracket = _mm_set1_epi8('[');
+    const __m128i close_bracket = _mm_set1_epi8(']');
+    const __m128i control_max = _mm_set1_epi8(0x1F);
+
+    masks->quote = masks->backslash = masks->whitespace = masks->structural = masks->control = 0;
+    for (unsigned i = 0; i < 64; i += 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(block + i));
+        __m128i shifted = _mm_sub_epi8(chunk, tab);
+        __m128i ws = _mm_or_si128(_mm_cmpeq_epi8(chunk, space),
+                                  _mm_cmpeq_epi8(_mm_max_epu8(shifted, range), range));
+        __m128i folded = _mm_andnot_si128(case_bit, chunk);
+        __m128i op = _mm_or_si128(_mm_cmpeq_epi8(folded, open_bracket), _mm_cmpeq_epi8(folded, close_bracket));
+        op = _mm_or_si128(op, _mm_or_si128(_mm_cmpeq_epi8(chunk, comma), _mm_cmpeq_epi8(chunk, colon)));
+
+        masks->quote |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, quote)) << i;
+        masks->backslash |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, backslash)) << i;
+        masks->whitespace |= (uint64_t)(uint32_t)_mm_movemask_epi8(ws) << i;
+        masks->structural |= (uint64_t)(uint32_t)_mm_movemask_epi8(op) << i;
+        masks->control |= (uint64_t)(uint32_t)_mm_movemask_epi8(
+                              _mm_cmpeq_epi8(_mm_max_epu8(chunk, control_max), control_max)) << i;
+    }
+}
+#endif
+
+#ifdef JSON_SIMD_HAVE_AVX2
+/* AVX2 kernels */
+JSON_TARGET_AVX2 static const char *scan_string_avx2(const char *p, const char *end)
+{
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i control_max = _mm256_set1_epi8(0x1F);
+
+    while (end - p >= 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)p);
+        __m256i special = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote),
+                                          _mm256_cmpeq_epi8(chunk, backslash));
+        special = _mm256_or_si256(special,
+                                  _mm256_cmpeq_epi8(_mm256_max_epu8(chunk, control_max), control_max));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(special);
+        if (mask)
+        {
+            return p + lowest_bit(mask);
+        }
+        p += 32;
+    }
+    /* Clear the upper halves before the SSE tail: the compiler turns the
+       call into a jump without vzeroupper, and mixing the two encodings
+       with dirty upper halves costs far more than the scan itself */
+    _mm256_zeroupper();
+    return scan_string_sse2(p, end);
+}
+
+JSON_TARGET_AVX2 static const char *skip_whitespace_avx2(const char *p, const char *end)
+{
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i range = _mm256_set1_epi8('\r' - '\t');
+
+    while (end - p >= 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)p);
+        __m256i shifted = _mm256_sub_epi8(chunk, tab);
+        __m256i ws = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, space),
+                                     _mm256_cmpeq_epi8(_mm256_max_epu8(shifted, range), range));
+        uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(ws);
+        if (mask)
+        {
+            return p + lowest_bit(mask);
+        }
+        p += 32;
+    }
+    _mm256_zeroupper(); /* See scan_string_avx2() */
+    return skip_whitespace_sse2(p, end);
+}
+
+JSON_TARGET_AVX2 static void classify_block_avx2(const char *block, JsonBlockMasks *masks)
+{
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i range = _mm256_set1_epi8('\r' - '\t');
+    const __m256i comma = _mm256_set1_epi8(',');
+    const __m256i colon = _mm256_set1_epi8(':');
+    const __m256i case_bit = _mm256_set1_epi8(0x20);
+    const __m256i open_bracket = _mm256_set1_epi8('[');
+    const __m256i close_bracket = _mm256_set1_epi8(']');
+    const __m256i control_max = _mm256_set1_epi8(0x1F);
+
+    masks->quote = masks->backslash = masks->whitespace = masks->structural = masks->control = 0;
+    for (unsigned i = 0; i < 64; i += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(block + i));
+        __m256i shifted = _mm256_sub_epi8(chunk, tab);
+        __m256i ws = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, space),
+                                     _mm256_cmpeq_epi8(_mm256_max_epu8(shifted, range), range));
+        __m256i folded = _mm256_andnot_si256(case_bit, chunk);
+        __m256i op = _mm256_or_si256(_mm256_cmpeq_epi8(folded, open_bracket),
+                                     _mm256_cmpeq_epi8(folded, close_bracket));
+        op = _mm256_or_si256(op, _mm256_or_si256(_mm256_cmpeq_epi8(chunk, comma),
+                                                 _mm256_cmpeq_epi8(chunk, colon)));
+
+        masks->quote |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, quote)) << i;
+        masks->backslash |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, backslash)) << i;
+        masks->whitespace |= (uint64_t)(uint32_t)_mm256_movemask_epi8(ws) << i;
+        masks->structural |= (uint64_t)(uint32_t)_mm256_movemask_epi8(op) << i;
+        masks->control |= (uint64_t)(uint32_t)_mm256_movemask_epi8(
+                              _mm256_cmpeq_epi8(_mm256_max_epu8(chunk, control_max), control_max)) << i;
+    }
+}
+#endif
+
+#ifdef JSON_SIMD_NEON
+/* Offset of the first non-zero byte of a comparison result, or 16 */
+static unsigned neon_first_set(uint8x16_t matches)
+{
+    /* Narrow to 4 bits per byte so the result fits into a 64-bit scalar */
+    uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(
+                        vshrn_n_u16(vreinterpretq_u16_u8(matches), 4)), 0);
+    if (!mask)
+    {
+        return 16;
+    }
+    return (unsigned)__builtin_ctzll(mask) >> 2;
+}
+
+static const char *scan_string_neon(const char *p, const char *end)
+{
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t backslash = vdupq_n_u8('\\');
+    const uint8x16_t control_limit = vdupq_n_u8(0x20);
+
+    while (end - p >= 16)
+    {
+        uint8x16_t chunk = vld1q_u8((const uint8_t *)p);
+        uint8x16_t special = vorrq_u8(vceqq_u8(chunk, quote), vceqq_u8(chunk, backslash));
+        special = vorrq_u8(special, vcltq_u8(chunk, control_limit));
+        unsigned offset = neon_first_set(special);
+        if (offset < 16)
+        {
+            return p + offset;
+        }
+        p += 16;
+    }
+    return scan_string_scalar(p, end);
+}
+
+static const char *skip_whitespace_neon(const char *p, const char *end)
+{
+    const uint8x16_t space = vdupq_n_u8(' ');
+    const uint8x16_t tab = vdupq_n_u8('\t');
+    const uint8x16_t range = vdupq_n_u8('\r' - '\t');
+
+    while (end - p >= 16)
+    {
+        uint8x16_t chunk = vld1q_u8((const uint8_t *)p);
+        uint8x16_t ws = vorrq_u8(vceqq_u8(chunk, space), vcleq_u8(vsubq_u8(chunk, tab), range));
+        unsigned offset = neon_first_set(vmvnq_u8(ws));
+        if (offset < 16)
+        {
+            return p + offset;
+        }
+        p += 16;
+    }
+    return skip_whitespace_scalar(p, end);
+}
+
+#ifdef __aarch64__
+/* One bit per byte of four comparison results, like x86 movemask */
+static uint64_t neon_movemask_64(uint8x16_t m0, uint8x16_t m1, uint8x16_t m2, uint8x16_t m3)
+{
+    static const uint8_t weights[16] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80,
+                                        0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80};
+    const uint8x16_t bits = vld1q_u8(weights);
+    uint8x16_t sum0 = vpaddq_u8(vandq_u8(m0, bits), vandq_u8(m1, bits));
+    uint8x16_t sum1 = vpaddq_u8(vandq_u8(m2, bits), vandq_u8(m3, bits));
+    sum0 = vpaddq_u8(sum0, sum1);
+    sum0 = vpaddq_u8(sum0, sum0);
+    return vgetq_lane_u64(vreinterpretq_u64_u8(sum0), 0);
+}
+
+static void classify_block_neon(const char *block, JsonBlockMasks *masks)
+{
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t backslash = vdupq_n_u8('\\');
+    const uint8x16_t space = vdupq_n_u8(' ');
+    const uint8x16_t tab = vdupq_n_u8('\t');
+    const uint8x16_t range = vdupq_n_u8('\r' - '\t');
+    const uint8x16_t comma = vdupq_n_u8(',');
+    const uint8x16_t colon = vdupq_n_u8(':');
+    const uint8x16_t case_bit = vdupq_n_u8(0x20);
+    const uint8x16_t open_bracket = vdupq_n_u8('[');
+    const uint8x16_t close_bracket = vdupq_n_u8(']');
+    const uint8x16_t control_max = vdupq_n_u8(0x1F);
+
+    uint8x16_t q[4], b[4], w[4], o[4], c[4];
+    for (unsigned i = 0; i < 4; i++)
+    {
+        uint8x16_t chunk = vld1q_u8((const uint8_t *)block + 16 * i);
+        uint8x16_t folded = vbicq_u8(chunk, case_bit);
+        q[i] = vceqq_u8(chunk, quote);
+        b[i] = vceqq_u8(chunk, backslash);
+        w[i] = vorrq_u8(vceqq_u8(chunk, space), vcleq_u8(vsubq_u8(chunk, tab), range));
+        o[i] = vorrq_u8(vorrq_u8(vceqq_u8(folded, open_bracket), vceqq_u8(folded, close_bracket)),
+                        vorrq_u8(vceqq_u8(chunk, comma), vceqq_u8(chunk, colon)));
+        c[i] = vcleq_u8(chunk, control_max);
+    }
+    masks->quote = neon_movemask_64(q[0], q[1], q[2], q[3]);
+    masks->backslash = neon_movemask_64(b[0], b[1], b[2], b[3]);
+    masks->whitespace = neon_movemask_64(w[0], w[1], w[2], w[3]);
+    masks->structural = neon_movemask_64(o[0], o[1], o[2], o[3]);
+    masks->control = neon_movemask_64(c[0], c[1], c[2], c[3]);
+}
+#else
+#define classify_block_neon classify_block_scalar
+#endif
+#endif
+
+/* Kernel table selected at runtime */
+typedef struct
+{
+    JsonSimdLevel level;
+    const char *(*scan_string)(const char *p, const char *end);
+    const char *(*skip_whitespace)(const char *p, const char *end);
+    void (*classify_block)(const char *block, JsonBlockMasks *masks);
+} SimdKernels;
+
+static const SimdKernels scalar_kernels = {JSON_SIMD_SCALAR, scan_string_scalar, skip_whitespace_scalar,
+                                           classify_block_scalar};
+#ifdef JSON_SIMD_X86
+static const SimdKernels sse2_kernels = {JSON_SIMD_SSE2, scan_string_sse2, skip_whitespace_sse2,
+                                         classify_block_sse2};
+#endif
+#ifdef JSON_SIMD_HAVE_AVX2
+static const SimdKernels avx2_kernels = {JSON_SIMD_AVX2, scan_string_avx2, skip_whitespace_avx2,
+                                         classify_block_avx2};
+#endif
+#ifdef JSON_SIMD_NEON
+static const SimdKernels neon_kernels = {JSON_SIMD_NEON, scan_string_neon, skip_whitespace_neon,
+                                         classify_block_neon};
+#endif
+
+/* Shared by all threads. Racing first uses store the same pointer, the
+   atomic accesses only keep that race well defined */
+static const SimdKernels *active_kernels = NULL;
+
+#if defined(__GNUC__) || defined(__clang__)
+#define KERNELS_LOAD() __atomic_load_n(&active_kernels, __ATOMIC_ACQUIRE)
+#define KERNELS_STORE(kernels) __atomic_store_n(&active_kernels, (kernels), __ATOMIC_RELEASE)
+#else
+#define KERNELS_LOAD() (active_kernels)
+#define KERNELS_STORE(kernels) (active_kernels = (kernels))
+#endif
+
+/* Kernels for a level, or NULL when this build or CPU cannot run it */
+static const SimdKernels *kernels_for_level(JsonSimdLevel level)
+{
+    switch (level)
+    {
+    case JSON_SIMD_SCALAR:
+        return &scalar_kernels;
+#ifdef JSON_SIMD_X86
+    case JSON_SIMD_SSE2:
+#if defined(__GNUC__) || defined(__clang__)
+        if (!__builtin_cpu_supports("sse2"))
+            return NULL;
+#endif
+        return &sse2_kernels;
+#endif
+#ifdef JSON_SIMD_HAVE_AVX2
+    case JSON_SIMD_AVX2:
+        if (!__builtin_cpu_supports("avx2"))
+            return NULL;
+        return &avx2_kernels;
+#endif
+#ifdef JSON_SIMD_NEON
+    case JSON_SIMD_NEON:
+        return &neon_kernels;
+#endif
+    case JSON_SIMD_AUTO:
+    {
+        static const JsonSimdLevel preference[] = {JSON_SIMD_AVX2, JSON_SIMD_SSE2, JSON_SIMD_NEON};
+        for (size_t i = 0; i < sizeof(preference) / sizeof(preference[0]); i++)
+        {
+            const SimdKernels *kernels = kernels_for_level(preference[i]);
+            if (kernels)
+                return kernels;
+        }
+        return &scalar_kernels;
+    }
+    default:
+        return NULL;
+    }
+}
+
+static const SimdKernels *get_kernels(void)
+{
+    const SimdKernels *kernels = KERNELS_LOAD();
+    if (!kernels)
+    {
+        kernels = kernels_for_level(JSON_SIMD_AUTO);
+        KERNELS_STORE(kernels);
+    }
+    return kernels;
+}
+
+/* Select the kernels used from now on. Returns 0 if the level is not available */
+int json_set_simd_level(JsonSimdLevel level)
+{
+    const SimdKernels *kernels = kernels_for_level(level);
+    if (!kernels)
+    {
+        return 0;
+    }
+    KERNELS_STORE(kernels);
+    return 1;
+}
+
+/* Level of the kernels currently in use */
+JsonSimdLevel json_get_simd_level(void)
+{
+    return get_kernels()->level;
+}
+
+/* First '"', '\\' or control character in [p, end), or end */
+const char *json_scan_string(const char *p, const char *end)
+{
+    return get_kernels()->scan_string(p, end);
+}
+
+/* First non-whitespace byte in [p, end), or end */
+const char *json_skip_whitespace(const char *p, const char *end)
+{
+    /* Most runs are empty or a single space, skip the call overhead */
+    if (p < end && !json_is_space(*p))
+        return p;
+    if (end - p >= 2 && !json_is_space(p[1]))
+        return p + 1;
+    return get_kernels()->skip_whitespace(p, end);
+}
+
+/* Masks of quotes, backslashes, whitespace and {}[]:, in 64 bytes */
+void json_classify_block(const char *block, JsonBlockMasks *masks)
+{
+    get_kernels()->classify_block(block, masks);
+}
+
+/* Bit i set when an odd number of quote bits are at or below i */
+uint64_t json_prefix_xor(uint64_t bits)
+{
+    bits ^= bits << 1;
+    bits ^= bits << 2;
+    bits ^= bits << 4;
+    bits ^= bits << 8;
+    bits ^= bits << 16;
+    bits ^= bits << 32;
+    return bits;
+}
+
+/* Bits of the bytes escaped by a backslash. Backslashes are rare, so the
+   runs are resolved one at a time */
+uint64_t json_find_escaped(uint64_t backslash, uint64_t *carry)
+{
+    uint64_t escaped = *carry;
+    backslash &= ~escaped;
+    *carry = 0;
+    while (backslash)
+    {
+        uint64_t bit = backslash & (~backslash + 1);
+        uint64_t next = bit << 1;
+        if (!next)
+            *carry = 1; /* Escapes the first byte of the next block */
+        escaped |= next;
+        backslash &= ~(bit | next);
+    }
+    return escaped;
+}
+
+/* Line and column (both 1-based) of position within input */
+void json_text_position(const char *input, const char *position, size_t *line, size_t *column)
+{
+    size_t current_line = 1;
+    const char *line_start = input;
+    for (const char *p = input; p < position; p++)
+    {
+        if (*p == '\n')
+        {
+            current_line++;
+            line_start = p + 1;
+        }
+    }
+    *line = current_line;
+    *column = (size_t)(position - line_start) + 1;
+}
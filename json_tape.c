@@ -0,0 +1,888 @@
+/* json_tape.c */
+#include "json_internal.h"
+#include <math.h>
+
+/* Two-stage parser. Stage 1 classifies the input 64 bytes at a time with
+   the SIMD kernels and records the offset of every structural character,
+   opening quote and scalar start that lies outside a string. Stage 2 walks
+   those offsets with an explicit stack and writes a flat tape of 64-bit
+   entries: the top byte is the entry type, the low 56 bits its payload.
+
+     '[' '{'  low 32 bits: tape index after the matching close,
+              bits 32-55:  number of elements or members (saturated)
+     ']' '}'  tape index of the matching open
+     's'      offset in the string buffer of a 32-bit length, the bytes and a NUL
+     'l' 'd'  followed by one raw entry: int64_t or the bits of a double
+     'n' 't' 'f'
+
+   Members of an object are a key 's' entry followed by the value. Any
+   input the tape rejects is handed to the recursive parser, so errors
+   (code, message, position, context) are exactly those of json_parse_buffer */
+
+#define TAPE_TYPE_SHIFT 56
+#define TAPE_PAYLOAD_MASK ((UINT64_C(1) << TAPE_TYPE_SHIFT) - 1)
+#define TAPE_COUNT_SHIFT 32
+#define TAPE_COUNT_MAX 0xFFFFFFu
+#define TAPE_MAX_INPUT 0xFFFFFFFFu
+
+struct JsonTape
+{
+    uint64_t *entries;
+    size_t length;
+    char *strings;
+    size_t strings_length;
+};
+
+static uint64_t tape_entry(char type, uint64_t payload)
+{
+    return ((uint64_t)(unsigned char)type << TAPE_TYPE_SHIFT) | (payload & TAPE_PAYLOAD_MASK);
+}
+
+static char entry_type(uint64_t entry)
+{
+    return (char)(entry >> TAPE_TYPE_SHIFT);
+}
+
+static uint64_t entry_payload(uint64_t entry)
+{
+    return entry & TAPE_PAYLOAD_MASK;
+}
+
+static unsigned count_bits64(uint64_t mask)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_popcountll(mask);
+#else
+    unsigned count = 0;
+    for (; mask; mask &= mask - 1)
+        count++;
+    return count;
+#endif
+}
+
+/* Stage 1 state carried from one block to the next */
+typedef struct
+{
+    uint64_t escape_carry;    /* Byte 0 of the next block is escaped */
+    uint64_t in_string;       /* All ones while inside a string */
+    uint64_t scalar_carry;    /* Last byte of the block was part of a scalar */
+} StructuralScan;
+
+/* Offsets of the structural bytes of one block, appended to indexes */
+static size_t scan_block(StructuralScan *scan, const char *block, uint32_t base, uint32_t *indexes,
+                         size_t *string_count)
+{
+    JsonBlockMasks masks;
+    json_classify_block(block, &masks);
+
+    uint64_t escaped = json_find_escaped(masks.backslash, &scan->escape_carry);
+    uint64_t quotes = masks.quote & ~escaped;
+    uint64_t in_string = json_prefix_xor(quotes) ^ scan->in_string;
+    scan->in_string = (uint64_t)0 - (in_string >> 63);
+
+    uint64_t opening_quotes = quotes & in_string;
+    uint64_t outside = ~in_string;
+    uint64_t scalar = ~(masks.whitespace | masks.structural | masks.quote) & outside;
+    uint64_t scalar_starts = scalar & ~((scalar << 1) | scan->scalar_carry);
+    scan->scalar_carry = scalar >> 63;
+
+    uint64_t bits = (masks.structural & outside) | opening_quotes | scalar_starts;
+    *string_count += count_bits64(opening_quotes);
+
+    size_t count = 0;
+    while (bits)
+    {
+        indexes[count++] = base + json_lowest_bit64(bits);
+        bits &= bits - 1;
+    }
+    return count;
+}
+
+/* Stage 1. Returns the number of indexes, with *unclosed set when the
+   input ends inside a string */
+static size_t find_structurals(const char *data, size_t length, uint32_t *indexes, size_t *string_count,
+                               int *unclosed)
+{
+    StructuralScan scan = {0, 0, 0};
+    size_t count = 0;
+    size_t offset = 0;
+
+    for (; offset + 64 <= length; offset += 64)
+    {
+        count += scan_block(&scan, data + offset, (uint32_t)offset, indexes + count, string_count);
+    }
+    if (offset < length)
+    {
+        /* Pad the tail with whitespace, which never adds an index */
+        char block[64];
+        memset(block, ' ', sizeof(block));
+        memcpy(block, data + offset, length - offset);
+        count += scan_block(&scan, block, (uint32_t)offset, indexes + count, string_count);
+    }
+    *unclosed = scan.in_string != 0;
+    return count;
+}
+
+/* Stage 2 */
+typedef struct
+{
+    const char *input;
+    const char *input_end;
+    const uint32_t *indexes;
+    size_t index_count;
+    size_t next;              /* Next index to consume */
+    JsonTape *tape;
+    size_t max_depth;
+    int out_of_memory;        /* The scope stack could not grow */
+} TapeBuilder;
+
+/* Scopes held without touching the heap */
+#define TAPE_INITIAL_SCOPES JSON_MAX_NESTING_DEPTH
+
+typedef struct
+{
+    size_t open;              /* Tape index of the open entry */
+    size_t count;
+    int is_object;
+} TapeScope;
+
+/* Position of the next token, NULL when the indexes are used up */
+static const char *next_token(TapeBuilder *builder)
+{
+    if (builder->next >= builder->index_count)
+        return NULL;
+    return builder->input + builder->indexes[builder->next++];
+}
+
+/* A scalar must be followed only by whitespace up to the next token */
+static int scalar_ends_cleanly(const TapeBuilder *builder, const char *end)
+{
+    const char *after = json_skip_whitespace(end, builder->input_end);
+    const char *token = builder->next < builder->index_count ? builder->input + builder->indexes[builder->next]
+                                                              : builder->input_end;
+    return after == token;
+}
+
+/* Decode the string starting at token into the string buffer */
+static int write_string(TapeBuilder *builder, const char *token)
+{
+    JsonTape *tape = builder->tape;
+    const char *p = token + 1;
+    const char *end = builder->input_end;
+    size_t header = tape->strings_length;
+    char *out = tape->strings + header + sizeof(uint32_t);
+    size_t length = 0;
+
+    for (;;)
+    {
+        const char *run = json_scan_string(p, end);
+        memcpy(out + length, p, (size_t)(run - p));
+        length += (size_t)(run - p);
+        p = run;
+        if (p >= end || (unsigned char)*p < 0x20)
+            return 0;
+        if (*p == '"')
+            break;
+
+        /* Backslash */
+        if (end - p < 2)
+            return 0;
+        char c = p[1];
+        p += 2;
+        switch (c)
+        {
+        case '"':  out[length++] = '"';  break;
+        case '\\': out[length++] = '\\'; break;
+        case '/':  out[length++] = '/';  break;
+        case 'b':  out[length++] = '\b'; break;
+        case 'f':  out[length++] = '\f'; break;
+        case 'n':  out[length++] = '\n'; break;
+        case 'r':  out[length++] = '\r'; break;
+        case 't':  out[length++] = '\t'; break;
+        case 'u':
+        {
+            uint32_t code_point = 0;
+            for (int pass = 0; pass < 2; pass++)
+            {
+                uint32_t unit = 0;
+                if (end - p < 4)
+                    return 0;
+                for (int i = 0; i < 4; i++)
+                {
+                    char h = p[i];
+                    int digit = (h >= '0' && h <= '9') ? h - '0'
+                              : (h >= 'a' && h <= 'f') ? h - 'a' + 10
+                              : (h >= 'A' && h <= 'F') ? h - 'A' + 10 : -1;
+                    if (digit < 0)
+                        return 0;
+                    unit = (unit << 4) | (uint32_t)digit;
+                }
+                p += 4;
+                if (pass == 0)
+                {
+                    if (unit >= 0xDC00 && unit <= 0xDFFF)
+                        return 0;
+                    code_point = unit;
+                    if (unit < 0xD800 || unit > 0xDBFF)
+                        break;
+                    /* High surrogate: a low one must follow */
+                    if (end - p < 2 || p[0] != '\\' || p[1] != 'u')
+                        return 0;
+                    p += 2;
+                }
+                else
+                {
+                    if (unit < 0xDC00 || unit > 0xDFFF)
+                        return 0;
+                    code_point = 0x10000 + (((code_point - 0xD800) << 10) | (unit - 0xDC00));
+                }
+            }
+
+            char *utf8 = out + length;
+            if (code_point <= 0x7F)
+            {
+                utf8[0] = (char)code_point;
+                length += 1;
+            }
+            else if (code_point <= 0x7FF)
+            {
+                utf8[0] = (char)(0xC0 | (code_point >> 6));
+                utf8[1] = (char)(0x80 | (code_point & 0x3F));
+                length += 2;
+            }
+            else if (code_point <= 0xFFFF)
+            {
+                utf8[0] = (char)(0xE0 | (code_point >> 12));
+                utf8[1] = (char)(0x80 | ((code_point >> 6) & 0x3F));
+                utf8[2] = (char)(0x80 | (code_point & 0x3F));
+                length += 3;
+            }
+            else
+            {
+                utf8[0] = (char)(0xF0 | (code_point >> 18));
+                utf8[1] = (char)(0x80 | ((code_point >> 12) & 0x3F));
+                utf8[2] = (char)(0x80 | ((code_point >> 6) & 0x3F));
+                utf8[3] = (char)(0x80 | (code_point & 0x3F));
+                length += 4;
+            }
+            break;
+        }
+        default:
+            return 0;
+        }
+    }
+
+    uint32_t stored = (uint32_t)length;
+    memcpy(tape->strings + header, &stored, sizeof(stored));
+    out[length] = '\0';
+    tape->strings_length = header + sizeof(uint32_t) + length + 1;
+    tape->entries[tape->length++] = tape_entry('s', header);
+    return 1;
+}
+
+/* Number, literal or string at token */
+static int write_scalar(TapeBuilder *builder, const char *token)
+{
+    JsonTape *tape = builder->tape;
+    size_t remaining = (size_t)(builder->input_end - token);
+
+    switch (*token)
+    {
+    case '"':
+        return write_string(builder, token);
+    case 't':
+        if (remaining < 4 || memcmp(token, "true", 4) != 0 || !scalar_ends_cleanly(builder, token + 4))
+            return 0;
+        tape->entries[tape->length++] = tape_entry('t', 0);
+        return 1;
+    case 'f':
+        if (remaining < 5 || memcmp(token, "false", 5) != 0 || !scalar_ends_cleanly(builder, token + 5))
+            return 0;
+        tape->entries[tape->length++] = tape_entry('f', 0);
+        return 1;
+    case 'n':
+        if (remaining < 4 || memcmp(token, "null", 4) != 0 || !scalar_ends_cleanly(builder, token + 4))
+            return 0;
+        tape->entries[tape->length++] = tape_entry('n', 0);
+        return 1;
+    default:
+    {
+        if (*token != '-' && (*token < '0' || *token > '9'))
+            return 0;
+        JsonNumberParse number;
+        if (!json_number_parse(token, builder->input_end, &number) || isnan(number.number) ||
+            isinf(number.number) || !scalar_ends_cleanly(builder, number.end))
+            return 0;
+        if (number.is_integer)
+        {
+            tape->entries[tape->length++] = tape_entry('l', 0);
+            memcpy(&tape->entries[tape->length++], &number.integer, sizeof(uint64_t));
+        }
+        else
+        {
+            tape->entries[tape->length++] = tape_entry('d', 0);
+            memcpy(&tape->entries[tape->length++], &number.number, sizeof(uint64_t));
+        }
+        return 1;
+    }
+    }
+}
+
+static void open_scope(TapeBuilder *builder, TapeScope *scope, int is_object)
+{
+    scope->open = builder->tape->length;
+    scope->count = 0;
+    scope->is_object = is_object;
+    builder->tape->entries[builder->tape->length++] = tape_entry(is_object ? '{' : '[', 0);
+}
+
+static void close_scope(TapeBuilder *builder, const TapeScope *scope)
+{
+    JsonTape *tape = builder->tape;
+    size_t close = tape->length++;
+    uint64_t count = scope->count > TAPE_COUNT_MAX ? TAPE_COUNT_MAX : scope->count;
+    tape->entries[close] = tape_entry(scope->is_object ? '}' : ']', scope->open);
+    tape->entries[scope->open] = tape_entry(scope->is_object ? '{' : '[',
+                                            (count << TAPE_COUNT_SHIFT) | (uint64_t)(close + 1));
+}
+
+/* Stage 2, with open containers on an explicit stack. Returns 0 on any
+   syntax error; the caller reports it */
+static int build_tape_scopes(TapeBuilder *builder, JsonStack *scopes)
+{
+    TapeScope *scope;
+    const char *token;
+
+value:
+    token = next_token(builder);
+    if (!token)
+        return 0;
+    if (*token == '{' || *token == '[')
+    {
+        if (scopes->count >= builder->max_depth)
+            return 0;
+        scope = (TapeScope *)json_stack_push(scopes);
+        if (!scope)
+        {
+            builder->out_of_memory = 1;
+            return 0;
+        }
+        int is_object = *token == '{';
+        open_scope(builder, scope, is_object);
+
+        const char *peek = builder->next < builder->index_count ? builder->input + builder->indexes[builder->next]
+                                                                 : NULL;
+        if (peek && *peek == (is_object ? '}' : ']'))
+        {
+            builder->next++;
+            close_scope(builder, scope);
+            scopes->count--;
+            goto after_value;
+        }
+        if (is_object)
+            goto key;
+        goto value;
+    }
+    if (!write_scalar(builder, token))
+        return 0;
+
+after_value:
+    if (scopes->count == 0)
+        return builder->next == builder->index_count; /* Only whitespace may follow */
+    scope = JSON_STACK_TOP(scopes, TapeScope);
+    scope->count++;
+    token = next_token(builder);
+    if (!token)
+        return 0;
+    if (*token == ',')
+    {
+        if (scope->is_object)
+            goto key;
+        goto value;
+    }
+    if (*token != (scope->is_object ? '}' : ']'))
+        return 0;
+    close_scope(builder, scope);
+    scopes->count--;
+    goto after_value;
+
+key:
+    token = next_token(builder);
+    if (!token || *token != '"' || !write_string(builder, token))
+        return 0;
+    token = next_token(builder);
+    if (!token || *token != ':')
+        return 0;
+    goto value;
+}
+
+static int build_tape(TapeBuilder *builder)
+{
+    TapeScope initial[TAPE_INITIAL_SCOPES];
+    JsonStack scopes;
+    json_stack_init(&scopes, initial, TAPE_INITIAL_SCOPES, sizeof(TapeScope));
+    int ok = build_tape_scopes(builder, &scopes);
+    json_stack_release(&scopes);
+    return ok;
+}
+
+void json_tape_free(JsonTape *tape)
+{
+    if (!tape)
+        return;
+    json_heap_free(tape->entries);
+    json_heap_free(tape->strings);
+    json_heap_free(tape);
+}
+
+static JsonTape *tape_parse(const char *data, size_t length, size_t max_depth, JsonError *error)
+{
+    JsonError scratch;
+    if (!error)
+        error = &scratch;
+
+    if (!data)
+    {
+        json_error_set(error, JSON_ERROR_INVALID_VALUE, "In put string is NULL");
+        return NULL;
+    }
+    if (length > TAPE_MAX_INPUT)
+    {
+        json_error_set(error, JSON_ERROR_INVALID_VALUE, "Input too large for the tape engine");
+        return NULL;
+    }
+
+    JsonTape *tape = (JsonTape *)json_heap_calloc(1, sizeof(JsonTape));
+    uint32_t *indexes = (uint32_t *)json_heap_alloc((length + 1) * sizeof(uint32_t));
+    if (!tape || !indexes)
+    {
+        json_heap_free(tape);
+        json_heap_free(indexes);
+        json_error_set(error, JSON_ERROR_MEMORY_ALLOCATION, "Failed to allocate tape");
+        return NULL;
+    }
+
+    size_t string_count = 0;
+    int unclosed = 0;
+    size_t index_count = find_structurals(data, length, indexes, &string_count, &unclosed);
+
+    /* Every index yields at most two entries; strings never grow when decoded */
+    tape->entries = (uint64_t *)json_heap_alloc((2 * index_count + 1) * sizeof(uint64_t));
+    tape->strings = (char *)json_heap_alloc(length + string_count * (sizeof(uint32_t) + 1) + 1);
+    if (!tape->entries || !tape->strings)
+    {
+        json_heap_free(indexes);
+        json_tape_free(tape);
+        json_error_set(error, JSON_ERROR_MEMORY_ALLOCATION, "Failed to allocate tape");
+        return NULL;
+    }
+
+    TapeBuilder builder = {data, data + length, indexes, index_count, 0, tape,
+                           json_resolve_max_depth(max_depth), 0};
+    int ok = !unclosed && build_tape(&builder);
+    json_heap_free(indexes);
+    if (ok)
+    {
+        json_error_clear(error);
+        return tape;
+    }
+
+    json_tape_free(tape);
+    if (builder.out_of_memory)
+    {
+        json_error_set(error, JSON_ERROR_MEMORY_ALLOCATION, "Failed to allocate tape");
+        return NULL;
+    }
+    /* Let the parser's grammar describe the problem */
+    if (json_parse_check_r(data, length, max_depth, error))
+        json_error_set(error, JSON_ERROR_INVALID_VALUE, "Input rejected by the tape engine");
+    return NULL;
+}
+
+/* Parse length bytes of data into a tape. On failure error receives what
+   json_parse_buffer_r() reports for the same input (error may be NULL) */
+JsonTape *json_tape_parse(const char *data, size_t length, JsonError *error)
+{
+    return json_tape_parse_depth_r(data, length, 0, error);
+}
+
+JsonTape *json_tape_parse_depth_r(const char *data, size_t length, size_t max_depth, JsonError *error)
+{
+    JsonPhaseMark mark;
+    json_phase_enter(JSON_PHASE_PARSE, &mark);
+    JsonTape *tape = tape_parse(data, length, max_depth, error);
+    json_phase_leave(&mark);
+    return tape;
+}
+
+/* Cursors */
+static JsonCursor make_cursor(const JsonTape *tape, size_t index, int in_object)
+{
+    JsonCursor cursor = {tape, index, in_object};
+    return cursor;
+}
+
+static const JsonCursor invalid_cursor = {NULL, 0, 0};
+
+static uint64_t cursor_entry(JsonCursor cursor)
+{
+    return cursor.tape->entries[cursor.index];
+}
+
+/* Tape index just past the value at index */
+static size_t skip_value(const JsonTape *tape, size_t index)
+{
+    uint64_t entry = tape->entries[index];
+    switch (entry_type(entry))
+    {
+    case '[':
+    case '{':
+        return (size_t)(entry_payload(entry) & 0xFFFFFFFFu);
+    case 'l':
+    case 'd':
+        return index + 2;
+    default:
+        return index + 1;
+    }
+}
+
+JsonCursor json_tape_root(const JsonTape *tape)
+{
+    return tape && tape->length ? make_cursor(tape, 0, 0) : invalid_cursor;
+}
+
+int json_cursor_is_valid(JsonCursor cursor)
+{
+    return cursor.tape != NULL;
+}
+
+JsonType json_cursor_type(JsonCursor cursor)
+{
+    if (!cursor.tape)
+        return JSON_NULL;
+    switch (entry_type(cursor_entry(cursor)))
+    {
+    case 't':
+    case 'f':
+        return JSON_BOOLEAN;
+    case 'l':
+    case 'd':
+        return JSON_NUMBER;
+    case 's':
+        return JSON_STRING;
+    case '[':
+        return JSON_ARRAY;
+    case '{':
+        return JSON_OBJECT;
+    default:
+        return JSON_NULL;
+    }
+}
+
+int json_cursor_boolean(JsonCursor cursor)
+{
+    return cursor.tape && entry_type(cursor_entry(cursor)) == 't';
+}
+
+int json_cursor_is_integer(JsonCursor cursor)
+{
+    return cursor.tape && entry_type(cursor_entry(cursor)) == 'l';
+}
+
+int64_t json_cursor_integer(JsonCursor cursor)
+{
+    if (!cursor.tape)
+        return 0;
+    char type = entry_type(cursor_entry(cursor));
+    if (type == 'l')
+    {
+        int64_t value;
+        memcpy(&value, &cursor.tape->entries[cursor.index + 1], sizeof(value));
+        return value;
+    }
+    return type == 'd' ? (int64_t)json_cursor_number(cursor) : 0;
+}
+
+double json_cursor_number(JsonCursor cursor)
+{
+    if (!cursor.tape)
+        return 0.0;
+    char type = entry_type(cursor_entry(cursor));
+    if (type == 'l')
+        return (double)json_cursor_integer(cursor);
+    if (type == 'd')
+    {
+        double value;
+        memcpy(&value, &cursor.tape->entries[cursor.index + 1], sizeof(value));
+        return value;
+    }
+    return 0.0;
+}
+
+/* NUL terminated string at a string entry, its byte length in *length */
+static const char *tape_string(const JsonTape *tape, uint64_t entry, size_t *length)
+{
+    const char *header = tape->strings + entry_payload(entry);
+    uint32_t stored;
+    memcpy(&stored, header, sizeof(stored));
+    if (length)
+        *length = stored;
+    return header + sizeof(stored);
+}
+
+const char *json_cursor_string(JsonCursor cursor, size_t *length)
+{
+    if (!cursor.tape || entry_type(cursor_entry(cursor)) != 's')
+    {
+        if (length)
+            *length = 0;
+        return NULL;
+    }
+    return tape_string(cursor.tape, cursor_entry(cursor), length);
+}
+
+size_t json_cursor_size(JsonCursor cursor)
+{
+    if (!cursor.tape)
+        return 0;
+    uint64_t entry = cursor_entry(cursor);
+    char type = entry_type(entry);
+    if (type != '[' && type != '{')
+        return 0;
+
+    size_t count = (size_t)(entry_payload(entry) >> TAPE_COUNT_SHIFT);
+    if (count < TAPE_COUNT_MAX)
+        return count;
+
+    /* Saturated: count the hard way */
+    count = 0;
+    for (JsonCursor child = json_cursor_first(cursor); child.tape; child = json_cursor_next(child))
+        count++;
+    return count;
+}
+
+/* First element of an array or value of the first member of an object */
+JsonCursor json_cursor_first(JsonCursor container)
+{
+    if (!container.tape)
+        return invalid_cursor;
+    char type = entry_type(cursor_entry(container));
+    if (type != '[' && type != '{')
+        return invalid_cursor;
+
+    size_t first = container.index + 1;
+    char first_type = entry_type(container.tape->entries[first]);
+    if (first_type == ']' || first_type == '}')
+        return invalid_cursor;
+    /* Object members start with their key */
+    return type == '{' ? make_cursor(container.tape, first + 1, 1) : make_cursor(container.tape, first, 0);
+}
+
+/* Next element or member value after cursor, invalid at the end */
+JsonCursor json_cursor_next(JsonCursor cursor)
+{
+    if (!cursor.tape)
+        return invalid_cursor;
+    size_t next = skip_value(cursor.tape, cursor.index);
+    char type = entry_type(cursor.tape->entries[next]);
+    if (type == ']' || type == '}')
+        return invalid_cursor;
+    return cursor.in_object ? make_cursor(cursor.tape, next + 1, 1) : make_cursor(cursor.tape, next, 0);
+}
+
+/* Key of the object member whose value cursor points at */
+const char *json_cursor_key(JsonCursor cursor, size_t *length)
+{
+    if (!cursor.tape || !cursor.in_object)
+    {
+        if (length)
+            *length = 0;
+        return NULL;
+    }
+    return tape_string(cursor.tape, cursor.tape->entries[cursor.index - 1], length);
+}
+
+/* Value of the first member named key, as a linear scan */
+JsonCursor json_cursor_get(JsonCursor object, const char *key)
+{
+    if (!object.tape || !key || entry_type(cursor_entry(object)) != '{')
+        return invalid_cursor;
+
+    size_t key_length = strlen(key);
+    for (JsonCursor member = json_cursor_first(object); member.tape; member = json_cursor_next(member))
+    {
+        size_t length;
+        const char *name = json_cursor_key(member, &length);
+        if (length == key_length && memcmp(name, key, length) == 0)
+            return member;
+    }
+    return invalid_cursor;
+}
+
+JsonCursor json_cursor_at(JsonCursor array, size_t index)
+{
+    if (!array.tape || entry_type(cursor_entry(array)) != '[')
+        return invalid_cursor;
+
+    JsonCursor element = json_cursor_first(array);
+    while (element.tape && index--)
+        element = json_cursor_next(element);
+    return element;
+}
+
+/* Node for the value at a cursor, from the heap or an arena. Arrays and
+   objects come back empty; arrays are sized for their elements */
+static JsonValue *materialize_node(JsonCursor cursor, JsonArena *arena)
+{
+    JsonValue *value = json_value_alloc(arena, json_cursor_type(cursor));
+    if (!value)
+        return NULL;
+
+    switch (value->type)
+    {
+    case JSON_BOOLEAN:
+        value->value.boolean = json_cursor_boolean(cursor);
+        break;
+    case JSON_NUMBER:
+        value->value.number = json_cursor_number(cursor);
+        if (json_cursor_is_integer(cursor))
+        {
+            value->flags |= JSON_VALUE_INTEGER;
+            value->integer = json_cursor_integer(cursor);
+        }
+        break;
+    case JSON_STRING:
+    {
+        size_t length;
+        const char *text = json_cursor_string(cursor, &length);
+        value->value.string = json_string_alloc(arena, length);
+        if (!value->value.string)
+        {
+            json_free(value);
+            return NULL;
+        }
+        memcpy(value->value.string, text, length + 1);
+        value->length = length;
+        break;
+    }
+    case JSON_ARRAY:
+    {
+        /* The element count is known, size the array once */
+        size_t count = json_cursor_size(cursor);
+        JsonArray *array = value->value.array;
+        if (count)
+        {
+            size_t bytes = count * sizeof(JsonValue *);
+            array->items = arena ? (JsonValue **)json_arena_alloc(arena, bytes) : (JsonValue **)json_heap_alloc(bytes);
+            if (!array->items)
+            {
+                json_free(value);
+                return NULL;
+            }
+            array->capacity = count;
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    return value;
+}
+
+/* Add the member at a cursor to its container. On failure the member is
+   freed */
+static int materialize_member(JsonValue *container, JsonCursor member, JsonValue *item, JsonArena *arena)
+{
+    if (container->type == JSON_ARRAY)
+    {
+        if (json_array_append(container, item))
+            return 1;
+        json_free(item);
+        return 0;
+    }
+
+    size_t key_length;
+    const char *name = json_cursor_key(member, &key_length);
+    char *key = json_string_alloc(arena, key_length);
+    if (key)
+    {
+        memcpy(key, name, key_length + 1);
+        if (json_object_set_owned_key(container, key, key_length, item))
+            return 1;
+        if (!arena)
+            json_heap_free(key);
+    }
+    json_free(item);
+    return 0;
+}
+
+/* Open container while materializing, with the cursor of its next member */
+typedef struct
+{
+    JsonValue *container;
+    JsonCursor member;
+} MaterializeFrame;
+
+#define MATERIALIZE_INITIAL_FRAMES JSON_MAX_NESTING_DEPTH
+
+/* Build the JsonValue tree of a cursor. Containers are filled in tape
+   order from an explicit stack, each member added as soon as it exists */
+static JsonValue *materialize(JsonCursor cursor, JsonArena *arena)
+{
+    JsonValue *root = materialize_node(cursor, arena);
+    if (!root || (root->type != JSON_ARRAY && root->type != JSON_OBJECT))
+        return root;
+
+    MaterializeFrame initial[MATERIALIZE_INITIAL_FRAMES];
+    JsonStack stack;
+    json_stack_init(&stack, initial, MATERIALIZE_INITIAL_FRAMES, sizeof(MaterializeFrame));
+    MaterializeFrame *frame = (MaterializeFrame *)json_stack_push(&stack);
+    frame->container = root;
+    frame->member = json_cursor_first(cursor);
+
+    while (stack.count)
+    {
+        frame = JSON_STACK_TOP(&stack, MaterializeFrame);
+        JsonCursor member = frame->member;
+        if (!member.tape)
+        {
+            stack.count--;
+            continue;
+        }
+        frame->member = json_cursor_next(member);
+
+        JsonValue *item = materialize_node(member, arena);
+        if (!item || !materialize_member(frame->container, member, item, arena))
+            break;
+        if (item->type == JSON_ARRAY || item->type == JSON_OBJECT)
+        {
+            frame = (MaterializeFrame *)json_stack_push(&stack);
+            if (!frame)
+                break;
+            frame->container = item;
+            frame->member = json_cursor_first(member);
+        }
+    }
+
+    int complete = stack.count == 0;
+    json_stack_release(&stack);
+    if (!complete)
+    {
+        json_free(root);
+        return NULL;
+    }
+    return root;
+}
+
+/* Heap-allocated JsonValue tree of a cursor, released with json_free() */
+JsonValue *json_cursor_materialize(JsonCursor cursor)
+{
+    return cursor.tape ? materialize(cursor, NULL) : NULL;
+}
+
+/* Tree of a whole tape built into an arena (document parsing) */
+JsonValue *json_tape_materialize_arena(const JsonTape *tape, JsonArena *arena)
+{
+    JsonCursor root = json_tape_root(tape);
+    return root.tape ? materialize(root, arena) : NULL;
+}
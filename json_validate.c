@@ -1,9 +1,19 @@
 /* json_validate.c */
-#include "json.h"
-#include <ctype.h>
-
-/* Single validation error state */
-static JsonError validation_error = {
+#include "json_internal.h"
+#include <math.h>
+
+/* Validation runs in two tiers. The fast path classifies the input 64
+   bytes at a time with the SIMD kernels and checks the token sequence with
+   a small state machine and a bit stack of open containers; it reads the
+   buffer once and, below 64 levels of nesting, never allocates. Only an
+   input it rejects is run through the parser's own grammar
+   (json_parse_check_r) to describe the problem, so validation and parsing
+   accept the same inputs and report the same errors. A successful
+   json_parse_*() call is therefore a full validation and needs no
+   json_validate_*() before it */
+
+/* Validation error state of the legacy API, one per thread */
+static JSON_THREAD_LOCAL JsonError validation_error = {
     .code = JSON_ERROR_NONE,
     .line = 1,
     .column = 1,
@@ -15,541 +25,512 @@ const JsonError* json_get_validation_error(void) {
     return &validation_error;
 }
 
-/* Validator state structure */
-typedef struct {
-    const char* input;
-    const char* input_start;
-    size_t input_length;
-    size_t line;
-    size_t column;
-    size_t nesting_level;
-} ValidatorState;
-
-/* Initialize validator state */
-static ValidatorState create_validator_state(const char* input) {
-    ValidatorState state = {
-        .input = input,
-        .input_start = input,
-        .input_length = input ? strlen(input) : 0,
-        .line = 1,
-        .column = 1,
-        .nesting_level = 0
-    };
-
-    /* Reset global error state */
-    validation_error.code = JSON_ERROR_NONE;
-    validation_error.line = 1;
-    validation_error.column = 1;
-    validation_error.message[0] = '\0';
-    validation_error.context[0] = '\0';
-
-    return state;
+/* Validation errors without a position report line 1, column 1 */
+static void reset_validation_error(JsonError* error) {
+    json_error_clear(error);
+    error->line = 1;
+    error->column = 1;
 }
 
-/* Set validation error */
-static void set_validation_error(const ValidatorState* state, JsonErrorCode code, const char* message) {
-    if (validation_error.code != JSON_ERROR_NONE) {
-        return; /* Only record first error */
-    }
-    
-    validation_error.code = code;
-    validation_error.line = state->line;
-    validation_error.column = state->column;
-    strncpy(validation_error.message, message, sizeof(validation_error.message) - 1);
-    validation_error.message[sizeof(validation_error.message) - 1] = '\0';
-    
-    if (!state->input) {
-        validation_error.context[0] = '\0';
-        return;
-    }
-
-    /* Capture error context */
-    const char* context_start = state->input - 20;
-    if (context_start < state->input_start) {
-        context_start = state->input_start;
-    }
-
-    size_t context_length = 40;
-    if (context_start + context_length > state->input_start + state->input_length) {
-        context_length = (state->input_start + state->input_length) - context_start;
-    }
-
-    /* Copy context */
-    if (context_start > state->input_start) {
-        strcpy(validation_error.context, "...");
-        strncpy(validation_error.context + 3, context_start,
-                sizeof(validation_error.context) - 7); /* -7 for "..." + "..." + null */
-        if (context_start + context_length < state->input_start + state->input_length) {
-            strcat(validation_error.context, "...");
-        }
-    } else {
-        strncpy(validation_error.context, context_start,
-                sizeof(validation_error.context) - 4); /* -4 for "..." + null */
-        if (context_start + context_length < state->input_start + state->input_length) {
-            strcat(validation_error.context, "...");
-        }
-    }
+static void set_validation_error(JsonError* error, JsonErrorCode code, const char* message) {
+    json_error_set(error, code, message);
+    error->line = 1;
+    error->column = 1;
 }
 
-
-
-/* Forward declarations */
-static int validate_value(ValidatorState* state);
-static int validate_string(ValidatorState* state);
-static int validate_number(ValidatorState* state);
-static int validate_array(ValidatorState* state);
-static int validate_object(ValidatorState* state);
-
-/* Skip whitespace characters */
-static void skip_whitespace(ValidatorState* state) {
-    while (isspace(*state->input)) {
-        if (*state->input == '\n') {
-            state->line++;
-            state->column = 1;
-        } else {
-            state->column++;
-        }
-        state->input++;
-    }
+/* What the fast path expects next */
+typedef enum {
+    EXPECT_VALUE,
+    EXPECT_VALUE_OR_CLOSE,      /* Just after '[' */
+    EXPECT_KEY,
+    EXPECT_KEY_OR_CLOSE,        /* Just after '{' */
+    EXPECT_COLON,
+    EXPECT_ARRAY_NEXT,          /* ',' or ']' after an element */
+    EXPECT_OBJECT_NEXT,         /* ',' or '}' after a member */
+    EXPECT_END                  /* Root value complete */
+} FastExpect;
+
+/* Fast path results */
+#define FAST_REJECTED 0
+#define FAST_VALID 1
+#define FAST_NO_MEMORY -1
+
+/* Fast path state */
+typedef struct {
+    const char* input;
+    const char* input_end;
+    FastExpect expect;
+    FastExpect after_value;     /* State once the current value is complete */
+    size_t depth;
+    size_t max_depth;
+    JsonStack objects;          /* Words of bits, bit d set when the container at depth d is an object */
+    size_t escape_skip;         /* Escapes before this offset were checked with their pair */
+    JsonLazyIndex* index;       /* Container spans to record, NULL for plain validation */
+    JsonStack open_spans;       /* Span of each open container, when indexing */
+} FastValidator;
+
+#define FAST_INITIAL_SPANS JSON_MAX_NESTING_DEPTH
+
+static unsigned lowest_bit64(uint64_t mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_ctzll(mask);
+#else
+    unsigned index = 0;
+    while (!(mask & 1u)) {
+        mask >>= 1;
+        index++;
+    }
+    return index;
+#endif
 }
 
-/* Validate a string */
-static int validate_string(ValidatorState* state) {
-    if (*state->input != '"') {
-        set_validation_error(state, JSON_ERROR_UNEXPECTED_CHAR, "Expected '\"' at start of string");
-        return 0;
-    }
+static int is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
 
-    state->input++;
-    state->column++;
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
 
-    while (*state->input && *state->input != '"') {
-        if ((unsigned char)*state->input < 0x20) {
-            set_validation_error(state, JSON_ERROR_INVALID_STRING_CHAR, "Invalid control character in string");
+/* Bytes that may follow a scalar: whitespace, structural characters and
+   quotes, the same set json_classify_block() separates tokens with */
+static int ends_scalar(char c) {
+    switch (c) {
+        case ' ': case '\t': case '\n': case '\v': case '\f': case '\r':
+        case '{': case '}': case '[': case ']': case ':': case ',': case '"':
+            return 1;
+        default:
             return 0;
-        }
-
-        if (*state->input == '\\') {
-            state->input++;
-            state->column++;
-
-            switch (*state->input) {
-                    case '"':
-                case '\\':
-                case '/':
-                case 'b':
-                case 'f':
-                case 'n':
-                case 'r':
-                case 't':
-                    state->input++;
-                    state->column++;
-                    break;
-
-                case 'u': {
-                    state->input++;
-                    state->column++;
-
-                    /* Validate 4 hex digits */
-                    for (int i = 0; i < 4; i++) {
-                        if (!isxdigit(*state->input)) {
-                            set_validation_error(state, JSON_ERROR_INVALID_UNICODE, "Invalid hex digit in unicode escape");
-                            return 0;
-                        }
-                        state->input++;
-                        state->column++;
-                    }
-                    break;
-                }
-                default:
-                    set_validation_error(state, JSON_ERROR_INVALID_ESCAPE_SEQUENCE, "Invalid escape sequence");
-                    return 0;
-            }
-        } else {
-            state->input++;
-            state->column++;
-        }
     }
-
-    if (*state->input != '"') {
-        set_validation_error(state, JSON_ERROR_UNTERMINATED_STRING, "Unterminated string");
-        return 0;
-    }
-
-    state->input++;
-    state->column++;
-    return 1;
 }
 
-/* Validate a number */
-static int validate_number(ValidatorState* state) {
-    /* Optional minus sign */
-    if (*state->input == '-') {
-        state->input++;
-        state->column++;
-    }
-
-    /* Integer part */
-    if (*state->input == '0') {
-        state->input++;
-        state->column++;
-        if (isdigit(*state->input)) {
-            set_validation_error(state, JSON_ERROR_INVALID_NUMBER, "Leading zeros not allowed");
-            return 0;
-        }
-    } else if (isdigit(*state->input)) {
-        while (isdigit(*state->input)) {
-            state->input++;
-            state->column++;
+/* End of the number at p, or NULL. Only literals with an exponent or a
+   very long mantissa can overflow, those are converted to catch infinity
+   exactly as the parser does */
+static const char* scan_number(const char* p, const char* end) {
+    const char* start = p;
+    int exponent = 0;
+
+    if (p < end && *p == '-') {
+        p++;
+    }
+    if (p < end && *p == '0') {
+        p++;
+    } else if (p < end && is_digit(*p)) {
+        while (p < end && is_digit(*p)) {
+            p++;
         }
     } else {
-        set_validation_error(state, JSON_ERROR_INVALID_NUMBER, "Expected digit");
-        return 0;
+        return NULL;
     }
-
-    /* Fractional part */
-    if(*state->input == '.') {
-        state->input++;
-        state->column++;
-        if (!isdigit(*state->input)) {
-            set_validation_error(state, JSON_ERROR_INVALID_NUMBER, "Exoected digit after decimal point");
-            return 0;
+    if (p < end && *p == '.') {
+        p++;
+        if (p >= end || !is_digit(*p)) {
+            return NULL;
         }
-        while (isdigit(*state->input)) {
-            state->input++;
-            state->column++;
+        while (p < end && is_digit(*p)) {
+            p++;
         }
     }
-
-    /* Exponent */
-    if (*state->input == 'e' || *state->input == 'E') {
-        state->input++;
-        state->column++;
-
-        if (*state->input == '+' || *state->input == '-') {
-            state->input++;
-            state->column++;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        exponent = 1;
+        p++;
+        if (p < end && (*p == '+' || *p == '-')) {
+            p++;
         }
-
-        if (!isdigit(*state->input)) {
-            set_validation_error(state, JSON_ERROR_INVALID_NUMBER, "Expected digit in exponent");
-            return 0;
+        if (p >= end || !is_digit(*p)) {
+            return NULL;
         }
-
-        while (isdigit(*state->input)) {
-            state->input++;
-            state->column++;
+        while (p < end && is_digit(*p)) {
+            p++;
         }
     }
-    return 1;
 
+    if (exponent || p - start > 300) {
+        JsonNumberParse number;
+        if (!json_number_parse(start, p, &number) || isinf(number.number)) {
+            return NULL;
+        }
+    }
+    return p;
 }
 
-/* Validate an Array */
-static int validate_array(ValidatorState* state) {
-    if (*state->input != '[') {
-        set_validation_error(state, JSON_ERROR_UNEXPECTED_CHAR, "Expected '[' at start of array");
-        return 0;
-    }
+/* A number or literal must fill its whole run of bytes */
+static int check_scalar(const FastValidator* v, const char* p) {
+    size_t remaining = (size_t)(v->input_end - p);
+    const char* after;
 
-    if (state->nesting_level >= JSON_MAX_NESTING_DEPTH) {
-        set_validation_error(state, JSON_ERROR_MAXIMUM_NESTING_REACHED, "Maximum nesting depth exceeded");
-        return 0;
+    switch (*p) {
+        case 't':
+            if (remaining < 4 || memcmp(p, "true", 4) != 0) return 0;
+            after = p + 4;
+            break;
+        case 'f':
+            if (remaining < 5 || memcmp(p, "false", 5) != 0) return 0;
+            after = p + 5;
+            break;
+        case 'n':
+            if (remaining < 4 || memcmp(p, "null", 4) != 0) return 0;
+            after = p + 4;
+            break;
+        default:
+            after = scan_number(p, v->input_end);
+            if (!after) return 0;
+            break;
     }
+    return after == v->input_end || ends_scalar(*after);
+}
 
-    state->nesting_level++;
-    state->input++;
-    state->column++;
-
-    skip_whitespace(state);
-
-    /* Empty array */
-    if (*state->input == ']') {
-        state->input++;
-        state->column++;
-        state->nesting_level--;
-        return 1;
+/* Four hex digits at p, or -1 */
+static long read_hex4(const FastValidator* v, const char* p) {
+    if (v->input_end - p < 4) {
+        return -1;
     }
-
-    /* Validate array elements*/
-    while (1) {
-        if (!validate_value(state)) {
-            return 0;
+    long value = 0;
+    for (int i = 0; i < 4; i++) {
+        int digit = hex_value(p[i]);
+        if (digit < 0) {
+            return -1;
         }
+        value = (value << 4) | digit;
+    }
+    return value;
+}
 
-        skip_whitespace(state);
-
-        if(*state->input == ']') {
-            state->input++;
-            state->column++;
-            state->nesting_level--;
+/* Check the escape whose backslash is at p. Surrogates must pair up;
+   the low half of a pair is marked as checked */
+static int check_escape(FastValidator* v, const char* p) {
+    if (v->input_end - p < 2) {
+        return 0;
+    }
+    switch (p[1]) {
+        case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+            return 1;
+        case 'u': {
+            long unit = read_hex4(v, p + 2);
+            if (unit < 0 || (unit >= 0xDC00 && unit <= 0xDFFF)) {
+                return 0;
+            }
+            if (unit < 0xD800 || unit > 0xDBFF) {
+                return 1;
+            }
+            /* High surrogate: a low one must follow */
+            if (v->input_end - p < 8 || p[6] != '\\' || p[7] != 'u') {
+                return 0;
+            }
+            long low = read_hex4(v, p + 8);
+            if (low < 0xDC00 || low > 0xDFFF) {
+                return 0;
+            }
+            v->escape_skip = (size_t)(p + 6 - v->input) + 1;
             return 1;
         }
-
-        if (*state->input != ',') {
-            set_validation_error(state, JSON_ERROR_EXPECTED_COMMA_OR_BRACKET, "Expected ',' or ']' after array element");
-            return 0;
-        }
-
-        state->input++;
-        state->column++;
-        skip_whitespace(state);
-
-        /* Check trailing comma */
-        if (*state->input == ']') {
-            set_validation_error(state,JSON_ERROR_UNEXPECTED_CHAR, "Trailing comma not allowed in array");
+        default:
             return 0;
-        }
     }
 }
 
-/* Validate an object */
-static int validate_object(ValidatorState* state) {
-    if (*state->input != '{') {
-        set_validation_error(state, JSON_ERROR_UNEXPECTED_CHAR, "Expected '{' at start of obejct");
-        return 0;
+/* Record the opening bracket at offset in the lazy index */
+static int index_open(FastValidator* v, size_t offset) {
+    JsonLazyIndex* index = v->index;
+    if (index->count == index->capacity) {
+        size_t capacity = index->capacity ? index->capacity * 2 : 64;
+        JsonLazySpan* spans = (JsonLazySpan*)json_allocator_realloc(index->allocator, index->spans,
+                                                                   capacity * sizeof(JsonLazySpan));
+        if (!spans) {
+            return 0;
+        }
+        index->spans = spans;
+        index->capacity = capacity;
     }
 
-    if (state->nesting_level >= JSON_MAX_NESTING_DEPTH) {
-        set_validation_error(state, JSON_ERROR_MAXIMUM_NESTING_REACHED, "Maximum nesting depth exceeded");
+    size_t* open = (size_t*)json_stack_push(&v->open_spans);
+    if (!open) {
         return 0;
     }
+    size_t span = index->count++;
+    index->spans[span].start = offset;
+    *open = span;
+    return 1;
+}
 
-    state->nesting_level++;
-    state->input++;
-    state->column++;
+/* Record the end of the innermost container, just past its closing bracket */
+static void index_close(FastValidator* v, size_t offset) {
+    size_t span = *JSON_STACK_TOP(&v->open_spans, size_t);
+    v->open_spans.count--;
+    v->index->spans[span].end = offset + 1;
+    v->index->spans[span].descendants = v->index->count - span - 1;
+}
 
-    skip_whitespace(state);
-    
-    /* Empty object */
-    if (*state->input == '}') {
-        state->input++;
-        state->column++;
-        state->nesting_level--;
-        return 1;
+/* Leave the innermost container */
+static void close_container(FastValidator* v, size_t offset) {
+    v->depth--;
+    if (v->index) {
+        index_close(v, offset);
     }
+    if (v->depth == 0) {
+        v->after_value = EXPECT_END;
+    } else {
+        size_t d = v->depth - 1;
+        uint64_t word = *JSON_STACK_AT(&v->objects, uint64_t, d / 64);
+        v->after_value = ((word >> (d % 64)) & 1u) ? EXPECT_OBJECT_NEXT : EXPECT_ARRAY_NEXT;
+    }
+    v->expect = v->after_value;
+}
 
-    /* Validate object members */
-    while (1) {
-        /* Validate string key */
-        if (!validate_string(state)) {
-            return 0;
-        }
-
-        skip_whitespace(state);
-
-        /* Expect colon */
-        if (*state->input != ':') {
-            set_validation_error(state, JSON_ERROR_EXPECTED_COLON, "Expected ':' after object key");
-            return 0;
-        }
+/* Enter a container; a new word of the bit stack every 64 levels */
+static int open_container(FastValidator* v, int is_object, size_t offset) {
+    if (v->depth >= v->max_depth) return FAST_REJECTED;
+    size_t word = v->depth / 64;
+    if (word == v->objects.count) {
+        uint64_t* bits = (uint64_t*)json_stack_push(&v->objects);
+        if (!bits) return FAST_NO_MEMORY;
+        *bits = 0;
+    }
+    if (v->index && !index_open(v, offset)) return FAST_NO_MEMORY;
+
+    uint64_t* bits = JSON_STACK_AT(&v->objects, uint64_t, word);
+    uint64_t bit = (uint64_t)1 << (v->depth % 64);
+    if (is_object) {
+        *bits |= bit;
+        v->expect = EXPECT_KEY_OR_CLOSE;
+        v->after_value = EXPECT_OBJECT_NEXT;
+    } else {
+        *bits &= ~bit;
+        v->expect = EXPECT_VALUE_OR_CLOSE;
+        v->after_value = EXPECT_ARRAY_NEXT;
+    }
+    v->depth++;
+    return FAST_VALID;
+}
 
-        state->input++;
-        state->column++;
+/* Feed one token: a structural character, an opening quote or the first
+   byte of a scalar */
+static int fast_token(FastValidator* v, size_t offset) {
+    const char* p = v->input + offset;
 
-        skip_whitespace(state);
+    switch (v->expect) {
+        case EXPECT_VALUE_OR_CLOSE:
+            if (*p == ']') {
+                close_container(v, offset);
+                return FAST_VALID;
+            }
+            /* fall through */
+        case EXPECT_VALUE:
+            switch (*p) {
+                case '"':
+                    /* The contents were checked with the block masks */
+                    v->expect = v->after_value;
+                    return FAST_VALID;
+                case '[':
+                case '{':
+                    return open_container(v, *p == '{', offset);
+                case ']': case '}': case ',': case ':':
+                    return FAST_REJECTED;
+                default:
+                    if (!check_scalar(v, p)) return FAST_REJECTED;
+                    v->expect = v->after_value;
+                    return FAST_VALID;
+            }
 
-        /* validate value*/
-        if (!validate_value(state)) {
-            return 0;
-        }
+        case EXPECT_ARRAY_NEXT:
+            if (*p == ',') {
+                v->expect = EXPECT_VALUE;
+                return FAST_VALID;
+            }
+            if (*p != ']') return FAST_REJECTED;
+            close_container(v, offset);
+            return FAST_VALID;
+
+        case EXPECT_OBJECT_NEXT:
+            if (*p == ',') {
+                v->expect = EXPECT_KEY;
+                return FAST_VALID;
+            }
+            if (*p != '}') return FAST_REJECTED;
+            close_container(v, offset);
+            return FAST_VALID;
+
+        case EXPECT_KEY_OR_CLOSE:
+            if (*p == '}') {
+                close_container(v, offset);
+                return FAST_VALID;
+            }
+            /* fall through */
+        case EXPECT_KEY:
+            if (*p != '"') return FAST_REJECTED;
+            v->expect = EXPECT_COLON;
+            return FAST_VALID;
 
-        skip_whitespace(state);
+        case EXPECT_COLON:
+            if (*p != ':') return FAST_REJECTED;
+            v->expect = EXPECT_VALUE;
+            return FAST_VALID;
 
-        if (*state->input == '}') {
-            state->input++;
-            state->column++;
-            state->nesting_level--;
-            return 1;
-        }
+        default:
+            return FAST_REJECTED; /* Content after the root value */
+    }
+}
 
-        if (*state->input != ',') {
-            set_validation_error(state, JSON_ERROR_EXPECTED_COMMA_OR_BRACE, "Expected ',' or '}' after object value");
-            return 0;
+/* One 64-byte block starting at offset base */
+static int fast_block(FastValidator* v, const char* block, size_t base,
+                      uint64_t* escape_carry, uint64_t* in_string_carry, uint64_t* scalar_carry) {
+    JsonBlockMasks masks;
+    json_classify_block(block, &masks);
+
+    uint64_t escaped = json_find_escaped(masks.backslash, escape_carry);
+    uint64_t quotes = masks.quote & ~escaped;
+    uint64_t in_string = json_prefix_xor(quotes) ^ *in_string_carry;
+    *in_string_carry = (uint64_t)0 - (in_string >> 63);
+
+    /* Raw control bytes are never allowed inside a string */
+    if (masks.control & in_string) {
+        return FAST_REJECTED;
+    }
+
+    /* Every escape inside a string is checked where it starts */
+    uint64_t escapes = masks.backslash & ~escaped & in_string;
+    while (escapes) {
+        size_t offset = base + lowest_bit64(escapes);
+        escapes &= escapes - 1;
+        if (offset >= v->escape_skip && !check_escape(v, v->input + offset)) {
+            return FAST_REJECTED;
         }
+    }
 
-        state->input++;
-        state->column++;
-
-        skip_whitespace(state);
+    uint64_t outside = ~in_string;
+    uint64_t scalar = ~(masks.whitespace | masks.structural | masks.quote) & outside;
+    uint64_t scalar_starts = scalar & ~((scalar << 1) | *scalar_carry);
+    *scalar_carry = scalar >> 63;
 
-        /* Check for trailing comma */
-        if (*state->input == '}') {
-            set_validation_error(state, JSON_ERROR_UNEXPECTED_CHAR, "Trailing comma not allowed in object");
-            return 0;
+    uint64_t tokens = (masks.structural & outside) | (quotes & in_string) | scalar_starts;
+    while (tokens) {
+        int result = fast_token(v, base + lowest_bit64(tokens));
+        if (result != FAST_VALID) {
+            return result;
         }
+        tokens &= tokens - 1;
     }
+    return FAST_VALID;
 }
 
-/* Validate any JSON value */
-static int validate_value(ValidatorState* state) {
-    skip_whitespace(state);
-    
-    switch (*state->input) {
-        case 'n':
-            if (strncmp(state->input, "null", 4) == 0) {
-                state->input += 4;
-                state->column += 4;
-                return 1;
-            }
-            set_validation_error(state, JSON_ERROR_INVALID_VALUE,
-                               "Invalid token: expected 'null'");
-            return 0;
-            
-        case 't':
-            if (strncmp(state->input, "true", 4) == 0) {
-                state->input += 4;
-                state->column += 4;
-                return 1;
-            }
-            set_validation_error(state, JSON_ERROR_INVALID_VALUE,
-                               "Invalid token: expected 'true'");
-            return 0;
-            
-        case 'f':
-            if (strncmp(state->input, "false", 5) == 0) {
-                state->input += 5;
-                state->column += 5;
-                return 1;
-            }
-            set_validation_error(state, JSON_ERROR_INVALID_VALUE,
-                               "Invalid token: expected 'false'");
-            return 0;
-            
-        case '"':
-            return validate_string(state);
-            
-        case '[':
-            return validate_array(state);
-            
-        case '{':
-            return validate_object(state);
-            
-        case '-':
-        case '0':
-        case '1':
-        case '2':
-        case '3':
-        case '4':
-        case '5':
-        case '6':
-        case '7':
-        case '8':
-        case '9':
-            return validate_number(state);
-            
-        case '\0':
-            set_validation_error(state, JSON_ERROR_UNEXPECTED_CHAR,
-                               "Unexpected end of input");
-            return 0;
-            
-        default:
-            {
-                char message[100];
-                if (isprint(*state->input)) {
-                    snprintf(message, sizeof(message),
-                            "Unexpected character '%c'", *state->input);
-                } else {
-                    snprintf(message, sizeof(message),
-                            "Unexpected character (code: %d)", (unsigned char)*state->input);
-                }
-                set_validation_error(state, JSON_ERROR_INVALID_VALUE, message);
-                return 0;
-            }
-    }
+/* Fast path over the whole buffer */
+static int fast_validate(const char* data, size_t length, JsonLazyIndex* index, size_t max_depth) {
+    uint64_t initial_objects[1];
+    size_t initial_spans[FAST_INITIAL_SPANS];
+    FastValidator v;
+    v.input = data;
+    v.input_end = data + length;
+    v.expect = EXPECT_VALUE;
+    v.after_value = EXPECT_END;
+    v.depth = 0;
+    v.max_depth = json_resolve_max_depth(max_depth);
+    json_stack_init(&v.objects, initial_objects, 1, sizeof(uint64_t));
+    v.escape_skip = 0;
+    v.index = index;
+    json_stack_init(&v.open_spans, initial_spans, FAST_INITIAL_SPANS, sizeof(size_t));
+
+    uint64_t escape_carry = 0, in_string = 0, scalar_carry = 0;
+    size_t offset = 0;
+    int result = FAST_VALID;
+
+    for (; offset + 64 <= length && result == FAST_VALID; offset += 64) {
+        result = fast_block(&v, data + offset, offset, &escape_carry, &in_string, &scalar_carry);
+    }
+    if (result == FAST_VALID && offset < length) {
+        /* Pad the tail with whitespace, which never adds a token */
+        char block[64];
+        memset(block, ' ', sizeof(block));
+        memcpy(block, data + offset, length - offset);
+        result = fast_block(&v, block, offset, &escape_carry, &in_string, &scalar_carry);
+    }
+
+    json_stack_release(&v.objects);
+    json_stack_release(&v.open_spans);
+    if (result != FAST_VALID) {
+        return result;
+    }
+    return !in_string && v.expect == EXPECT_END ? FAST_VALID : FAST_REJECTED;
 }
 
-/* Public validation interface */
-int json_validate_string(const char* json_string) {
-    ValidatorState state = create_validator_state(json_string);
-    
-    if (!json_string) {
-        set_validation_error(&state, JSON_ERROR_INVALID_VALUE, "Input string is NULL");
-        return 0;
+/* Reentrant validation: errors go to the caller's JsonError (which may
+   be NULL) and nothing global is touched */
+int json_validate_buffer_r(const char* data, size_t length, JsonError* error) {
+    JsonError scratch;
+    if (!error) {
+        error = &scratch;
     }
-    
-    /* Validate root value */
-    if (!validate_value(&state)) {
-        return 0;  /* Error already set by validate_value */
-    }
-    
-    /* Check for trailing content */
-    skip_whitespace(&state);
-    if (*state.input != '\0') {
-        set_validation_error(&state, JSON_ERROR_UNEXPECTED_CHAR,
-                           "Unexpected content after JSON value");
+
+    if (!data) {
+        set_validation_error(error, JSON_ERROR_INVALID_VALUE, "Input string is NULL");
         return 0;
     }
-    
-    return 1;
-}
 
-/* File validation function */
-int json_validate_file(const char* filename) {
-    ValidatorState state = create_validator_state(NULL);
-    
-    if (!filename) {
-        set_validation_error(&state, JSON_ERROR_INVALID_VALUE, "Filename is NULL");
-        return 0;
+    JsonPhaseMark mark;
+    json_phase_enter(JSON_PHASE_PARSE, &mark);
+    int valid = fast_validate(data, length, NULL, 0) == FAST_VALID || json_parse_check_r(data, length, 0, error);
+    json_phase_leave(&mark);
+
+    if (valid) {
+        reset_validation_error(error);
     }
+    return valid;
+}
 
-    FILE* file = fopen(filename, "r");
-    if (!file) {
-        char message[256];
-        snprintf(message, sizeof(message), "Could not open file: %s", filename);
-        set_validation_error(&state, JSON_ERROR_INVALID_VALUE, message);
-        return 0;
+/* Validation for lazy documents, appending the span of every container
+   to index */
+int json_validate_index_r(const char* data, size_t length, JsonLazyIndex* index, size_t max_depth,
+                          JsonError* error) {
+    int result = fast_validate(data, length, index, max_depth);
+    if (result == FAST_VALID) {
+        json_error_clear(error);
+        return 1;
     }
 
-    /* Get file size */
-    if (fseek(file, 0, SEEK_END) != 0) {
-        fclose(file);
-        set_validation_error(&state, JSON_ERROR_INVALID_VALUE, "Could not determine file size");
-        return 0;
+    index->count = 0;
+    if (result == FAST_NO_MEMORY) {
+        json_error_set(error, JSON_ERROR_MEMORY_ALLOCATION, "Failed to grow the lazy index");
+    } else if (json_parse_check_r(data, length, max_depth, error)) {
+        json_error_set(error, JSON_ERROR_INVALID_VALUE, "Input rejected by the lazy index");
     }
+    return 0;
+}
 
-    long size = ftell(file);
-    if (size < 0) {
-        fclose(file);
-        set_validation_error(&state, JSON_ERROR_INVALID_VALUE, "Could not determine file size");
-        return 0;
+/* File validation: the file is mapped (or read once) and validated in place */
+int json_validate_file_r(const char* filename, JsonError* error) {
+    JsonError scratch;
+    if (!error) {
+        error = &scratch;
     }
+    reset_validation_error(error);
 
-    /* Return to start of file */
-    if (fseek(file, 0, SEEK_SET) != 0) {
-        fclose(file);
-        set_validation_error(&state, JSON_ERROR_INVALID_VALUE, "Could not read file");
+    if (!filename) {
+        set_validation_error(error, JSON_ERROR_INVALID_VALUE, "Filename is NULL");
         return 0;
     }
 
-    /* Allocate buffer */
-    char* buffer = (char*)malloc(size + 1);
-    if (!buffer) {
-        fclose(file);
-        set_validation_error(&state, JSON_ERROR_MEMORY_ALLOCATION, 
-                           "Could not allocate memory for file contents");
+    JsonFileView view;
+    if (!json_file_view_open(&view, filename, error)) {
         return 0;
     }
 
-    /* Read file content */
-    size_t read_size = fread(buffer, 1, size, file);
-    fclose(file);
+    int result = json_validate_buffer_r(view.data, view.length, error);
+    json_file_view_close(&view);
+    return result;
+}
 
-    if (read_size != (size_t)size) {
-        free(buffer);
-        set_validation_error(&state, JSON_ERROR_INVALID_VALUE, "Could not read entire file");
-        return 0;
-    }
+/* Public validation interface, reporting through json_get_validation_error() */
+int json_validate_buffer(const char* data, size_t length) {
+    return json_validate_buffer_r(data, length, &validation_error);
+}
 
-    buffer[size] = '\0';
+int json_validate_string(const char* json_string) {
+    return json_validate_buffer(json_string, json_string ? strlen(json_string) : 0);
+}
 
-    /* Validate the string */
-    int result = json_validate_string(buffer);
-    if (!result) {
-        /* Get the validation error from string validation and preserve it */
-        const JsonError* string_error = json_get_validation_error();
-        memcpy(&validation_error, string_error, sizeof(JsonError));
-    }
-    free(buffer);
-    return result;
-}
\ No newline at end of file
+int json_validate_file(const char* filename) {
+    return json_validate_file_r(filename, &validation_error);
+}
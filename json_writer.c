@@ -0,0 +1,382 @@
+/* json_writer.c */
+#define _POSIX_C_SOURCE 200809L /* fseeko, ftruncate, fileno, fsync */
+#include "json_internal.h"
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+/* Append-only writer for one top-level array, as used for telemetry logs.
+   Values are formatted into a reused buffer and collected into batches;
+   each batch goes to the file in one write together with the closing
+   "\n]\n", which the next batch overwrites. Between batches the file is
+   therefore always a complete array.
+
+   Layout: "[", then "\n" before the first element and ",\n" before each
+   later one, then "\n]\n". Reopening in append mode scans the existing
+   file, keeps every element that was written completely, and drops a
+   cut-off tail left by a crash */
+
+#define WRITER_DEFAULT_BUFFER_SIZE (64 * 1024)
+#define WRITER_TAIL "\n]\n"
+#define WRITER_TAIL_LENGTH (sizeof(WRITER_TAIL) - 1)
+
+const JsonArrayWriterConfig JSON_ARRAY_WRITER_DEFAULT = {
+    .buffer_size = 0,
+    .format = NULL,
+    .sync_every = 0,
+    .sync_interval_ms = 1000,
+    .sync_on_close = 1,
+    .append = 0,
+};
+
+struct JsonArrayWriter
+{
+    FILE *file;
+    JsonArrayWriterConfig config;
+    JsonFormatBuffer element;   /* The value being appended */
+    char *batch;                /* Formatted elements not yet written */
+    size_t batch_length;
+    size_t batch_capacity;
+    uint64_t data_end;          /* File offset where the next batch goes */
+    size_t count;               /* Elements in the file and in the batch */
+    size_t unsynced;            /* Elements appended since the last sync */
+    double last_sync;
+    JsonError error;
+};
+
+static int writer_fail(JsonArrayWriter *writer, JsonErrorCode code, const char *message)
+{
+    json_error_set(&writer->error, code, message);
+    return 0;
+}
+
+static int seek_to(FILE *file, uint64_t offset)
+{
+#ifdef _WIN32
+    return _fseeki64(file, (__int64)offset, SEEK_SET) == 0;
+#else
+    return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+static int truncate_to(FILE *file, uint64_t length)
+{
+#ifdef _WIN32
+    return _chsize_s(_fileno(file), (__int64)length) == 0;
+#else
+    return ftruncate(fileno(file), (off_t)length) == 0;
+#endif
+}
+
+static int sync_file(FILE *file)
+{
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+/* Offset just past the last element of an existing array file that was
+   written completely, and the number of such elements. A container
+   element is complete at its closing bracket, a scalar only once the
+   whitespace, ',' or ']' after it is there. Returns 0 if the file is not
+   an array */
+static uint64_t recover_elements(const char *data, size_t length, size_t *count, JsonError *error)
+{
+    const char *end = data + length;
+    const char *open = json_skip_whitespace(data, end);
+    if (open == end || *open != '[')
+    {
+        json_error_set(error, JSON_ERROR_INVALID_VALUE, "Existing file does not hold an array");
+        return 0;
+    }
+
+    size_t start = (size_t)(open - data);
+    size_t complete = start + 1;        /* End of the last complete element */
+    size_t boundary = start + 1;        /* Just past the last '[' or ',' at depth 1 */
+    int counted = 0;                    /* The element after boundary was counted */
+    size_t depth = 0;
+    uint64_t escape_carry = 0, in_string = 0;
+    *count = 0;
+
+    for (size_t offset = start; offset < length; offset += 64)
+    {
+        const char *block = data + offset;
+        char padded[64];
+        if (length - offset < 64)
+        {
+            memset(padded, ' ', sizeof(padded));
+            memcpy(padded, block, length - offset);
+            block = padded;
+        }
+
+        JsonBlockMasks masks;
+        json_classify_block(block, &masks);
+        uint64_t escaped = json_find_escaped(masks.backslash, &escape_carry);
+        uint64_t inside = json_prefix_xor(masks.quote & ~escaped) ^ in_string;
+        in_string = (uint64_t)0 - (inside >> 63);
+
+        for (uint64_t bits = masks.structural & ~inside; bits; bits &= bits - 1)
+        {
+            size_t at = offset + json_lowest_bit64(bits);
+            char c = data[at];
+            if (c == '[' || c == '{')
+            {
+                depth++;
+                continue;
+            }
+            if (c == ']' || c == '}')
+            {
+                if (--depth == 1)
+                {
+                    /* A container element closed */
+                    complete = at + 1;
+                    counted = 1;
+                    (*count)++;
+                }
+                if (depth != 0)
+                    continue;
+            }
+            else if (c != ',' || depth != 1)
+            {
+                continue;
+            }
+
+            /* ',' or the array's own ']': a scalar before it is complete */
+            if (!counted && json_skip_whitespace(data + boundary, data + at) != data + at)
+            {
+                size_t scalar_end = at;
+                while (json_is_space(data[scalar_end - 1]))
+                    scalar_end--;
+                complete = scalar_end;
+                (*count)++;
+            }
+            if (depth == 0)
+                return complete; /* The array was closed */
+            counted = 0;
+            boundary = at + 1;
+        }
+    }
+
+    /* Whitespace also ends a scalar, one cut off has none after it */
+    if (depth == 1 && !counted && !in_string)
+    {
+        size_t scalar_end = length;
+        while (scalar_end > boundary && json_is_space(data[scalar_end - 1]))
+            scalar_end--;
+        if (scalar_end > boundary && scalar_end < length)
+        {
+            complete = scalar_end;
+            (*count)++;
+        }
+    }
+    return complete;
+}
+
+/* Ready an existing file for appending: cut it after its last complete
+   element and close the array again */
+static int recover_file(JsonArrayWriter *writer, const char *filename, JsonError *error)
+{
+    JsonFileView view;
+    if (!json_file_view_open(&view, filename, error))
+        return 0;
+    size_t count = 0;
+    uint64_t data_end = 0;
+    int empty = json_skip_whitespace(view.data, view.data + view.length) == view.data + view.length;
+    if (!empty)
+        data_end = recover_elements(view.data, view.length, &count, error);
+    json_file_view_close(&view);
+    if (!empty && data_end == 0)
+        return 0;
+
+    if (empty)
+    {
+        data_end = 1;
+        if (!seek_to(writer->file, 0) || fputc('[', writer->file) == EOF)
+        {
+            json_error_set(error, JSON_ERROR_FILE_WRITE, "Failed to start the array");
+            return 0;
+        }
+    }
+    if (!seek_to(writer->file, data_end) || fwrite(WRITER_TAIL, 1, WRITER_TAIL_LENGTH, writer->file) != WRITER_TAIL_LENGTH ||
+        fflush(writer->file) != 0 || !truncate_to(writer->file, data_end + WRITER_TAIL_LENGTH))
+    {
+        json_error_set(error, JSON_ERROR_FILE_WRITE, "Failed to truncate the recovered file");
+        return 0;
+    }
+    writer->data_end = data_end;
+    writer->count = count;
+    return 1;
+}
+
+JsonArrayWriter *json_array_writer_open(const char *filename, const JsonArrayWriterConfig *config, JsonError *error)
+{
+    json_error_clear(error);
+    if (!filename)
+    {
+        json_error_set(error, JSON_ERROR_INVALID_VALUE, "NULL filename passed to json_array_writer_open");
+        return NULL;
+    }
+    if (!config)
+        config = &JSON_ARRAY_WRITER_DEFAULT;
+
+    JsonArrayWriter *writer = (JsonArrayWriter *)json_heap_calloc(1, sizeof(JsonArrayWriter));
+    if (!writer)
+    {
+        json_error_set(error, JSON_ERROR_MEMORY_ALLOCATION, "Failed to allocate array writer");
+        return NULL;
+    }
+    writer->config = *config;
+    if (writer->config.buffer_size == 0)
+        writer->config.buffer_size = WRITER_DEFAULT_BUFFER_SIZE;
+    if (!writer->config.format)
+        writer->config.format = &JSON_FORMAT_COMPACT;
+    json_format_buffer_init(&writer->element, NULL, 0);
+    writer->batch_capacity = writer->config.buffer_size + WRITER_TAIL_LENGTH;
+    writer->batch = (char *)json_heap_alloc(writer->batch_capacity);
+
+    /* "r+b" keeps an existing file; a missing one is created either way */
+    writer->file = config->append ? fopen(filename, "r+b") : NULL;
+    int existing = writer->file != NULL;
+    if (!writer->file)
+        writer->file = fopen(filename, "w+b");
+
+    int ok = writer->batch && writer->file;
+    if (!ok)
+        json_error_set(error, writer->batch ? JSON_ERROR_FILE_WRITE : JSON_ERROR_MEMORY_ALLOCATION,
+                       writer->batch ? "Failed to open file for writing" : "Failed to allocate write buffer");
+
+    if (ok)
+    {
+        /* Batches are written in one call each, so stdio buffering adds nothing */
+        setvbuf(writer->file, NULL, _IONBF, 0);
+        if (existing)
+        {
+            ok = recover_file(writer, filename, error);
+        }
+        else
+        {
+            writer->data_end = 1;
+            ok = fwrite("[" WRITER_TAIL, 1, 1 + WRITER_TAIL_LENGTH, writer->file) == 1 + WRITER_TAIL_LENGTH;
+            if (!ok)
+                json_error_set(error, JSON_ERROR_FILE_WRITE, "Failed to start the array");
+        }
+    }
+    if (!ok)
+    {
+        if (writer->file)
+            fclose(writer->file);
+        json_format_buffer_release(&writer->element);
+        json_heap_free(writer->batch);
+        json_heap_free(writer);
+        return NULL;
+    }
+    writer->last_sync = json_clock_seconds();
+    return writer;
+}
+
+/* Write the batch and the closing bracket over the previous one */
+int json_array_writer_flush(JsonArrayWriter *writer)
+{
+    if (!writer)
+        return 0;
+    if (writer->batch_length == 0)
+        return 1;
+
+    memcpy(writer->batch + writer->batch_length, WRITER_TAIL, WRITER_TAIL_LENGTH);
+    size_t length = writer->batch_length + WRITER_TAIL_LENGTH;
+    JsonPhaseMark mark;
+    json_phase_enter(JSON_PHASE_WRITE, &mark);
+    int ok = seek_to(writer->file, writer->data_end) && fwrite(writer->batch, 1, length, writer->file) == length;
+    json_phase_leave(&mark);
+    if (!ok)
+        return writer_fail(writer, JSON_ERROR_FILE_WRITE, "Failed to write batch");
+
+    writer->data_end += writer->batch_length;
+    writer->batch_length = 0;
+    return 1;
+}
+
+int json_array_writer_sync(JsonArrayWriter *writer)
+{
+    if (!json_array_writer_flush(writer))
+        return 0;
+    JsonPhaseMark mark;
+    json_phase_enter(JSON_PHASE_WRITE, &mark);
+    int ok = sync_file(writer->file);
+    json_phase_leave(&mark);
+    if (!ok)
+        return writer_fail(writer, JSON_ERROR_FILE_WRITE, "Failed to sync file");
+    writer->unsynced = 0;
+    writer->last_sync = json_clock_seconds();
+    return 1;
+}
+
+/* Grow the batch for a value larger than the configured buffer */
+static int reserve_batch(JsonArrayWriter *writer, size_t length)
+{
+    size_t needed = writer->batch_length + length + WRITER_TAIL_LENGTH;
+    if (needed <= writer->batch_capacity)
+        return 1;
+    char *grown = (char *)json_heap_realloc(writer->batch, needed);
+    if (!grown)
+        return writer_fail(writer, JSON_ERROR_MEMORY_ALLOCATION, "Failed to grow write buffer");
+    writer->batch = grown;
+    writer->batch_capacity = needed;
+    return 1;
+}
+
+int json_array_writer_append(JsonArrayWriter *writer, const JsonValue *value)
+{
+    if (!writer || !value)
+        return writer ? writer_fail(writer, JSON_ERROR_INVALID_VALUE, "NULL value passed to json_array_writer_append")
+                      : 0;
+    if (!json_format_into(value, writer->config.format, &writer->element))
+        return writer_fail(writer, JSON_ERROR_FORMAT_ERROR, "Failed to format value");
+
+    const char *separator = writer->count ? ",\n" : "\n";
+    size_t separator_length = writer->count ? 2 : 1;
+    size_t length = separator_length + writer->element.length;
+    if (writer->batch_length + length > writer->config.buffer_size && !json_array_writer_flush(writer))
+        return 0;
+    if (!reserve_batch(writer, length))
+        return 0;
+    memcpy(writer->batch + writer->batch_length, separator, separator_length);
+    memcpy(writer->batch + writer->batch_length + separator_length, writer->element.data, writer->element.length);
+    writer->batch_length += length;
+    writer->count++;
+    writer->unsynced++;
+
+    /* Group commit: one sync covers every value since the last */
+    const JsonArrayWriterConfig *config = &writer->config;
+    if ((config->sync_every && writer->unsynced >= config->sync_every) ||
+        (config->sync_interval_ms && (json_clock_seconds() - writer->last_sync) * 1000.0 >= config->sync_interval_ms))
+        return json_array_writer_sync(writer);
+    return 1;
+}
+
+size_t json_array_writer_count(const JsonArrayWriter *writer)
+{
+    return writer ? writer->count : 0;
+}
+
+const JsonError *json_array_writer_error(const JsonArrayWriter *writer)
+{
+    return writer ? &writer->error : NULL;
+}
+
+int json_array_writer_close(JsonArrayWriter *writer)
+{
+    if (!writer)
+        return 0;
+    int ok = writer->config.sync_on_close ? json_array_writer_sync(writer) : json_array_writer_flush(writer);
+    if (fclose(writer->file) != 0)
+        ok = 0;
+    json_format_buffer_release(&writer->element);
+    json_heap_free(writer->batch);
+    json_heap_free(writer);
+    return ok;
+}
@@ -1,7 +1,12 @@
+#define _POSIX_C_SOURCE 200809L /* fileno */
 #include <stdio.h>
 #include "json.h"
 #include <math.h>
 #include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <time.h>
 
 void test_formatting_options(void) {
     printf("\nTesting JSON Formatting Options\n");
@@ -466,6 +471,3169 @@ void test_file_operations(void) {
     printf("\nFile operation tests completed!\n");
 }
 
+void test_wide_objects(void) {
+    printf("\nWide Object Tests\n");
+    printf("=================\n\n");
+
+    /* Enough members to switch the object to its hash index */
+    JsonValue* record = json_create_object();
+    char key[32];
+    for (int i = 0; i < 250; i++) {
+        snprintf(key, sizeof(key), "field_%d", i);
+        json_object_set(record, key, json_create_number(i));
+    }
+
+    /* Updating existing keys must not add members */
+    json_object_set(record, "field_7", json_create_number(-7));
+    json_object_set(record, "field_249", json_create_string("last"));
+
+    int found = 0;
+    for (int i = 0; i < 250; i++) {
+        snprintf(key, sizeof(key), "field_%d", i);
+        if (json_object_get(record, key)) found++;
+    }
+    printf("Members: %zu, found: %d, missing key: %s\n", record->value.object->size, found,
+           json_object_get(record, "field_250") ? "found (unexpected!)" : "not found");
+    printf("field_7: ");
+    json_print_value(json_object_get(record, "field_7"), 0);
+    printf("\nfield_249: ");
+    json_print_value(json_object_get(record, "field_249"), 0);
+    printf("\nFirst member (insertion order): %s\n", record->value.object->pairs->key);
+    json_free(record);
+
+    /* Duplicate keys while parsing keep the last value */
+    JsonValue* parsed = json_parse_string("{\"a\":1,\"b\":2,\"a\":3}");
+    if (parsed) {
+        char* formatted = json_format_string(parsed, &JSON_FORMAT_COMPACT);
+        printf("Duplicate keys: %s\n", formatted);
+        free(formatted);
+        json_free(parsed);
+    }
+}
+
+void test_document_parsing(void) {
+    printf("\nDocument (Arena) Parsing Tests\n");
+    printf("==============================\n\n");
+
+    /* Parse a file into a document */
+    JsonDocument* doc = json_document_parse_file("test.json");
+    if (doc) {
+        printf("Document parsed from test.json:\n");
+        json_print_value(json_document_root(doc), 0);
+        printf("\n");
+        json_document_free(doc);
+    } else {
+        printf("Failed to parse test.json: %s\n", json_get_last_error()->message);
+    }
+
+    /* Many sibling objects and strings in one arena */
+    size_t count = 1000;
+    char* input = (char*)malloc(count * 48 + 3);
+    if (!input) return;
+    size_t pos = 0;
+    input[pos++] = '[';
+    for (size_t i = 0; i < count; i++) {
+        pos += sprintf(input + pos, "%s{\"id\":%zu,\"name\":\"sensor\\n%zu\"}",
+                       i ? "," : "", i, i);
+    }
+    input[pos++] = ']';
+    input[pos] = '\0';
+
+    doc = json_document_parse_string(input);
+    if (doc) {
+        JsonValue* root = json_document_root(doc);
+        JsonValue* last = json_array_get(root, count - 1);
+        printf("Parsed %zu records, last name: ", root->value.array->size);
+        json_print_value(json_object_get(last, "name"), 0);
+        printf("\n");
+
+        /* json_free is a no-op for document-owned values */
+        json_free(last);
+        json_document_free(doc);
+    } else {
+        printf("Failed to parse records: %s\n", json_get_last_error()->message);
+    }
+
+    /* Zero-copy strings point into the input buffer */
+    const char* log_line = "{\"level\":\"info\",\"msg\":\"tab\\there\",\"ok\":true}";
+    doc = json_document_parse_string_ex(log_line, &JSON_PARSE_ZERO_COPY);
+    if (doc) {
+        JsonValue* root = json_document_root(doc);
+        JsonValue* level = json_object_get(root, "level");
+        JsonValue* msg = json_object_get(root, "msg");
+        printf("Zero-copy 'level': %.*s (view: %s)\n", (int)level->length, level->value.string,
+               (level->flags & JSON_VALUE_VIEW) ? "yes" : "no");
+        printf("Escaped 'msg' copied: %s\n", (msg->flags & JSON_VALUE_VIEW) ? "no" : "yes");
+        char* formatted = json_format_string(root, &JSON_FORMAT_COMPACT);
+        printf("Zero-copy round trip: %s\n", formatted);
+        free(formatted);
+        json_document_free(doc);
+    }
+
+    /* Errors are reported the same way as json_parse_string */
+    doc = json_document_parse_string("{\"a\": [1, 2,]}");
+    if (!doc) {
+        printf("Expected error: %s\n", json_get_last_error()->message);
+    }
+    free(input);
+}
+
+/* Run the same inputs through every scanner level and compare the results */
+void test_simd_scanning(void) {
+    printf("\nSIMD Scanning Tests\n");
+    printf("===================\n\n");
+
+    static const struct { JsonSimdLevel level; const char* name; } levels[] = {
+        {JSON_SIMD_SCALAR, "scalar"}, {JSON_SIMD_SSE2, "SSE2"},
+        {JSON_SIMD_AVX2, "AVX2"}, {JSON_SIMD_NEON, "NEON"},
+    };
+    JsonSimdLevel original = json_get_simd_level();
+    char input[512];
+
+    for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+        if (!json_set_simd_level(levels[l].level)) {
+            printf("%-6s: not available\n", levels[l].name);
+            continue;
+        }
+
+        /* Strings and whitespace runs of every length up to a few vectors */
+        int passed = 0;
+        int total = 0;
+        for (int len = 0; len < 70; len++) {
+            int pos = 0;
+            for (int i = 0; i < len; i++) input[pos++] = (i % 7 == 3) ? '\n' : ' ';
+            input[pos++] = '[';
+            input[pos++] = '"';
+            for (int i = 0; i < len; i++) input[pos++] = (char)('a' + i % 26);
+            input[pos++] = '"';
+            input[pos++] = ',';
+            input[pos++] = '"';
+            for (int i = 0; i < len; i++) input[pos++] = 'x';
+            input[pos++] = '\\';
+            input[pos++] = 't';
+            input[pos++] = '"';
+            for (int i = 0; i < len; i++) input[pos++] = '\t';
+            input[pos++] = ']';
+            input[pos] = '\0';
+
+            total++;
+            JsonValue* value = json_parse_string(input);
+            if (value && json_validate_string(input) &&
+                value->value.array->size == 2 &&
+                json_array_get(value, 0)->length == (size_t)len &&
+                json_array_get(value, 1)->length == (size_t)len + 1 &&
+                json_array_get(value, 1)->value.string[len] == '\t') {
+                passed++;
+            }
+            json_free(value);
+        }
+
+        /* Error positions are derived from the offset when an error is set */
+        const char* bad = "{\n  \"name\": \"abc\",\n  \"note\": \"0123456789abcdefghij\x01\"\n}";
+        json_parse_string(bad);
+        const JsonError* error = json_get_last_error();
+        json_validate_string(bad);
+        const JsonError* verror = json_get_validation_error();
+        printf("%-6s: %d/%d inputs ok, control char at line %zu column %zu (validator: %zu:%zu)\n",
+               levels[l].name, passed, total, error->line, error->column,
+               verror->line, verror->column);
+    }
+
+    json_set_simd_level(original);
+}
+
+/* Compare the in-place number parser against strtod */
+void test_number_parsing(void) {
+    printf("\nNumber Parsing Tests\n");
+    printf("====================\n\n");
+
+    static const char* cases[] = {
+        "0", "-0", "1", "-1", "42", "23.45", "-17.125", "0.1", "1e22", "1e23",
+        "9007199254740993", "123456789012345678901234567890",
+        "2.2250738585072011e-308", "4.9406564584124654e-324", "1.7976931348623157e308",
+        "0.000000000000000000000000000001", "3.14159265358979323846264338327950288",
+        "2.47032822920623272e-324", "9223372036854775807", "-9223372036854775808",
+        "18446744073709551616", "1E+2", "7.0e-10", "89255.0e-22", "4.4501477170144022e-308",
+    };
+    int mismatches = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        JsonValue* value = json_parse_string(cases[i]);
+        double expected = strtod(cases[i], NULL);
+        if (!value || memcmp(&value->value.number, &expected, sizeof(double)) != 0) {
+            printf("Mismatch for %s\n", cases[i]);
+            mismatches++;
+        }
+        json_free(value);
+    }
+    printf("Edge cases: %d mismatches\n", mismatches);
+
+    /* Random doubles printed with 17 digits and random short decimals */
+    char buffer[64];
+    unsigned long long seed = 88172645463325252ULL;
+    mismatches = 0;
+    int total = 20000;
+    for (int i = 0; i < total; i++) {
+        seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+        if (i % 2) {
+            double d;
+            unsigned long long bits = seed & 0x7FEFFFFFFFFFFFFFULL;
+            memcpy(&d, &bits, sizeof(d));
+            snprintf(buffer, sizeof(buffer), "%.17g", d);
+        } else {
+            snprintf(buffer, sizeof(buffer), "%llu.%llue%d", seed % 100000, (seed >> 20) % 1000,
+                     (int)((seed >> 40) % 60) - 30);
+        }
+        JsonValue* value = json_parse_string(buffer);
+        double expected = strtod(buffer, NULL);
+        if (!value || memcmp(&value->value.number, &expected, sizeof(double)) != 0) {
+            if (mismatches < 5) printf("Mismatch for %s\n", buffer);
+            mismatches++;
+        }
+        json_free(value);
+    }
+    printf("Random numbers: %d/%d match strtod\n", total - mismatches, total);
+
+    /* 64-bit IDs keep their exact value through a round trip */
+    JsonValue* record = json_parse_string("{\"id\": 9007199254740993, \"min\": -9223372036854775808}");
+    char* text = record ? json_format_string(record, &JSON_FORMAT_COMPACT) : NULL;
+    printf("Integer round trip: %s\n", text ? text : "(failed)");
+    free(text);
+    json_free(record);
+
+    JsonValue* id = json_create_integer(INT64_MAX);
+    text = json_format_string(id, &JSON_FORMAT_COMPACT);
+    printf("json_create_integer: %s\n", text ? text : "(failed)");
+    free(text);
+    json_free(id);
+
+    /* Syntax errors are still reported */
+    const char* invalid[] = {"-", "01", "1.", "1e", "-a"};
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        if (!json_parse_string(invalid[i])) {
+            printf("'%s': %s\n", invalid[i], json_get_last_error()->message);
+        }
+    }
+}
+
+/* Shortest round-trip number output */
+void test_number_formatting(void) {
+    printf("\nShortest Number Formatting Tests\n");
+    printf("================================\n\n");
+
+    JsonFormatConfig config = JSON_FORMAT_COMPACT;
+    config.number_format = JSON_NUMBER_FORMAT_SHORTEST;
+
+    static const double samples[] = {
+        0.1, 23.45, -17.125, 42.0, 1e21, 1e-7, 5e-324, 1.7976931348623157e308, 0.3 - 0.1, -0.0,
+    };
+    JsonValue* array = json_create_array();
+    for (size_t i = 0; i < sizeof(samples) / sizeof(samples[0]); i++) {
+        json_array_append(array, json_create_number(samples[i]));
+    }
+    char* text = json_format_string(array, &config);
+    printf("Shortest: %s\n", text ? text : "(failed)");
+    free(text);
+    text = json_format_string(array, &JSON_FORMAT_COMPACT);
+    printf("Auto:     %s\n", text ? text : "(failed)");
+    free(text);
+    json_free(array);
+
+    /* Every value must parse back to the same bits */
+    unsigned long long seed = 2463534242ULL;
+    int total = 20000;
+    int exact = 0;
+    for (int i = 0; i < total; i++) {
+        seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+        double d;
+        unsigned long long bits = seed & 0xFFEFFFFFFFFFFFFFULL;
+        memcpy(&d, &bits, sizeof(d));
+
+        JsonValue* value = json_create_number(d);
+        text = json_format_string(value, &config);
+        JsonValue* parsed = text ? json_parse_string(text) : NULL;
+        if (parsed && memcmp(&parsed->value.number, &d, sizeof(d)) == 0) {
+            exact++;
+        }
+        json_free(parsed);
+        json_free(value);
+        free(text);
+    }
+    printf("Round trip: %d/%d values exact\n", exact, total);
+}
+
+/* Sink used by the streaming tests: compares the output with an expected
+   string and records the largest chunk */
+typedef struct {
+    const char* expected;
+    size_t offset;
+    size_t largest_chunk;
+    size_t chunks;
+    int matches;
+} StreamCheck;
+
+static int check_sink(const char* data, size_t length, void* user_data) {
+    StreamCheck* check = (StreamCheck*)user_data;
+    if (memcmp(check->expected + check->offset, data, length) != 0) {
+        check->matches = 0;
+    }
+    check->offset += length;
+    check->chunks++;
+    if (length > check->largest_chunk) check->largest_chunk = length;
+    return 1;
+}
+
+static int failing_sink(const char* data, size_t length, void* user_data) {
+    (void)data; (void)length; (void)user_data;
+    return 0;
+}
+
+void test_streaming_output(void) {
+    printf("\nStreaming Output Tests\n");
+    printf("======================\n\n");
+
+    /* A large array of records streams in fixed-size chunks */
+    JsonValue* array = json_create_array();
+    for (int i = 0; i < 20000; i++) {
+        JsonValue* record = json_create_object();
+        json_object_set(record, "id", json_create_integer(i));
+        json_object_set(record, "value", json_create_number(i * 0.5));
+        json_object_set(record, "label", json_create_string("sensor \"A\""));
+        json_array_append(array, record);
+    }
+
+    char* expected = json_format_string(array, &JSON_FORMAT_PRETTY);
+    StreamCheck check = {expected, 0, 0, 0, 1};
+    int ok = expected && json_format_callback(array, &JSON_FORMAT_PRETTY, check_sink, &check);
+    printf("Callback: %s, %zu bytes in %zu chunks (largest %zu), output %s\n",
+           ok ? "ok" : "failed", check.offset, check.chunks, check.largest_chunk,
+           (check.matches && expected && check.offset == strlen(expected)) ? "identical" : "differs");
+    free(expected);
+
+    /* FILE* and file descriptor sinks */
+    expected = json_format_string(array, &JSON_FORMAT_COMPACT);
+    FILE* file = tmpfile();
+    if (file && expected) {
+        int stream_ok = json_write_stream(array, file);
+        long stream_size = ftell(file);
+        fflush(file);
+        int fd_ok = json_format_fd(array, fileno(file), &JSON_FORMAT_COMPACT);
+        long total_size = lseek(fileno(file), 0, SEEK_END);
+        printf("json_write_stream: %s (%ld bytes, expected %zu)\n",
+               stream_ok ? "ok" : "failed", stream_size, strlen(expected));
+        printf("json_format_fd: %s (%ld bytes)\n", fd_ok ? "ok" : "failed", total_size - stream_size);
+        fclose(file);
+    }
+    free(expected);
+
+    /* Sink errors abort formatting */
+    printf("Failing sink returns: %d\n",
+           json_format_callback(array, &JSON_FORMAT_COMPACT, failing_sink, NULL));
+    json_free(array);
+}
+
+/* Newline-delimited and concatenated values through a small reader buffer */
+void test_incremental_reader(void) {
+    printf("\nIncremental Reader Tests\n");
+    printf("========================\n\n");
+
+    const char* filename = "test_stream.ndjson";
+    FILE* file = fopen(filename, "w");
+    if (!file) {
+        printf("Failed to create %s\n", filename);
+        return;
+    }
+    for (int i = 0; i < 500; i++) {
+        fprintf(file, "{\"id\":%d,\"note\":\"brace } and \\\"quote\\\" [%d]\",\"values\":[%d,%d.5]}\n",
+                i, i, i, i);
+    }
+    /* One value much larger than the buffer */
+    fprintf(file, "[");
+    for (int i = 0; i < 2000; i++) {
+        fprintf(file, "%s%d", i ? "," : "", i);
+    }
+    fprintf(file, "]\n");
+    /* Back-to-back values, a bad record, then more values */
+    fprintf(file, "{\"a\":1}{\"b\":2} 3 \"text\" true\n{\"bad\": }\n[1,2]\n-4.25");
+    fclose(file);
+
+    JsonFileReader* reader = json_file_reader_create(filename, 64);
+    if (!reader) {
+        printf("Failed to create reader: %s\n", json_get_file_error()->message);
+        return;
+    }
+
+    int records = 0;
+    int errors = 0;
+    int others = 0;
+    int ids_in_order = 1;
+    size_t large_size = 0;
+    for (;;) {
+        JsonValue* value = json_file_reader_next(reader);
+        if (!value) {
+            if (json_get_file_error()->code == JSON_ERROR_NONE) break; /* End of file */
+            printf("Record error: %s\n", json_get_file_error()->message);
+            errors++;
+            continue;
+        }
+        JsonValue* id = value->type == JSON_OBJECT ? json_object_get(value, "id") : NULL;
+        if (id) {
+            if (id->integer != records) ids_in_order = 0;
+            records++;
+        } else if (value->type == JSON_ARRAY && value->value.array->size > 100) {
+            large_size = value->value.array->size;
+        } else {
+            char* text = json_format_string(value, &JSON_FORMAT_COMPACT);
+            printf("Value: %s\n", text ? text : "(null)");
+            free(text);
+            others++;
+        }
+        json_free(value);
+    }
+    printf("Records: %d (in order: %s), large array: %zu items, other values: %d, errors: %d\n",
+           records, ids_in_order ? "yes" : "no", large_size, others, errors);
+    printf("Bytes read: %zu, buffer grew to %zu bytes\n", reader->bytes_read, reader->buffer_size);
+    json_file_reader_free(reader);
+    remove(filename);
+}
+
+void test_mapped_files(void) {
+    printf("\nMapped File Tests\n");
+    printf("=================\n\n");
+
+    const char* filename = "test_mapped.json";
+    FILE* file = fopen(filename, "wb");
+    if (!file) {
+        printf("Failed to create %s\n", filename);
+        return;
+    }
+    fprintf(file, "{\"devices\": [");
+    for (int i = 0; i < 1000; i++) {
+        fprintf(file, "%s{\"name\": \"sensor-%d\", \"value\": %d.25}", i ? ", " : "", i, i);
+    }
+    /* Ends exactly at the closing brace, without a NUL or newline */
+    fprintf(file, "]}");
+    fclose(file);
+
+    JsonValue* value = json_parse_file(filename);
+    if (value) {
+        JsonValue* devices = json_object_get(value, "devices");
+        printf("Parsed %zu devices from mapped file\n", devices->value.array->size);
+        json_free(value);
+    } else {
+        printf("Failed to parse mapped file: %s\n", json_get_last_error()->message);
+    }
+
+    printf("Validate mapped file: %s\n", json_validate_file(filename) ? "valid" : "invalid");
+
+    JsonDocument* doc = json_document_parse_file_ex(filename, &JSON_PARSE_ZERO_COPY);
+    if (doc) {
+        JsonValue* devices = json_object_get(json_document_root(doc), "devices");
+        JsonValue* name = json_object_get(json_array_get(devices, 999), "name");
+        printf("Zero-copy name from file: %.*s (view: %s)\n", (int)name->length, name->value.string,
+               (name->flags & JSON_VALUE_VIEW) ? "yes" : "no");
+        json_document_free(doc);
+    } else {
+        printf("Failed to parse mapped document: %s\n", json_get_last_error()->message);
+    }
+
+    /* Streams are parsed from their current position */
+    file = fopen(filename, "w+b");
+    if (file) {
+        fprintf(file, "# header line\n[1, 2, 3]");
+        fseek(file, 14, SEEK_SET);
+        value = json_parse_stream(file);
+        printf("Stream from offset: %s\n",
+               value && value->type == JSON_ARRAY ? "array" : json_get_file_error()->message);
+        json_free(value);
+        fclose(file);
+    }
+
+    /* Truncated input must not be read past its end */
+    file = fopen(filename, "wb");
+    if (file) {
+        fprintf(file, "{\"name\": \"unterminated");
+        fclose(file);
+    }
+    value = json_parse_file(filename);
+    printf("Truncated parse: %s\n", value ? "parsed" : json_get_last_error()->message);
+    json_free(value);
+    printf("Truncated validate: %s\n",
+           json_validate_file(filename) ? "valid" : json_get_validation_error()->message);
+
+    file = fopen(filename, "wb");
+    if (file) {
+        fprintf(file, "[tru");
+        fclose(file);
+    }
+    printf("Truncated literal: %s\n",
+           json_validate_file(filename) ? "valid" : json_get_validation_error()->message);
+
+    file = fopen(filename, "wb");
+    if (file) fclose(file);
+    value = json_parse_file(filename);
+    printf("Empty file: %s\n", value ? "parsed" : json_get_last_error()->message);
+    json_free(value);
+
+    value = json_parse_file("does_not_exist.json");
+    printf("Missing file: %s\n", value ? "parsed" : json_get_last_error()->message);
+    remove(filename);
+}
+
+void test_buffer_parsing(void) {
+    printf("\nBuffer Parsing Tests\n");
+    printf("====================\n\n");
+
+    /* Several frames back to back, none of them NUL terminated. The copy
+       has exactly the frame bytes so any overread is caught by ASan */
+    const char frames[] = "{\"seq\":1,\"temp\":21.5}[1,2,3]\"tail\"true";
+    const size_t bounds[][2] = {{0, 21}, {21, 7}, {28, 6}, {34, 4}};
+    for (size_t i = 0; i < sizeof(bounds) / sizeof(bounds[0]); i++) {
+        char* frame = (char*)malloc(bounds[i][1]);
+        memcpy(frame, frames + bounds[i][0], bounds[i][1]);
+        JsonValue* value = json_parse_buffer(frame, bounds[i][1]);
+        char* text = value ? json_format_string(value, &JSON_FORMAT_COMPACT) : NULL;
+        printf("Frame %zu: %s (valid: %s)\n", i, text ? text : json_get_last_error()->message,
+               json_validate_buffer(frame, bounds[i][1]) ? "yes" : "no");
+        free(text);
+        json_free(value);
+        free(frame);
+    }
+
+    /* A slice that cuts a value short is an error, not an overread */
+    const size_t cuts[] = {5, 12, 20, 37};
+    for (size_t i = 0; i < sizeof(cuts) / sizeof(cuts[0]); i++) {
+        char* frame = (char*)malloc(cuts[i]);
+        memcpy(frame, frames, cuts[i]);
+        JsonValue* value = json_parse_buffer(frame, cuts[i]);
+        printf("Cut at %zu: %s\n", cuts[i], value ? "parsed" : json_get_last_error()->message);
+        json_free(value);
+        free(frame);
+    }
+
+    JsonDocument* doc = json_document_parse_buffer(frames, 21, &JSON_PARSE_ZERO_COPY);
+    if (doc) {
+        printf("Document from slice: seq=%lld\n",
+               (long long)json_object_get(json_document_root(doc), "seq")->integer);
+        json_document_free(doc);
+    }
+
+    printf("Empty buffer: %s\n", json_parse_buffer(frames, 0) ? "parsed" : json_get_last_error()->message);
+    printf("NULL buffer: %s\n", json_validate_buffer(NULL, 4) ? "valid" : json_get_validation_error()->message);
+}
+
+/* Each worker checks that it only ever sees its own errors */
+typedef struct {
+    int id;
+    int mismatches;
+    int parsed;
+} ErrorWorker;
+
+static void* error_worker(void* arg) {
+    ErrorWorker* worker = (ErrorWorker*)arg;
+    /* Every worker fails in a different way */
+    static const char* bad_inputs[] = { "[1, 2,]", "{\"a\" 1}", "\"open", "[01]" };
+    static const char* expected[] = {
+        "Trailing comma not allowed in array",
+        "Expected ':' after object key",
+        "Unterminated string",
+        "Leading zeros are not allowed",
+    };
+    const char* bad = bad_inputs[worker->id];
+    char good[64];
+    snprintf(good, sizeof(good), "{\"worker\": %d, \"values\": [1, 2, 3]}", worker->id);
+
+    for (int i = 0; i < 2000; i++) {
+        JsonError error;
+        JsonValue* value = json_parse_buffer_r(good, strlen(good), &error);
+        if (value && error.code == JSON_ERROR_NONE &&
+            json_object_get(value, "worker")->integer == worker->id) {
+            worker->parsed++;
+        } else {
+            worker->mismatches++;
+        }
+        json_free(value);
+
+        if (json_parse_buffer_r(bad, strlen(bad), &error) || error.code == JSON_ERROR_NONE) {
+            worker->mismatches++;
+        }
+
+        /* The legacy API keeps its state per thread */
+        json_free(json_parse_string(bad));
+        json_validate_string(bad);
+        if (strcmp(json_get_validation_error()->message, expected[worker->id]) != 0) {
+            worker->mismatches++;
+        }
+        if (json_get_last_error()->code != error.code) {
+            worker->mismatches++;
+        }
+        if (json_validate_string(good) == 0 || json_get_validation_error()->code != JSON_ERROR_NONE) {
+            worker->mismatches++;
+        }
+    }
+    return NULL;
+}
+
+void test_reentrant_errors(void) {
+    printf("\nReentrant Error Tests\n");
+    printf("=====================\n\n");
+
+    JsonError error;
+    JsonValue* value = json_parse_buffer_r("[1, 2", 5, &error);
+    printf("Caller-owned error: %s at line %zu, column %zu\n",
+           value ? "none" : error.message, error.line, error.column);
+    printf("Validate into caller error: %s\n",
+           json_validate_buffer_r("{\"a\": tru}", 10, &error) ? "valid" : error.message);
+    printf("NULL error pointer is accepted: %s\n",
+           json_parse_buffer_r("{", 1, NULL) ? "parsed" : "failed");
+
+    /* The main thread's legacy error survives the workers' failures */
+    json_free(json_parse_string("[true false]"));
+
+    pthread_t threads[4];
+    ErrorWorker workers[4];
+    for (int i = 0; i < 4; i++) {
+        workers[i].id = i;
+        workers[i].mismatches = 0;
+        workers[i].parsed = 0;
+        pthread_create(&threads[i], NULL, error_worker, &workers[i]);
+    }
+    int mismatches = 0;
+    int parsed = 0;
+    for (int i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+        mismatches += workers[i].mismatches;
+        parsed += workers[i].parsed;
+    }
+    printf("Parallel parses: %d, error mismatches: %d\n", parsed, mismatches);
+    printf("Main thread error unchanged: %s\n", json_get_last_error()->message);
+}
+
+/* Batch callback state; unordered callbacks run on several threads */
+typedef struct {
+    pthread_mutex_t lock;
+    size_t records;
+    size_t errors;
+    long long id_sum;
+    size_t last_offset[2];
+    int in_order;
+    size_t stop_after;
+} BatchCheck;
+
+static int batch_check_record(const JsonBatchRecord* record, void* user_data) {
+    BatchCheck* check = (BatchCheck*)user_data;
+    pthread_mutex_lock(&check->lock);
+    if (record->value) {
+        check->id_sum += json_object_get(record->value, "id")->integer;
+    } else {
+        if (check->errors == 0) {
+            printf("Bad record in file %zu at offset %zu: %s (line %zu, column %zu)\n",
+                   record->file_index, record->offset, record->error->message,
+                   record->error->line, record->error->column);
+        }
+        check->errors++;
+    }
+    if (check->records && record->offset <= check->last_offset[record->file_index]) {
+        check->in_order = 0;
+    }
+    check->last_offset[record->file_index] = record->offset;
+    check->records++;
+    int keep_going = !check->stop_after || check->records < check->stop_after;
+    pthread_mutex_unlock(&check->lock);
+    return keep_going;
+}
+
+static void batch_check_reset(BatchCheck* check) {
+    check->records = 0;
+    check->errors = 0;
+    check->id_sum = 0;
+    check->last_offset[0] = 0;
+    check->last_offset[1] = 0;
+    check->in_order = 1;
+    check->stop_after = 0;
+}
+
+void test_batch_ingest(void) {
+    printf("\nBatch Ingest Tests\n");
+    printf("==================\n\n");
+
+    const char* files[] = { "test_batch_a.ndjson", "test_batch_b.ndjson" };
+    long long expected_sum = 0;
+    for (int f = 0; f < 2; f++) {
+        FILE* file = fopen(files[f], "wb");
+        if (!file) {
+            printf("Failed to create %s\n", files[f]);
+            return;
+        }
+        for (int i = 0; i < 3000; i++) {
+            int id = f * 100000 + i;
+            if (f == 0 && i == 1234) {
+                fprintf(file, "{\"id\": %d, \"reading\": }\n", id);
+                continue;
+            }
+            if (i % 500 == 0) fprintf(file, "\n   \n"); /* Blank lines are skipped */
+            fprintf(file, "{\"id\": %d, \"sensor\": \"s-%d\", \"reading\": %d.5, \"tags\": [\"a\", \"b\"]}%s",
+                    id, i % 7, i, i % 3 == 0 ? "\r\n" : "\n");
+            expected_sum += id;
+        }
+        if (f == 1) fprintf(file, "{\"id\": 0, \"last\": true}"); /* No final newline */
+        fclose(file);
+    }
+
+    BatchCheck check;
+    pthread_mutex_init(&check.lock, NULL);
+    JsonBatchStats stats;
+
+    JsonBatchConfig config = JSON_BATCH_DEFAULT;
+    config.threads = 4;
+    config.chunk_size = 4096;
+    batch_check_reset(&check);
+    int ok = json_batch_process_files(files, 2, &config, batch_check_record, &check, &stats);
+    printf("Ordered: ok=%d records=%zu errors=%zu in order=%s sum matches=%s\n", ok, check.records,
+           check.errors, check.in_order ? "yes" : "no", check.id_sum == expected_sum ? "yes" : "no");
+    printf("Stats: files=%zu chunks>1=%s records=%zu errors=%zu threads=%zu\n", stats.files,
+           stats.chunks > 1 ? "yes" : "no", stats.records, stats.errors, stats.threads);
+
+    config.ordered = 0;
+    config.parse = JSON_PARSE_ZERO_COPY;
+    batch_check_reset(&check);
+    ok = json_batch_process_files(files, 2, &config, batch_check_record, &check, &stats);
+    printf("Unordered zero-copy: ok=%d records=%zu errors=%zu sum matches=%s\n", ok, check.records,
+           check.errors, check.id_sum == expected_sum ? "yes" : "no");
+
+    config.threads = 1;
+    batch_check_reset(&check);
+    ok = json_batch_process_file(files[1], &config, batch_check_record, &check, &stats);
+    printf("Single thread: ok=%d records=%zu in order=%s\n", ok, check.records, check.in_order ? "yes" : "no");
+
+    config = JSON_BATCH_DEFAULT;
+    config.chunk_size = 1024;
+    batch_check_reset(&check);
+    check.stop_after = 100;
+    ok = json_batch_process_files(files, 2, &config, batch_check_record, &check, &stats);
+    printf("Stopped by callback: ok=%d records=%zu\n", ok, check.records);
+
+    const char* missing[] = { files[0], "does_not_exist.ndjson" };
+    ok = json_batch_process_files(missing, 2, NULL, batch_check_record, &check, NULL);
+    printf("Missing file: ok=%d (%s)\n", ok, json_get_batch_error()->message);
+
+    pthread_mutex_destroy(&check.lock);
+    remove(files[0]);
+    remove(files[1]);
+}
+
+/* Parse with both engines and compare the trees or the errors */
+static int tape_matches_parser(const char* input, size_t length) {
+    JsonError parser_error, tape_error;
+    JsonValue* expected = json_parse_buffer_r(input, length, &parser_error);
+    JsonTape* tape = json_tape_parse(input, length, &tape_error);
+    int same;
+    if (!expected || !tape) {
+        same = !expected && !tape && parser_error.code == tape_error.code &&
+               strcmp(parser_error.message, tape_error.message) == 0 &&
+               parser_error.line == tape_error.line && parser_error.column == tape_error.column &&
+               strcmp(parser_error.context, tape_error.context) == 0;
+    } else {
+        JsonValue* actual = json_cursor_materialize(json_tape_root(tape));
+        char* a = json_format_string(expected, &JSON_FORMAT_COMPACT);
+        char* b = actual ? json_format_string(actual, &JSON_FORMAT_COMPACT) : NULL;
+        same = a && b && strcmp(a, b) == 0;
+        free(a);
+        free(b);
+        json_free(actual);
+    }
+    json_free(expected);
+    json_tape_free(tape);
+    return same;
+}
+
+void test_tape_engine(void) {
+    printf("\nTape Engine Tests\n");
+    printf("=================\n\n");
+
+    const char* text = "{\"sensor\": \"t-1\", \"ok\": true, \"count\": 3, \"readings\": [21.5, -3, 1e2, null],"
+                       " \"meta\": {\"unit\": \"\\u00b0C\", \"tags\": []}, \"note\": \"a \\\"quoted\\\" word\"}";
+    JsonTape* tape = json_tape_parse(text, strlen(text), NULL);
+    if (!tape) {
+        printf("Tape parse failed\n");
+        return;
+    }
+    JsonCursor root = json_tape_root(tape);
+    printf("Root members: %zu\n", json_cursor_size(root));
+    for (JsonCursor member = json_cursor_first(root); json_cursor_is_valid(member);
+         member = json_cursor_next(member)) {
+        size_t key_length;
+        const char* key = json_cursor_key(member, &key_length);
+        printf("  %.*s: type %d\n", (int)key_length, key, json_cursor_type(member));
+    }
+    JsonCursor readings = json_cursor_get(root, "readings");
+    printf("readings[0] = %g, readings[1] integer: %s (%lld), size %zu\n",
+           json_cursor_number(json_cursor_at(readings, 0)),
+           json_cursor_is_integer(json_cursor_at(readings, 1)) ? "yes" : "no",
+           (long long)json_cursor_integer(json_cursor_at(readings, 1)), json_cursor_size(readings));
+    printf("readings[4] valid: %s\n", json_cursor_is_valid(json_cursor_at(readings, 4)) ? "yes" : "no");
+    printf("meta.unit = %s, note = %s\n",
+           json_cursor_string(json_cursor_get(json_cursor_get(root, "meta"), "unit"), NULL),
+           json_cursor_string(json_cursor_get(root, "note"), NULL));
+    JsonValue* meta = json_cursor_materialize(json_cursor_get(root, "meta"));
+    char* formatted = json_format_string(meta, &JSON_FORMAT_COMPACT);
+    printf("Materialized meta: %s\n", formatted);
+    free(formatted);
+    json_free(meta);
+    json_tape_free(tape);
+
+    /* Documents can be built through the tape engine */
+    JsonDocument* doc = json_document_parse_string_ex(text, &JSON_PARSE_TAPE);
+    printf("Tape document count: %lld\n",
+           doc ? (long long)json_object_get(json_document_root(doc), "count")->integer : -1LL);
+    json_document_free(doc);
+
+    /* Same results and errors as the recursive parser */
+    static const char* cases[] = {
+        "[]", "{}", "  7  ", "\"x\"", "[1,[2,[3,[4]]]]", "{\"a\":{\"b\":[true,false,null]}}",
+        "[1,2,]", "{\"a\":1,}", "{\"a\" 1}", "{1:2}", "[1 2]", "[tru]", "[truex]", "[nul]",
+        "\"abc", "[\"a\\x\"]", "[\"\\ud800\"]", "[\"\\udc00\"]", "[\"\\ud83d\\ude00\"]",
+        "[\"\\u12\"]", "[1e999]", "[-]", "[01]", "[1.]", "[.5]", "1 2", "{} x", "", "   ",
+        "[\"tab\there\"]", "{\"a\":1}}", "[[[]]", "]", "[1,\"a\"\"b\"]", "[1\"a\"]",
+        "{\"k\":\"v\" \"k2\":1}", "{\"dup\":1,\"dup\":2}", "[\"\\/\\b\\f\\n\\r\\t\"]", "\xef\xbb\xbf[]",
+        "[-0, 0.0, 1E+2, 2e-3, 9007199254740993, -9223372036854775808, 18446744073709551616]",
+    };
+    int mismatches = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        if (!tape_matches_parser(cases[i], strlen(cases[i]))) {
+            printf("Mismatch on case %zu: %s\n", i, cases[i]);
+            mismatches++;
+        }
+    }
+
+    /* Nesting limit */
+    char deep[80];
+    for (int depth = 31; depth <= 34; depth++) {
+        memset(deep, '[', depth);
+        memset(deep + depth, ']', depth);
+        if (!tape_matches_parser(deep, 2 * depth)) {
+            printf("Mismatch at depth %d\n", depth);
+            mismatches++;
+        }
+    }
+
+    /* Strings and escapes across 64-byte block boundaries */
+    char long_input[512];
+    for (int shift = 0; shift < 70; shift++) {
+        int n = snprintf(long_input, sizeof(long_input), "[%*s\"%.*s\\\\\\\"x\\u00e9\", 12345, \"%.*s\"]", shift, "",
+                         shift, "abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyz",
+                         70 - shift, "{[:,]}{[:,]}{[:,]}{[:,]}{[:,]}{[:,]}{[:,]}{[:,]}{[:,]}{[:,]}{[:,]}{[:,]}");
+        if (!tape_matches_parser(long_input, (size_t)n)) {
+            printf("Mismatch with shift %d\n", shift);
+            mismatches++;
+        }
+    }
+
+    /* Random corruptions of a valid document, with each scanner */
+    static const char alphabet[] = "{}[]:,\"\\ 0123456789-+.eEtrufalsn\tu\n";
+    JsonSimdLevel levels[] = { JSON_SIMD_SCALAR, JSON_SIMD_SSE2, JSON_SIMD_AVX2, JSON_SIMD_NEON };
+    unsigned seed = 12345;
+    int trials = 0;
+    for (int level = 0; level < 4; level++) {
+        if (!json_set_simd_level(levels[level])) continue; /* Not available here */
+        for (int trial = 0; trial < 3000; trial++) {
+            char mutated[256];
+            size_t length = strlen(text);
+            memcpy(mutated, text, length);
+            int edits = 1 + trial % 3;
+            for (int e = 0; e < edits; e++) {
+                seed = seed * 1103515245u + 12345u;
+                size_t pos = (seed >> 8) % length;
+                seed = seed * 1103515245u + 12345u;
+                mutated[pos] = alphabet[(seed >> 8) % (sizeof(alphabet) - 1)];
+            }
+            seed = seed * 1103515245u + 12345u;
+            if ((seed >> 8) % 4 == 0) length = (seed >> 12) % length; /* Truncate */
+            trials++;
+            if (!tape_matches_parser(mutated, length)) {
+                if (mismatches < 5) printf("Mismatch on mutation: %.*s\n", (int)length, mutated);
+                mismatches++;
+            }
+        }
+    }
+    json_set_simd_level(JSON_SIMD_AUTO);
+    printf("Differential checks: %zu cases, mutations on every scanner: %s, mismatches: %d\n",
+           sizeof(cases) / sizeof(cases[0]), trials >= 6000 ? "yes" : "no", mismatches);
+
+    JsonError error;
+    printf("Error via tape: %s\n", json_tape_parse("{\"a\": [1, 2,]}", 14, &error) ? "parsed" : error.message);
+}
+
+/* Parse eagerly and lazily and compare the trees or the errors */
+static int document_matches_eager(const char* input, size_t length, const JsonParseConfig* config) {
+    JsonError eager_error, lazy_error;
+    JsonDocument* eager = json_document_parse_buffer_r(input, length, &JSON_PARSE_DEFAULT, &eager_error);
+    JsonDocument* lazy = json_document_parse_buffer_r(input, length, config, &lazy_error);
+    int same;
+    if (!eager || !lazy) {
+        same = !eager && !lazy && eager_error.code == lazy_error.code &&
+               strcmp(eager_error.message, lazy_error.message) == 0 &&
+               eager_error.line == lazy_error.line && eager_error.column == lazy_error.column &&
+               strcmp(eager_error.context, lazy_error.context) == 0;
+    } else {
+        char* a = json_format_string(json_document_root(eager), &JSON_FORMAT_COMPACT);
+        char* b = json_format_string(json_document_root(lazy), &JSON_FORMAT_COMPACT);
+        same = a && b && strcmp(a, b) == 0;
+        free(a);
+        free(b);
+    }
+    json_document_free(eager);
+    json_document_free(lazy);
+    return same;
+}
+
+static int lazy_matches_parser(const char* input, size_t length) {
+    return document_matches_eager(input, length, &JSON_PARSE_LAZY);
+}
+
+void test_lazy_documents(void) {
+    printf("\nLazy Document Tests\n");
+    printf("===================\n\n");
+
+    const char* text = "[{\"timestamp\": 1, \"temperature\": 21.5, \"raw\": {\"adc\": [1, 2, 3], \"cal\": {\"k\": 0.5}}},"
+                       " {\"timestamp\": 2, \"temperature\": \"nan\", \"raw\": {\"adc\": [], \"cal\": {}}},"
+                       " {\"timestamp\": 3, \"temperature\": 22.25, \"raw\": null, \"tags\": [\"a\\u00e9\", \"\\ud83d\\ude00\"]}]";
+    JsonDocument* doc = json_document_parse_string_ex(text, &JSON_PARSE_LAZY);
+    if (!doc) {
+        printf("Lazy parse failed: %s\n", json_get_last_error()->message);
+        return;
+    }
+    JsonValue* root = json_document_root(doc);
+    printf("Root lazy before access: %s\n", (root->flags & JSON_VALUE_LAZY) ? "yes" : "no");
+    size_t records = json_array_size(root);
+    printf("Records: %zu, root lazy after: %s\n", records, (root->flags & JSON_VALUE_LAZY) ? "yes" : "no");
+    JsonValue* first = json_array_get(root, 0);
+    printf("First record lazy: %s\n", (first->flags & JSON_VALUE_LAZY) ? "yes" : "no");
+    printf("First temperature: %g, members: %zu\n",
+           json_object_get(first, "temperature")->value.number, json_object_size(first));
+    JsonValue* raw = json_object_get(first, "raw");
+    printf("Untouched raw still lazy: %s\n", (raw->flags & JSON_VALUE_LAZY) ? "yes" : "no");
+    printf("raw.cal.k: %g\n", json_object_get(json_object_get(raw, "cal"), "k")->value.number);
+    printf("Third record untouched: %s\n", (json_array_get(root, 2)->flags & JSON_VALUE_LAZY) ? "yes" : "no");
+
+    JsonCleanStats stats;
+    JsonValue* cleaned = json_clean_data(root, "temperature", &stats);
+    printf("Cleaned lazily: %zu of %zu kept\n", stats.cleaned_count, stats.original_count);
+    json_free(cleaned);
+
+    /* Setters build the container before changing it. Heap values stay
+       owned by the caller */
+    JsonValue* third = json_array_get(root, 2);
+    JsonValue* checked = json_create_boolean(1);
+    printf("Set on lazy object: %s, members now %zu\n",
+           json_object_set(third, "checked", checked) ? "ok" : "failed", json_object_size(third));
+    json_document_free(doc);
+    json_free(checked);
+
+    /* Same trees and errors as an eager document */
+    static const char* cases[] = {
+        "[]", "{}", "  7  ", "\"x\"", "[1,[2,[3,[4]]]]", "{\"a\":{\"b\":[true,false,null]}}",
+        "[1,2,]", "{\"a\":1,}", "{\"a\" 1}", "{1:2}", "[1 2]", "[tru]", "[nul]", "\"abc",
+        "[\"a\\x\"]", "[\"\\ud800\"]", "[\"\\udc00\"]", "[\"\\ud83d\\ude00\"]", "[\"\\ud800\\u0041\"]",
+        "[\"\\u12\"]", "[1e999]", "{\"a\":[-1e400]}", "[-]", "[01]", "[1.]", "1 2", "{} x", "", "   ",
+        "[\"tab\there\"]", "{\"a\":1}}", "[[[]]", "]", "{\"dup\":1,\"dup\":2}", "[[],{},[{}],{\"a\":[]}]",
+        "[-0, 0.0, 1E+2, 2e-3, 9007199254740993, -9223372036854775808, 18446744073709551616]",
+    };
+    int mismatches = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        if (!lazy_matches_parser(cases[i], strlen(cases[i]))) {
+            printf("Mismatch on case %zu: %s\n", i, cases[i]);
+            mismatches++;
+        }
+    }
+
+    char deep[80];
+    for (int depth = 31; depth <= 34; depth++) {
+        memset(deep, '[', depth);
+        memset(deep + depth, ']', depth);
+        if (!lazy_matches_parser(deep, 2 * depth)) {
+            printf("Mismatch at depth %d\n", depth);
+            mismatches++;
+        }
+    }
+
+    /* Random corruptions of a valid document */
+    static const char alphabet[] = "{}[]:,\"\\ 0123456789-+.eEtrufalsn\tu\n";
+    unsigned seed = 4242;
+    size_t text_length = strlen(text);
+    for (int trial = 0; trial < 3000; trial++) {
+        char mutated[512];
+        size_t length = text_length;
+        memcpy(mutated, text, length);
+        int edits = 1 + trial % 3;
+        for (int e = 0; e < edits; e++) {
+            seed = seed * 1103515245u + 12345u;
+            size_t pos = (seed >> 8) % length;
+            seed = seed * 1103515245u + 12345u;
+            mutated[pos] = alphabet[(seed >> 8) % (sizeof(alphabet) - 1)];
+        }
+        seed = seed * 1103515245u + 12345u;
+        if ((seed >> 8) % 4 == 0) length = (seed >> 12) % length; /* Truncate */
+        if (!lazy_matches_parser(mutated, length)) {
+            if (mismatches < 5) printf("Mismatch on mutation: %.*s\n", (int)length, mutated);
+            mismatches++;
+        }
+    }
+    printf("Differential checks: %zu cases, 3000 mutations, mismatches: %d\n",
+           sizeof(cases) / sizeof(cases[0]), mismatches);
+
+    /* Files keep their mapping for later expansion */
+    const char* filename = "lazy_test.json";
+    FILE* file = fopen(filename, "w");
+    if (file) {
+        fputs(text, file);
+        fclose(file);
+        JsonParseConfig config = JSON_PARSE_LAZY;
+        config.zero_copy_strings = 1;
+        JsonDocument* file_doc = json_document_parse_file_ex(filename, &config);
+        JsonValue* tags = file_doc ? json_object_get(json_array_get(json_document_root(file_doc), 2), "tags") : NULL;
+        JsonValue* tag = json_array_get(tags, 0);
+        printf("Lazy file tag: %s\n", tag ? "found" : "missing");
+        if (tag) printf("Tag bytes: %zu, view: %s\n", tag->length, (tag->flags & JSON_VALUE_VIEW) ? "yes" : "no");
+        json_document_free(file_doc);
+        remove(filename);
+    }
+
+    JsonError error;
+    printf("Lazy error: %s\n",
+           json_document_parse_buffer_r("[{\"a\": [1, 2,]}]", 16, &JSON_PARSE_LAZY, &error) ? "parsed" : error.message);
+}
+
+/* Validation and parsing must agree on acceptance and on every detail of
+   the error */
+static int validation_matches_parser(const char* input, size_t length) {
+    JsonError parse_error, validate_error;
+    JsonValue* value = json_parse_buffer_r(input, length, &parse_error);
+    int valid = json_validate_buffer_r(input, length, &validate_error);
+    int same;
+    if (value || valid) {
+        same = value && valid && validate_error.code == JSON_ERROR_NONE;
+    } else {
+        same = parse_error.code == validate_error.code &&
+               strcmp(parse_error.message, validate_error.message) == 0 &&
+               parse_error.line == validate_error.line && parse_error.column == validate_error.column &&
+               strcmp(parse_error.context, validate_error.context) == 0;
+    }
+    json_free(value);
+    return same;
+}
+
+void test_single_pass_validation(void) {
+    printf("\nSingle-Pass Validation Tests\n");
+    printf("============================\n\n");
+
+    static const char* cases[] = {
+        "[]", "{}", "  7  ", "\"x\"", "[1,[2,[3,[4]]]]", "{\"a\":{\"b\":[true,false,null]}}",
+        "[1,2,]", "{\"a\":1,}", "{\"a\" 1}", "{1:2}", "[1 2]", "[tru]", "[truex]", "[nul]", "true false",
+        "\"abc", "[\"a\\x\"]", "[\"\\ud800\"]", "[\"\\udc00\"]", "[\"\\ud83d\\ude00\"]", "[\"\\ud800\\u0041\"]",
+        "[\"\\ud800\\\\ude00\"]", "[\"\\u12\"]", "[\"\\u00e9\\\\\"]", "[\"\\\\\\\"\"]", "[1e999]", "[-1e400]",
+        "[1e-999]", "[-]", "[01]", "[1.]", "[.5]", "[1e]", "[1e+]", "1 2", "{} x", "", "   ", "\t\n\v\f\r[]",
+        "[\"tab\there\"]", "{\"a\":1}}", "[[[]]", "]", "[1,\"a\"\"b\"]", "[1\"a\"]", "[1/]", "[\\]", "[1]\\",
+        "{\"k\":\"v\" \"k2\":1}", "{\"a\":}", "{\"a\"::1}", "{,}", "[,]", "[1,,2]", "{\"a\":1 \"b\":2}",
+        "[\"\\/\\b\\f\\n\\r\\t\"]", "\xef\xbb\xbf[]", "[\"\xc3\xa9\"]", "[1]\x01", "[\"\x01\"]", "nul", "-0",
+        "[-0, 0.0, 1E+2, 2e-3, 9007199254740993, -9223372036854775808, 18446744073709551616]",
+    };
+    int mismatches = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        if (!validation_matches_parser(cases[i], strlen(cases[i])) ||
+            !lazy_matches_parser(cases[i], strlen(cases[i]))) {
+            printf("Mismatch on case %zu: %s\n", i, cases[i]);
+            mismatches++;
+        }
+    }
+
+    /* Nesting limit, NUL bytes and inputs that are not NUL terminated */
+    char deep[80];
+    for (int depth = 31; depth <= 34; depth++) {
+        memset(deep, '[', depth);
+        memset(deep + depth, ']', depth);
+        if (!validation_matches_parser(deep, 2 * depth)) {
+            printf("Mismatch at depth %d\n", depth);
+            mismatches++;
+        }
+    }
+    if (!validation_matches_parser("[1]\0", 4) || !validation_matches_parser("[\"a\0\"]", 6) ||
+        !validation_matches_parser("[12345", 4)) {
+        printf("Mismatch on embedded NUL or truncated buffer\n");
+        mismatches++;
+    }
+
+    /* Tokens, strings and escapes across 64-byte block boundaries */
+    char long_input[512];
+    for (int shift = 0; shift < 70; shift++) {
+        int n = snprintf(long_input, sizeof(long_input),
+                         "{\"k%*s\": [%.*s\"\\\\\\\"x\\ud83d\\ude00\", 12345.5e3, true, \"%.*s\"]}", shift, "",
+                         shift, "null, false, -1, 0.25, [], {}, null, false, -1, 0.25, [], {}, 7, 8, 9, 10",
+                         70 - shift, "{[:,]}{[:,]}{[:,]}{[:,]}{[:,]}{[:,]}{[:,]}{[:,]}{[:,]}{[:,]}{[:,]}{[:,]}");
+        if (!validation_matches_parser(long_input, (size_t)n) || !lazy_matches_parser(long_input, (size_t)n)) {
+            printf("Mismatch with shift %d\n", shift);
+            mismatches++;
+        }
+    }
+
+    /* Random corruptions of a valid document, with each scanner */
+    const char* text = "{\"sensor\": \"t-1\", \"ok\": true, \"count\": 3, \"readings\": [21.5, -3, 1e2, null],"
+                       " \"meta\": {\"unit\": \"\\u00b0C\", \"tags\": [], \"pair\": \"\\ud83d\\ude00\"},"
+                       " \"note\": \"a \\\"quoted\\\" \\\\ word\", \"big\": 1.5e300, \"list\": [[1], {\"x\": false}]}";
+    static const char alphabet[] = "{}[]:,\"\\ 0123456789-+.eEtrufalsn\tu\ndD\x01";
+    JsonSimdLevel levels[] = { JSON_SIMD_SCALAR, JSON_SIMD_SSE2, JSON_SIMD_AVX2, JSON_SIMD_NEON };
+    unsigned seed = 777;
+    int trials = 0;
+    size_t text_length = strlen(text);
+    for (int level = 0; level < 4; level++) {
+        if (!json_set_simd_level(levels[level])) continue; /* Not available here */
+        for (int trial = 0; trial < 3000; trial++) {
+            char mutated[512];
+            size_t length = text_length;
+            memcpy(mutated, text, length);
+            int edits = 1 + trial % 3;
+            for (int e = 0; e < edits; e++) {
+                seed = seed * 1103515245u + 12345u;
+                size_t pos = (seed >> 8) % length;
+                seed = seed * 1103515245u + 12345u;
+                mutated[pos] = alphabet[(seed >> 8) % (sizeof(alphabet) - 1)];
+            }
+            seed = seed * 1103515245u + 12345u;
+            if ((seed >> 8) % 4 == 0) length = (seed >> 12) % length; /* Truncate */
+            trials++;
+            if (!validation_matches_parser(mutated, length) || !lazy_matches_parser(mutated, length)) {
+                if (mismatches < 5) printf("Mismatch on mutation: %.*s\n", (int)length, mutated);
+                mismatches++;
+            }
+        }
+    }
+    json_set_simd_level(JSON_SIMD_AUTO);
+    printf("Differential checks: %zu cases, mutations on every scanner: %s, mismatches: %d\n",
+           sizeof(cases) / sizeof(cases[0]), trials >= 6000 ? "yes" : "no", mismatches);
+
+    /* One parse is a full validation: the diagnostics are the same */
+    JsonError error;
+    const char* bad = "{\n  \"a\": [1, 2],\n  \"b\": tru\n}";
+    json_validate_buffer_r(bad, strlen(bad), &error);
+    printf("Validation: %s at line %zu, column %zu\n", error.message, error.line, error.column);
+    json_parse_buffer_r(bad, strlen(bad), &error);
+    printf("Parse:      %s at line %zu, column %zu\n", error.message, error.line, error.column);
+    int valid = json_validate_buffer_r("[1]", 3, &error);
+    printf("Valid input: %s, line %zu, column %zu\n", valid ? "yes" : "no", error.line, error.column);
+}
+
+/* Allocator that counts calls and live bytes, with an optional failure
+   after a number of allocations. Each block carries its size in front */
+typedef struct {
+    size_t allocations;
+    size_t frees;
+    size_t live_bytes;
+    long fail_after;    /* -1 never fails */
+} CountingHeap;
+
+static int counting_should_fail(CountingHeap* heap) {
+    if (heap->fail_after < 0) {
+        return 0;
+    }
+    if (heap->fail_after == 0) {
+        return 1;
+    }
+    heap->fail_after--;
+    return 0;
+}
+
+static void* counting_allocate(void* user_data, size_t size) {
+    CountingHeap* heap = (CountingHeap*)user_data;
+    if (counting_should_fail(heap)) {
+        return NULL;
+    }
+    size_t* block = malloc(sizeof(max_align_t) + size);
+    if (!block) {
+        return NULL;
+    }
+    *block = size;
+    heap->allocations++;
+    heap->live_bytes += size;
+    return (char*)block + sizeof(max_align_t);
+}
+
+static void* counting_reallocate(void* user_data, void* ptr, size_t size) {
+    CountingHeap* heap = (CountingHeap*)user_data;
+    if (!ptr) {
+        return counting_allocate(user_data, size);
+    }
+    if (counting_should_fail(heap)) {
+        return NULL;
+    }
+    size_t* block = (size_t*)((char*)ptr - sizeof(max_align_t));
+    size_t old_size = *block;
+    block = realloc(block, sizeof(max_align_t) + size);
+    if (!block) {
+        return NULL;
+    }
+    *block = size;
+    heap->allocations++;
+    heap->live_bytes += size - old_size;
+    return (char*)block + sizeof(max_align_t);
+}
+
+static void counting_release(void* user_data, void* ptr) {
+    CountingHeap* heap = (CountingHeap*)user_data;
+    size_t* block = (size_t*)((char*)ptr - sizeof(max_align_t));
+    heap->frees++;
+    heap->live_bytes -= *block;
+    free(block);
+}
+
+void test_allocator_hooks(void) {
+    printf("\nAllocator and Statistics Tests\n");
+    printf("==============================\n\n");
+
+    CountingHeap global_heap = {0, 0, 0, -1};
+    JsonAllocator global = {counting_allocate, counting_reallocate, counting_release, &global_heap};
+    JsonAllocator incomplete = global;
+    incomplete.release = NULL;
+    printf("Incomplete allocator rejected: %s\n", json_set_allocator(&incomplete) ? "no" : "yes");
+
+    /* Everything on the heap goes through the global allocator */
+    json_set_allocator(&global);
+    const char* text = "{\"sensor\": \"north\", \"readings\": [21.5, 22.0, {\"raw\": [1, 2, 3]}], \"ok\": true}";
+    JsonValue* value = json_parse_string(text);
+    char* formatted = json_format_string(value, &JSON_FORMAT_PRETTY);
+    size_t in_use = global_heap.live_bytes;
+    json_free_string(formatted);
+    json_free(value);
+    printf("Global allocator used: %s, balanced after free: %s\n",
+           in_use > 0 ? "yes" : "no",
+           global_heap.allocations == global_heap.frees && global_heap.live_bytes == 0 ? "yes" : "no");
+
+    /* A document can bring its own allocator, the global one is not touched */
+    CountingHeap doc_heap = {0, 0, 0, -1};
+    JsonAllocator doc_allocator = {counting_allocate, counting_reallocate, counting_release, &doc_heap};
+    JsonParseConfig config = JSON_PARSE_LAZY;
+    config.allocator = &doc_allocator;
+    size_t global_before = global_heap.allocations;
+    JsonDocument* doc = json_document_parse_string_ex(text, &config);
+    double raw = json_array_get(json_object_get(json_array_get(json_object_get(json_document_root(doc),
+                                                "readings"), 2), "raw"), 1)->value.number;
+    size_t doc_allocations = doc_heap.allocations;
+    json_document_free(doc);
+    printf("Document allocator: %s, raw[1] = %g, global calls: %zu, balanced: %s\n",
+           doc_allocations > 0 ? "used" : "unused", raw, global_heap.allocations - global_before,
+           doc_heap.allocations == doc_heap.frees && doc_heap.live_bytes == 0 ? "yes" : "no");
+
+    /* Running out of memory at any point fails cleanly */
+    int clean = 1;
+    for (long limit = 0; limit < 40; limit++) {
+        global_heap.fail_after = limit;
+        JsonValue* partial = json_parse_string(text);
+        char* output = partial ? json_format_string(partial, &JSON_FORMAT_COMPACT) : NULL;
+        if (!partial && json_get_last_error()->code != JSON_ERROR_MEMORY_ALLOCATION) {
+            clean = 0;
+        }
+        json_free_string(output);
+        json_free(partial);
+    }
+    global_heap.fail_after = -1;
+    printf("Allocation failures handled: %s, balanced: %s\n", clean ? "yes" : "no",
+           global_heap.live_bytes == 0 ? "yes" : "no");
+    json_set_allocator(NULL);
+
+    /* Statistics for everything this thread does */
+    JsonStats stats;
+    memset(&stats, 0, sizeof(stats));
+    JsonStats* previous = json_stats_collect(&stats);
+    value = json_parse_string(text);
+    printf("Collecting replaced nothing: %s\n", previous == NULL ? "yes" : "no");
+    printf("Nodes: %zu, peak depth: %zu, allocations counted: %s\n", stats.nodes, stats.peak_depth,
+           stats.allocations > 0 && stats.bytes_allocated > 0 ? "yes" : "no");
+
+    JsonValue* big = json_create_array();
+    for (int i = 0; i < 500; i++) {
+        json_array_append(big, json_parse_string(text));
+    }
+    size_t reallocs_before = stats.builder_reallocs;
+    formatted = json_format_string(big, &JSON_FORMAT_PRETTY);
+    printf("Output buffer growths counted: %s\n", stats.builder_reallocs > reallocs_before ? "yes" : "no");
+    const JsonFileWriteConfig write_config = {4096, ".tmp", 1};
+    json_write_file_ex(big, "stats_test.json", &write_config);
+    json_stats_collect(NULL);
+    size_t frees = stats.frees;
+    free(formatted);
+    json_free(big);
+    json_free(value);
+    printf("Stopped collecting: %s\n", stats.frees == frees ? "yes" : "no");
+    printf("Phases timed: parse %s, format %s, write %s\n", stats.seconds[JSON_PHASE_PARSE] > 0 ? "yes" : "no",
+           stats.seconds[JSON_PHASE_FORMAT] > 0 ? "yes" : "no", stats.seconds[JSON_PHASE_WRITE] > 0 ? "yes" : "no");
+
+    /* Per-parse statistics through the configuration */
+    JsonStats doc_stats;
+    memset(&doc_stats, 0, sizeof(doc_stats));
+    config = JSON_PARSE_DEFAULT;
+    config.stats = &doc_stats;
+    doc = json_document_parse_file_ex("stats_test.json", &config);
+    printf("Document from file: %s, nodes %zu, depth %zu, read timed: %s, thread target: %s\n",
+           doc ? "parsed" : "failed", doc_stats.nodes, doc_stats.peak_depth,
+           doc_stats.seconds[JSON_PHASE_READ] > 0 ? "yes" : "no",
+           json_stats_collect(NULL) == NULL ? "restored" : "leaked");
+    json_document_free(doc);
+    remove("stats_test.json");
+}
+
+/* Every container of a compact document keeps its children in one block */
+static int compact_is_contiguous(const JsonValue* value) {
+    if (value->type == JSON_ARRAY) {
+        const JsonArray* array = value->value.array;
+        for (size_t i = 0; i < array->size; i++) {
+            if (array->items[i] != &array->elements[i] || !compact_is_contiguous(array->items[i])) {
+                return 0;
+            }
+        }
+    } else if (value->type == JSON_OBJECT) {
+        const JsonKeyValue* first = value->value.object->pairs;
+        size_t i = 0;
+        for (const JsonKeyValue* pair = first; pair; pair = pair->next, i++) {
+            if (pair != first + i || pair->value != first->value + i || !compact_is_contiguous(pair->value)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+void test_compact_documents(void) {
+    printf("\nCompact Document Tests\n");
+    printf("======================\n\n");
+
+    const char* text = "{\"sensor\": \"north-east-gateway-7\", \"id\": 7,"
+                       " \"readings\": [21.5, 22.0, {\"raw\": [1, 2, 3], \"unit\": \"C\"}],"
+                       " \"tags\": [\"a\\u00e9\", \"b\"], \"ok\": true, \"id\": 8}";
+    JsonDocument* doc = json_document_parse_string_ex(text, &JSON_PARSE_COMPACT);
+    if (!doc) {
+        printf("Compact parse failed: %s\n", json_get_last_error()->message);
+        return;
+    }
+    JsonValue* root = json_document_root(doc);
+    printf("Members: %zu, contiguous: %s\n", json_object_size(root), compact_is_contiguous(root) ? "yes" : "no");
+    printf("Duplicate key keeps last value: %g\n", json_object_get(root, "id")->value.number);
+    JsonValue* readings = json_object_get(root, "readings");
+    printf("readings[2].unit: %s\n", json_object_get(json_array_get(readings, 2), "unit")->value.string);
+
+    /* Compact containers stay editable */
+    JsonValue* added = json_create_number(23.5);
+    JsonValue* site = json_create_string("roof");
+    json_array_append(readings, added);
+    json_object_set(root, "site", site);
+    char* edited = json_format_string(root, &JSON_FORMAT_COMPACT);
+    printf("After edits: %s\n", edited);
+    free(edited);
+    json_document_free(doc);
+    json_free(added);
+    json_free(site);
+
+    /* Wide objects get their hash index at parse time */
+    char wide[4096];
+    size_t used = 0;
+    wide[used++] = '{';
+    for (int i = 0; i < 200; i++) {
+        used += (size_t)snprintf(wide + used, sizeof(wide) - used, "%s\"k%d\":%d", i ? "," : "", i, i);
+    }
+    wide[used++] = '}';
+    doc = json_document_parse_buffer(wide, used, &JSON_PARSE_COMPACT);
+    root = doc ? json_document_root(doc) : NULL;
+    printf("Wide object: %zu members, indexed: %s, k150 = %g\n", root ? json_object_size(root) : 0,
+           root && root->value.object->index ? "yes" : "no",
+           root ? json_object_get(root, "k150")->value.number : 0.0);
+    json_document_free(doc);
+
+    /* Heap trees keep short strings and keys in the same allocation as
+       their node or pair */
+    JsonValue* heap = json_parse_string(text);
+    JsonValue* unit = json_object_get(json_array_get(json_object_get(heap, "readings"), 2), "unit");
+    JsonValue* sensor = json_object_get(heap, "sensor");
+    printf("Short string inline: %s, long string inline: %s\n",
+           (unit->flags & JSON_VALUE_INLINE) ? "yes" : "no", (sensor->flags & JSON_VALUE_INLINE) ? "yes" : "no");
+    printf("Short key inline: %s\n",
+           heap->value.object->pairs->key == (char*)(heap->value.object->pairs + 1) ? "yes" : "no");
+    JsonValue* copy = json_create_string("inline");
+    printf("Created string inline: %s, text: %s\n", (copy->flags & JSON_VALUE_INLINE) ? "yes" : "no",
+           copy->value.string);
+    json_free(copy);
+    json_free(heap);
+
+    /* Same trees and errors as an eager document */
+    static const char* cases[] = {
+        "[]", "{}", "  7  ", "\"x\"", "[1,[2,[3,[4]]]]", "{\"a\":{\"b\":[true,false,null]}}",
+        "[1,2,]", "{\"a\":1,}", "{\"a\" 1}", "{1:2}", "[1 2]", "[tru]", "\"abc", "[\"a\\x\"]",
+        "[\"\\ud83d\\ude00\"]", "[1e999]", "1 2", "{} x", "", "{\"a\":1}}", "[[[]]",
+        "{\"dup\":1,\"dup\":2,\"x\":{\"dup\":[3],\"dup\":[4,5]}}", "[[],{},[{}],{\"a\":[]}]",
+        "[\"0123456789abcde\", \"0123456789abcdef\", {\"0123456789abcde\": 1, \"0123456789abcdef\": 2}]",
+    };
+    int mismatches = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        if (!document_matches_eager(cases[i], strlen(cases[i]), &JSON_PARSE_COMPACT)) {
+            printf("Mismatch on case %zu: %s\n", i, cases[i]);
+            mismatches++;
+        }
+        JsonValue* tree = json_parse_buffer(cases[i], strlen(cases[i]));
+        JsonDocument* compact = json_document_parse_buffer(cases[i], strlen(cases[i]), &JSON_PARSE_COMPACT);
+        if (!tree != !compact) {
+            mismatches++;
+        } else if (tree) {
+            char* a = json_format_string(tree, &JSON_FORMAT_COMPACT);
+            char* b = json_format_string(json_document_root(compact), &JSON_FORMAT_COMPACT);
+            if (strcmp(a, b) != 0 || !compact_is_contiguous(json_document_root(compact))) {
+                printf("Heap tree differs on case %zu: %s\n", i, cases[i]);
+                mismatches++;
+            }
+            free(a);
+            free(b);
+        }
+        json_free(tree);
+        json_document_free(compact);
+    }
+    char deep[80];
+    for (int depth = 31; depth <= 34; depth++) {
+        memset(deep, '[', depth);
+        memset(deep + depth, ']', depth);
+        if (!document_matches_eager(deep, 2 * depth, &JSON_PARSE_COMPACT)) {
+            printf("Mismatch at depth %d\n", depth);
+            mismatches++;
+        }
+    }
+    printf("Differential checks: %zu cases, mismatches: %d\n", sizeof(cases) / sizeof(cases[0]), mismatches);
+
+    /* Running out of memory fails cleanly */
+    CountingHeap heap_counts = {0, 0, 0, -1};
+    JsonAllocator allocator = {counting_allocate, counting_reallocate, counting_release, &heap_counts};
+    int clean = 1;
+    for (long limit = 0; limit < 12; limit++) {
+        heap_counts.fail_after = limit;
+        json_set_allocator(&allocator);
+        JsonParseConfig config = JSON_PARSE_COMPACT;
+        config.allocator = &allocator;
+        JsonError error;
+        JsonDocument* partial = json_document_parse_buffer_r(text, strlen(text), &config, &error);
+        if (!partial && error.code != JSON_ERROR_MEMORY_ALLOCATION) {
+            clean = 0;
+        }
+        json_document_free(partial);
+        json_set_allocator(NULL);
+    }
+    printf("Allocation failures handled: %s, balanced: %s\n", clean ? "yes" : "no",
+           heap_counts.live_bytes == 0 ? "yes" : "no");
+}
+
+void test_key_interning(void) {
+    printf("\nKey Interning Tests\n");
+    printf("===================\n\n");
+
+    const char* text = "[{\"timestamp\": 1, \"temperature\": 21.5, \"sensor\": {\"id\": \"a\"}},"
+                       " {\"timestamp\": 2, \"temperature\": 22.0, \"sensor\": {\"id\": \"b\"}},"
+                       " {\"timestamp\": 3, \"temperature\": 22.5, \"sensor\": {\"id\": \"c\"}, \"q\\\"uote\\n\": 0}]";
+    JsonParseConfig config = JSON_PARSE_DEFAULT;
+    config.intern_keys = 1;
+    JsonDocument* doc = json_document_parse_string_ex(text, &config);
+    if (!doc) {
+        printf("Interned parse failed: %s\n", json_get_last_error()->message);
+        return;
+    }
+    JsonValue* root = json_document_root(doc);
+    JsonKeyValue* first = json_array_get(root, 0)->value.object->pairs;
+    JsonKeyValue* second = json_array_get(root, 1)->value.object->pairs;
+    printf("Distinct keys: %zu\n", json_key_table_size(json_document_key_table(doc)));
+    printf("Records share keys: %s, flagged: %s\n", first->key == second->key ? "yes" : "no",
+           (first->flags & JSON_KEY_INTERNED) ? "yes" : "no");
+
+    const char* temperature = json_key_table_intern(json_document_key_table(doc), "temperature", 11);
+    printf("Interned lookup: %g, same pointer: %s\n",
+           json_object_get_interned(json_array_get(root, 2), temperature)->value.number,
+           temperature == first->next->key ? "yes" : "no");
+    printf("Plain lookup: %g\n", json_object_get(json_array_get(root, 1), "temperature")->value.number);
+
+    char* interned = json_format_string(root, &JSON_FORMAT_COMPACT);
+    JsonValue* plain = json_parse_string(text);
+    char* expected = json_format_string(plain, &JSON_FORMAT_COMPACT);
+    printf("Formatting unchanged: %s\n", strcmp(interned, expected) == 0 ? "yes" : "no");
+    printf("Escaped key: %s\n", strstr(interned, "\"q\\\"uote\\n\":0") ? "yes" : "no");
+    free(interned);
+    free(expected);
+    interned = json_format_string(root, &JSON_FORMAT_PRETTY);
+    expected = json_format_string(plain, &JSON_FORMAT_PRETTY);
+    printf("Pretty output unchanged: %s\n", strcmp(interned, expected) == 0 ? "yes" : "no");
+    free(interned);
+    free(expected);
+    json_free(plain);
+    json_document_free(doc);
+
+    /* Every document flavour agrees with an eager, uninterned document */
+    static const char* cases[] = {
+        "{}", "[{\"a\":1,\"b\":2},{\"b\":3,\"a\":4}]", "{\"dup\":1,\"dup\":2}",
+        "{\"\\u00e9t\\u00e9\":[{\"\\ud83d\\ude00\":null}]}", "{\"a\":1,}", "{\"a\\x\":1}",
+        "[{\"k0\":0,\"k1\":1,\"k2\":2,\"k3\":3,\"k4\":4,\"k5\":5,\"k6\":6,\"k7\":7,\"k8\":8,\"k0\":9}]",
+    };
+    JsonParseConfig flavours[3] = {JSON_PARSE_DEFAULT, JSON_PARSE_LAZY, JSON_PARSE_COMPACT};
+    int mismatches = 0;
+    for (int f = 0; f < 3; f++) {
+        flavours[f].intern_keys = 1;
+        for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+            if (!document_matches_eager(cases[i], strlen(cases[i]), &flavours[f])) {
+                printf("Mismatch on flavour %d, case %zu: %s\n", f, i, cases[i]);
+                mismatches++;
+            }
+        }
+    }
+    printf("Differential checks: %d mismatches\n", mismatches);
+
+    /* Heap values from a reader share one caller-owned table */
+    const char* filename = "intern_test.ndjson";
+    FILE* file = fopen(filename, "w");
+    if (!file) {
+        return;
+    }
+    for (int i = 0; i < 1000; i++) {
+        fprintf(file, "{\"timestamp\": %d, \"temperature\": %d.5, \"location\": \"roof\"}\n", i, i % 40);
+    }
+    fclose(file);
+
+    JsonKeyTable* keys = json_key_table_create(NULL);
+    JsonFileReader* reader = json_file_reader_create(filename, 0);
+    json_file_reader_set_key_table(reader, keys);
+    JsonValue* records = json_create_array();
+    JsonValue* record;
+    while ((record = json_file_reader_next(reader))) {
+        json_array_append(records, record);
+    }
+    json_file_reader_free(reader);
+    JsonValue* last = json_array_get(records, 999);
+    printf("Reader records: %zu, distinct keys: %zu, shared: %s\n", json_array_size(records),
+           json_key_table_size(keys),
+           json_array_get(records, 0)->value.object->pairs->key == last->value.object->pairs->key ? "yes" : "no");
+
+    /* Interned objects stay editable; new keys are their own */
+    JsonValue* flag = json_create_boolean(1);
+    json_object_set(last, "checked", flag);
+    json_object_set(last, "temperature", json_create_number(-1));
+    char* edited = json_format_string(last, &JSON_FORMAT_COMPACT);
+    printf("Edited record: %s\n", edited);
+    free(edited);
+    json_free(records);
+    json_key_table_free(keys);
+    remove(filename);
+
+    JsonError error;
+    keys = json_key_table_create(NULL);
+    JsonValue* bad = json_parse_buffer_keys_r("{\"a\": [1, }", 11, keys, &error);
+    printf("Interned parse error: %s\n", bad ? "parsed" : error.message);
+    json_key_table_free(keys);
+}
+
+void test_columnar_extraction(void) {
+    printf("\nColumnar Extraction Tests\n");
+    printf("=========================\n\n");
+
+    /* Readings with NaN, a string, a null and a missing temperature */
+    JsonValue* readings = json_create_array();
+    for (int i = 0; i < 1000; i++) {
+        JsonValue* reading = json_create_object();
+        json_object_set(reading, "timestamp", json_parse_string(i % 3 ? "1700000000" : "17e8"));
+        json_object_get(reading, "timestamp")->value.number += i;
+        json_object_get(reading, "timestamp")->integer += i;
+        if (i % 97 == 5) {
+            json_object_set(reading, "temperature", json_create_number(NAN));
+        } else if (i % 101 == 7) {
+            json_object_set(reading, "temperature", json_create_string("nan"));
+        } else if (i % 103 == 9) {
+            json_object_set(reading, "temperature", json_create_null());
+        } else if (i % 107 != 11) {
+            json_object_set(reading, "temperature", json_create_number(15.0 + (i * 37 % 200) / 10.0));
+        }
+        json_array_append(readings, reading);
+    }
+    json_array_append(readings, json_create_string("not a record"));
+
+    const char* fields[] = {"timestamp", "temperature"};
+    JsonColumns* columns = json_columns_extract(readings, fields, 2);
+    if (!columns) {
+        printf("Extraction failed\n");
+        json_free(readings);
+        return;
+    }
+    const JsonColumn* temperature = json_columns_find(columns, "temperature");
+    printf("Rows: %zu, columns: %zu, valid temperatures: %zu, found missing column: %s\n",
+           columns->rows, columns->column_count, temperature->valid_count,
+           json_columns_find(columns, "humidity") ? "yes" : "no");
+
+    /* Cleaning matches json_clean_data() */
+    uint64_t selection[JSON_BITMAP_WORDS(1001)];
+    json_columns_select_all(columns, selection);
+    JsonCleanStats column_stats, tree_stats;
+    size_t kept = json_columns_select_clean(columns, temperature, selection, &column_stats);
+    JsonValue* cleaned = json_clean_data(readings, "temperature", &tree_stats);
+    printf("Kept %zu, stats match: %s\n", kept,
+           column_stats.original_count == tree_stats.original_count &&
+           column_stats.cleaned_count == tree_stats.cleaned_count &&
+           column_stats.removed_count == tree_stats.removed_count ? "yes" : "no");
+
+    /* Serialized columns equal the cleaned tree */
+    const JsonFormatConfig* configs[] = {&JSON_FORMAT_COMPACT, &JSON_FORMAT_DEFAULT, &JSON_FORMAT_PRETTY};
+    int same = 1;
+    for (int c = 0; c < 3; c++) {
+        char* from_columns = json_format_columns(columns, selection, configs[c]);
+        char* from_tree = json_format_string(cleaned, configs[c]);
+        same = same && from_columns && from_tree && strcmp(from_columns, from_tree) == 0;
+        free(from_columns);
+        free(from_tree);
+    }
+    printf("Formatted like the cleaned tree: %s\n", same ? "yes" : "no");
+    json_free(cleaned);
+
+    /* Aggregates against a plain loop over the tree */
+    double sum = 0, low = INFINITY, high = -INFINITY;
+    size_t count = 0, in_range = 0;
+    for (size_t i = 0; i < json_array_size(readings); i++) {
+        JsonValue* value = json_object_get(json_array_get(readings, i), "temperature");
+        if (value && value->type == JSON_NUMBER && !isnan(value->value.number)) {
+            sum += value->value.number;
+            low = fmin(low, value->value.number);
+            high = fmax(high, value->value.number);
+            count++;
+            if (value->value.number >= 20.0 && value->value.number <= 25.0) in_range++;
+        }
+    }
+    JsonColumnStats stats;
+    json_column_stats(columns, temperature, selection, &stats);
+    printf("Count %zu, min %.1f, max %.1f, mean matches: %s\n", stats.count, stats.min, stats.max,
+           count == stats.count && low == stats.min && high == stats.max &&
+           fabs(stats.mean - sum / count) < 1e-9 ? "yes" : "no");
+    size_t selected = json_columns_select_range(columns, temperature, 20.0, 25.0, selection);
+    printf("In [20, 25]: %zu, matches loop: %s, count agrees: %s\n", selected, selected == in_range ? "yes" : "no",
+           json_columns_count(columns, selection) == selected ? "yes" : "no");
+
+    /* Integers keep their exact form */
+    memset(selection, 0, sizeof(selection));
+    selection[0] = 1u << 1;
+    char* row = json_format_columns(columns, selection, &JSON_FORMAT_COMPACT);
+    printf("Row 1: %s\n", row);
+    free(row);
+
+    JsonColumnStats empty;
+    json_column_stats(columns, json_columns_find(columns, "temperature"), (uint64_t[JSON_BITMAP_WORDS(1001)]){0}, &empty);
+    printf("Empty selection: count %zu, mean is NaN: %s\n", empty.count, isnan(empty.mean) ? "yes" : "no");
+    json_columns_free(columns);
+    json_free(readings);
+
+    printf("Non-array rejected: %s\n", json_columns_extract(json_document_root(NULL), fields, 2) ? "no" : "yes");
+}
+
+static int warmer_than(const JsonValue* record, void* user_data) {
+    const JsonValue* temperature = json_object_get(record, "temperature");
+    return temperature && temperature->type == JSON_NUMBER &&
+           temperature->value.number > *(const double*)user_data;
+}
+
+static JsonValue* make_readings(size_t count) {
+    JsonValue* readings = json_create_array();
+    for (size_t i = 0; i < count; i++) {
+        JsonValue* reading = json_create_object();
+        json_object_set(reading, "id", json_create_number((double)i));
+        if (i % 7 == 3) {
+            json_object_set(reading, "temperature", json_create_number(NAN));
+        } else if (i % 11 == 5) {
+            json_object_set(reading, "temperature", json_create_string("n/a"));
+        } else if (i % 13 != 0) {
+            json_object_set(reading, "temperature", json_create_number(15.0 + (double)(i % 17)));
+        }
+        json_array_append(readings, reading);
+    }
+    json_array_append(readings, json_create_boolean(1));
+    return readings;
+}
+
+void test_clean_variants(void) {
+    printf("\nClean Variant Tests\n");
+    printf("===================\n\n");
+
+    JsonValue* readings = make_readings(500);
+    JsonCleanStats copy_stats, stats;
+    JsonValue* copied = json_clean_data(readings, "temperature", &copy_stats);
+    char* expected = json_format_string(copied, &JSON_FORMAT_COMPACT);
+    json_free(copied);
+
+    /* In place: no allocations, rejected records freed (ASan checks) */
+    JsonStats counters;
+    memset(&counters, 0, sizeof(counters));
+    json_stats_collect(&counters);
+    size_t kept = json_clean_in_place(readings, json_clean_keep_valid, "temperature", &stats);
+    json_stats_collect(NULL);
+    char* actual = json_format_string(readings, &JSON_FORMAT_COMPACT);
+    printf("In place kept %zu of %zu, same as copy: %s, allocations: %zu, frees: %s\n", kept,
+           stats.original_count, strcmp(expected, actual) == 0 ? "yes" : "no", counters.allocations,
+           counters.frees > 0 ? "yes" : "no");
+    printf("Kept counts agree: %s\n", kept == copy_stats.cleaned_count ? "yes" : "no");
+    free(expected);
+    free(actual);
+
+    /* Chained predicate on what is left */
+    double threshold = 25.0;
+    kept = json_clean_in_place(readings, warmer_than, &threshold, NULL);
+    int all_warm = 1;
+    for (size_t i = 0; i < json_array_size(readings); i++) {
+        all_warm = all_warm && warmer_than(json_array_get(readings, i), &threshold);
+    }
+    printf("Warmer than 25: %zu, all match: %s\n", kept, all_warm ? "yes" : "no");
+    json_free(readings);
+
+    /* Index lists leave the document untouched */
+    readings = make_readings(200);
+    char* text = json_format_string(readings, &JSON_FORMAT_COMPACT);
+    json_free(readings);
+    JsonDocument* doc = json_document_parse_string_ex(text, &JSON_PARSE_LAZY);
+    JsonValue* root = json_document_root(doc);
+    size_t indices[201];
+    kept = json_clean_indices(root, json_clean_keep_valid, "temperature", indices, &stats);
+    size_t warm = json_clean_refine(root, indices, kept, warmer_than, &threshold);
+    printf("Indices: %zu valid, %zu warm, first warm id %g, root size still %zu\n", kept, warm,
+           json_object_get(json_array_get(root, indices[0]), "id")->value.number, json_array_size(root));
+    json_document_free(doc);
+
+    /* Compact documents stay contiguous */
+    doc = json_document_parse_string_ex(text, &JSON_PARSE_COMPACT);
+    root = json_document_root(doc);
+    kept = json_clean_in_place(root, json_clean_keep_valid, "temperature", NULL);
+    printf("Compact in place: %zu kept, contiguous: %s\n", kept, compact_is_contiguous(root) ? "yes" : "no");
+    json_document_free(doc);
+    free(text);
+
+    printf("Non-array rejected: %s\n", json_clean_in_place(NULL, json_clean_keep_valid, "x", NULL) == 0 ? "yes" : "no");
+}
+
+/* {"a":[{"a":[ ... 7 ... ]}]}, depth containers in all */
+static char* generate_mixed_nesting(size_t depth) {
+    char* json = (char*)malloc(depth * 6 + 2);
+    if (!json) return NULL;
+    char* p = json;
+    for (size_t i = 0; i < depth; i++) {
+        if (i % 2 == 0) {
+            memcpy(p, "{\"a\":", 5);
+            p += 5;
+        } else {
+            *p++ = '[';
+        }
+    }
+    *p++ = '7';
+    for (size_t i = depth; i-- > 0;) {
+        *p++ = i % 2 == 0 ? '}' : ']';
+    }
+    *p = '\0';
+    return json;
+}
+
+#define DEEP_NESTING 100000
+
+static void* deep_nesting_worker(void* arg) {
+    int* ok = (int*)arg;
+    char* text = generate_mixed_nesting(DEEP_NESTING);
+    if (!text) return NULL;
+    size_t length = strlen(text);
+
+    /* The default limit still applies */
+    JsonValue* value = json_parse_string(text);
+    printf("Default limit rejects: %s (code %d)\n", value == NULL ? "yes" : "no",
+           json_get_last_error()->code == JSON_ERROR_MAXIMUM_NESTING_REACHED);
+    printf("Validator agrees: %s\n", json_validate_string(text) ? "no" : "yes");
+
+    /* Per document, every engine */
+    JsonParseConfig config = JSON_PARSE_DEFAULT;
+    config.max_depth = DEEP_NESTING;
+    const char* names[] = {"arena", "compact", "lazy", "tape"};
+    for (int mode = 0; mode < 4; mode++) {
+        config.compact = mode == 1;
+        config.lazy = mode == 2;
+        config.engine = mode == 3 ? JSON_PARSE_ENGINE_TAPE : JSON_PARSE_ENGINE_RECURSIVE;
+        JsonDocument* doc = json_document_parse_buffer(text, length, &config);
+        const JsonValue* node = doc ? json_document_root(doc) : NULL;
+        size_t levels = 0;
+        while (node && (node->type == JSON_ARRAY || node->type == JSON_OBJECT)) {
+            node = node->type == JSON_ARRAY ? json_array_get(node, 0) : json_object_get(node, "a");
+            levels++;
+        }
+        printf("Document (%s): %zu levels, leaf %g\n", names[mode], levels,
+               node && node->type == JSON_NUMBER ? node->value.number : -1.0);
+        json_document_free(doc);
+    }
+    config = JSON_PARSE_DEFAULT;
+    config.max_depth = DEEP_NESTING - 1;
+    JsonDocument* doc = json_document_parse_buffer(text, length, &config);
+    printf("One level short rejected: %s\n", doc == NULL ? "yes" : "no");
+    json_document_free(doc);
+
+    /* Process-wide limit: heap parse, validate, format, copy and free */
+    json_set_max_depth(DEEP_NESTING + 1);
+    printf("Validates with raised limit: %s\n", json_validate_string(text) ? "yes" : "no");
+    value = json_parse_string(text);
+    char* formatted = value ? json_format_string(value, &JSON_FORMAT_COMPACT) : NULL;
+    printf("Heap round trip: %s\n", formatted && strcmp(formatted, text) == 0 ? "yes" : "no");
+    free(formatted);
+
+    /* json_clean_data() deep-copies the records it keeps */
+    JsonValue* records = json_create_array();
+    json_array_append(records, value);
+    JsonValue* copy = json_clean_data(records, "temperature", NULL);
+    formatted = copy ? json_format_string(json_array_get(copy, 0), &JSON_FORMAT_COMPACT) : NULL;
+    printf("Deep copy matches: %s\n", formatted && strcmp(formatted, text) == 0 ? "yes" : "no");
+    free(formatted);
+    json_free(copy);
+    json_free(records);
+    json_set_max_depth(0);
+    printf("Limit restored: %s\n", json_get_max_depth() == JSON_MAX_NESTING_DEPTH ? "yes" : "no");
+
+    free(text);
+    *ok = 1;
+    return NULL;
+}
+
+void test_deep_nesting(void) {
+    printf("\nDeep Nesting Tests\n");
+    printf("==================\n\n");
+
+    /* A small stack: recursion over 100000 levels could not fit in it */
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 256 * 1024);
+    pthread_t thread;
+    int ok = 0;
+    if (pthread_create(&thread, &attr, deep_nesting_worker, &ok) == 0) {
+        pthread_join(thread, NULL);
+    }
+    pthread_attr_destroy(&attr);
+    printf("Worker with 256 KiB stack finished: %s\n", ok ? "yes" : "no");
+}
+
+/* Keeps every value the push parser emits */
+typedef struct {
+    JsonValue* values[8];
+    size_t count;
+    size_t limit; /* Stop after this many values, 0 for never */
+} PushCollector;
+
+static int collect_pushed(JsonValue* value, void* user_data) {
+    PushCollector* collector = (PushCollector*)user_data;
+    if (collector->count < 8) {
+        collector->values[collector->count++] = value;
+    } else {
+        json_free(value);
+    }
+    return !collector->limit || collector->count < collector->limit;
+}
+
+static void push_collector_clear(PushCollector* collector) {
+    for (size_t i = 0; i < collector->count; i++) {
+        json_free(collector->values[i]);
+    }
+    collector->count = 0;
+}
+
+/* Feed text in pieces of chunk bytes, then finish */
+static int push_in_chunks(JsonPushParser* parser, const char* text, size_t chunk) {
+    size_t length = strlen(text);
+    json_push_parser_reset(parser);
+    for (size_t offset = 0; offset < length; offset += chunk) {
+        size_t n = length - offset < chunk ? length - offset : chunk;
+        if (!json_push_parser_feed(parser, text + offset, n)) {
+            return 0;
+        }
+    }
+    return json_push_parser_finish(parser);
+}
+
+void test_push_parser(void) {
+    printf("\nPush Parser Tests\n");
+    printf("=================\n\n");
+
+    const char* text = "{\"name\":\"caf\\u00e9 \\ud83d\\ude00\",\"tags\":[\"a\\\"b\",true,false,null],"
+                       "\"reading\":{\"t\":-12.5e-1,\"n\":9007199254740993,\"id\":42},\"empty\":[{},[]],\"\":\"\"}";
+    size_t length = strlen(text);
+    JsonValue* expected = json_parse_string(text);
+    char* expected_text = json_format_string(expected, &JSON_FORMAT_COMPACT);
+
+    /* Every chunk size and every two-piece split puts a boundary inside
+       each string, escape, surrogate pair, literal and number */
+    PushCollector collector = {0};
+    JsonPushParser* parser = json_push_parser_create(collect_pushed, &collector);
+    size_t runs = 0, mismatches = 0;
+    for (size_t chunk = 1; chunk <= length; chunk++, runs++) {
+        push_in_chunks(parser, text, chunk);
+        char* got = collector.count == 1 ? json_format_string(collector.values[0], &JSON_FORMAT_COMPACT) : NULL;
+        mismatches += !got || strcmp(got, expected_text) != 0;
+        free(got);
+        push_collector_clear(&collector);
+    }
+    for (size_t split = 1; split < length; split++, runs++) {
+        json_push_parser_reset(parser);
+        json_push_parser_feed(parser, text, split);
+        json_push_parser_feed(parser, text + split, length - split);
+        char* got = collector.count == 1 ? json_format_string(collector.values[0], &JSON_FORMAT_COMPACT) : NULL;
+        mismatches += !got || strcmp(got, expected_text) != 0;
+        free(got);
+        push_collector_clear(&collector);
+    }
+    printf("Chunkings: %zu, mismatches: %zu\n", runs, mismatches);
+    free(expected_text);
+    json_free(expected);
+
+    /* A value is emitted by the byte that completes it */
+    json_push_parser_reset(parser);
+    json_push_parser_feed(parser, "[1, {\"a\": [2", 12);
+    size_t depth = json_push_parser_depth(parser);
+    size_t before = collector.count;
+    json_push_parser_feed(parser, "]}]", 3);
+    printf("Emitted on closing bracket: %s (depth %zu, %zu then %zu)\n",
+           before == 0 && collector.count == 1 ? "yes" : "no", depth, before, collector.count);
+    push_collector_clear(&collector);
+
+    /* Back-to-back values; the final number waits for the end of input */
+    const char* stream = "{\"seq\":1}\n[2]\n\"three\"{}\n5";
+    json_push_parser_reset(parser);
+    json_push_parser_feed(parser, stream, strlen(stream));
+    before = collector.count;
+    json_push_parser_finish(parser);
+    printf("Stream: %zu values before finish, %zu after, last %g\n", before, collector.count,
+           collector.count == 5 ? collector.values[4]->value.number : -1.0);
+    push_collector_clear(&collector);
+
+    /* Errors match the parser's, however the input is cut */
+    const char* malformed[] = {
+        "[1, 2,]", "{\"a\" 1}", "[1 2]", "{\"a\":1,}", "[\"bad \\x\"]", "[01]", "[tru]",
+        "{\"k\":\"\\ud800x\"}", "[1.5.2]", "[\n  1,\n  ]", "{\"a\":\"abc", "[1,", "{\"a\"", "{\"a\":1", "[\"ok\", 7 x]",
+        "{\"", "{1}", "{\"a\":1,"
+    };
+    size_t cases = sizeof(malformed) / sizeof(malformed[0]), matched = 0, chunkings = 0;
+    for (size_t i = 0; i < cases; i++) {
+        JsonValue* value = json_parse_string(malformed[i]);
+        JsonError parse_error = *json_get_last_error();
+        json_free(value);
+        int same = 1;
+        for (size_t chunk = 1; chunk <= 4; chunk++, chunkings++) {
+            int ok = push_in_chunks(parser, malformed[i], chunk);
+            const JsonError* error = json_push_parser_error(parser);
+            same = same && !ok && error->code == parse_error.code && error->line == parse_error.line &&
+                   error->column == parse_error.column && strcmp(error->message, parse_error.message) == 0;
+            if (!same) {
+                printf("  %s (chunk %zu): %s at %zu:%zu, parser %s at %zu:%zu\n", malformed[i], chunk,
+                       error->message, error->line, error->column, parse_error.message, parse_error.line,
+                       parse_error.column);
+                break;
+            }
+            push_collector_clear(&collector);
+        }
+        matched += same;
+    }
+    printf("Errors matching the parser: %zu/%zu\n", matched, cases);
+
+    /* A key cut off at the end of the input, also after an earlier value */
+    const char* truncated[] = { "{\"", "\"\"{\"", "[\"a\" , {\"" };
+    size_t unterminated = 0;
+    for (size_t i = 0; i < sizeof(truncated) / sizeof(truncated[0]); i++) {
+        int ok = push_in_chunks(parser, truncated[i], 1);
+        unterminated += !ok && json_push_parser_error(parser)->code == JSON_ERROR_UNTERMINATED_STRING;
+        push_collector_clear(&collector);
+    }
+    printf("Truncated keys unterminated: %zu/%zu\n", unterminated, sizeof(truncated) / sizeof(truncated[0]));
+
+    /* A failed stream rejects input until reset */
+    printf("Rejected after error: %s\n", json_push_parser_feed(parser, "1 ", 2) == 0 ? "yes" : "no");
+    json_push_parser_reset(parser);
+    printf("Accepts after reset: %s\n", json_push_parser_feed(parser, "1 ", 2) && collector.count == 1 ? "yes" : "no");
+    push_collector_clear(&collector);
+
+    /* The default nesting limit applies */
+    char brackets[JSON_MAX_NESTING_DEPTH + 2];
+    memset(brackets, '[', JSON_MAX_NESTING_DEPTH + 1);
+    brackets[JSON_MAX_NESTING_DEPTH + 1] = '\0';
+    json_push_parser_reset(parser);
+    json_push_parser_feed(parser, brackets, JSON_MAX_NESTING_DEPTH + 1);
+    printf("Depth limit: %s\n",
+           json_push_parser_error(parser)->code == JSON_ERROR_MAXIMUM_NESTING_REACHED ? "yes" : "no");
+
+    /* The callback can stop the stream */
+    collector.limit = 2;
+    json_push_parser_reset(parser);
+    int fed = json_push_parser_feed(parser, "1 2 3 4 ", 8);
+    printf("Stopped by callback: %s after %zu values\n", fed == 0 ? "yes" : "no", collector.count);
+    push_collector_clear(&collector);
+    json_push_parser_free(parser);
+}
+
+/* Writes one token per event, e.g. "{ k:a n:1 }" */
+typedef struct {
+    char trace[512];
+    size_t length;
+    size_t numbers;
+    size_t stop_after;  /* Stop at this number event, 0 for never */
+    const char* skip_key; /* Skip the container that follows this key */
+    int skip_next;
+} SaxTrace;
+
+static int sax_trace_add(SaxTrace* trace, const char* text, size_t length) {
+    if (trace->length + length + 2 < sizeof(trace->trace)) {
+        if (trace->length) trace->trace[trace->length++] = ' ';
+        memcpy(trace->trace + trace->length, text, length);
+        trace->length += length;
+        trace->trace[trace->length] = '\0';
+    }
+    return JSON_SAX_CONTINUE;
+}
+
+static int sax_open(SaxTrace* trace, const char* bracket) {
+    sax_trace_add(trace, bracket, 1);
+    int skip = trace->skip_next;
+    trace->skip_next = 0;
+    return skip ? JSON_SAX_SKIP : JSON_SAX_CONTINUE;
+}
+
+static int trace_start_object(void* user_data) { return sax_open((SaxTrace*)user_data, "{"); }
+static int trace_end_object(void* user_data) { return sax_trace_add((SaxTrace*)user_data, "}", 1); }
+static int trace_start_array(void* user_data) { return sax_open((SaxTrace*)user_data, "["); }
+static int trace_end_array(void* user_data) { return sax_trace_add((SaxTrace*)user_data, "]", 1); }
+
+static int trace_key(void* user_data, const char* key, size_t length) {
+    SaxTrace* trace = (SaxTrace*)user_data;
+    trace->skip_next = trace->skip_key && strlen(trace->skip_key) == length &&
+                       memcmp(trace->skip_key, key, length) == 0;
+    char text[64];
+    int n = snprintf(text, sizeof(text), "k:%.*s", (int)length, key);
+    return sax_trace_add(trace, text, (size_t)n);
+}
+
+static int trace_string(void* user_data, const char* value, size_t length) {
+    char text[64];
+    int n = snprintf(text, sizeof(text), "s:%.*s", (int)length, value);
+    return sax_trace_add((SaxTrace*)user_data, text, (size_t)n);
+}
+
+static int trace_number(void* user_data, double value, int is_integer, int64_t integer) {
+    SaxTrace* trace = (SaxTrace*)user_data;
+    char text[64];
+    int n = is_integer ? snprintf(text, sizeof(text), "i:%lld", (long long)integer)
+                       : snprintf(text, sizeof(text), "n:%g", value);
+    sax_trace_add(trace, text, (size_t)n);
+    return ++trace->numbers == trace->stop_after ? JSON_SAX_STOP : JSON_SAX_CONTINUE;
+}
+
+static int trace_boolean(void* user_data, int value) {
+    return sax_trace_add((SaxTrace*)user_data, value ? "t" : "f", 1);
+}
+
+static int trace_null(void* user_data) { return sax_trace_add((SaxTrace*)user_data, "z", 1); }
+
+static const JsonSaxHandler trace_handler = {
+    trace_start_object, trace_end_object, trace_start_array, trace_end_array,
+    trace_key, trace_string, trace_number, trace_boolean, trace_null
+};
+
+/* Sum of one field over an array of records, tracking only the last key */
+typedef struct {
+    const char* field;
+    int in_field;
+    size_t depth;
+    double sum;
+    size_t count;
+} SaxSum;
+
+static int sum_start(void* user_data) { ((SaxSum*)user_data)->depth++; return JSON_SAX_CONTINUE; }
+static int sum_end(void* user_data) { ((SaxSum*)user_data)->depth--; return JSON_SAX_CONTINUE; }
+
+static int sum_key(void* user_data, const char* key, size_t length) {
+    SaxSum* sum = (SaxSum*)user_data;
+    sum->in_field = sum->depth == 2 && strlen(sum->field) == length && memcmp(sum->field, key, length) == 0;
+    return JSON_SAX_CONTINUE;
+}
+
+static int sum_number(void* user_data, double value, int is_integer, int64_t integer) {
+    (void)is_integer;
+    (void)integer;
+    SaxSum* sum = (SaxSum*)user_data;
+    if (sum->in_field) {
+        sum->sum += value;
+        sum->count++;
+    }
+    return JSON_SAX_CONTINUE;
+}
+
+void test_sax_parser(void) {
+    printf("\nSAX Parser Tests\n");
+    printf("================\n\n");
+
+    /* Every event, with escapes decoded */
+    const char* text = "{\"name\":\"caf\\u00e9\",\"n\":42,\"x\":-1.5,\"ok\":[true,false,null],\"e\":{},\"tab\\t\":\"a\\\"b\"}";
+    SaxTrace trace = {0};
+    int ok = json_sax_parse_string(text, &trace_handler, &trace, NULL);
+    printf("Events (%s): %s\n", ok ? "ok" : "failed", trace.trace);
+
+    /* Skipped subtrees produce no events */
+    const char* nested = "{\"id\":1,\"meta\":{\"tags\":[1,2,{\"deep\":3}]},\"after\":[4]}";
+    memset(&trace, 0, sizeof(trace));
+    trace.skip_key = "meta";
+    ok = json_sax_parse_string(nested, &trace_handler, &trace, NULL);
+    printf("Skip (%s): %s\n", ok ? "ok" : "failed", trace.trace);
+
+    /* Stopping is not an error */
+    memset(&trace, 0, sizeof(trace));
+    trace.stop_after = 2;
+    JsonError error;
+    ok = json_sax_parse_string("[1,2,3,4]", &trace_handler, &trace, &error);
+    printf("Stop: returned %d, error code %d, events: %s\n", ok, error.code, trace.trace);
+
+    /* An aggregate over many records, without a tree or allocations */
+    size_t records = 2000;
+    char* big = (char*)malloc(records * 48 + 2);
+    size_t used = 0;
+    double expected = 0.0;
+    big[used++] = '[';
+    for (size_t i = 0; i < records; i++) {
+        double temperature = 15.0 + (double)(i % 17) * 0.5;
+        expected += temperature;
+        used += (size_t)sprintf(big + used, "%s{\"id\":%zu,\"temperature\":%.1f,\"ok\":true}", i ? "," : "",
+                                i, temperature);
+    }
+    big[used++] = ']';
+    big[used] = '\0';
+
+    JsonSaxHandler sum_handler = {0};
+    sum_handler.start_object = sum_start;
+    sum_handler.end_object = sum_end;
+    sum_handler.start_array = sum_start;
+    sum_handler.end_array = sum_end;
+    sum_handler.key = sum_key;
+    sum_handler.number = sum_number;
+    SaxSum sum = {"temperature", 0, 0, 0.0, 0};
+    JsonStats counters;
+    memset(&counters, 0, sizeof(counters));
+    json_stats_collect(&counters);
+    ok = json_sax_parse_buffer(big, used, &sum_handler, &sum, NULL);
+    json_stats_collect(NULL);
+    printf("Sum of %zu temperatures: %s, matches: %s, allocations: %zu, nodes: %zu\n", sum.count,
+           ok ? "ok" : "failed", sum.sum == expected ? "yes" : "no", counters.allocations, counters.nodes);
+
+    /* Files are mapped and scanned in place */
+    const char* filename = "sax_test.json";
+    FILE* file = fopen(filename, "w");
+    if (file) {
+        fwrite(big, 1, used, file);
+        fclose(file);
+        memset(&sum, 0, sizeof(sum));
+        sum.field = "temperature";
+        ok = json_sax_parse_file(filename, &sum_handler, &sum, NULL);
+        printf("File: %s, %zu temperatures\n", ok ? "ok" : "failed", sum.count);
+        remove(filename);
+    }
+    free(big);
+
+    /* Errors are the parser's */
+    const char* malformed[] = {"[1, 2,]", "{\"a\" 1}", "[\"bad \\x\"]", "[01]", "{\"a\":1", "[1] x"};
+    size_t cases = sizeof(malformed) / sizeof(malformed[0]), matched = 0;
+    for (size_t i = 0; i < cases; i++) {
+        JsonValue* value = json_parse_string(malformed[i]);
+        json_free(value);
+        memset(&trace, 0, sizeof(trace));
+        ok = json_sax_parse_string(malformed[i], &trace_handler, &trace, &error);
+        const JsonError* parse_error = json_get_last_error();
+        matched += !ok && error.code == parse_error->code && error.column == parse_error->column &&
+                   strcmp(error.message, parse_error->message) == 0;
+    }
+    printf("Errors matching the parser: %zu/%zu\n", matched, cases);
+
+    /* Deep input is limited by json_get_max_depth(), not the C stack */
+    char* deep = generate_mixed_nesting(1000);
+    json_set_max_depth(1000);
+    JsonSaxHandler empty = {0};
+    printf("Nesting 1000 with the limit raised: %s\n", json_sax_parse_string(deep, &empty, NULL, NULL) ? "ok" : "failed");
+    json_set_max_depth(0);
+    printf("Rejected at the default limit: %s\n", json_sax_parse_string(deep, &empty, NULL, NULL) ? "no" : "yes");
+    free(deep);
+}
+
+void test_json_path(void) {
+    printf("\nJSON Pointer Tests\n");
+    printf("==================\n\n");
+
+    /* The examples of RFC 6901, section 5 */
+    const char* rfc = "{\"foo\":[\"bar\",\"baz\"],\"\":0,\"a/b\":1,\"c%d\":2,\"e^f\":3,\"g|h\":4,"
+                      "\"i\\\\j\":5,\"k\\\"l\":6,\" \":7,\"m~n\":8}";
+    JsonValue* root = json_parse_string(rfc);
+    const char* pointers[] = {"/", "/a~1b", "/c%d", "/e^f", "/g|h", "/i\\j", "/k\"l", "/ ", "/m~0n"};
+    size_t passed = 0;
+    for (size_t i = 0; i < sizeof(pointers) / sizeof(pointers[0]); i++) {
+        JsonValue* value = json_pointer_get(root, pointers[i]);
+        passed += value && value->type == JSON_NUMBER && value->value.number == (double)i;
+    }
+    JsonValue* foo = json_pointer_get(root, "/foo");
+    JsonValue* baz = json_pointer_get(root, "/foo/1");
+    passed += json_pointer_get(root, "") == root;
+    passed += foo && foo->type == JSON_ARRAY && json_array_size(foo) == 2;
+    passed += baz && baz->type == JSON_STRING && strcmp(baz->value.string, "baz") == 0;
+    printf("RFC 6901 examples: %zu/12\n", passed);
+
+    const char* missing[] = {"/foo/2", "/foo/-", "/foo/01", "/foo/bar", "/nope", "/foo/0/x"};
+    size_t absent = 0;
+    for (size_t i = 0; i < sizeof(missing) / sizeof(missing[0]); i++) {
+        absent += json_pointer_get(root, missing[i]) == NULL;
+    }
+    printf("Absent paths: %zu/6\n", absent);
+    JsonPath* bad1 = json_path_compile("foo");
+    JsonPath* bad2 = json_path_compile("/a~2b");
+    JsonPath* bad3 = json_path_compile("/a~");
+    printf("Malformed pointers rejected: %s\n", !bad1 && !bad2 && !bad3 ? "yes" : "no");
+
+    JsonPath* escaped = json_path_compile("/a~1b/m~0n/");
+    size_t segment_length;
+    const char* segment = json_path_segment(escaped, 1, &segment_length);
+    printf("Segments: %zu, second \"%s\" (%zu bytes)\n", json_path_length(escaped), segment ? segment : "",
+           segment_length);
+    json_path_free(escaped);
+    json_free(root);
+
+    /* Compiled once, evaluated against every representation */
+    const char* message = "{\"route\":{\"service\":\"billing\",\"region\":\"eu\"},"
+                          "\"readings\":[{\"temperature\":21.5},{\"temperature\":22}],"
+                          "\"payload\":{\"big\":[1,2,3],\"more\":{\"x\":[4]}}}";
+    JsonPath* service = json_path_compile("/route/service");
+    JsonPath* temperature = json_path_compile("/readings/1/temperature");
+
+    JsonValue* tree = json_parse_string(message);
+    JsonDocument* doc = json_document_parse_string(message);
+    JsonDocument* compact = json_document_parse_string_ex(message, &JSON_PARSE_COMPACT);
+    JsonDocument* lazy = json_document_parse_string_ex(message, &JSON_PARSE_LAZY);
+    const JsonValue* roots[] = {tree, json_document_root(doc), json_document_root(compact), json_document_root(lazy)};
+    const char* names[] = {"heap", "document", "compact", "lazy"};
+    for (int i = 0; i < 4; i++) {
+        JsonValue* name = json_path_get(roots[i], service);
+        JsonValue* t = json_path_get(roots[i], temperature);
+        printf("%s: service %s, temperature %g\n", names[i], name ? name->value.string : "(none)",
+               t ? t->value.number : -1.0);
+    }
+
+    /* The lazy document built the path, not its neighbours */
+    const JsonValue* payload = NULL;
+    for (const JsonKeyValue* pair = json_document_root(lazy)->value.object->pairs; pair; pair = pair->next) {
+        if (strcmp(pair->key, "payload") == 0) payload = pair->value;
+    }
+    printf("Unrelated subtree still lazy: %s\n", payload && (payload->flags & JSON_VALUE_LAZY) ? "yes" : "no");
+
+    JsonTape* tape = json_tape_parse(message, strlen(message), NULL);
+    JsonCursor cursor = json_path_cursor(json_tape_root(tape), temperature);
+    size_t length = 0;
+    JsonCursor name = json_path_cursor(json_tape_root(tape), service);
+    const char* text = json_cursor_string(name, &length);
+    printf("tape: service %s, temperature %g\n", text ? text : "(none)",
+           json_cursor_is_valid(cursor) ? json_cursor_number(cursor) : -1.0);
+    JsonPath* nowhere = json_path_compile("/payload/more/y");
+    printf("Absent on tape: %s\n", json_cursor_is_valid(json_path_cursor(json_tape_root(tape), nowhere)) ? "no" : "yes");
+    json_path_free(nowhere);
+    json_tape_free(tape);
+
+    /* Duplicate keys resolve to the last value on the tree and the tape */
+    const char* duplicated = "{\"a\":1,\"b\":{\"a\":[]},\"a\":2}";
+    JsonPath* a_path = json_path_compile("/a");
+    JsonValue* dup_tree = json_parse_string(duplicated);
+    JsonValue* dup_value = json_path_get(dup_tree, a_path);
+    tape = json_tape_parse(duplicated, strlen(duplicated), NULL);
+    cursor = json_path_cursor(json_tape_root(tape), a_path);
+    printf("Duplicate key: tree %g, tape %g\n", dup_value ? dup_value->value.number : -1.0,
+           json_cursor_is_valid(cursor) ? json_cursor_number(cursor) : -1.0);
+    json_tape_free(tape);
+    json_free(dup_tree);
+    json_path_free(a_path);
+    json_document_free(lazy);
+    json_document_free(compact);
+    json_document_free(doc);
+    json_free(tree);
+
+    /* Indexed objects and many messages */
+    JsonValue* wide = json_create_object();
+    for (int i = 0; i < 20; i++) {
+        char key[24];
+        snprintf(key, sizeof(key), "field%d", i);
+        json_object_set(wide, key, json_create_number(i));
+    }
+    JsonPath* field = json_path_compile("/field17");
+    JsonValue* found = json_path_get(wide, field);
+    printf("Indexed object lookup: %g\n", found ? found->value.number : -1.0);
+    json_path_free(field);
+    json_free(wide);
+
+    double total = 0.0;
+    for (int i = 0; i < 100; i++) {
+        char text_buffer[128];
+        snprintf(text_buffer, sizeof(text_buffer),
+                 "{\"route\":{\"service\":\"s%d\"},\"readings\":[{},{\"temperature\":%d}]}", i, i);
+        JsonDocument* each = json_document_parse_string(text_buffer);
+        JsonValue* t = json_path_get(json_document_root(each), temperature);
+        total += t ? t->value.number : 0.0;
+        json_document_free(each);
+    }
+    printf("Sum over 100 messages: %g\n", total);
+    json_path_free(temperature);
+    json_path_free(service);
+}
+
+void test_format_buffer(void) {
+    printf("\nFormat Buffer Tests\n");
+    printf("===================\n\n");
+
+    const char* text = "{\"id\":7,\"name\":\"probe \\\"A\\\"\\n\",\"ratio\":0.125,\"big\":123456789.5,"
+                       "\"tiny\":0.00001,\"flags\":[true,false,null],\"readings\":[1.5,-2,3e10],"
+                       "\"nested\":{\"list\":[{\"x\":1},{\"y\":[]}],\"empty\":{}}}";
+    JsonValue* value = json_parse_string(text);
+
+    /* Caller storage is used in place while the output fits */
+    char storage[4096];
+    JsonFormatBuffer buffer;
+    json_format_buffer_init(&buffer, storage, sizeof(storage));
+    char* expected = json_format_string(value, &JSON_FORMAT_PRETTY);
+    int ok = json_format_into(value, &JSON_FORMAT_PRETTY, &buffer);
+    printf("Into storage: %s, in place %s, identical %s\n", ok ? "ok" : "failed",
+           buffer.data == storage && !buffer.owned ? "yes" : "no",
+           expected && buffer.length == strlen(expected) && strcmp(buffer.data, expected) == 0 ? "yes" : "no");
+    free(expected);
+
+    /* Reuse allocates nothing */
+    JsonStats stats;
+    memset(&stats, 0, sizeof(stats));
+    json_stats_collect(&stats);
+    int reused = 1;
+    for (int i = 0; i < 100; i++) {
+        reused &= json_format_into(value, i % 2 ? &JSON_FORMAT_COMPACT : &JSON_FORMAT_DEFAULT, &buffer);
+    }
+    json_stats_collect(NULL);
+    printf("Reused 100 times: %s, allocations %zu\n", reused ? "ok" : "failed", stats.allocations);
+
+    /* Outgrowing the storage moves the output to the heap */
+    JsonValue* big = json_create_array();
+    for (int i = 0; i < 200; i++) {
+        json_array_append(big, json_parse_string(text));
+    }
+    json_format_buffer_init(&buffer, storage, 64);
+    expected = json_format_string(big, NULL);
+    ok = json_format_into(big, NULL, &buffer);
+    printf("Outgrown: %s, moved to the heap %s, identical %s\n", ok ? "ok" : "failed",
+           buffer.owned && buffer.data != storage && buffer.capacity > 64 ? "yes" : "no",
+           expected && strcmp(buffer.data, expected) == 0 ? "yes" : "no");
+    free(expected);
+    json_format_buffer_release(&buffer);
+    printf("Released: %s\n", !buffer.data && !buffer.capacity && !buffer.owned ? "yes" : "no");
+
+    /* The estimate bounds the output under every configuration, and reserving
+       it sizes the buffer exactly once */
+    JsonFormatConfig inline_off = JSON_FORMAT_DEFAULT;
+    inline_off.inline_simple_arrays = 0;
+    JsonFormatConfig decimal = JSON_FORMAT_DEFAULT;
+    decimal.number_format = JSON_NUMBER_FORMAT_DECIMAL;
+    JsonFormatConfig scientific = JSON_FORMAT_PRETTY;
+    scientific.number_format = JSON_NUMBER_FORMAT_SCIENTIFIC;
+    scientific.precision = 0;
+    JsonFormatConfig shortest = JSON_FORMAT_COMPACT;
+    shortest.number_format = JSON_NUMBER_FORMAT_SHORTEST;
+    JsonFormatConfig tabs = JSON_FORMAT_DEFAULT;
+    tabs.indent_string = "\t";
+    tabs.line_end = "\r\n";
+    tabs.spaces_after_colon = 20;
+    const JsonFormatConfig* configs[] = {&JSON_FORMAT_DEFAULT, &JSON_FORMAT_COMPACT, &JSON_FORMAT_PRETTY,
+                                         &inline_off, &decimal, &scientific, &shortest, &tabs};
+    size_t bounded = 0, single = 0;
+    for (size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); i++) {
+        size_t estimate = json_format_estimate(big, configs[i]);
+        json_format_buffer_init(&buffer, NULL, 0);
+        size_t before = 0;
+        memset(&stats, 0, sizeof(stats));
+        json_stats_collect(&stats);
+        if (json_format_buffer_reserve(&buffer, estimate)) {
+            before = stats.builder_reallocs;
+            ok = json_format_into(big, configs[i], &buffer);
+            bounded += ok && buffer.length <= estimate && buffer.length * 4 > estimate * 3;
+            single += stats.builder_reallocs == before;
+        }
+        json_stats_collect(NULL);
+        json_format_buffer_release(&buffer);
+    }
+    printf("Estimates within bounds: %zu/8, no regrowth: %zu/8\n", bounded, single);
+    printf("Estimate of NULL: %zu\n", json_format_estimate(NULL, NULL));
+
+    /* Decimal numbers that round up into one more integer digit */
+    static const struct {
+        double number;
+        int precision;
+    } carries[] = {{-9.96, 1}, {-9.6, 0}, {9.96, 1}, {-99.95, 1}, {-999.5, 0}, {-0.96, 0}};
+    size_t carries_bounded = 0, carries_total = sizeof(carries) / sizeof(carries[0]);
+    for (size_t i = 0; i < carries_total; i++) {
+        JsonFormatConfig carry = decimal;
+        carry.precision = carries[i].precision;
+        JsonValue* number = json_create_number(carries[i].number);
+        char* formatted = json_format_string(number, &carry);
+        size_t estimate = json_format_estimate(number, &carry);
+        if (formatted && strlen(formatted) <= estimate) {
+            carries_bounded++;
+        } else {
+            printf("%s estimated at %zu\n", formatted ? formatted : "nothing", estimate);
+        }
+        free(formatted);
+        json_free(number);
+    }
+    printf("Rounding carries within estimate: %zu/%zu\n", carries_bounded, carries_total);
+
+    /* Arrays written one item per line still get their commas */
+    char* lines = json_format_string(value, &inline_off);
+    JsonValue* reparsed = lines ? json_parse_string(lines) : NULL;
+    printf("Non-inline arrays parse back: %s\n", reparsed ? "yes" : "no");
+    json_free(reparsed);
+    free(lines);
+
+    /* Indentation deeper than the indent run */
+    JsonValue* deep = json_create_integer(1);
+    for (int i = 0; i < 100; i++) {
+        JsonValue* wrapper = json_create_object();
+        json_object_set(wrapper, "k", deep);
+        deep = wrapper;
+    }
+    char* indented = json_format_string(deep, &JSON_FORMAT_PRETTY);
+    char pattern[512];
+    pattern[0] = '\n';
+    memset(pattern + 1, ' ', 400);
+    memcpy(pattern + 401, "\"k\": 1", 7);
+    printf("Indent at depth 100: %s\n", indented && strstr(indented, pattern) ? "ok" : "wrong");
+    free(indented);
+    json_free(deep);
+
+    json_free(big);
+    json_free(value);
+}
+
+/* Escaping as the formatter did it byte by byte, for comparison */
+static size_t reference_escape(char* out, const unsigned char* str, size_t length) {
+    static const char hex[] = "0123456789abcdef";
+    char* p = out;
+    *p++ = '"';
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = str[i];
+        const char* short_form = c == '"' ? "\\\"" : c == '\\' ? "\\\\" : c == '\b' ? "\\b" : c == '\f' ? "\\f" :
+                                 c == '\n' ? "\\n" : c == '\r' ? "\\r" : c == '\t' ? "\\t" : NULL;
+        if (short_form) {
+            memcpy(p, short_form, 2);
+            p += 2;
+        } else if (c < 32) {
+            p += sprintf(p, "\\u00%c%c", hex[c >> 4], hex[c & 15]);
+        } else {
+            *p++ = (char)c;
+        }
+    }
+    *p++ = '"';
+    *p = '\0';
+    return (size_t)(p - out);
+}
+
+void test_string_escaping(void) {
+    printf("\nString Escaping Tests\n");
+    printf("=====================\n\n");
+
+    static const struct { JsonSimdLevel level; const char* name; } levels[] = {
+        {JSON_SIMD_SCALAR, "scalar"}, {JSON_SIMD_SSE2, "SSE2"},
+        {JSON_SIMD_AVX2, "AVX2"}, {JSON_SIMD_NEON, "NEON"},
+    };
+    JsonSimdLevel original = json_get_simd_level();
+    unsigned char input[300];
+    char expected[300 * 6 + 3];
+
+    for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+        if (!json_set_simd_level(levels[l].level)) {
+            printf("%-6s: not available\n", levels[l].name);
+            continue;
+        }
+
+        /* Every length up to a few vectors, with the byte needing an escape
+           at every offset, plus random mixes including bytes above 0x7F */
+        int passed = 0;
+        int total = 0;
+        unsigned seed = 12345;
+        for (int round = 0; round < 1500; round++) {
+            size_t length = round < 1200 ? (size_t)(round / 12) : (size_t)(round % 300);
+            for (size_t i = 0; i < length; i++) {
+                input[i] = (unsigned char)('a' + i % 26);
+            }
+            if (round < 1200 && length) {
+                static const unsigned char specials[] = {'"', '\\', '\n', '\t', 0x01, 0x1F, '\b', '\f', '\r',
+                                                         0x00, 0x7F, 0xC3};
+                input[(size_t)round % length] = specials[round % 12];
+            } else {
+                for (size_t i = 0; i < length; i++) {
+                    seed = seed * 1103515245u + 12345u;
+                    if ((seed >> 16) % 8 == 0) input[i] = (unsigned char)(seed >> 24);
+                }
+            }
+
+            size_t expected_length = reference_escape(expected, input, length);
+            JsonValue* value = json_create_string_length((const char*)input, length);
+            char* compact = json_format_string(value, &JSON_FORMAT_COMPACT);
+            total++;
+            passed += compact && strlen(compact) == expected_length && strcmp(compact, expected) == 0 &&
+                      json_format_estimate(value, &JSON_FORMAT_COMPACT) == expected_length;
+            free(compact);
+            json_free(value);
+        }
+        printf("%-6s: %d/%d strings escaped identically\n", levels[l].name, passed, total);
+    }
+
+    json_set_simd_level(original);
+}
+
+/* Encoding of one value as lowercase hex, "" if it failed */
+static const char* cbor_hex(const JsonValue* value, char* hex, size_t size) {
+    JsonFormatBuffer buffer;
+    json_format_buffer_init(&buffer, NULL, 0);
+    hex[0] = '\0';
+    if (json_cbor_encode(value, &buffer, NULL)) {
+        for (size_t i = 0; i < buffer.length && 2 * i + 2 < size; i++) {
+            snprintf(hex + 2 * i, 3, "%02x", (unsigned char)buffer.data[i]);
+        }
+    }
+    json_format_buffer_release(&buffer);
+    return hex;
+}
+
+static size_t cbor_unhex(const char* hex, unsigned char* out) {
+    size_t length = 0;
+    for (; hex[0] && hex[1]; hex += 2) {
+        unsigned int byte;
+        sscanf(hex, "%2x", &byte);
+        out[length++] = (unsigned char)byte;
+    }
+    return length;
+}
+
+/* Compact text of a value with exact numbers, for comparisons */
+static char* cbor_text(const JsonValue* value) {
+    JsonFormatConfig config = JSON_FORMAT_COMPACT;
+    config.number_format = JSON_NUMBER_FORMAT_SHORTEST;
+    return value ? json_format_string(value, &config) : NULL;
+}
+
+static int cbor_collect(const char* data, size_t length, void* user_data) {
+    JsonFormatBuffer* buffer = (JsonFormatBuffer*)user_data;
+    if (!json_format_buffer_reserve(buffer, buffer->length + length)) {
+        return 0;
+    }
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+    return 1;
+}
+
+void test_cbor(void) {
+    printf("\nCBOR Tests\n");
+    printf("==========\n\n");
+
+    /* Encodings from RFC 8949 Appendix A */
+    static const struct {
+        const char* json;
+        int integer;            /* Build with json_create_integer() */
+        const char* hex;
+    } encodings[] = {
+        {"0", 1, "00"}, {"23", 1, "17"}, {"24", 1, "1818"}, {"1000", 1, "1903e8"},
+        {"1000000", 1, "1a000f4240"}, {"1000000000000", 1, "1b000000e8d4a51000"},
+        {"-1", 1, "20"}, {"-1000", 1, "3903e7"},
+        {"9223372036854775807", 1, "1b7fffffffffffffff"}, {"-9223372036854775808", 1, "3b7fffffffffffffff"},
+        {"0", 0, "f90000"}, {"-0", 0, "f98000"}, {"1", 0, "f93c00"}, {"1.5", 0, "f93e00"},
+        {"65504", 0, "f97bff"}, {"100000", 0, "fa47c35000"}, {"3.4028234663852886e+38", 0, "fa7f7fffff"},
+        {"1e300", 0, "fb7e37e43c8800759c"}, {"5.960464477539063e-8", 0, "f90001"},
+        {"0.00006103515625", 0, "f90400"}, {"-4", 0, "f9c400"}, {"-4.1", 0, "fbc010666666666666"},
+        {"false", 0, "f4"}, {"true", 0, "f5"}, {"null", 0, "f6"},
+        {"\"\"", 0, "60"}, {"\"a\"", 0, "6161"}, {"\"IETF\"", 0, "6449455446"},
+        {"\"\\u00fc\"", 0, "62c3bc"}, {"[]", 0, "80"}, {"[1,[2,3],[4,5]]", 0, "8301820203820405"},
+        {"{}", 0, "a0"}, {"{\"a\":1,\"b\":[2,3]}", 0, "a26161016162820203"},
+    };
+    int matched = 0, total = (int)(sizeof(encodings) / sizeof(encodings[0]));
+    char hex[128];
+    for (int i = 0; i < total; i++) {
+        JsonValue* value;
+        if (encodings[i].integer) {
+            value = json_create_integer(strtoll(encodings[i].json, NULL, 10));
+        } else if (encodings[i].json[0] == '-' || (encodings[i].json[0] >= '0' && encodings[i].json[0] <= '9')) {
+            value = json_create_number(strtod(encodings[i].json, NULL));
+        } else {
+            value = json_parse_string(encodings[i].json);
+        }
+        if (strcmp(cbor_hex(value, hex, sizeof(hex)), encodings[i].hex) == 0) {
+            matched++;
+        } else {
+            printf("Mismatch for %s: %s, expected %s\n", encodings[i].json, hex, encodings[i].hex);
+        }
+        json_free(value);
+    }
+    JsonValue* special = json_create_number(INFINITY);
+    int specials = strcmp(cbor_hex(special, hex, sizeof(hex)), "f97c00") == 0;
+    special->value.number = -INFINITY;
+    specials += strcmp(cbor_hex(special, hex, sizeof(hex)), "f9fc00") == 0;
+    special->value.number = NAN;
+    specials += strcmp(cbor_hex(special, hex, sizeof(hex)), "f97e00") == 0;
+    json_free(special);
+    printf("Appendix A encodings: %d/%d, infinities and NaN: %d/3\n", matched, total, specials);
+
+    /* Decoding, also of forms the encoder never writes */
+    static const struct {
+        const char* hex;
+        const char* json;
+    } decodings[] = {
+        {"9fff", "[]"}, {"9f018202039f0405ffff", "[1,[2,3],[4,5]]"},
+        {"83019f0203ff820405", "[1,[2,3],[4,5]]"},
+        {"bf61610161629f0203ffff", "{\"a\":1,\"b\":[2,3]}"},
+        {"bf6346756ef563416d7421ff", "{\"Fun\":true,\"Amt\":-2}"},
+        {"7f657374726561646d696e67ff", "\"streaming\""}, {"bf7f61616162ff01ff", "{\"ab\":1}"},
+        {"c074323031332d30332d32315432303a30343a30305a", "\"2013-03-21T20:04:00Z\""},
+        {"c11a514b67b0", "1363896240"}, {"f7", "null"}, {"1818", "24"},
+        {"1b0000000000000001", "1"}, {"f97bff", "65504"}, {"fa47c35000", "100000"},
+        {"fb3ff199999999999a", "1.1"}, {"f90001", "5.960464477539063e-8"},
+        {"1bffffffffffffffff", "18446744073709552000"}, {"3bffffffffffffffff", "-18446744073709552000"},
+        {"a2616101616102", "{\"a\":2}"}, {"7f60ff", "\"\""}, {"7f606161606162ff", "\"ab\""},
+    };
+    matched = 0;
+    total = (int)(sizeof(decodings) / sizeof(decodings[0]));
+    for (int i = 0; i < total; i++) {
+        unsigned char bytes[64];
+        size_t length = cbor_unhex(decodings[i].hex, bytes);
+        JsonError error;
+        JsonValue* value = json_cbor_decode(bytes, length, NULL, &error);
+        char* text = cbor_text(value);
+        if (text && strcmp(text, decodings[i].json) == 0) {
+            matched++;
+        } else {
+            printf("Decoded %s as %s, expected %s (%s)\n", decodings[i].hex, text ? text : "nothing",
+                   decodings[i].json, error.message);
+        }
+        free(text);
+        json_free(value);
+    }
+    printf("Decodings: %d/%d\n", matched, total);
+
+    /* Round trip keeps integers apart from doubles */
+    const char* document = "{\"id\":7,\"name\":\"probe \\\"A\\\"\\n\",\"ratio\":0.125,\"one\":1.0,"
+                           "\"big\":123456789.5,\"tiny\":1e-300,\"flags\":[true,false,null],"
+                           "\"readings\":[1.5,-2,3e10,-9007199254740993],"
+                           "\"nested\":{\"list\":[{\"x\":1},{\"y\":[]}],\"empty\":{}}}";
+    JsonValue* original = json_parse_string(document);
+    JsonFormatBuffer buffer;
+    json_format_buffer_init(&buffer, NULL, 0);
+    JsonError error;
+    int encoded = json_cbor_encode(original, &buffer, &error);
+    JsonValue* decoded = json_cbor_decode(buffer.data, buffer.length, NULL, &error);
+    char* expected = cbor_text(original);
+    char* actual = cbor_text(decoded);
+    JsonValue* one = json_object_get(decoded, "one");
+    JsonValue* id = json_object_get(decoded, "id");
+    JsonValue* exact = json_array_get(json_object_get(decoded, "readings"), 3);
+    printf("Round trip: %s, %zu bytes for %zu of JSON, identical %s\n", encoded ? "ok" : "failed",
+           buffer.length, strlen(document), expected && actual && strcmp(expected, actual) == 0 ? "yes" : "no");
+    printf("Integer flags kept: %s\n",
+           id && (id->flags & JSON_VALUE_INTEGER) && one && !(one->flags & JSON_VALUE_INTEGER) &&
+           exact && (exact->flags & JSON_VALUE_INTEGER) && exact->integer == -9007199254740993LL ? "yes" : "no");
+    free(expected);
+    free(actual);
+    json_free(decoded);
+
+    /* Callback output is the same bytes, also across the sink buffer */
+    JsonValue* large = json_create_array();
+    char* long_string = (char*)malloc(40001);
+    memset(long_string, 'x', 40000);
+    long_string[40000] = '\0';
+    json_array_append(large, json_create_string(long_string));
+    json_array_append(large, json_parse_string(document));
+    free(long_string);
+    JsonFormatBuffer collected;
+    json_format_buffer_init(&collected, NULL, 0);
+    int streamed = json_cbor_write_callback(large, cbor_collect, &collected, NULL);
+    json_cbor_encode(large, &buffer, NULL);
+    printf("Callback: %s, identical %s\n", streamed ? "ok" : "failed",
+           collected.length == buffer.length && memcmp(collected.data, buffer.data, buffer.length) == 0 ? "yes" : "no");
+    json_format_buffer_release(&collected);
+
+    /* Errors carry the offset of the offending item */
+    static const struct {
+        const char* hex;
+        JsonErrorCode code;
+        size_t column;
+    } errors[] = {
+        {"830102", JSON_ERROR_CBOR_TRUNCATED, 4}, {"6568656c", JSON_ERROR_CBOR_TRUNCATED, 2},
+        {"19ff", JSON_ERROR_CBOR_TRUNCATED, 1}, {"9f01", JSON_ERROR_CBOR_TRUNCATED, 3},
+        {"821c", JSON_ERROR_CBOR_MALFORMED, 2}, {"ff", JSON_ERROR_CBOR_MALFORMED, 1},
+        {"0102", JSON_ERROR_CBOR_MALFORMED, 2}, {"1f", JSON_ERROR_CBOR_MALFORMED, 1},
+        {"7f6161810060ff", JSON_ERROR_CBOR_MALFORMED, 4}, {"4100", JSON_ERROR_CBOR_UNSUPPORTED, 1},
+        {"a10102", JSON_ERROR_CBOR_UNSUPPORTED, 2}, {"f0", JSON_ERROR_CBOR_UNSUPPORTED, 1},
+    };
+    matched = 0;
+    total = (int)(sizeof(errors) / sizeof(errors[0]));
+    for (int i = 0; i < total; i++) {
+        unsigned char bytes[64];
+        size_t length = cbor_unhex(errors[i].hex, bytes);
+        JsonValue* value = json_cbor_decode(bytes, length, NULL, &error);
+        if (!value && error.code == errors[i].code && error.line == 0 && error.column == errors[i].column) {
+            matched++;
+        } else {
+            printf("Input %s: code %d at column %zu (%s)\n", errors[i].hex, error.code, error.column, error.message);
+        }
+        json_free(value);
+    }
+    printf("Errors: %d/%d\n", matched, total);
+
+    unsigned char pair[] = {0x01, 0x62, 'h', 'i'};
+    size_t used = 0;
+    JsonValue* first = json_cbor_decode(pair, sizeof(pair), &used, &error);
+    printf("With used: %s, consumed %zu byte\n", first && first->integer == 1 ? "ok" : "failed", used);
+    json_free(first);
+
+    /* Nesting is limited like in the text parser */
+    unsigned char deep[21];
+    memset(deep, 0x81, sizeof(deep) - 1);
+    deep[sizeof(deep) - 1] = 0x00;
+    json_set_max_depth(16);
+    JsonValue* nested = json_cbor_decode(deep, sizeof(deep), NULL, &error);
+    printf("Depth limit: %s\n", !nested && error.code == JSON_ERROR_MAXIMUM_NESTING_REACHED ? "enforced" : "missed");
+    json_set_max_depth(0);
+    nested = json_cbor_decode(deep, sizeof(deep), NULL, &error);
+    printf("Within default limit: %s\n", nested ? "ok" : "failed");
+    json_free(nested);
+
+    /* Sequence of records through a small reader buffer */
+    const char* filename = "test_sequence.cbor";
+    FILE* file = fopen(filename, "wb");
+    if (!file) {
+        printf("Failed to create %s\n", filename);
+        json_format_buffer_release(&buffer);
+        json_free(original);
+        json_free(large);
+        return;
+    }
+    int written = 1;
+    for (int i = 0; i < 300; i++) {
+        JsonValue* record = json_create_object();
+        json_object_set(record, "id", json_create_integer(i));
+        json_object_set(record, "value", json_create_number(i * 0.5));
+        written &= json_cbor_write_stream(record, file, NULL);
+        json_free(record);
+    }
+    written &= json_cbor_write_stream(large, file, NULL);
+    fclose(file);
+
+    JsonCborReader* reader = json_cbor_reader_create(filename, 64, &error);
+    int records = 0, in_order = 1, large_ok = 0;
+    JsonValue* item;
+    while ((item = json_cbor_reader_next(reader, &error)) != NULL) {
+        if (item->type == JSON_OBJECT) {
+            JsonValue* record_id = json_object_get(item, "id");
+            in_order &= record_id && record_id->integer == records;
+            records++;
+        } else {
+            large_ok = json_array_size(item) == 2 && json_array_get(item, 0)->length == 40000;
+        }
+        json_free(item);
+    }
+    printf("Sequence: written %s, %d records (in order: %s), large item %s, clean end %s\n",
+           written ? "ok" : "failed", records, in_order ? "yes" : "no", large_ok ? "ok" : "failed",
+           error.code == JSON_ERROR_NONE ? "yes" : "no");
+    json_cbor_reader_free(reader);
+
+    /* A cut-off last item is an error, not the end */
+    file = fopen(filename, "ab");
+    fputc(0x82, file);
+    fputc(0x01, file);
+    fclose(file);
+    reader = json_cbor_reader_create(filename, 0, &error);
+    records = 0;
+    while ((item = json_cbor_reader_next(reader, &error)) != NULL) {
+        records++;
+        json_free(item);
+    }
+    printf("Cut-off sequence: %d items, then %s\n", records,
+           error.code == JSON_ERROR_CBOR_TRUNCATED ? "truncation reported" : "no error");
+    json_cbor_reader_free(reader);
+
+    /* Files go through a temporary name like json_write_file_ex() */
+    JsonFileWriteConfig config = {4096, ".part", 1};
+    int saved = json_cbor_write_file(original, filename, &config, &error);
+    FILE* leftover = fopen("test_sequence.cbor.part", "rb");
+    JsonValue* loaded = json_cbor_read_file(filename, &error);
+    expected = cbor_text(original);
+    actual = cbor_text(loaded);
+    printf("File: %s, temporary removed %s, read back identical %s\n", saved ? "saved" : "failed",
+           leftover ? "no" : "yes", expected && actual && strcmp(expected, actual) == 0 ? "yes" : "no");
+    if (leftover) {
+        fclose(leftover);
+    }
+    free(expected);
+    free(actual);
+    json_free(loaded);
+
+    file = fopen(filename, "rb");
+    loaded = json_cbor_read_stream(file, &error);
+    printf("Stream read: %s\n", loaded && json_object_size(loaded) == json_object_size(original) ? "ok" : "failed");
+    fclose(file);
+    json_free(loaded);
+    remove(filename);
+
+    loaded = json_cbor_read_file("missing.cbor", &error);
+    printf("Missing file: %s\n", !loaded && error.code != JSON_ERROR_NONE ? "reported" : "not reported");
+
+    json_format_buffer_release(&buffer);
+    json_free(original);
+    json_free(large);
+}
+
+/* Element i of the full parse and of the index, formatted alike */
+static int index_matches(const JsonIndex* index, const JsonValue* full) {
+    int same = json_index_count(index) == (full->type == JSON_ARRAY ? json_array_size(full) : json_object_size(full));
+    const JsonKeyValue* pair = full->type == JSON_OBJECT ? full->value.object->pairs : NULL;
+    for (size_t i = 0; same && i < json_index_count(index); i++) {
+        const JsonValue* expected_value = pair ? pair->value : json_array_get(full, i);
+        JsonValue* element = json_index_get(index, i, NULL);
+        char* expected = json_format_string(expected_value, &JSON_FORMAT_COMPACT);
+        char* actual = element ? json_format_string(element, &JSON_FORMAT_COMPACT) : NULL;
+        same = expected && actual && strcmp(expected, actual) == 0;
+        if (pair) {
+            same = same && json_index_find(index, pair->key) == i;
+            pair = pair->next;
+        }
+        free(expected);
+        free(actual);
+        json_free(element);
+    }
+    return same;
+}
+
+static int write_text_file(const char* filename, const char* text) {
+    FILE* file = fopen(filename, "wb");
+    if (!file) {
+        return 0;
+    }
+    int ok = fputs(text, file) >= 0;
+    return fclose(file) == 0 && ok;
+}
+
+void test_indexed_files(void) {
+    printf("\nIndexed File Tests\n");
+    printf("==================\n\n");
+
+    /* Strings with brackets, commas, colons and escaped quotes, crossing
+       the scanner's 64-byte blocks at every offset */
+    JsonValue* archive = json_create_array();
+    for (int i = 0; i < 2000; i++) {
+        JsonValue* record = json_create_object();
+        char note[96];
+        snprintf(note, sizeof(note), "%.*s\"],{:\\ %d", i % 40, "........................................", i);
+        json_object_set(record, "id", json_create_integer(i));
+        json_object_set(record, "note", json_create_string(note));
+        json_object_set(record, "values", json_parse_string(i % 3 ? "[1,[2,3],{\"x\":[]}]" : "[]"));
+        json_array_append(archive, i % 7 ? record : (json_free(record), json_create_integer(-i)));
+    }
+
+    const char* filename = "test_archive.json";
+    const char* index_filename = "test_archive.json.idx";
+    int formats_ok = 1;
+    const JsonFormatConfig* formats[] = {&JSON_FORMAT_COMPACT, &JSON_FORMAT_PRETTY};
+    for (int f = 0; f < 2; f++) {
+        json_format_file(archive, filename, formats[f]);
+        JsonError error;
+        JsonIndex* index = json_index_build(filename, &error);
+        formats_ok &= index && json_index_type(index) == JSON_ARRAY && index_matches(index, archive);
+        json_index_free(index);
+    }
+    printf("Compact and pretty archives: %zu elements each, identical %s\n", json_array_size(archive),
+           formats_ok ? "yes" : "no");
+
+    /* Sidecar round trip, then random access without a scan */
+    JsonError error;
+    JsonIndex* built = json_index_build(filename, &error);
+    int saved = json_index_save(built, index_filename, &error);
+    json_index_free(built);
+    JsonIndex* index = json_index_open(filename, index_filename, &error);
+    JsonValue* element = json_index_get(index, 1999, &error);
+    printf("Sidecar: %s, reopened %s, element 1999 id %lld\n", saved ? "saved" : "failed",
+           index && index_matches(index, archive) ? "identical" : "different",
+           element ? (long long)json_object_get(element, "id")->integer : -1LL);
+    json_free(element);
+
+    JsonValue* range = json_index_get_range(index, 10, 5, &error);
+    JsonValue* tenth = json_array_get(range, 0);
+    printf("Range: %zu elements, first id %lld\n", json_array_size(range),
+           tenth && tenth->type == JSON_OBJECT ? (long long)json_object_get(tenth, "id")->integer : -1LL);
+    json_free(range);
+    range = json_index_get_range(index, 1998, 5, &error);
+    printf("Range past the end: %s\n", !range && error.code == JSON_ERROR_INVALID_VALUE ? "rejected" : "accepted");
+    json_free(range);
+    size_t length = 0;
+    const char* text = json_index_text(index, 7, &length);
+    printf("Raw element 7: %.*s\n", (int)length, text ? text : "");
+    json_index_free(index);
+
+    /* A changed file makes the sidecar stale */
+    FILE* file = fopen(filename, "ab");
+    fputs("\n", file);
+    fclose(file);
+    index = json_index_open(filename, index_filename, &error);
+    printf("Changed file: %s\n", !index && error.code == JSON_ERROR_INDEX_STALE ? "stale" : "accepted");
+    json_index_free(index);
+    write_text_file(index_filename, "not an index");
+    index = json_index_open(filename, index_filename, &error);
+    printf("Damaged sidecar: %s\n", !index && error.code == JSON_ERROR_INDEX_INVALID ? "rejected" : "accepted");
+    json_index_free(index);
+    remove(index_filename);
+
+    /* Objects index members by key */
+    const char* members = "{ \"alpha\" : 1, \"be\\\"ta\": [1, 2] ,\"gamma\":{\"x\":\"}\"},\n \"\":null }";
+    write_text_file(filename, members);
+    index = json_index_build(filename, &error);
+    JsonValue* full = json_parse_string(members);
+    const char* key = json_index_key(index, 1, &length);
+    printf("Object: %zu members, identical %s, raw key 1: %.*s, missing key %s\n", json_index_count(index),
+           index && index_matches(index, full) ? "yes" : "no", (int)length, key ? key : "",
+           json_index_find(index, "delta") == JSON_INDEX_NOT_FOUND ? "not found" : "found");
+    json_free(full);
+
+    /* A sidecar whose key entry is too short to hold quotes */
+    json_index_save(index, index_filename, &error);
+    json_index_free(index);
+    file = fopen(index_filename, "r+b");
+    uint64_t short_key[2] = {2, 0};
+    fseek(file, 40, SEEK_SET); /* First entry after the header */
+    fwrite(short_key, sizeof(short_key), 1, file);
+    fclose(file);
+    index = json_index_open(filename, index_filename, &error);
+    printf("Sidecar with a short key: %s\n", !index && error.code == JSON_ERROR_INDEX_INVALID ? "rejected" : "accepted");
+    json_index_free(index);
+
+    /* Spans are trimmed of every byte the parser skips as whitespace */
+    write_text_file(filename, "[\v1\f,\ftrue\v\r]");
+    index = json_index_build(filename, &error);
+    size_t first_length = 0, second_length = 0;
+    const char* first_text = json_index_text(index, 0, &first_length);
+    const char* second_text = json_index_text(index, 1, &second_length);
+    printf("Trimmed spans: '%.*s' '%.*s'\n", (int)first_length, first_text ? first_text : "", (int)second_length,
+           second_text ? second_text : "");
+    json_index_free(index);
+
+    /* A duplicated key finds the member whose value the parser keeps */
+    write_text_file(filename, "{\"a\":1,\"b\":2,\"a\":3}");
+    index = json_index_build(filename, &error);
+    printf("Duplicate key: member %zu\n", json_index_find(index, "a"));
+    json_index_free(index);
+
+    write_text_file(filename, " [ ] ");
+    index = json_index_build(filename, &error);
+    printf("Empty array: %s, %zu elements", index ? "ok" : "failed", json_index_count(index));
+    saved = json_index_save(index, index_filename, &error);
+    json_index_free(index);
+    index = json_index_open(filename, index_filename, &error);
+    printf(", sidecar %s\n", saved && index && json_index_count(index) == 0 ? "reopened" : "failed");
+    json_index_free(index);
+    remove(index_filename);
+
+    /* Structural errors are found by the scan; elements are checked when parsed */
+    static const struct {
+        const char* text;
+        JsonErrorCode code;
+    } broken[] = {
+        {"[1,,2]", JSON_ERROR_INVALID_VALUE}, {"[1,2,]", JSON_ERROR_INVALID_VALUE},
+        {"[1,[2]", JSON_ERROR_EXPECTED_COMMA_OR_BRACKET}, {"[\"abc]", JSON_ERROR_UNTERMINATED_STRING},
+        {"[1] 2", JSON_ERROR_UNEXPECTED_CHAR}, {"[1}", JSON_ERROR_UNEXPECTED_CHAR},
+        {"{\"a\" 1}", JSON_ERROR_EXPECTED_COLON}, {"{a:1}", JSON_ERROR_EXPECTED_KEY},
+        {"{\"a\":1:2}", JSON_ERROR_EXPECTED_COMMA_OR_BRACE}, {"{\"a\":}", JSON_ERROR_INVALID_VALUE},
+        {"42", JSON_ERROR_INVALID_VALUE}, {"", JSON_ERROR_INVALID_VALUE},
+    };
+    int rejected = 0, total = (int)(sizeof(broken) / sizeof(broken[0]));
+    for (int i = 0; i < total; i++) {
+        write_text_file(filename, broken[i].text);
+        index = json_index_build(filename, &error);
+        if (!index && error.code == broken[i].code) {
+            rejected++;
+        } else {
+            printf("'%s': code %d (%s)\n", broken[i].text, error.code, error.message);
+        }
+        json_index_free(index);
+    }
+    write_text_file(filename, "[1,\n tru]");
+    index = json_index_build(filename, &error);
+    element = json_index_get(index, 1, &error);
+    printf("Malformed input rejected: %d/%d, bad element: %s (%s)\n", rejected, total,
+           index && !element ? "fails on access" : "missed", error.message);
+    json_index_free(index);
+
+    json_free(archive);
+    remove(filename);
+}
+
+/* Elements of a parsed array file, -1 if it does not parse */
+static long array_file_count(const char* filename) {
+    JsonValue* value = json_parse_file(filename);
+    long count = value && value->type == JSON_ARRAY ? (long)json_array_size(value) : -1;
+    json_free(value);
+    return count;
+}
+
+void test_array_writer(void) {
+    printf("\nArray Writer Tests\n");
+    printf("==================\n\n");
+
+    const char* filename = "test_writer.json";
+    remove(filename);
+
+    /* One reading object, updated in place for every sample */
+    JsonValue* reading = json_create_object();
+    json_object_set(reading, "timestamp", json_create_integer(0));
+    json_object_set(reading, "temperature", json_create_number(0.0));
+    json_object_set(reading, "note", json_create_string("ok, [fine]"));
+    JsonValue* timestamp = json_object_get(reading, "timestamp");
+    JsonValue* temperature = json_object_get(reading, "temperature");
+
+    JsonArrayWriterConfig config = JSON_ARRAY_WRITER_DEFAULT;
+    config.buffer_size = 256;
+    config.sync_every = 100;
+    JsonError error;
+    JsonArrayWriter* writer = json_array_writer_open(filename, &config, &error);
+    printf("Opened: %s, empty array on disk: %s\n", writer ? "ok" : error.message,
+           array_file_count(filename) == 0 ? "yes" : "no");
+
+    JsonStats stats;
+    memset(&stats, 0, sizeof(stats));
+    int appended = 1;
+    for (int i = 0; i < 1000; i++) {
+        if (i == 10) {
+            json_stats_collect(&stats);
+        }
+        timestamp->integer = 1700000000 + i;
+        timestamp->value.number = (double)timestamp->integer;
+        temperature->value.number = 20.0 + i % 50 * 0.1;
+        appended &= json_array_writer_append(writer, reading);
+    }
+    json_stats_collect(NULL);
+    long on_disk = array_file_count(filename);
+    printf("Appended 1000: %s, allocations after warm-up: %zu\n", appended ? "ok" : "failed", stats.allocations);
+    printf("Valid while open: %s (%ld elements written so far)\n", on_disk > 900 && on_disk <= 1000 ? "yes" : "no",
+           on_disk);
+    int closed = json_array_writer_close(writer);
+    JsonValue* array = json_parse_file(filename);
+    JsonValue* last = json_array_get(array, 999);
+    printf("Closed: %s, %zu elements, last timestamp %lld\n", closed ? "ok" : "failed", json_array_size(array),
+           last ? (long long)json_object_get(last, "timestamp")->integer : -1LL);
+    json_free(array);
+
+    /* Reopening appends to the complete array */
+    config.append = 1;
+    writer = json_array_writer_open(filename, &config, &error);
+    size_t recovered = json_array_writer_count(writer);
+    for (int i = 0; i < 5; i++) {
+        json_array_writer_append(writer, reading);
+    }
+    json_array_writer_close(writer);
+    printf("Reopened with %zu elements, now %ld\n", recovered, array_file_count(filename));
+
+    /* Cut the file at every offset, as a crash might, and append once more */
+    writer = json_array_writer_open(filename, NULL, &error);
+    const char* samples[] = {"{\"a\":[1,2]}", "-7", "\"x,]}\"", "[]", "true", "{\"b\":\"\\\"]\"}", "3.5"};
+    for (int i = 0; i < 7; i++) {
+        JsonValue* sample = json_parse_string(samples[i]);
+        json_array_writer_append(writer, sample);
+        json_free(sample);
+    }
+    json_array_writer_close(writer);
+    /* Where each element ends, and whether it is a container, from an index
+       freed before the file is rewritten under its mapping */
+    JsonIndex* index = json_index_build(filename, &error);
+    size_t element_count = json_index_count(index);
+    size_t element_ends[16];
+    int containers[16];
+    for (size_t i = 0; i < element_count && i < 16; i++) {
+        size_t length;
+        const char* text = json_index_text(index, i, &length);
+        element_ends[i] = (size_t)(text - json_index_text(index, 0, NULL)) + 2 + length;
+        containers[i] = text[0] == '{' || text[0] == '[';
+    }
+    json_index_free(index);
+    FILE* file = fopen(filename, "rb");
+    char original[256];
+    size_t original_length = file ? fread(original, 1, sizeof(original), file) : 0;
+    if (file) {
+        fclose(file);
+    }
+
+    JsonValue* marker = json_create_string("appended");
+    int cuts = 0, recovered_ok = 0;
+    for (size_t cut = 0; cut <= original_length; cut++) {
+        file = fopen(filename, "wb");
+        fwrite(original, 1, cut, file);
+        fclose(file);
+
+        long expected = 0;
+        for (size_t i = 0; i < element_count; i++) {
+            /* Containers are complete at their bracket, scalars need what follows */
+            expected += containers[i] ? cut >= element_ends[i] : cut > element_ends[i];
+        }
+
+        writer = json_array_writer_open(filename, &config, &error);
+        int ok = writer && (long)json_array_writer_count(writer) == expected &&
+                 json_array_writer_append(writer, marker);
+        ok &= json_array_writer_close(writer);
+        JsonValue* result = json_parse_file(filename);
+        JsonValue* tail = json_array_get(result, json_array_size(result) - 1);
+        ok &= result && (long)json_array_size(result) == expected + 1 && tail && tail->type == JSON_STRING &&
+              strcmp(tail->value.string, "appended") == 0;
+        json_free(result);
+        cuts++;
+        recovered_ok += ok;
+    }
+    printf("Recovered after %d/%d cut-off files\n", recovered_ok, cuts);
+    json_free(marker);
+
+    /* An append after sync_interval_ms has passed syncs the batch, also
+       when the logger slept in between */
+    JsonArrayWriterConfig timed = JSON_ARRAY_WRITER_DEFAULT;
+    timed.buffer_size = 4096;
+    timed.sync_interval_ms = 50;
+    writer = json_array_writer_open(filename, &timed, &error);
+    json_array_writer_append(writer, reading);
+    long before_sleep = array_file_count(filename);
+    struct timespec pause = {0, 80 * 1000000L};
+    nanosleep(&pause, NULL);
+    json_array_writer_append(writer, reading);
+    printf("Timed sync: %ld elements on disk before the interval, %ld after\n", before_sleep,
+           array_file_count(filename));
+    json_array_writer_close(writer);
+
+    /* Vertical tab and form feed end a scalar, as they do for the parser;
+       the last one is cut back to its final digit */
+    file = fopen(filename, "wb");
+    fputs("[\n7\v,\n8\f", file);
+    fclose(file);
+    writer = json_array_writer_open(filename, &config, &error);
+    size_t scalars = json_array_writer_count(writer);
+    json_array_writer_append(writer, reading);
+    json_array_writer_close(writer);
+    char recovered_text[256] = "";
+    file = fopen(filename, "rb");
+    if (file) {
+        recovered_text[fread(recovered_text, 1, sizeof(recovered_text) - 1, file)] = '\0';
+        fclose(file);
+    }
+    printf("Scalars ended by \\v and \\f: %zu recovered, trimmed %s\n", scalars,
+           strncmp(recovered_text, "[\n7\v,\n8,\n{", 10) == 0 ? "yes" : "no");
+
+    /* Files that do not hold an array are left alone */
+    file = fopen(filename, "wb");
+    fputs("{\"not\":\"an array\"}", file);
+    fclose(file);
+    writer = json_array_writer_open(filename, &config, &error);
+    printf("Non-array file: %s, file kept: %s\n", !writer && error.code == JSON_ERROR_INVALID_VALUE ? "rejected" : "accepted",
+           array_file_count(filename) == -1 ? "yes" : "no");
+    json_array_writer_close(writer);
+
+    remove(filename);
+    json_free(reading);
+}
+
 int main() {
     printf("Testing JSON Library Implementation\n");
     printf("===================================\n\n");
@@ -629,6 +3797,90 @@ int main() {
     printf("\n=== File Operation Tests ===\n");
     test_file_operations();
 
+    printf("\n=== Wide Object Tests ===\n");
+    test_wide_objects();
+
+    printf("\n=== Document Parsing Tests ===\n");
+    test_document_parsing();
+
+    printf("\n=== SIMD Scanning Tests ===\n");
+    test_simd_scanning();
+
+    printf("\n=== Number Parsing Tests ===\n");
+    test_number_parsing();
+
+    printf("\n=== Number Formatting Tests ===\n");
+    test_number_formatting();
+
+    printf("\n=== Streaming Output Tests ===\n");
+    test_streaming_output();
+
+    printf("\n=== Incremental Reader Tests ===\n");
+    test_incremental_reader();
+
+    printf("\n=== Mapped File Tests ===\n");
+    test_mapped_files();
+
+    printf("\n=== Buffer Parsing Tests ===\n");
+    test_buffer_parsing();
+
+    printf("\n=== Reentrant Error Tests ===\n");
+    test_reentrant_errors();
+
+    printf("\n=== Batch Ingest Tests ===\n");
+    test_batch_ingest();
+
+    printf("\n=== Tape Engine Tests ===\n");
+    test_tape_engine();
+
+    printf("\n=== Lazy Document Tests ===\n");
+    test_lazy_documents();
+
+    printf("\n=== Single-Pass Validation Tests ===\n");
+    test_single_pass_validation();
+
+    printf("\n=== Allocator and Statistics Tests ===\n");
+    test_allocator_hooks();
+
+    printf("\n=== Compact Document Tests ===\n");
+    test_compact_documents();
+
+    printf("\n=== Key Interning Tests ===\n");
+    test_key_interning();
+
+    printf("\n=== Columnar Extraction Tests ===\n");
+    test_columnar_extraction();
+
+    printf("\n=== Clean Variant Tests ===\n");
+    test_clean_variants();
+
+    printf("\n=== Deep Nesting Tests ===\n");
+    test_deep_nesting();
+
+    printf("\n=== Push Parser Tests ===\n");
+    test_push_parser();
+
+    printf("\n=== SAX Parser Tests ===\n");
+    test_sax_parser();
+
+    printf("\n=== JSON Pointer Tests ===\n");
+    test_json_path();
+
+    printf("\n=== Format Buffer Tests ===\n");
+    test_format_buffer();
+
+    printf("\n=== String Escaping Tests ===\n");
+    test_string_escaping();
+
+    printf("\n=== CBOR Tests ===\n");
+    test_cbor();
+
+    printf("\n=== Indexed File Tests ===\n");
+    test_indexed_files();
+
+    printf("\n=== Array Writer Tests ===\n");
+    test_array_writer();
+
     printf("\nAll tests completed!\n");
     return 0;
 